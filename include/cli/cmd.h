@@ -41,6 +41,54 @@ int doctor(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags
 
 int chkin(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags);
 
+/**
+ * Ensure a file cached while checked into a dataframe is stored by another
+ * dataframe it's new to, that the duplicates stored from a tree don't depend
+ * on the number of threads, and that files past the memory budget are left
+ * for the next run.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_chkin(void);
+
 int ls_data(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags);
 
+/**
+ * Writes the content of the object given in the arguments to the standard
+ * output, decompressing it and putting chunked files back together.
+ *
+ * @param argc Number of arguments passed
+ * @param args Array of arguments
+ * @returns In case of success returns 0 otherwise -1
+ */
+int cat_data(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags);
+
+/**
+ * Moves the loose objects smaller than PACK_OBJ_MAX into a new pack, removing
+ * the loose copies once the pack is in place.
+ *
+ * @param argc Number of arguments passed
+ * @param args Array of arguments
+ * @returns In case of success returns 0 otherwise -1
+ */
+int repack(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags);
+
+/**
+ * Moves every object to the shard depth given in the arguments, using several
+ * threads, and records the depth in the repository's configuration.
+ *
+ * @param argc Number of arguments passed
+ * @param args Array of arguments
+ * @returns In case of success returns 0 otherwise -1
+ */
+int reshard(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags);
+
+/**
+ * Runs the benchmark given in the arguments or all of them.
+ *
+ * @param argc Number of arguments passed
+ * @param args Array of arguments
+ * @returns In case of success returns 0 otherwise -1
+ */
+int bench(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags);
+
 #endif // __CMD_H_
@@ -0,0 +1,87 @@
+#ifndef LZ_H_
+#define LZ_H_
+
+#include "inttypes.h"
+#include "stdio.h"
+
+/**
+ * @file lz.h
+ *
+ * Functions used to compress buffers with donut's LZ codec.
+ *
+ * The format follows LZ4's block format: a sequence is a token holding the
+ * number of literals in its high nibble and the match length minus the
+ * minimum in its low nibble, followed by any extra length bytes, the literals,
+ * the match's offset as two little-endian bytes and the extra match length
+ * bytes. The last sequence only has literals. Matches are found through a
+ * single-entry hash table of 4 byte sequences, skipping faster over data
+ * which doesn't match, so incompressible data costs little time.
+ */
+
+/**
+ * @def LZ_MIN_MATCH
+ * Minimum length of a match.
+ */
+#define LZ_MIN_MATCH 4
+
+/**
+ * @def LZ_MAX_OFFSET
+ * Furthest a match can be from the data it replaces.
+ */
+#define LZ_MAX_OFFSET 65535
+
+/**
+ * @def LZ_HASH_BITS
+ * Number of bits in the hash of a sequence.
+ */
+#define LZ_HASH_BITS 14
+
+/**
+ * @def LZ_TABLE_SZ
+ * Byte size of the hash table used to compress.
+ */
+#define LZ_TABLE_SZ ((1 << LZ_HASH_BITS) * sizeof(uint32_t))
+
+/**
+ * Obtain the largest compressed size of a buffer.
+ *
+ * @param len Number of bytes in the buffer.
+ * @returns Largest number of bytes output by lz_compress.
+ */
+size_t lz_bound(size_t len);
+
+/**
+ * Compress a buffer.
+ *
+ * @param in Buffer with the data.
+ * @param len Number of bytes in the buffer.
+ * @param out Buffer where the compressed data is placed.
+ * @param cap Byte size of the output buffer.
+ * @param table Hash table of LZ_TABLE_SZ bytes.
+ * @returns Number of compressed bytes or 0 if they don't fit the output.
+ */
+size_t lz_compress(const uint8_t* in, size_t len, uint8_t* out, size_t cap,
+                   uint32_t* table);
+
+/**
+ * Decompress a buffer.
+ *
+ * Corrupt data is detected rather than read or written out of bounds.
+ *
+ * @param in Buffer with the compressed data.
+ * @param len Number of bytes in the buffer.
+ * @param out Buffer where the data is placed.
+ * @param size Number of bytes of the decompressed data.
+ * @returns Returns 0 on success or -1 if the data is corrupt.
+ */
+int lz_decompress(const uint8_t* in, size_t len, uint8_t* out, size_t size);
+
+/* Unit Tests */
+
+/**
+ * Ensure buffers are restored after compression and corrupt data is detected.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_lz(void);
+
+#endif // LZ_H_
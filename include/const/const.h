@@ -30,12 +30,54 @@
  */
 #define DATA_FOLDER "/.donut/data/"
 
+/**
+ * @def META_FOLDER_RELATIVE
+ * Relative path to donut's folder where the repository's metadata is stored.
+ */
+#define META_FOLDER_RELATIVE ".donut/meta"
+
+/**
+ * @def INDEX_FILE_EXT
+ * Extension of a dataframe's object index file in the metadata folder.
+ */
+#define INDEX_FILE_EXT ".idx"
+
+/**
+ * @def FILTER_FILE_EXT
+ * Extension appended to an object index's path to obtain its filter's path.
+ */
+#define FILTER_FILE_EXT ".bloom"
+
+/**
+ * @def STAT_CACHE_FILE_RELATIVE
+ * Relative path to the file caching the object IDs of files outside donut.
+ */
+#define STAT_CACHE_FILE_RELATIVE ".donut/meta/stat-cache"
+
 /**
  * @def CONFIG_FILE
  * File where all Donut's configuration is stored.
  */
 #define CONFIG_FILE "config"
 
+/**
+ * @def CONFIG_FILE_RELATIVE
+ * Relative path to the file where all Donut's configuration is stored.
+ */
+#define CONFIG_FILE_RELATIVE ".donut/config"
+
+/**
+ * @def TMP_FOLDER_RELATIVE
+ * Relative path to the folder of objects being written.
+ */
+#define TMP_FOLDER_RELATIVE ".donut/tmp"
+
+/**
+ * @def TREE_LEAF_SZ
+ * Size of the leaves used by the tree object ID scheme.
+ */
+#define TREE_LEAF_SZ (1024 * 1024)
+
 /**
  * @def DATA_FOLDER_NAME
  * The name of the folder where all the data is stored.
@@ -51,8 +93,15 @@
 /**
  * @def DATA_FILE_NAME_SIZE
  * Number of characters used in data files including the null character.
+ * Data files are named after the hex representation of their object ID.
  */
-#define DATA_FILE_NAME_SIZE 32
+#define DATA_FILE_NAME_SIZE 65
+
+/**
+ * @def READ_BUF_SZ
+ * Size of the buffer used to read files' content during ingestion.
+ */
+#define READ_BUF_SZ (4 * 1024 * 1024)
 
 /**
  * @def MAX_ARG_SZ
@@ -66,6 +115,48 @@
  */
 #define NAME_ARG_IDX 0
 
+/**
+ * @def ID_ARG_IDX
+ * Index of the object ID scheme argument value.
+ */
+#define ID_ARG_IDX 1
+
+/**
+ * @def JOBS_ARG_IDX
+ * Index of the number of jobs argument value.
+ */
+#define JOBS_ARG_IDX 2
+
+/**
+ * @def COMPRESS_ARG_IDX
+ * Index of the compression policy argument value.
+ */
+#define COMPRESS_ARG_IDX 3
+
+/**
+ * @def TRACE_ARG_IDX
+ * Index of the trace file argument value.
+ */
+#define TRACE_ARG_IDX 4
+
+/**
+ * @def MEM_BUDGET_ARG_IDX
+ * Index of the memory budget argument value.
+ */
+#define MEM_BUDGET_ARG_IDX 5
+
+/**
+ * @def CHUNK_ARG_IDX
+ * Index of the average chunk size argument value.
+ */
+#define CHUNK_ARG_IDX 6
+
+/**
+ * @def MAX_JOBS
+ * Maximum number of threads a command may be given with the jobs option.
+ */
+#define MAX_JOBS 256
+
 /**
  * @def RECURSIVE_OPT
  * Bit that is set when the recursive option is selected.
@@ -78,6 +169,60 @@
  */
 #define NAME_OPT 0x2
 
+/**
+ * @def ID_OPT
+ * Bit that is set when the object ID scheme option is selected.
+ */
+#define ID_OPT 0x4
+
+/**
+ * @def JOBS_OPT
+ * Bit that is set when the number of jobs option is selected.
+ */
+#define JOBS_OPT 0x8
+
+/**
+ * @def KEEP_OPT
+ * Bit that is set when the keep source option is selected.
+ */
+#define KEEP_OPT 0x10
+
+/**
+ * @def COMPRESS_OPT
+ * Bit that is set when the compression policy option is selected.
+ */
+#define COMPRESS_OPT 0x20
+
+/**
+ * @def STATS_OPT
+ * Bit that is set when the per-phase statistics option is selected.
+ */
+#define STATS_OPT 0x40
+
+/**
+ * @def TRACE_OPT
+ * Bit that is set when the trace file option is selected.
+ */
+#define TRACE_OPT 0x80
+
+/**
+ * @def MEM_STATS_OPT
+ * Bit that is set when the memory statistics option is selected.
+ */
+#define MEM_STATS_OPT 0x100
+
+/**
+ * @def MEM_BUDGET_OPT
+ * Bit that is set when the memory budget option is selected.
+ */
+#define MEM_BUDGET_OPT 0x200
+
+/**
+ * @def CHUNK_OPT
+ * Bit that is set when the chunking option is selected.
+ */
+#define CHUNK_OPT 0x400
+
 /**
  * @def DEFAULT_DF
  * Name of the default dataframe.
@@ -0,0 +1,116 @@
+#ifndef BLOOM_H_
+#define BLOOM_H_
+
+#include "inttypes.h"
+#include "mem/slob.h"
+
+/**
+ * @file bloom.h
+ *
+ * Functions used to operate on persistent blocked Bloom filters.
+ *
+ * A filter answers if an object ID may be in a set, with no false negatives,
+ * using a small fraction of the set's memory. All the bits of an ID are placed
+ * in a single cache line sized block, so a lookup touches one cache line.
+ *
+ * Filters are files mapped in shared mode. Bits are set with atomic operations
+ * and never cleared, so every ID added is immediately visible to any process
+ * using the filter, and a filter is never seen in an inconsistent state.
+ */
+
+/**
+ * Open an existing filter.
+ *
+ * @param slobs Slob allocator used for the filter's bookkeeping.
+ * @param path String containing the path to the filter.
+ * @returns Pointer to the filter or NULL if it's missing or invalid.
+ */
+struct bloom* open_bloom(struct slobs* slobs, const char* path);
+
+/**
+ * Create an empty filter sized for a number of IDs.
+ *
+ * The filter is written next to its final path and only replaces the file
+ * at the path when "save_bloom" is called, so it can be populated first.
+ *
+ * @param slobs Slob allocator used for the filter's bookkeeping.
+ * @param path String containing the path to the filter.
+ * @param capacity Number of IDs the filter is sized for.
+ * @returns Pointer to the filter.
+ */
+struct bloom* create_bloom(struct slobs* slobs, const char* path,
+                           uint64_t capacity);
+
+/**
+ * Atomically place a created filter at its path.
+ *
+ * @param b Filter to be saved.
+ */
+void save_bloom(struct bloom* b);
+
+/**
+ * Release a filter's mapping.
+ *
+ * @param b Filter to be closed.
+ */
+void close_bloom(struct bloom* b);
+
+/**
+ * Add an object ID to the filter.
+ *
+ * @param b Filter to be updated.
+ * @param id Binary object ID to be added.
+ */
+void bloom_add(struct bloom* b, const uint8_t* id);
+
+/**
+ * Determines if an object ID may be in the filter.
+ *
+ * @param b Filter to be checked.
+ * @param id Binary object ID to be checked.
+ * @returns Returns 0 if the ID is certainly absent and 1 otherwise.
+ */
+int bloom_has(struct bloom* b, const uint8_t* id);
+
+/**
+ * Number of object IDs added to the filter.
+ *
+ * @param b Filter to be checked.
+ * @returns Number of IDs.
+ */
+uint64_t bloom_count(struct bloom* b);
+
+/**
+ * Number of object IDs the filter was sized for.
+ *
+ * @param b Filter to be checked.
+ * @returns Number of IDs.
+ */
+uint64_t bloom_capacity(struct bloom* b);
+
+/**
+ * Bytes of memory used by the filter.
+ *
+ * @param b Filter to be checked.
+ * @returns Number of bytes.
+ */
+uint64_t bloom_mem(struct bloom* b);
+
+/**
+ * Estimate the filter's false positive rate from the bits currently set.
+ *
+ * @param b Filter to be checked.
+ * @returns Probability of an absent ID being reported as present.
+ */
+double bloom_fp_rate(struct bloom* b);
+
+/* Unit Tests */
+
+/**
+ * Ensure added IDs are always found, before and after the filter is saved, and
+ * that absent IDs are rarely found.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_bloom(void);
+
+#endif // BLOOM_H_
@@ -0,0 +1,126 @@
+#ifndef CDC_H_
+#define CDC_H_
+
+#include "inttypes.h"
+#include "stdio.h"
+#include "core/object.h"
+
+/**
+ * @file cdc.h
+ *
+ * Functions used to split files into content-defined chunks.
+ *
+ * Boundaries are found with FastCDC: a Gear rolling hash is updated with every
+ * byte and a chunk ends where the hash has all bits of a mask clear. Since
+ * boundaries depend only on the bytes before them, data inserted or removed
+ * in a file only changes the chunks around the edit, and the rest are stored
+ * once. A stricter mask is used before the average size and a looser one
+ * after it, which keeps the sizes close to the average. The hash is rolled
+ * two bytes at a time with a second table holding the Gear values shifted by
+ * one, halving the dependent operations.
+ *
+ * A chunked file is stored as one object per chunk, named by the chunk's
+ * SHA-2, and a chunk list object. The list is a cdc_list_hdr followed by a
+ * cdc_entry per chunk in the file's order. The file's object ID is the SHA-2
+ * of its list, whatever the repository's ID scheme. As that ID isn't the
+ * content's digest and changes with the chunk size, chunking is only turned on
+ * by init's --chunk option.
+ */
+
+/**
+ * @def CDC_AVG_SZ
+ * Average chunk size of repositories initialized with chunking.
+ */
+#define CDC_AVG_SZ (64 * 1024)
+
+/**
+ * @def CDC_MIN_AVG
+ * Smallest average chunk size.
+ */
+#define CDC_MIN_AVG 256
+
+/**
+ * @def CDC_MAX_AVG
+ * Largest average chunk size, so a maximum chunk fits in a read buffer.
+ */
+#define CDC_MAX_AVG (512 * 1024)
+
+/**
+ * @def CDC_FILE_CHUNKS
+ * Files of at least this many average chunks are chunked.
+ */
+#define CDC_FILE_CHUNKS 64
+
+/**
+ * @def CDC_LIST_MAGIC
+ * Bytes at the start of a chunk list object.
+ */
+#define CDC_LIST_MAGIC "DCDC"
+
+/**
+ * @def CDC_LIST_VERSION
+ * Version of the chunk list format.
+ */
+#define CDC_LIST_VERSION 1
+
+/**
+ * Header of a chunk list object.
+ */
+struct cdc_list_hdr {
+        char magic[4];    /**< CDC_LIST_MAGIC        */
+        uint32_t version; /**< CDC_LIST_VERSION      */
+        uint64_t size;    /**< Byte size of the file */
+        uint64_t count;   /**< Number of chunks      */
+};
+
+/**
+ * Chunk of a chunk list object.
+ */
+struct cdc_entry {
+        uint8_t id[OID_SZ]; /**< Object ID of the chunk */
+        uint64_t len;       /**< Byte size of the chunk */
+};
+
+/**
+ * Parameters of the chunking.
+ */
+struct cdc {
+        uint64_t min;          /**< Minimum chunk size               */
+        uint64_t avg;          /**< Average chunk size               */
+        uint64_t max;          /**< Maximum chunk size               */
+        uint64_t mask_s;       /**< Mask used before the average     */
+        uint64_t mask_l;       /**< Mask used after the average      */
+        uint64_t gear[256];    /**< Gear values of the bytes         */
+        uint64_t gear_ls[256]; /**< Gear values shifted left by one  */
+};
+
+/**
+ * Set the chunking parameters up.
+ *
+ * @param c Parameters to be set up.
+ * @param avg Average chunk size, rounded to a power of two between CDC_MIN_AVG
+ * and CDC_MAX_AVG.
+ */
+void cdc_init(struct cdc* c, uint64_t avg);
+
+/**
+ * Find the end of the chunk at the start of a buffer.
+ *
+ * @param c Chunking parameters.
+ * @param in Buffer with the data.
+ * @param len Number of bytes in the buffer, which must be at least the
+ * maximum chunk size unless the data ends with the buffer.
+ * @returns Byte size of the chunk.
+ */
+size_t cdc_cut(const struct cdc* c, const uint8_t* in, size_t len);
+
+/* Unit Tests */
+
+/**
+ * Ensure chunks respect their bounds and an insertion only changes the chunks
+ * around it.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_cdc(void);
+
+#endif // CDC_H_
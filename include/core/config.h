@@ -0,0 +1,151 @@
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include "inttypes.h"
+#include "mem/slob.h"
+
+/**
+ * @file config.h
+ *
+ * Functions used to read and write the repository's configuration.
+ *
+ * The configuration is stored in a plain text file inside donut's folder, with
+ * one "key = value" pair per line. Repositories created before a setting
+ * existed don't have it in their file, so every setting has a default which
+ * matches the behaviour of those repositories.
+ */
+
+/**
+ * @def ID_SCHEME_SHA256
+ * Object IDs are the SHA-2 hash of the whole file.
+ */
+#define ID_SCHEME_SHA256 0
+
+/**
+ * @def ID_SCHEME_TREE
+ * Object IDs are the root of a SHA-2 Merkle tree over fixed-size leaves.
+ */
+#define ID_SCHEME_TREE 1
+
+/**
+ * @def COMPRESS_NEVER
+ * Objects are stored raw.
+ */
+#define COMPRESS_NEVER 0
+
+/**
+ * @def COMPRESS_ALWAYS
+ * Objects are stored compressed.
+ */
+#define COMPRESS_ALWAYS 1
+
+/**
+ * @def COMPRESS_SAVING
+ * Objects are stored compressed when it saves enough space.
+ */
+#define COMPRESS_SAVING 2
+
+/**
+ * @def COMPRESS_MIN_SAVING
+ * Default percentage of an object's size compression must save.
+ */
+#define COMPRESS_MIN_SAVING 10
+
+/**
+ * Repository's configuration.
+ */
+struct repo_config {
+        uint32_t id_scheme;   /**< Scheme used to compute object IDs */
+        uint64_t leaf_sz;     /**< Leaf size of the tree ID scheme   */
+        uint64_t chunk_sz;    /**< Average chunk size or 0 if off    */
+        uint32_t compress;    /**< Compression policy of the objects */
+        uint32_t min_saving;  /**< Percentage compression must save  */
+        uint32_t shard_depth; /**< Directories above the objects     */
+        uint32_t huge_pages;  /**< Pages backing large tables        */
+};
+
+/**
+ * Set a configuration to the defaults of a repository without settings.
+ *
+ * @param conf Configuration to be initialized.
+ */
+void default_repo_config(struct repo_config* conf);
+
+/**
+ * Read a repository's configuration.
+ *
+ * Settings missing from the file, or the file itself, take their default
+ * value. An unknown object ID scheme fails the program, since objects
+ * can't be identified without it.
+ *
+ * @param path String containing the path to the configuration file.
+ * @param conf Configuration to be populated.
+ */
+void read_repo_config(const char* path, struct repo_config* conf);
+
+/**
+ * Write a repository's configuration.
+ *
+ * @param path String containing the path to the configuration file.
+ * @param conf Configuration to be written.
+ * @returns In case of success returns 0 otherwise -1
+ */
+int write_repo_config(const char* path, const struct repo_config* conf);
+
+/**
+ * Obtain the ID scheme with the given name.
+ *
+ * @param name String with the scheme's name.
+ * @returns The scheme's ID or -1 if the name is unknown.
+ */
+int id_scheme_from_str(const char* name);
+
+/**
+ * Obtain the name of an ID scheme.
+ *
+ * @param scheme Scheme's ID.
+ * @returns String with the scheme's name.
+ */
+const char* id_scheme_to_str(uint32_t scheme);
+
+/**
+ * Obtain the compression policy with the given name.
+ *
+ * @param name String with the policy's name.
+ * @returns The policy's ID or -1 if the name is unknown.
+ */
+int compress_from_str(const char* name);
+
+/**
+ * Obtain the name of a compression policy.
+ *
+ * @param policy Policy's ID.
+ * @returns String with the policy's name.
+ */
+const char* compress_to_str(uint32_t policy);
+
+/**
+ * Obtain the pages backing large tables with the given name.
+ *
+ * @param name String with the pages' name.
+ * @returns One of SLOB_PAGES_* or -1 if the name is unknown.
+ */
+int huge_pages_from_str(const char* name);
+
+/**
+ * Obtain the name of the pages backing large tables.
+ *
+ * @param pages One of SLOB_PAGES_*.
+ * @returns String with the pages' name.
+ */
+const char* huge_pages_to_str(uint32_t pages);
+
+/* Unit Tests */
+
+/**
+ * Ensure the configuration is written and read back with the same values.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_repo_config(void);
+
+#endif // CONFIG_H_
@@ -8,13 +8,19 @@
  * @file data-list.h
  *
  * Functions used to operate on the data_list structure.
+ *
+ * The data_list is the set of object IDs present in a repository, used to
+ * determine if a file's content is already stored. It's a hash table, so
+ * adding and finding an ID takes constant time regardless of the number of
+ * objects.
  */
 
 /**
  * Initialize a data_list structure.
  *
  * Allocates the memory required for the structure, initializes the values to 0
- * and assigns it a slob allocator.
+ * and assigns it a slob allocator. All the memory of the list is allocated
+ * with it, so it's released when the allocator is cleared.
  *
  * @param slobs Pointer to the allocator mean to bed use for memory allocations.
  * @returns Pointer to the initialized data_list structure.
@@ -22,38 +28,61 @@
 struct data_list* init_data_list(struct slobs* slobs);
 
 /**
- * Add a file name to the data_list structure.
+ * Add an object ID to the data_list structure.
+ *
+ * The table is grown when it's 7/8 full. IDs already in the list are ignored.
  *
- * @param data data_list object to be updated with the file name.
- * @param f_name Name of the file to be added.
+ * @param data data_list object to be updated with the object ID.
+ * @param id Binary object ID of OID_SZ bytes to be added.
  */
-void add_file_to_list(struct data_list* restrict data, char* f_name);
+void add_file_to_list(struct data_list* restrict data, const uint8_t* id);
 
 /**
- * Determines if a name is present in the data_list.
+ * Determines if an object ID is present in the data_list.
  *
  * @param list data_list object to be checked.
- * @param str Name to be checked.
- * @returns Returns 1 if the name is found and 0 otherwise.
+ * @param id Binary object ID to be checked.
+ * @returns Returns 1 if the ID is found and 0 otherwise.
  */
-int is_in_data_list(struct data_list* list, char* str);
+int is_in_data_list(struct data_list* list, const uint8_t* id);
 
 /**
  * Populates the given list with all the files in the repository.
  *
+ * The object IDs are decoded from the files' names. Files whose name isn't
+ * the hex representation of an object ID are skipped.
+ *
  * @param list data_list object to be populated.
  * @param path String containing the path to the repository's data directory.
+ * @param depth Number of shard directories above the objects.
+ */
+void get_repo_data_list(struct data_list* list, char* path,
+                        unsigned int depth);
+
+/**
+ * Number of object IDs in the data_list.
+ *
+ * @param list data_list object to be checked.
+ * @returns Number of IDs.
+ */
+uint64_t data_list_size(struct data_list* list);
+
+/**
+ * Bytes of memory used by the data_list's table.
+ *
+ * @param list data_list object to be checked.
+ * @returns Number of bytes.
  */
-void get_repo_data_list(struct data_list* list, char* path);
+uint64_t data_list_mem(struct data_list* list);
 
 /**
- * Return a pointer to the list element at a given index.
+ * Copy every object ID of the data_list.
  *
- * @param data data_list object whose element will be returned.
- * @param idx Index of the element be returned.
- * @returns Pointer to the element.
+ * @param list data_list object to be copied.
+ * @param dst Buffer of data_list_size IDs where they're placed, in no order.
+ * @returns Number of IDs copied.
  */
- char* get_data_list_index(struct data_list* restrict data, uint32_t idx);
+uint64_t copy_data_list(struct data_list* list, uint8_t* dst);
 
 /* Unit Tests */
 
@@ -64,13 +93,13 @@ void get_repo_data_list(struct data_list* list, char* path);
 int test_data_list_init(void);
 
 /**
- * Ensures the correct element is returned from the data_list object.
+ * Ensures all elements are still found after the data_list object grows.
  * @returns In case of success the return value is 1 otherwise its 0.
  */
-int test_get_data_list_index(void);
+int test_data_list_growth(void);
 
 /**
- * Ensure that an element is added to the data_list object at the correct index.
+ * Ensure that an element is added to the data_list object at the correct slot.
  * @returns In case of success the return value is 1 otherwise its 0.
  */
 int test_add_file_to_data_list(void);
@@ -0,0 +1,79 @@
+#ifndef INGEST_H_
+#define INGEST_H_
+
+#include "inttypes.h"
+#include "core/config.h"
+
+/**
+ * @file ingest.h
+ *
+ * Functions used to copy a file's content into a new object, leaving the file
+ * in place.
+ *
+ * A file is cloned when its filesystem can share extents between files,
+ * otherwise it's copied by the kernel with "copy_file_range". When neither is
+ * supported between the two files, the file is read once and its content is
+ * written and hashed at the same time.
+ */
+
+/**
+ * @def INGEST_CLONE
+ * Share the file's extents with the object.
+ */
+#define INGEST_CLONE 0
+
+/**
+ * @def INGEST_COPY
+ * Copy the file's content within the kernel.
+ */
+#define INGEST_COPY 1
+
+/**
+ * @def INGEST_STREAM
+ * Read the file's content, hashing it while it's written.
+ */
+#define INGEST_STREAM 2
+
+/**
+ * Clone a file's content into an empty file.
+ *
+ * @param src_fd Descriptor of the file.
+ * @param dst_fd Descriptor of the empty file.
+ * @returns Returns 0 on success or -1 if cloning isn't supported.
+ */
+int ingest_clone(int src_fd, int dst_fd);
+
+/**
+ * Copy a file's content into an empty file within the kernel.
+ *
+ * @param src_fd Descriptor of the file.
+ * @param dst_fd Descriptor of the empty file.
+ * @param size Byte size of the file.
+ * @returns Returns 0 on success or -1 if the copy isn't supported, in which
+ * case nothing was copied.
+ */
+int ingest_copy(int src_fd, int dst_fd, uint64_t size);
+
+/**
+ * Copy a file's content into an empty file and compute its object ID on the
+ * way, so the content is only read once.
+ *
+ * @param src_fd Descriptor of the file.
+ * @param dst_fd Descriptor of the empty file.
+ * @param conf Repository's configuration.
+ * @param hash Buffer for the hash state.
+ * @param buf Read buffer of READ_BUF_SZ bytes.
+ * @param id Buffer where the object ID is placed.
+ */
+void ingest_stream(int src_fd, int dst_fd, const struct repo_config* conf,
+                   void* hash, void* buf, uint8_t* id);
+
+/* Unit Tests */
+
+/**
+ * Ensure every method copies the content, and streaming yields its object ID.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_ingest(void);
+
+#endif // INGEST_H_
@@ -0,0 +1,174 @@
+#ifndef OBJ_FILE_H_
+#define OBJ_FILE_H_
+
+#include "inttypes.h"
+#include "stdio.h"
+#include "sys/types.h"
+#include "core/config.h"
+#include "core/object.h"
+
+/**
+ * @file obj-file.h
+ *
+ * Functions used to store objects in a container, rather than as their raw
+ * content.
+ *
+ * A container starts with an obj_file_hdr holding the codec, the size of the
+ * content and the object's ID, which is still computed from the uncompressed
+ * content so equal content is stored once whatever its encoding. The LZ codec
+ * splits the content into blocks of OBJ_BLOCK_SZ bytes, each stored as its
+ * 4 byte little-endian length followed by its compressed bytes, or its raw
+ * bytes when OBJ_BLOCK_RAW is set in the length.
+ *
+ * Objects without a container are raw content. A file is only taken for a
+ * container when its header holds the ID the file is named after, which raw
+ * content can't do since the ID is a hash of it.
+ */
+
+/**
+ * @def OBJ_FILE_MAGIC
+ * Bytes at the start of a container.
+ */
+#define OBJ_FILE_MAGIC "DOBJ"
+
+/**
+ * @def OBJ_FILE_VERSION
+ * Version of the container format.
+ */
+#define OBJ_FILE_VERSION 1
+
+/**
+ * @def OBJ_CODEC_NONE
+ * Content is stored as it is after the header.
+ */
+#define OBJ_CODEC_NONE 0
+
+/**
+ * @def OBJ_CODEC_LZ
+ * Content is stored as blocks compressed with donut's LZ codec.
+ */
+#define OBJ_CODEC_LZ 1
+
+/**
+ * @def OBJ_TYPE_DATA
+ * Content is a file's data.
+ */
+#define OBJ_TYPE_DATA 0
+
+/**
+ * @def OBJ_TYPE_LIST
+ * Content is the chunk list of a file.
+ */
+#define OBJ_TYPE_LIST 1
+
+/**
+ * @def OBJ_BLOCK_SZ
+ * Number of bytes of content in a compressed block.
+ */
+#define OBJ_BLOCK_SZ (64 * 1024)
+
+/**
+ * @def OBJ_BLOCK_RAW
+ * Flag set in a block's length when the block is stored uncompressed.
+ */
+#define OBJ_BLOCK_RAW 0x80000000u
+
+/**
+ * Header of a container.
+ */
+struct obj_file_hdr {
+        char magic[4];      /**< OBJ_FILE_MAGIC       */
+        uint8_t version;    /**< OBJ_FILE_VERSION     */
+        uint8_t codec;      /**< Codec of the content */
+        uint8_t type;       /**< Type of the content  */
+        uint8_t reserved;   /**< Zero                 */
+        uint64_t size;      /**< Byte size of content */
+        uint8_t id[OID_SZ]; /**< Object ID            */
+};
+
+/**
+ * Set a container's header up.
+ *
+ * @param hdr Header to be set up.
+ * @param codec Codec of the content.
+ * @param type Type of the content.
+ * @param size Byte size of the content.
+ * @param id Object ID.
+ */
+void obj_file_init_hdr(struct obj_file_hdr* hdr, uint8_t codec, uint8_t type,
+                       uint64_t size, const uint8_t* id);
+
+/**
+ * Obtain the largest number of bytes the LZ codec stores for some content.
+ *
+ * @param len Number of bytes of content.
+ * @returns Largest number of bytes output by obj_file_pack.
+ */
+size_t obj_file_bound(size_t len);
+
+/**
+ * Compress content with the LZ codec.
+ *
+ * Content may be packed a buffer at a time, as long as every buffer but the
+ * last holds whole blocks.
+ *
+ * @param in Buffer with the content.
+ * @param len Number of bytes in the buffer.
+ * @param out Buffer of obj_file_bound bytes where the blocks are placed.
+ * @param table Hash table of LZ_TABLE_SZ bytes.
+ * @returns Number of bytes output.
+ */
+size_t obj_file_pack(const uint8_t* in, size_t len, uint8_t* out,
+                     uint32_t* table);
+
+/**
+ * Check whether content is stored compressed by the repository's policy.
+ *
+ * @param conf Repository's configuration.
+ * @param size Byte size of the content.
+ * @param stored Byte size of the container holding it compressed.
+ * @returns Returns 1 if the container is kept or 0.
+ */
+int obj_file_worth(const struct repo_config* conf, uint64_t size,
+                   uint64_t stored);
+
+/**
+ * Read an object's container header.
+ *
+ * @param fd Descriptor of the object.
+ * @param base Offset of the object in the file, which isn't 0 in a pack.
+ * @param id Object ID, which the file is named after.
+ * @param hdr Header to be populated.
+ * @returns Returns 1 if the object is in a container or 0 if it's raw.
+ */
+int obj_file_read_hdr(int fd, off_t base, const uint8_t* id,
+                      struct obj_file_hdr* hdr);
+
+/**
+ * Restore the content of a container.
+ *
+ * The content is written to a descriptor a buffer at a time, or otherwise
+ * placed whole in the output buffer.
+ *
+ * @param fd Descriptor of the object.
+ * @param base Offset of the object in the file.
+ * @param hdr Container's header.
+ * @param out_fd Descriptor where the content is written or -1.
+ * @param out Buffer of READ_BUF_SZ bytes, or of the content's size without
+ * a descriptor.
+ * @param in Read buffer of READ_BUF_SZ bytes.
+ * @returns Returns 0 on success or -1 if the container is corrupt.
+ */
+int obj_file_unpack(int fd, off_t base, const struct obj_file_hdr* hdr,
+                    int out_fd, uint8_t* out, uint8_t* in);
+
+/* Unit Tests */
+
+/**
+ * Ensure content is restored from containers and raw objects aren't taken for
+ * containers.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_obj_file(void);
+
+#endif // OBJ_FILE_H_
@@ -0,0 +1,118 @@
+#ifndef OBJ_INDEX_H_
+#define OBJ_INDEX_H_
+
+#include "inttypes.h"
+#include "mem/slob.h"
+
+/**
+ * @file obj-index.h
+ *
+ * Functions used to operate on the persistent object index.
+ *
+ * Each data directory has an index of the object IDs it holds, so the objects
+ * of a repository are known without listing its directory. The index has two
+ * files:
+ *   1. A base file with the IDs sorted and a 256 entry fan-out table, which
+ *      is mapped read-only and binary searched in place
+ *   2. A log file, next to it, where IDs added since the base was written are
+ *      appended. It's read into memory when the index is opened
+ * Once the log holds a large enough share of the IDs, both are merged into a
+ * new base file which replaces the old one atomically.
+ *
+ * IDs added since the index was opened are kept in a striped set, so several
+ * threads may look up and add IDs at once. Opening and closing the index
+ * mustn't overlap with them.
+ */
+
+/**
+ * Open the object index of a data directory.
+ *
+ * If the base file is missing or invalid, it's rebuilt from the objects in the
+ * data directory. This only happens once for repositories created before the
+ * index existed.
+ *
+ * @param slobs Slob allocator used for the index's structure. Its tables have
+ * an allocator of their own, backed by the same pages and released by
+ * close_obj_index.
+ * @param path String containing the path to the base file.
+ * @param data_dir String containing the path to the data directory.
+ * @param depth Number of shard directories above the objects.
+ * @returns Pointer to the opened index.
+ */
+struct obj_index* open_obj_index(struct slobs* slobs, const char* path,
+                                 const char* data_dir, unsigned int depth);
+
+/**
+ * Determines if an object ID is present in the index.
+ *
+ * @param idx Index to be checked.
+ * @param id Binary object ID to be checked.
+ * @returns Returns 1 if the ID is found and 0 otherwise.
+ */
+int obj_index_has(struct obj_index* idx, const uint8_t* id);
+
+/**
+ * Add an object ID to the index if it's absent.
+ *
+ * When several threads claim the same new ID at once, exactly one of them is
+ * told it's new, so only that one stores the object.
+ *
+ * @param idx Index to be updated.
+ * @param id Binary object ID to be claimed.
+ * @returns Returns 1 if the ID was added by this call or 0 if it was present.
+ */
+int obj_index_claim(struct obj_index* idx, const uint8_t* id);
+
+/**
+ * Determines if an object ID was added since the index was opened.
+ *
+ * @param idx Index to be checked.
+ * @param id Binary object ID to be checked.
+ * @returns Returns 1 if the ID was added and 0 otherwise.
+ */
+int obj_index_added(struct obj_index* idx, const uint8_t* id);
+
+/**
+ * Add an object ID to the index.
+ *
+ * The ID is found by the following lookups, but it's only written when the
+ * index is closed.
+ *
+ * @param idx Index to be updated.
+ * @param id Binary object ID to be added.
+ */
+void obj_index_add(struct obj_index* idx, const uint8_t* id);
+
+/**
+ * Number of object IDs in the index.
+ *
+ * @param idx Index to be checked.
+ * @returns Number of IDs.
+ */
+uint64_t obj_index_size(struct obj_index* idx);
+
+/**
+ * Bytes mapped for the index's tables, the base file aside.
+ *
+ * @param idx Index to be checked.
+ * @param huge Updated with the bytes on huge pages.
+ * @returns Bytes mapped.
+ */
+uint64_t obj_index_mem(struct obj_index* idx, uint64_t* huge);
+
+/**
+ * Write the IDs added to the index and release its mapping.
+ *
+ * @param idx Index to be closed.
+ */
+void close_obj_index(struct obj_index* idx);
+
+/* Unit Tests */
+
+/**
+ * Ensure IDs are found after the index is rebuilt, reopened and compacted.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_obj_index(void);
+
+#endif // OBJ_INDEX_H_
@@ -2,6 +2,13 @@
 #define OBJ_H_
 
 #include "inttypes.h"
+#include "string.h"
+
+#if defined(__SSE2__)
+#include "emmintrin.h"
+#elif defined(__aarch64__)
+#include "arm_neon.h"
+#endif
 
 /**
  * @file object.h
@@ -10,10 +17,16 @@
  */
 
 /**
- * @def OID_LENGTH
- * Length of the Object's ID.
+ * @def OID_SZ
+ * Byte size of the Object's ID, which is the raw SHA-2 digest of its content.
  */
-#define OID_LENGTH 65
+#define OID_SZ 32
+
+/**
+ * @def OID_STR_SZ
+ * Length of the Object's ID hex representation including the null character.
+ */
+#define OID_STR_SZ 65
 
 /**
  * @def DATAFILE_OBJ
@@ -34,8 +47,35 @@
 #define NODE_OBJ 0x4
 
 struct object {
-        uint16_t oflags;     /**< Object's bit flags */
-        char id[OID_LENGTH]; /**< Object's ID */
+        uint16_t oflags;    /**< Object's bit flags */
+        uint8_t id[OID_SZ]; /**< Object's ID */
 };
 
+/**
+ * Determines if two object IDs are equal.
+ *
+ * The IDs are compared as two 16 byte vectors when SIMD is available.
+ *
+ * @param a First object ID.
+ * @param b Second object ID.
+ * @returns Returns 1 if the IDs are equal and 0 otherwise.
+ */
+inline static int
+oid_eq(const uint8_t* a, const uint8_t* b)
+{
+#if defined(__SSE2__)
+        __m128i lo = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)a),
+                                    _mm_loadu_si128((const __m128i*)b));
+        __m128i hi = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + 16)),
+                                    _mm_loadu_si128((const __m128i*)(b + 16)));
+        return _mm_movemask_epi8(_mm_and_si128(lo, hi)) == 0xffff;
+#elif defined(__aarch64__)
+        uint8x16_t eq = vandq_u8(vceqq_u8(vld1q_u8(a), vld1q_u8(b)),
+                                 vceqq_u8(vld1q_u8(a + 16), vld1q_u8(b + 16)));
+        return vminvq_u8(eq) == 0xff;
+#else
+        return !memcmp(a, b, OID_SZ);
+#endif
+}
+
 #endif // OBJ_H_
@@ -0,0 +1,90 @@
+#ifndef OID_SET_H_
+#define OID_SET_H_
+
+#include "inttypes.h"
+#include "mem/slob.h"
+
+/**
+ * @file oid-set.h
+ *
+ * Functions used to operate on a set of object IDs shared by threads.
+ *
+ * The set is split in stripes, each a data_list with its own lock and slob
+ * allocator, and an ID always falls in the same stripe. Threads adding IDs
+ * only contend when their IDs fall in the same stripe, and a stripe grows
+ * without stopping the others. A stripe's allocator and table are only
+ * created by the first ID falling in it, so an empty set maps no memory. Claiming an ID adds it only if it's absent, in
+ * a single step, so when several threads find the same new ID at once exactly
+ * one of them is told it's new.
+ */
+
+/**
+ * @def OID_SET_STRIPES_PER_CPU
+ * Minimum number of stripes of a set for each CPU, rounded up to a power
+ * of 2.
+ */
+#define OID_SET_STRIPES_PER_CPU 4
+
+/**
+ * Initialize an empty set.
+ *
+ * @param slobs Slob allocator used for the set's structure. The stripes'
+ * tables have allocators of their own, backed by the same pages and released
+ * by clear_oid_set.
+ * @returns Pointer to the initialized set.
+ */
+struct oid_set* init_oid_set(struct slobs* slobs);
+
+/**
+ * Add an object ID to the set if it's absent.
+ *
+ * @param set Set to be updated.
+ * @param id Binary object ID to be claimed.
+ * @returns Returns 1 if the ID was added by this call or 0 if it was present.
+ */
+int oid_set_claim(struct oid_set* set, const uint8_t* id);
+
+/**
+ * Determines if an object ID is in the set.
+ *
+ * @param set Set to be checked.
+ * @param id Binary object ID to be checked.
+ * @returns Returns 1 if the ID is found and 0 otherwise.
+ */
+int oid_set_has(struct oid_set* set, const uint8_t* id);
+
+/**
+ * Number of object IDs in the set.
+ *
+ * @param set Set to be checked.
+ * @returns Number of IDs.
+ */
+uint64_t oid_set_size(struct oid_set* set);
+
+/**
+ * Copy every object ID of the set.
+ *
+ * Should only be called once no thread is adding IDs.
+ *
+ * @param set Set to be copied.
+ * @param dst Buffer of oid_set_size IDs where they're placed, in no order.
+ * @returns Number of IDs copied.
+ */
+uint64_t oid_set_copy(struct oid_set* set, uint8_t* dst);
+
+/**
+ * Release the memory of the set's stripes.
+ *
+ * @param set Set to be cleared.
+ */
+void clear_oid_set(struct oid_set* set);
+
+/* Unit Tests */
+
+/**
+ * Ensure every ID raced for by several threads is claimed exactly once.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_oid_set(void);
+
+#endif // OID_SET_H_
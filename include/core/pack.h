@@ -0,0 +1,157 @@
+#ifndef PACK_H_
+#define PACK_H_
+
+#include "inttypes.h"
+#include "stdio.h"
+#include "core/object.h"
+#include "mem/slob.h"
+
+/**
+ * @file pack.h
+ *
+ * Functions used to store many small objects in a single file.
+ *
+ * A data directory keeps its packs in PACK_FOLDER. Each pack has two files:
+ *   1. A pack file with a pack_hdr followed by its objects, each stored with
+ *      the same bytes it had as a loose file, so containers are kept
+ *   2. An index file with a pack_idx_hdr, holding a 256 entry fan-out table,
+ *      followed by a pack_entry per object sorted by ID. It's mapped
+ *      read-only and binary searched in place
+ * Packs are written whole under the temporary folder and renamed into place,
+ * the index last, so only complete packs are ever seen. Their names are the
+ * SHA-2 of the IDs they hold.
+ */
+
+/**
+ * @def PACK_FOLDER
+ * Folder of the packs, appended to a data directory's path.
+ */
+#define PACK_FOLDER ".packs/"
+
+/**
+ * @def PACK_EXT
+ * Extension of a pack file.
+ */
+#define PACK_EXT ".pack"
+
+/**
+ * @def PACK_IDX_EXT
+ * Extension of a pack's index file.
+ */
+#define PACK_IDX_EXT ".idx"
+
+/**
+ * @def PACK_OBJ_MAX
+ * Objects smaller than this size are packed.
+ */
+#define PACK_OBJ_MAX (1024 * 1024)
+
+/**
+ * Object held by a pack.
+ */
+struct pack_entry {
+        uint8_t id[OID_SZ]; /**< Object ID                      */
+        uint64_t off;       /**< Offset of the object's bytes   */
+        uint64_t len;       /**< Number of the object's bytes   */
+};
+
+/**
+ * Header of a pack's index file.
+ */
+struct pack_idx_hdr {
+        uint32_t magic;       /**< Must be PACK_IDX_MAGIC                 */
+        uint32_t version;     /**< Must be PACK_VERSION                   */
+        uint64_t count;       /**< Number of objects in the pack          */
+        uint32_t fanout[256]; /**< Number of IDs whose first byte is <= i */
+};
+
+/**
+ * Pack opened for reading.
+ */
+struct pack {
+        int fd;                           /**< Descriptor of the pack file */
+        const struct pack_idx_hdr* hdr;   /**< Mapped index file           */
+        const struct pack_entry* entries; /**< Objects sorted by ID        */
+        size_t map_sz;                    /**< Size of the mapping         */
+};
+
+/**
+ * Packs of a data directory.
+ */
+struct packs {
+        struct pack* packs; /**< Opened packs    */
+        unsigned int n;     /**< Number of packs */
+};
+
+/**
+ * Open the packs of a data directory.
+ *
+ * Packs whose index is invalid are skipped.
+ *
+ * @param slobs Slob allocator used for the packs' memory.
+ * @param data_dir String containing the path to the data directory, ending
+ * with a slash.
+ * @returns Pointer to the opened packs.
+ */
+struct packs* open_packs(struct slobs* slobs, const char* data_dir);
+
+/**
+ * Find an object in the packs.
+ *
+ * @param packs Packs to be searched.
+ * @param id Binary object ID to be found.
+ * @param fd Set to the descriptor of the pack holding the object.
+ * @returns The object's entry or NULL if it isn't packed.
+ */
+const struct pack_entry* find_packed(const struct packs* packs,
+                                     const uint8_t* id, int* fd);
+
+/**
+ * Release the packs' descriptors and mappings.
+ *
+ * @param packs Packs to be closed.
+ */
+void close_packs(struct packs* packs);
+
+/**
+ * Start writing a pack.
+ *
+ * @param slobs Slob allocator used for the pack's memory.
+ * @param tmp_dir String containing the path to the temporary folder.
+ * @returns Pointer to the pack being written.
+ */
+struct pack_writer* begin_pack(struct slobs* slobs, const char* tmp_dir);
+
+/**
+ * Append an object to the pack being written.
+ *
+ * @param pw Pack being written.
+ * @param id Binary object ID.
+ * @param fd Descriptor of the object's file.
+ * @param len Number of bytes in the object's file.
+ */
+void pack_object(struct pack_writer* pw, const uint8_t* id, int fd,
+                 uint64_t len);
+
+/**
+ * Write the pack's index and move the pack into a data directory.
+ *
+ * An empty pack is discarded.
+ *
+ * @param pw Pack being written.
+ * @param data_dir String containing the path to the data directory, ending
+ * with a slash.
+ * @param name Buffer of OID_STR_SZ bytes where the pack's name is placed.
+ * @returns Number of objects in the pack.
+ */
+uint64_t end_pack(struct pack_writer* pw, const char* data_dir, char* name);
+
+/* Unit Tests */
+
+/**
+ * Ensure packed objects are found with their bytes and loose IDs aren't.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_pack(void);
+
+#endif // PACK_H_
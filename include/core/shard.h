@@ -0,0 +1,132 @@
+#ifndef SHARD_H_
+#define SHARD_H_
+
+#include "inttypes.h"
+#include "stdio.h"
+#include "core/object.h"
+#include "mem/slob.h"
+
+/**
+ * @file shard.h
+ *
+ * Functions used to spread a data directory's objects over subdirectories.
+ *
+ * With a depth of n, an object is stored n directories down from the data
+ * directory, each named after the next byte of its ID in hex. An object whose
+ * ID starts with "abcd" is stored as "ab/cd/abcd..." with a depth of 2, which
+ * keeps directories small enough for lookups, renames and listings to stay
+ * fast with millions of objects. A depth of 0 is the flat layout of older
+ * repositories. Objects keep their whole ID as their file name.
+ */
+
+/**
+ * @def SHARD_DEPTH_MAX
+ * Largest number of directories an object is stored under.
+ */
+#define SHARD_DEPTH_MAX 3
+
+/**
+ * @def SHARD_DEPTH_DEF
+ * Number of directories objects are stored under in new repositories.
+ */
+#define SHARD_DEPTH_DEF 1
+
+/**
+ * @def SHARD_NAME_SZ
+ * Largest number of characters of an object's path within a data directory,
+ * including the null character.
+ */
+#define SHARD_NAME_SZ (OID_STR_SZ + 3 * SHARD_DEPTH_MAX)
+
+/**
+ * Shards of a data directory being written.
+ */
+struct shards {
+        unsigned int depth; /**< Number of directories above the objects */
+        uint64_t* made;     /**< Bit per last-level shard known to exist */
+        char* dir;          /**< Path to the data directory              */
+        size_t len;         /**< Length of the data directory's path     */
+};
+
+/**
+ * Function called on every object found in a data directory.
+ *
+ * @param arg Argument given for the walk.
+ * @param id Binary object ID, decoded from the file's name.
+ * @param path String containing the path to the object.
+ */
+typedef void (*shard_obj_fn)(void* arg, const uint8_t* id, const char* path);
+
+/**
+ * Write an object's path within a data directory.
+ *
+ * @param depth Number of directories above the objects.
+ * @param id Binary object ID.
+ * @param dst Buffer of SHARD_NAME_SZ bytes where the path is placed.
+ * @returns Number of characters written, without the null character.
+ */
+size_t shard_name(unsigned int depth, const uint8_t* id, char* dst);
+
+/**
+ * Check whether a directory's name is the name of a shard.
+ *
+ * @param name String containing the directory's name.
+ * @returns Returns 1 if the name is a byte in hex or 0.
+ */
+int is_shard(const char* name);
+
+/**
+ * Set up the shards of a data directory for objects to be added.
+ *
+ * @param slobs Slob allocator used for the shards' memory.
+ * @param data_dir String containing the path to the data directory, ending
+ * with a slash.
+ * @param depth Number of directories above the objects.
+ * @returns Pointer to the shards.
+ */
+struct shards* open_shards(struct slobs* slobs, const char* data_dir,
+                           unsigned int depth);
+
+/**
+ * Create the directories an object is stored under, if they're missing.
+ *
+ * Directories are only created once, it's safe to call from several threads.
+ *
+ * @param s Shards of the data directory.
+ * @param id Binary object ID.
+ */
+void make_shard(struct shards* s, const uint8_t* id);
+
+/**
+ * Call a function on every object of a data directory.
+ *
+ * Only directories named after a byte in hex are entered, so dataframes and
+ * packs aren't taken for shards.
+ *
+ * @param data_dir String containing the path to the data directory, ending
+ * with a slash.
+ * @param depth Number of directories above the objects.
+ * @param fn Function called on every object.
+ * @param arg Argument given to the function.
+ */
+void walk_objects(const char* data_dir, unsigned int depth, shard_obj_fn fn,
+                  void* arg);
+
+/**
+ * Remove the empty shards of a data directory, down to the given depth.
+ *
+ * @param data_dir String containing the path to the data directory, ending
+ * with a slash.
+ * @param depth Number of directories above the objects.
+ */
+void prune_shards(const char* data_dir, unsigned int depth);
+
+/* Unit Tests */
+
+/**
+ * Ensure objects are found in their shards at every depth.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_shard(void);
+
+#endif // SHARD_H_
@@ -0,0 +1,99 @@
+#ifndef STAT_CACHE_H_
+#define STAT_CACHE_H_
+
+#include "inttypes.h"
+#include "sys/stat.h"
+#include "mem/slob.h"
+
+/**
+ * @file stat-cache.h
+ *
+ * Functions used to operate on the stat cache.
+ *
+ * The stat cache remembers the object ID of files that were hashed but left in
+ * place, keyed on their path and the (dev, ino, size, mtime, ctime) tuple of
+ * their status. A file whose status is unchanged has the same content, so its
+ * ID is taken from the cache instead of hashing the file again.
+ *
+ * Entries are kept sorted by the hash of their path in a file which is mapped
+ * and binary searched in place. New entries are merged into a new file when
+ * the cache is closed. Entries which weren't used in STAT_CACHE_MAX_AGE runs
+ * are dropped at that point.
+ */
+
+/**
+ * @def STAT_CACHE_MAX_AGE
+ * Number of runs after which an unused entry is dropped.
+ */
+#define STAT_CACHE_MAX_AGE 16
+
+/**
+ * @def STAT_CACHE_RACY_NS
+ * Nanoseconds since a file's last change before its ID may be cached.
+ */
+#define STAT_CACHE_RACY_NS 1000000000ll
+
+/**
+ * Open the stat cache.
+ *
+ * A cache written for another object ID scheme, or which is missing or
+ * invalid, is treated as empty.
+ *
+ * @param slobs Slob allocator used for the cache's structure. Its entries
+ * have an allocator of their own, backed by the same pages and released by
+ * close_stat_cache.
+ * @param path String containing the path to the cache's file.
+ * @param id_scheme Object ID scheme of the repository.
+ * @returns Pointer to the opened cache.
+ */
+struct stat_cache* open_stat_cache(struct slobs* slobs, const char* path,
+                                   uint32_t id_scheme);
+
+/**
+ * Obtain the object ID of an unchanged file.
+ *
+ * May be called by several threads at once, and while another thread adds
+ * entries with stat_cache_put.
+ *
+ * @param sc Stat cache to be checked.
+ * @param path String containing the absolute path to the file.
+ * @param st Current status of the file.
+ * @param id Buffer where the object ID is placed if found.
+ * @returns Returns 1 if the file's ID was found and 0 otherwise.
+ */
+int stat_cache_get(struct stat_cache* sc, const char* path,
+                   const struct stat* st, uint8_t* id);
+
+/**
+ * Add the object ID of a file to the cache.
+ *
+ * Calls must not overlap with each other.
+ *
+ * Files changed less than STAT_CACHE_RACY_NS before the cache was opened, or
+ * since, are not added, since they could change again within the file
+ * system's timestamp granularity without a change to their status.
+ *
+ * @param sc Stat cache to be updated.
+ * @param path String containing the absolute path to the file.
+ * @param st Status of the file when it was hashed.
+ * @param id Binary object ID of the file.
+ */
+void stat_cache_put(struct stat_cache* sc, const char* path,
+                    const struct stat* st, const uint8_t* id);
+
+/**
+ * Write the entries added to the cache and release its mapping.
+ *
+ * @param sc Stat cache to be closed.
+ */
+void close_stat_cache(struct stat_cache* sc);
+
+/* Unit Tests */
+
+/**
+ * Ensure cached IDs are only found while the file's status is unchanged.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_stat_cache(void);
+
+#endif // STAT_CACHE_H_
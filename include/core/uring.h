@@ -0,0 +1,113 @@
+#ifndef URING_H_
+#define URING_H_
+
+#include "inttypes.h"
+#include "mem/slob.h"
+
+/**
+ * @file uring.h
+ *
+ * Functions used to queue file operations on an io_uring.
+ *
+ * Operations are prepared in the submission queue and handed to the kernel in
+ * batches by uring_submit. Each operation carries a tag which is returned
+ * along with its result once it completes. Only the operations used by donut
+ * are provided, through the kernel's interface directly.
+ *
+ * On systems without io_uring, or where it's disallowed, uring_init fails and
+ * callers are expected to use blocking calls instead.
+ */
+
+/**
+ * Create an io_uring.
+ *
+ * @param slobs Slob allocator used for the bookkeeping.
+ * @param entries Number of operations which may be queued at once.
+ * @returns Pointer to the ring or NULL if io_uring isn't available.
+ */
+struct uring* uring_init(struct slobs* slobs, unsigned int entries);
+
+/**
+ * Release an io_uring. Operations still in flight are abandoned.
+ *
+ * @param r Ring to be released.
+ */
+void uring_exit(struct uring* r);
+
+/**
+ * Obtain the number of operations which may still be prepared.
+ */
+unsigned int uring_space(struct uring* r);
+
+/**
+ * Obtain the number of operations submitted but not yet reaped.
+ */
+unsigned int uring_inflight(struct uring* r);
+
+/**
+ * Queue the opening of a file relative to a directory.
+ *
+ * The path must stay valid until the operation is submitted. The result is
+ * the file descriptor or a negative errno.
+ *
+ * @returns Returns 0 on success or -1 if the queue is full.
+ */
+int uring_openat(struct uring* r, int dir_fd, const char* path, int flags,
+                 uint64_t tag);
+
+/**
+ * Queue a read from a file. The result is the number of bytes read or a
+ * negative errno.
+ *
+ * @returns Returns 0 on success or -1 if the queue is full.
+ */
+int uring_read(struct uring* r, int fd, void* buf, uint32_t len, uint64_t off,
+               uint64_t tag);
+
+/**
+ * Queue the closing of a file descriptor.
+ *
+ * @returns Returns 0 on success or -1 if the queue is full.
+ */
+int uring_close(struct uring* r, int fd, uint64_t tag);
+
+/**
+ * Queue the renaming of a file.
+ *
+ * Both paths must stay valid until the operation is submitted. The result is
+ * 0 or a negative errno.
+ *
+ * @returns Returns 0 on success or -1 if the queue is full.
+ */
+int uring_renameat(struct uring* r, int old_fd, const char* old_path,
+                   int new_fd, const char* new_path, uint64_t tag);
+
+/**
+ * Submit the queued operations and wait for some to complete.
+ *
+ * @param r Ring whose operations are submitted.
+ * @param wait Number of completions to wait for.
+ * @returns Returns 0 on success or a negative errno.
+ */
+int uring_submit(struct uring* r, unsigned int wait);
+
+/**
+ * Reap a completed operation.
+ *
+ * @param r Ring whose completions are reaped.
+ * @param tag Set to the operation's tag.
+ * @param res Set to the operation's result.
+ * @returns Returns 1 if an operation was reaped or 0 if none completed.
+ */
+int uring_reap(struct uring* r, uint64_t* tag, int32_t* res);
+
+/* Unit Tests */
+
+/**
+ * Ensure opens, reads, renames and closes complete with their tags. Passes if
+ * io_uring isn't available.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_uring(void);
+
+#endif // URING_H_
@@ -0,0 +1,68 @@
+#ifndef WALK_H_
+#define WALK_H_
+
+#include "stddef.h"
+
+/**
+ * @file walk.h
+ *
+ * Functions used to walk directory trees with several threads.
+ *
+ * Directories are read a batch of entries at a time. The thread reading a
+ * batch queues the rest of the directory and its subdirectories as tasks
+ * before handling the batch's files, so idle threads steal them and neither
+ * deep trees nor large directories are left to a single thread.
+ *
+ * Descriptors of directories are kept open for their subdirectories and files
+ * to be opened relative to them, within a budget derived from OPEN_MAX.
+ * Directories read once the budget is used up are read whole and closed, and
+ * their subdirectories are opened by path.
+ */
+
+/**
+ * Function called on every regular file found by a walk.
+ *
+ * @param arg Argument given for the thread finding the file.
+ * @param dir_fd Descriptor of the file's directory, valid during the call.
+ * @param path String containing the path to the file.
+ * @param len Length of the path.
+ * @param name String containing the file's name within its directory.
+ */
+typedef void (*walk_file_fn)(void* arg, int dir_fd, const char* path,
+                             size_t len, const char* name);
+
+/**
+ * Function called whenever a thread runs out of tasks, before it waits for
+ * more or exits.
+ *
+ * @param arg Argument given for the thread.
+ */
+typedef void (*walk_idle_fn)(void* arg);
+
+/**
+ * Call a function on every regular file of a directory.
+ *
+ * Symbolic links are not followed and donut's own folder is never entered.
+ * The calling thread takes part in the walk as thread 0.
+ *
+ * @param root String containing the path to the directory.
+ * @param recursive If set the subdirectories are walked as well.
+ * @param jobs Number of threads walking the directory.
+ * @param fds Number of descriptors each thread's calls keep open at most.
+ * @param args Array with the argument given to each thread's calls.
+ * @param file Function called on every regular file.
+ * @param idle Function called when a thread runs out of tasks or NULL.
+ */
+void walk_tree(const char* root, int recursive, unsigned int jobs,
+               unsigned int fds, void** args, walk_file_fn file,
+               walk_idle_fn idle);
+
+/* Unit Tests */
+
+/**
+ * Ensure every file is found once, whatever the number of threads.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_walk_tree(void);
+
+#endif // WALK_H_
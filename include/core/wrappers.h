@@ -29,6 +29,19 @@
  */
 int xopen(const char* path, int oflag, ...);
 
+/**
+ * Simple wrapper of the standard "openat" function.
+ *
+ * Opens an existing file relative to a directory, retrying if an interrupt
+ * signal is received and exiting if the file can't be opened.
+ *
+ * @param dir_fd File descriptor of the directory
+ * @param path Path to a file relative to the directory
+ * @param oflag Status flags to be used
+ * @returns Integer providing the file descriptor.
+ */
+int xopenat(int dir_fd, const char* path, int oflag);
+
 /**
  * Simple wrapper of the standard "close" function.
  *
@@ -219,6 +232,13 @@ void* xrealloc(void* buff, size_t sz);
  */
 int test_xopen(void);
 
+/**
+ * Unit test for xopenat.
+ * Runs tests to check if the function opens a file relative to a directory.
+ * @returns In case of success the return value is 1 otheriwse its 0.
+ */
+int test_xopenat(void);
+
 /**
  * Unit tests for xclose.
  * Runs tests to check if the function is capable of closing a file.
@@ -0,0 +1,66 @@
+#ifndef SHA2_FILE_H_
+#define SHA2_FILE_H_
+
+#include "stdio.h"
+#include "stdint.h"
+
+/**
+ * @file sha2-file.h
+ *
+ * SHA-2 hashing of whole files.
+ *
+ * A file's content is either read into a buffer a chunk at a time or mapped
+ * into memory and hashed straight from the mapping, which avoids copying it
+ * and lets the kernel read ahead. Mapping a file has a fixed cost, so only
+ * large files are mapped unless a strategy is requested.
+ */
+
+/**
+ * @def SHA2_READ_AUTO
+ * Select the strategy by the size of the file.
+ */
+#define SHA2_READ_AUTO 0
+
+/**
+ * @def SHA2_READ_BUF
+ * Read the file into the buffer a chunk at a time.
+ */
+#define SHA2_READ_BUF 1
+
+/**
+ * @def SHA2_READ_MMAP
+ * Map the file into memory and hash it from the mapping.
+ */
+#define SHA2_READ_MMAP 2
+
+/**
+ * @def SHA2_MMAP_MIN
+ * Files of this size or larger are mapped by the automatic strategy.
+ */
+#define SHA2_MMAP_MIN (1024 * 1024)
+
+/**
+ * Compute the hash of a file's whole content.
+ *
+ * Files which can't be mapped are read instead. A mapped file must not be
+ * truncated while it's being hashed.
+ *
+ * @param fd File descriptor of the file
+ * @param size Byte size of the file, used to select and map it
+ * @param strategy One of the SHA2_READ strategies
+ * @param hash Buffer for the hash state
+ * @param buf Read buffer of READ_BUF_SZ bytes
+ * @param out Buffer where the 32 bytes of the hash will be placed
+ */
+void sha2_file(int fd, uint64_t size, int strategy, void* hash, void* buf,
+               uint8_t* out);
+
+/* Unit Tests */
+
+/**
+ * Ensure every strategy produces the same hash as hashing the content at once.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_sha2_file(void);
+
+#endif // SHA2_FILE_H_
@@ -0,0 +1,94 @@
+#ifndef SHA2_MB_H_
+#define SHA2_MB_H_
+
+#include "stdio.h"
+#include "stdint.h"
+#include "mem/slob.h"
+#include "crypto/sha2.h"
+
+/**
+ * @file sha2-mb.h
+ *
+ * Multi-buffer SHA-2 hashing engine.
+ *
+ * Hashing a single message is bound by the dependency chain between the
+ * rounds of the SHA-2 transform. When many small messages must be hashed, the
+ * engine keeps several independent hash states in flight, one per SIMD lane,
+ * and transforms one block of every lane at once. Messages are submitted as
+ * lanes free up and returned as soon as their hash is complete.
+ */
+
+/**
+ * @def SHA2_MB_MAX_LANES
+ * Maximum number of lanes supported by any multi-buffer backend.
+ */
+#define SHA2_MB_MAX_LANES 16
+
+/**
+ * A message to be hashed by the multi-buffer engine.
+ */
+struct sha2_job {
+        const uint8_t* in;              /**< Message to be hashed           */
+        size_t len;                     /**< Byte length of the message     */
+        uint8_t digest[SHA2_DIGEST_SZ]; /**< Hash of the message            */
+        void* tag;                      /**< Caller data carried by the job */
+};
+
+/**
+ * Initialize a multi-buffer engine.
+ *
+ * The engine selects the widest SIMD backend supported by the CPU and is
+ * allocated with the given slob allocator, so it's released with it.
+ *
+ * @param slobs Slob allocator used for the engine's memory.
+ * @returns Pointer to the engine.
+ */
+struct sha2_mb* sha2_mb_init(struct slobs* slobs);
+
+/**
+ * Submit a message to the engine.
+ *
+ * The job is placed on a free lane. If no lanes are left afterwards, the lanes
+ * are transformed until at least one of the messages is hashed. The message's
+ * buffer must remain valid until the job is returned.
+ *
+ * @param mb Pointer to the engine.
+ * @param job Job describing the message to be hashed.
+ * @returns A completed job or NULL if none is completed yet.
+ */
+struct sha2_job* sha2_mb_submit(struct sha2_mb* mb, struct sha2_job* job);
+
+/**
+ * Complete the jobs still in flight.
+ *
+ * Should be called repeatedly after the last submission until it returns NULL.
+ *
+ * @param mb Pointer to the engine.
+ * @returns A completed job or NULL if all jobs were returned.
+ */
+struct sha2_job* sha2_mb_flush(struct sha2_mb* mb);
+
+/**
+ * Number of lanes used by the engine.
+ * @param mb Pointer to the engine.
+ * @returns Number of messages that are hashed simultaneously.
+ */
+unsigned int sha2_mb_lanes(struct sha2_mb* mb);
+
+/**
+ * Name of the multi-buffer backend selected for the CPU.
+ * @returns String with the backend's name
+ */
+const char* sha2_mb_backend(void);
+
+/* Unit Tests */
+
+/**
+ * Test all multi-buffer backends supported by the CPU.
+ * Ensures messages of several lengths, submitted in bulk, get the same hash as
+ * the single buffer implementation.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_sha2_mb(void);
+
+#endif // SHA2_MB_H_
@@ -0,0 +1,121 @@
+#ifndef SHA2_TREE_H_
+#define SHA2_TREE_H_
+
+#include "stdio.h"
+#include "stdint.h"
+#include "crypto/sha2.h"
+
+/**
+ * @file sha2-tree.h
+ *
+ * SHA-2 Merkle tree hashing.
+ *
+ * A message is split into fixed-size leaves which are hashed independently,
+ * then pairs of hashes are combined level by level up to a single root hash.
+ * Since leaves don't depend on each other, very large files are hashed by
+ * several threads at once. Leaves and nodes are hashed with different prefix
+ * bytes, so a leaf can never be mistaken for a node:
+ *   - leaf = SHA-2(0x00 || data)
+ *   - node = SHA-2(0x01 || left || right)
+ * When a level has an odd number of hashes, the last one is promoted to the
+ * next level unchanged. A message with a single leaf has the leaf's hash as
+ * its root.
+ */
+
+/**
+ * @def TREE_LEAF_PREFIX
+ * Byte prepended to the data of a leaf before hashing it.
+ */
+#define TREE_LEAF_PREFIX 0x00
+
+/**
+ * @def TREE_NODE_PREFIX
+ * Byte prepended to the pair of hashes of a node before hashing it.
+ */
+#define TREE_NODE_PREFIX 0x01
+
+/**
+ * Compute the hash of a leaf.
+ *
+ * @param in Buffer with the leaf's data
+ * @param len Byte length of the leaf
+ * @param out Buffer where the 32 bytes of the hash will be placed
+ * @param buf Buffer where the hash state will be stored during the procedure
+ */
+void sha2_tree_leaf(const uint8_t* in, size_t len, uint8_t* out, void* buf);
+
+/**
+ * Combine the hashes of all leaves into the root hash.
+ *
+ * The leaves' hashes are overwritten during the procedure.
+ *
+ * @param hashes Buffer with the 32 byte hashes of the leaves
+ * @param n Number of leaves
+ * @param out Buffer where the 32 bytes of the root hash will be placed
+ * @param buf Buffer where the hash state will be stored during the procedure
+ */
+void sha2_tree_root(uint8_t* hashes, uint64_t n, uint8_t* out, void* buf);
+
+/**
+ * Compute the root hash of a file.
+ *
+ * The leaves are read with "pread" and hashed by the given number of threads,
+ * the calling thread included.
+ *
+ * @param fd File descriptor of the file
+ * @param size Byte size of the file
+ * @param leaf_sz Byte size of the leaves
+ * @param out Buffer where the 32 bytes of the root hash will be placed
+ * @param threads Maximum number of threads hashing leaves
+ */
+void sha2_tree_file(int fd, uint64_t size, uint64_t leaf_sz, uint8_t* out,
+                    unsigned int threads);
+
+/**
+ * State of a root hash computed from a stream of data.
+ */
+struct sha2_tree {
+        uint64_t state[SHA_STRUCT_SZ / 8]; /**< Hash state of the leaf  */
+        uint64_t leaf_sz;                  /**< Byte size of the leaves */
+        uint64_t leaf_len;                 /**< Bytes of the last leaf  */
+        uint64_t n;                        /**< Number of leaves hashed */
+        uint64_t cap;                      /**< Capacity of the hashes  */
+        uint8_t* hashes;                   /**< Hashes of the leaves    */
+};
+
+/**
+ * Start computing a root hash from a stream of data.
+ *
+ * @param t Structure to be initialized
+ * @param leaf_sz Byte size of the leaves
+ */
+void sha2_tree_init(struct sha2_tree* t, uint64_t leaf_sz);
+
+/**
+ * Add data to the stream, which may be split at any byte.
+ *
+ * @param t State of the stream
+ * @param in Buffer with the data
+ * @param len Number of bytes in the buffer
+ */
+void sha2_tree_update(struct sha2_tree* t, const uint8_t* in, size_t len);
+
+/**
+ * Produce the root hash of the stream and release its state.
+ *
+ * @param t State of the stream
+ * @param out Buffer where the 32 bytes of the root hash will be placed
+ */
+void sha2_tree_final(struct sha2_tree* t, uint8_t* out);
+
+/* Unit Tests */
+
+/**
+ * Test the Merkle tree hashing of a file.
+ * Ensures the root matches a tree built by hand and doesn't depend on the
+ * number of threads or on how a stream of the file is split.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_sha2_tree(void);
+
+#endif // SHA2_TREE_H_
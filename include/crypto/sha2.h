@@ -25,7 +25,57 @@
  * @def SHA2_STRUCT_SZ
  * SHA-2 state structure size in bytes.
  */
-#define SHA_STRUCT_SZ 360
+#define SHA_STRUCT_SZ 104
+
+/**
+ * @def SHA2_DIGEST_SZ
+ * SHA-2 digest size in bytes.
+ */
+#define SHA2_DIGEST_SZ 32
+
+/**
+ * @def SHA2_HEX_SZ
+ * Number of hex digits in the string representation of a digest.
+ */
+#define SHA2_HEX_SZ 64
+
+/**
+ * SHA-2 round constants.
+ */
+extern const uint32_t sha2_k[64];
+
+/**
+ * SHA-2 initial hash values.
+ */
+extern const uint32_t sha2_h0[8];
+
+/**
+ * Select the fastest SHA-2 block transform supported by the CPU.
+ *
+ * Probes the CPU features once (CPUID on x86, hwcap on ARM) and selects the
+ * SHA-NI, ARMv8 cryptographic extensions or the portable backend. Must be
+ * called before any hashing takes place, otherwise the portable backend is
+ * used. All backends produce bit-identical digests.
+ */
+void sha2_setup(void);
+
+/**
+ * Name of the SHA-2 backend currently in use.
+ * @returns String with the backend's name
+ */
+const char* sha2_backend(void);
+
+/**
+ * Transform whole blocks with the selected SHA-2 backend.
+ *
+ * Low level access to the block transform, used by the hashing engines built
+ * on top of it. No padding or length accounting is performed.
+ *
+ * @param hx Hash state of 8 words, updated in place
+ * @param in Buffer containing the blocks to be processed
+ * @param blks Number of 64 byte blocks to process
+ */
+void sha2_xform(uint32_t* restrict hx, const uint8_t* restrict in, size_t blks);
 
 /**
  * Computes the SHA-2 hash of a given buffer.
@@ -44,12 +94,13 @@ void sha2_hash(uint8_t* restrict in, uint8_t* out, void* restrict buf, size_t le
 /**
  * Convert a hash into a string.
  *
- * Converts a hash into a string with it's hex representation.
+ * Converts a hash into a null terminated string with it's hex representation.
+ * The digits are produced with SIMD instructions when available.
  *
  * @param hash Pointer to hash buffer
- * @param buf Buffer where the string value of the hash will be placed
+ * @param buf Buffer of SHA2_HEX_SZ + 1 bytes where the string will be placed
  */
-void sha2_to_str(uint8_t* hash, char* buf);
+void sha2_to_str(const uint8_t* hash, char* buf);
 
 /**
  * Convert the first nbytes of the hash into a string.
@@ -61,7 +112,16 @@ void sha2_to_str(uint8_t* hash, char* buf);
  * @param buf Buffer where the string value of the hash will be placed
  * @param bytes Number of bytes to convert into a string
  */
-void sha2_to_strn(uint8_t* hash, char* buf, uint8_t bytes);
+void sha2_to_strn(const uint8_t* hash, char* buf, uint8_t bytes);
+
+/**
+ * Convert the hex representation of a hash back into the hash.
+ *
+ * @param str String with exactly SHA2_HEX_SZ lowercase hex digits
+ * @param hash Buffer where the SHA2_DIGEST_SZ bytes of the hash are placed
+ * @returns 0 if the string is a valid hash otherwise -1
+ */
+int sha2_from_str(const char* str, uint8_t* hash);
 
 /**
  * Initialize the hash state structure.
@@ -71,12 +131,25 @@ void sha2_to_strn(uint8_t* hash, char* buf, uint8_t bytes);
 void sha2_init(void* buf);
 
 /**
- * This function processes 64 bytes of data and ypdates the hash state.
+ * Add data to the message being hashed.
+ *
+ * Whole blocks are transformed straight from the input buffer, while a partial
+ * block at the end is kept in the hash state until the next update or the
+ * final step. Therefore, the input may be split at any byte.
  *
  * @param in Input buffer containing the data to be processed
- * @param buf Buffer containg the current hash state
+ * @param buf Buffer containing the current hash state
+ * @param bytes Number of bytes in the input buffer
  */
-void sha2_update(void* in, void* out, void* buf, size_t bytes);
+void sha2_update(const void* in, void* buf, size_t bytes);
+
+/**
+ * Pad the message and produce its hash.
+ *
+ * @param out Buffer where the 32 bytes of the hash will be placed
+ * @param buf Buffer containing the current hash state
+ */
+void sha2_final(uint8_t* out, void* buf);
 
 /**
  * Test correctness of the hashing process, by running it on testing vectors.
@@ -87,6 +160,18 @@ void sha2_update(void* in, void* out, void* buf, size_t bytes);
  */
 int test_sha2(void);
 
+/**
+ * Test all SHA-2 backends supported by the CPU against the portable one.
+ * Ensures every backend produces the same hash state over several block counts.
+ */
+int test_sha2_backends(void);
+
+/**
+ * Test the incremental hashing of a message.
+ * Ensures a message fed in chunks of any size gets the same hash as at once.
+ */
+int test_sha2_update(void);
+
 /**
  * Test the initialization of the hash state.
  * Ensure the initial hash structure is initialized with the correct values.
@@ -106,4 +191,10 @@ int test_sha2_to_str(void);
  */
 int test_sha2_to_strn(void);
 
+/**
+ * Test the conversion of a hex string into a SHA-2 hash.
+ * Ensures valid strings are decoded and any other string is rejected.
+ */
+int test_sha2_from_str(void);
+
 #endif // SHA2_H_
@@ -0,0 +1,139 @@
+#ifndef MEM_STATS_H_
+#define MEM_STATS_H_
+
+#include "inttypes.h"
+#include "stdio.h"
+
+/**
+ * @file mem_stats.h
+ *
+ * Functions used to account the memory of donut's allocators.
+ *
+ * Every allocator is tagged with the name of its owner, the subsystem it
+ * serves, and allocators with the same owner are accounted together. Bytes
+ * mapped are counted when memory is mapped or unmapped, which is rare, so
+ * they're shared by every thread and give the exact peak of each owner.
+ * Allocations are counted by the allocator itself, which is owned by a single
+ * thread, and only summed when they're reported.
+ *
+ * A budget may cap the bytes mapped by the process. Memory a command maps
+ * to set itself up is counted as fixed, and commands building large
+ * structures check mem_over_budget to stop growing them past 3/4 of what's
+ * left. Going over the budget is reported once and recorded, so the command
+ * stops like it does close to the budget and fails once its work is saved.
+ */
+
+/**
+ * Allocations of an allocator, updated by the allocator alone.
+ */
+struct mem_usage {
+        uint64_t allocs;         /**< Allocations made                  */
+        uint64_t frees;          /**< Allocations freed                 */
+        uint64_t live;           /**< Bytes allocated and not freed     */
+        struct mem_usage* prev;  /**< Previous allocator of the owner   */
+        struct mem_usage* next;  /**< Next allocator of the owner       */
+};
+
+/**
+ * Obtain the owner with the given name, registering it on first use.
+ *
+ * Owners live until the program exits.
+ *
+ * @param name String with the owner's name, which must outlive the program.
+ * @returns Pointer to the owner.
+ */
+struct mem_owner* mem_owner(const char* name);
+
+/**
+ * Account a new allocator to its owner.
+ *
+ * @param o Owner of the allocator.
+ * @param u Allocations of the allocator, zeroed.
+ */
+void mem_attach(struct mem_owner* o, struct mem_usage* u);
+
+/**
+ * Fold the allocations of an allocator being released into its owner.
+ *
+ * @param o Owner of the allocator.
+ * @param u Allocations of the allocator.
+ */
+void mem_detach(struct mem_owner* o, struct mem_usage* u);
+
+/**
+ * Account memory mapped by an owner.
+ *
+ * The first mapping taking the process over its budget is reported, see
+ * mem_exceeded.
+ *
+ * @param o Owner of the memory.
+ * @param bytes Bytes mapped.
+ */
+void mem_map(struct mem_owner* o, uint64_t bytes);
+
+/**
+ * Account memory unmapped by an owner.
+ *
+ * @param o Owner of the memory.
+ * @param bytes Bytes unmapped.
+ */
+void mem_unmap(struct mem_owner* o, uint64_t bytes);
+
+/**
+ * Cap the bytes mapped by the process, forgetting any overrun recorded.
+ *
+ * @param bytes Budget in bytes, or 0 for none.
+ */
+void mem_set_budget(uint64_t bytes);
+
+/**
+ * Count the bytes mapped so far as fixed, which the threshold of
+ * mem_over_budget is placed after.
+ */
+void mem_set_base(void);
+
+/**
+ * Determines if the process is close to its budget, past the fixed bytes and
+ * 3/4 of the rest, where commands should stop growing their structures.
+ *
+ * @returns Returns 1 if it is and 0 otherwise.
+ */
+int mem_over_budget(void);
+
+/**
+ * Determines if the process went over its budget at any point.
+ *
+ * @returns Returns 1 if it did and 0 otherwise.
+ */
+int mem_exceeded(void);
+
+/**
+ * Bytes mapped by the process at once, at most.
+ *
+ * @returns Peak bytes mapped.
+ */
+uint64_t mem_peak(void);
+
+/**
+ * Print the allocations, bytes mapped and peak of every owner.
+ */
+void mem_report(void);
+
+/**
+ * Write the usage of every owner as Chrome trace counter events.
+ *
+ * @param f Trace file, after at least one event.
+ * @param ts Timestamp of the events in microseconds.
+ */
+void mem_write_trace(FILE* f, double ts);
+
+/* Unit Tests */
+
+/**
+ * Ensure allocators of the same owner are accounted together, before and
+ * after they're released, and that the budget is checked past the fixed bytes.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_mem_stats(void);
+
+#endif // MEM_STATS_H_
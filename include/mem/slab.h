@@ -1,9 +1,139 @@
 #ifndef SLAB_H_
 #define SLAB_H_
 
-#include "mem/slab.h"
+#include "inttypes.h"
 #include "core/file.h"
 #include "core/dataframe.h"
 #include "core/node.h"
 
+/**
+ * @file slab.h
+ *
+ * Fixed size object cache for donut's objects.
+ *
+ * Every object handed out is a union donut_objects, carved from regions of
+ * SLAB_REGION_SZ bytes mapped at once, so millions of objects cost no more
+ * than their own size. Each thread allocates through its own magazine, an
+ * array of free objects it owns, and only takes the cache's lock to exchange
+ * SLAB_MAG_SZ / 2 objects at a time with the cache's free list. Objects are
+ * freed one by one into the magazine, or all at once when the cache is
+ * cleared at the end of a command.
+ *
+ * Objects are rounded to the cache line, wasting up to a line each, so the
+ * objects held by different threads' magazines never share one.
+ *
+ * Objects are accounted to the cache's owner as allocated while magazines
+ * hold them, so the counts are updated along with the exchanges rather than
+ * for every object.
+ */
+
+/**
+ * @def SLAB_REGION_SZ
+ * Bytes mapped at once for a cache's objects.
+ */
+#define SLAB_REGION_SZ (2 * 1024 * 1024)
+
+/**
+ * @def SLAB_MAG_SZ
+ * Number of free objects a magazine holds.
+ */
+#define SLAB_MAG_SZ 64
+
+/**
+ * Objects held by the cache.
+ */
+union donut_objects {
+        struct dataframe dataframe; /**< Dataframe object */
+        struct data_file file;      /**< File object      */
+        struct node node;           /**< Node object      */
+};
+
+/**
+ * Free objects owned by a thread.
+ */
+struct slab_mag {
+        struct slab* cache;         /**< Cache of the objects             */
+        void* objs[SLAB_MAG_SZ];    /**< Free objects                     */
+        uint32_t n;                 /**< Number of free objects           */
+        struct slab_mag* next;      /**< Next magazine of the cache       */
+};
+
+/**
+ * Initialize an empty object cache.
+ *
+ * @param owner String with the name the cache's memory is accounted to.
+ * @returns Pointer to the cache.
+ */
+struct slab* init_slabs(const char* owner);
+
+/**
+ * Obtain a magazine for the calling thread.
+ *
+ * A magazine must only be used by a single thread at a time. It's released
+ * along with the cache.
+ *
+ * @param s Cache the magazine allocates from.
+ * @returns Pointer to the magazine.
+ */
+struct slab_mag* get_slab_mag(struct slab* s);
+
+/**
+ * Give a magazine's free objects back to its cache, so other threads may
+ * allocate them.
+ *
+ * @param m Magazine to be emptied.
+ */
+void flush_slab_mag(struct slab_mag* m);
+
+/**
+ * Allocate a zeroed object.
+ *
+ * @param m Magazine of the calling thread.
+ * @returns Pointer to the object, aligned to the cache line.
+ */
+union donut_objects* alloc_slab(struct slab_mag* m);
+
+/**
+ * Free an object of the magazine's cache.
+ *
+ * @param m Magazine of the calling thread.
+ * @param obj Object to be freed.
+ */
+void free_slab(struct slab_mag* m, union donut_objects* obj);
+
+/**
+ * Number of objects handed out by the cache and not freed.
+ *
+ * Objects in magazines count as free. Their threads change the magazines'
+ * counts without the cache's lock, so the result is only valid once every
+ * thread allocating from the cache has been joined.
+ *
+ * @param s Cache to be checked.
+ * @returns Number of objects.
+ */
+uint64_t slab_live(struct slab* s);
+
+/**
+ * Unmap every object of the cache at once, release its magazines and the
+ * cache itself.
+ *
+ * @param s Cache to be cleared.
+ */
+void clear_slabs(struct slab* s);
+
+/* Unit Tests */
+
+/**
+ * Ensure the cache is initialized with the correct values.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_init_slabs(void);
+
+/**
+ * Ensure objects allocated and freed by several threads are never handed out
+ * twice.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_slabs(void);
+
 #endif // SLAB_H_
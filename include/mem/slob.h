@@ -2,6 +2,7 @@
 #define __SLOB_H_
 
 #include "stdlib.h"
+#include "inttypes.h"
 
 /**
  * @file slob.h
@@ -10,21 +11,142 @@
  * created. It allows the "owner" of the allocator to request and realease
  * memory slabs as needed, with the guarantuee of no memory leaks. Moreover
  * it will align memory to the cache-line's size to prevent false sharing.
+ *
+ * The allocator is an arena. Slobs are rounded up to a size class and carved
+ * from runs of memory mapped in bulk, and freed slobs are kept for the next
+ * allocation of their class, so both take constant time. The memory is only
+ * given back when the allocator is cleared, except for slobs larger than the
+ * largest class. An allocator mustn't be shared by threads.
+ *
+ * An allocator may also back its large slobs with huge pages, which cuts the
+ * TLB misses of large tables looked up at random, such as the hash tables of
+ * object IDs. Slobs of at least SLOB_HUGE_PAGE_SZ bytes are then mapped in
+ * multiples of huge pages aligned to their size, either advised to the kernel
+ * as transparent huge pages or taken from the reserved hugetlbfs pool. Smaller
+ * slobs are never placed on huge pages, since a huge page is faulted in whole.
+ */
+
+/**
+ * @def SLOB_CLASS_MAX
+ * Largest slob carved from a run, larger slobs are mapped on their own.
+ */
+#define SLOB_CLASS_MAX 8192
+
+/**
+ * @def SLOB_CLASSES
+ * Number of size classes kept by an allocator, enough for cache lines of 16
+ * bytes or more.
+ */
+#define SLOB_CLASSES 32
+
+/**
+ * @def SLOB_RUN_SZ
+ * Bytes of a run, which holds slobs of a single class.
+ */
+#define SLOB_RUN_SZ (64 * 1024)
+
+/**
+ * @def SLOB_REGION_SZ
+ * Most bytes mapped at once, split in runs as classes need them. Smaller
+ * regions are mapped first, so small allocators stay small.
+ */
+#define SLOB_REGION_SZ (16 * SLOB_RUN_SZ)
+
+/**
+ * @def SLOB_HUGE_PAGE_SZ
+ * Bytes of a huge page, the smallest slob placed on huge pages.
+ */
+#define SLOB_HUGE_PAGE_SZ (2 * 1024 * 1024)
+
+/**
+ * @def SLOB_PAGES_BASE
+ * Every slob is placed on base pages.
+ */
+#define SLOB_PAGES_BASE 0
+
+/**
+ * @def SLOB_PAGES_THP
+ * Large slobs are advised as transparent huge pages.
+ */
+#define SLOB_PAGES_THP 1
+
+/**
+ * @def SLOB_PAGES_HUGETLB
+ * Large slobs are taken from hugetlbfs, or advised as transparent huge pages
+ * when no huge page is reserved.
  */
+#define SLOB_PAGES_HUGETLB 2
 
 /**
  * Initialize a SLOB allocator.
+ *
+ * Its memory and allocations are accounted to an owner, see mem_stats.h.
+ *
+ * @param owner String with the name of the subsystem using the allocator
+ * @returns Pointer to the slob allocator.
+ */
+struct slobs* init_slobs(const char* owner);
+
+/**
+ * Initialize a SLOB allocator placing its large slobs on huge pages.
+ *
+ * @param owner String with the name of the subsystem using the allocator
+ * @param pages Pages backing the large slobs, one of SLOB_PAGES_*
  * @returns Pointer to the slob allocator.
  */
-struct slobs* init_slobs(void);
+struct slobs* init_huge_slobs(const char* owner, unsigned int pages);
+
+/**
+ * Obtain the pages an allocator backs its large slobs with.
+ *
+ * @param ptr Pointer to a slob allocator structure
+ * @returns One of SLOB_PAGES_*
+ */
+unsigned int slob_pages(struct slobs* ptr);
+
+/**
+ * Bytes currently mapped by an allocator.
+ *
+ * @param ptr Pointer to a slob allocator structure
+ * @returns Bytes of the allocator's regions and large slobs
+ */
+uint64_t slob_mem(struct slobs* ptr);
+
+/**
+ * Bytes of an allocator's slobs that ended up on huge pages.
+ *
+ * Slobs from hugetlbfs always are. Transparent huge pages are only a hint,
+ * so the kernel's accounting of the mappings holding them is read from
+ * /proc/self/smaps, and mappings merged with them by the kernel count too.
+ *
+ * @param ptr Pointer to a slob allocator structure
+ * @returns Bytes on huge pages
+ */
+uint64_t slob_huge_mem(struct slobs* ptr);
+
+
+/**
+ * Obtain the size class of a slob.
+ *
+ * @param sz Bytes of the slob, no more than SLOB_CLASS_MAX
+ * @returns Index of the smallest class holding the slob
+ */
+unsigned int slob_class(size_t sz);
 
+/**
+ * Obtain the bytes of a size class's slobs.
+ *
+ * @param cls Index of the class
+ * @returns Bytes of the class's slobs, a multiple of the cache line
+ */
+size_t slob_class_size(unsigned int cls);
 
 /**
  * Allocate a slab with a given SLOB allocator.
  *
- * This function will allocate a new slab of aligned memory and add it to the
- * SLOB allocator provided. It will grow the amount of slabs supported if all
- * the slots have already been filled.
+ * The slab is zeroed and aligned to the cache line. It's reused from the
+ * slabs of its size class freed before, carved from the class's run, or
+ * mapped on its own if it's larger than SLOB_CLASS_MAX.
  *
  * @param ptr Pointer to a slob allocator structure
  * @param slob_sz Byte of the slab to be allocated
@@ -35,14 +157,17 @@ void* alloc_slob(struct slobs* ptr, size_t sz);
 /**
  * Free a slab from the given SLOB allocator structure.
  *
- * Receives a pointer and determines if it corresponds to a slab within the
- * given SLOB structure. If that's the case the following happens:
- *   1. The memory slab is freed
- *   2. The SLOB list is updated to support 1 more slab
- *   3. The SLOB list is re-ordered so that no gaps exist
+ * The slab's header is found by masking its address, so freeing takes
+ * constant time. The slab must therefore come from a SLOB allocator, a
+ * pointer from malloc or the slab allocator would have its header read from
+ * unrelated or unmapped memory. Slabs of another SLOB allocator and NULL are
+ * ignored, otherwise:
+ *   1. Slabs of a size class are kept for its next allocation
+ *   2. Slabs larger than SLOB_CLASS_MAX are unmapped
  *
  * @param ptr Pointer to a SLOB allocator
- * @param slob Pointer to the slab to deallocate
+ * @param slob Pointer to the slab to deallocate, NULL or allocated by any
+ *             SLOB allocator
  */
 void free_slob(struct slobs* ptr, void* slob);
 
@@ -50,8 +175,8 @@ void free_slob(struct slobs* ptr, void* slob);
 /**
  * Free all memory managed by the allocator and the allocator itself.
  *
- * The function will walk over the list of slabs maintained by the allocator and
- * free all of them. At the end the allocator itself is freed.
+ * The function will unmap the regions and large slabs of the allocator. At the
+ * end the allocator itself is freed.
  *
  * @param ptr Pointer to the allocator structure to free
  */
@@ -70,10 +195,11 @@ int test_init_slob(void);
  * Unit test for "alloc_slab" function.
  *
  * Performs several tests to ensure that:
- *   1. Slab allocation under the machine's page size is performed successfully
- *   2. Slab allocation above the machine's page size is performed successfully
- *   3. The slabs allocated are aligned to the machine's cache line size
- *   4. The bookkeeping variables are properly updated as allocations occur
+ *   1. Sizes are rounded up to a class wasting less than a quarter
+ *   2. Slab allocation within the size classes is performed successfully
+ *   3. Slab allocation above the largest class is performed successfully
+ *   4. The slabs allocated are zeroed and aligned to the cache line size
+ *   5. Runs are refilled from new regions as allocations occur
  *
  * @returns In case of success the return value is 1 otherwise its 0.
  */
@@ -83,11 +209,25 @@ int test_alloc_slob(void);
  * Unit test for "free_slob" function.
  *
  * Performs several tests to ensure that:
- *   1. The allocator is capable of freeing memory slabs
- *   2. The bookkeeping variables are properly updated as deallocations occur
+ *   1. Freed slabs are reused, zeroed, by their size class
+ *   2. Large slabs are unmapped wherever they are in the list
+ *   3. Slabs of other allocators are ignored
+ *   4. Slabs in use are accounted to the allocator's owner
  *
  * @returns In case of success the return value is 1 otherwise its 0.
  */
 int test_free_slob(void);
 
+/**
+ * Unit test for "init_huge_slobs" function.
+ *
+ * Performs several tests to ensure that:
+ *   1. Large slobs of a huge allocator are aligned to huge pages
+ *   2. Smaller slobs are still carved from runs
+ *   3. The bytes on huge pages never exceed the bytes mapped
+ *
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_huge_slob(void);
+
 #endif // __SLOB_H_
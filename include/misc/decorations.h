@@ -36,10 +36,20 @@
 Starting a working area: \n \
 \t - init \t Create an empty Donut container \n \
 \t - chkin \t Commit data to an existing Donut container \n \
+\t - cat-data \t Write the content of a data object \n \
+\t - repack \t Move small data objects into a single pack \n \
+\t - reshard \t Spread data objects over more or fewer folders \n \
 \n \
 Check if your Donut isn't spoiled: \n \
 \t - doctor \t Run all the unit tests to check for issues \n \
 \t - conf \t Show Donut's current hardware and software configuration \n \
+\t - bench \t Measure the performance of Donut's building blocks \n \
+\n \
+Options accepted by every command: \n \
+\t --stats \t Print where the command spent its time \n \
+\t --trace=FILE \t Write the command's spans as a Chrome trace \n \
+\t --mem-stats \t Print the memory used by each subsystem \n \
+\t --mem-budget=MIB \t Stop before mapping more memory, failing past it \n \
 "
 
 #endif // __DECORATIONS_H_
@@ -0,0 +1,149 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "inttypes.h"
+#include "stdio.h"
+
+/**
+ * @file stats.h
+ *
+ * Functions used to measure where commands spend their time.
+ *
+ * Spans time a phase of work with the monotonic clock and counters count
+ * events, such as bytes hashed or index lookups. Each thread keeps its own
+ * totals and trace events, merged when they're reported, so measuring doesn't
+ * make threads contend. Nothing is measured unless "--stats" or "--trace" was
+ * given, in which case a span costs two clock reads.
+ *
+ * Phases may nest, a copy's time includes the lookup and store of the object
+ * being copied, so the times of the phases don't add up to the command's.
+ */
+
+/**
+ * Phases of work timed by spans.
+ */
+enum stats_phase {
+        PHASE_COMMAND,  /**< Whole command                        */
+        PHASE_SCAN,     /**< Reading directories                  */
+        PHASE_STAT,     /**< Status and cached IDs of files       */
+        PHASE_HASH,     /**< Reading and hashing files            */
+        PHASE_IO,       /**< Waiting on asynchronous reads        */
+        PHASE_LOOKUP,   /**< Object index lookups                 */
+        PHASE_STORE,    /**< Renaming and linking objects         */
+        PHASE_COPY,     /**< Copying files which stay in place    */
+        PHASE_COMPRESS, /**< Compressing files                    */
+        PHASE_CHUNK,    /**< Splitting large files into chunks    */
+        PHASE_PACK,     /**< Copying objects into packs           */
+        PHASE_INDEX,    /**< Opening and saving the index         */
+        PHASE_N
+};
+
+/**
+ * Events counted.
+ */
+enum stats_counter {
+        STAT_BYTES_HASHED,  /**< Bytes of content hashed            */
+        STAT_FILES_SCANNED, /**< Files found while walking          */
+        STAT_LOOKUPS,       /**< Object index lookups               */
+        STAT_HITS,          /**< Lookups of objects already stored  */
+        STAT_SLOB_ALLOCS,   /**< Slobs allocated                    */
+        STAT_SLOB_BYTES,    /**< Bytes requested from slobs         */
+        STAT_N
+};
+
+/**
+ * Set if spans and counters are recorded.
+ */
+extern int stats_on;
+
+/**
+ * Start recording spans and counters.
+ *
+ * @param trace String containing the path of the trace file to be written by
+ * stats_report, or NULL.
+ */
+void stats_start(const char* trace);
+
+/**
+ * Obtain the monotonic clock in nanoseconds.
+ *
+ * @returns Nanoseconds since an arbitrary point.
+ */
+uint64_t stats_now(void);
+
+/**
+ * Record a span and its work.
+ *
+ * @param phase Phase of the span.
+ * @param start Value of stats_begin when the span started.
+ * @param bytes Bytes handled during the span.
+ * @param files Files handled during the span.
+ */
+void stats_span(unsigned int phase, uint64_t start, uint64_t bytes,
+                uint64_t files);
+
+/**
+ * Add to a counter of the calling thread.
+ *
+ * @param counter Counter to be increased.
+ * @param n Amount added.
+ */
+void stats_count(unsigned int counter, uint64_t n);
+
+/**
+ * Print the per-phase breakdown and counters, and write the trace file.
+ *
+ * Should only be called once every measured thread has exited.
+ *
+ * @param print Set if the breakdown is printed.
+ */
+void stats_report(int print);
+
+/**
+ * Start a span.
+ *
+ * @returns The time the span started, or 0 if nothing is recorded.
+ */
+static inline uint64_t
+stats_begin(void)
+{
+        return (stats_on) ? stats_now() : 0;
+}
+
+/**
+ * End a span started by stats_begin.
+ *
+ * @param phase Phase of the span.
+ * @param start Value returned by stats_begin.
+ * @param bytes Bytes handled during the span.
+ * @param files Files handled during the span.
+ */
+static inline void
+stats_end(unsigned int phase, uint64_t start, uint64_t bytes, uint64_t files)
+{
+        if (stats_on)
+                stats_span(phase, start, bytes, files);
+}
+
+/**
+ * Add to a counter if counters are recorded.
+ *
+ * @param counter Counter to be increased.
+ * @param n Amount added.
+ */
+static inline void
+stats_add(unsigned int counter, uint64_t n)
+{
+        if (stats_on)
+                stats_count(counter, n);
+}
+
+/* Unit Tests */
+
+/**
+ * Ensure spans and counters of several threads are merged.
+ * @returns In case of success the return value is 1 otherwise its 0.
+ */
+int test_stats(void);
+
+#endif // STATS_H_
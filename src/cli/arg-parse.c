@@ -7,6 +7,18 @@
 #include "string.h"
 #include "unistd.h"
 
+/**
+ * Options only given by their long name, whose values follow the characters.
+ */
+static const struct option long_opts[] = {
+        {"stats", no_argument, NULL, 0x100},
+        {"trace", required_argument, NULL, 0x101},
+        {"mem-stats", no_argument, NULL, 0x102},
+        {"mem-budget", required_argument, NULL, 0x103},
+        {"chunk", optional_argument, NULL, 0x104},
+        {NULL, 0, NULL, 0}
+};
+
 static int
 is_valid_str_arg(char* str, char arg)
 {
@@ -24,17 +36,63 @@ parse_opts(int argc, char** argv, void* buf, uint64_t* opt_flags)
         int option;
         char* str;
 
-        while ((option = getopt((argc - 1), &argv[1], "rn:")) != -1) {
+        while ((option = getopt_long((argc - 1), &argv[1], "rkn:i:j:c:",
+                                     long_opts, NULL)) != -1) {
                 switch (option) {
                         case 'r':
                                 *opt_flags |= RECURSIVE_OPT;
                                 break;
+                        case 'k':
+                                *opt_flags |= KEEP_OPT;
+                                break;
                         case 'n':
                                 *opt_flags |= NAME_OPT;
                                 str = (char*)buf + (NAME_ARG_IDX * (MAX_ARG_SZ + 1));
                                 if (is_valid_str_arg(optarg, 'n'))
                                         strncpy(str, optarg, MAX_ARG_SZ);
                                 break;
+                        case 'i':
+                                *opt_flags |= ID_OPT;
+                                str = (char*)buf + (ID_ARG_IDX * (MAX_ARG_SZ + 1));
+                                if (is_valid_str_arg(optarg, 'i'))
+                                        strncpy(str, optarg, MAX_ARG_SZ);
+                                break;
+                        case 'j':
+                                *opt_flags |= JOBS_OPT;
+                                str = (char*)buf + (JOBS_ARG_IDX * (MAX_ARG_SZ + 1));
+                                if (is_valid_str_arg(optarg, 'j'))
+                                        strncpy(str, optarg, MAX_ARG_SZ);
+                                break;
+                        case 'c':
+                                *opt_flags |= COMPRESS_OPT;
+                                str = (char*)buf + (COMPRESS_ARG_IDX * (MAX_ARG_SZ + 1));
+                                if (is_valid_str_arg(optarg, 'c'))
+                                        strncpy(str, optarg, MAX_ARG_SZ);
+                                break;
+                        case 0x100:
+                                *opt_flags |= STATS_OPT;
+                                break;
+                        case 0x101:
+                                *opt_flags |= TRACE_OPT;
+                                str = (char*)buf + (TRACE_ARG_IDX * (MAX_ARG_SZ + 1));
+                                if (is_valid_str_arg(optarg, 't'))
+                                        strncpy(str, optarg, MAX_ARG_SZ);
+                                break;
+                        case 0x102:
+                                *opt_flags |= MEM_STATS_OPT;
+                                break;
+                        case 0x103:
+                                *opt_flags |= MEM_BUDGET_OPT;
+                                str = (char*)buf + (MEM_BUDGET_ARG_IDX * (MAX_ARG_SZ + 1));
+                                if (is_valid_str_arg(optarg, 'm'))
+                                        strncpy(str, optarg, MAX_ARG_SZ);
+                                break;
+                        case 0x104:
+                                *opt_flags |= CHUNK_OPT;
+                                str = (char*)buf + (CHUNK_ARG_IDX * (MAX_ARG_SZ + 1));
+                                if (optarg && is_valid_str_arg(optarg, 'h'))
+                                        strncpy(str, optarg, MAX_ARG_SZ);
+                                break;
                         default:
                                 break;
                 }
@@ -58,6 +116,18 @@ test_parse_opts(void)
         "~/test.txt"};
         char* args_5[6] = {"/usr/local/bin/donut", "chkin", "-n", "name", "-r",
         "~/test/txt"};
+        char* args_6[5] = {"/usr/local/bin/donut", "init", "-i", "tree",
+        "~/test"};
+        char* args_7[6] = {"/usr/local/bin/donut", "chkin", "-j", "4", "-r",
+        "~/test"};
+        char* args_8[4] = {"/usr/local/bin/donut", "chkin", "-k", "~/test"};
+        char* args_9[5] = {"/usr/local/bin/donut", "init", "-c", "20", "~/test"};
+        char* args_10[6] = {"/usr/local/bin/donut", "chkin", "--stats",
+        "--trace=/tmp/t.json", "-k", "~/test"};
+        char* args_11[5] = {"/usr/local/bin/donut", "chkin", "--mem-stats",
+        "--mem-budget=64", "~/test"};
+        char* args_12[5] = {"/usr/local/bin/donut", "init", "--chunk",
+        "--chunk=8192", "~/test"};
 
         /* First Test */
         opt_idx = parse_opts(4, args_1, buf, &tmp);
@@ -100,6 +170,77 @@ test_parse_opts(void)
         ret &= (opt_idx == 5) ? 1 : 0;
         ret &= (!strncmp(buf, "name", 4)) ? 1 : 0;
 
+        /* Sixth Test */
+        memset(buf, 0x0, 1024);
+        optind = 1;
+        tmp = 0;
+        opt_idx = parse_opts(5, args_6, buf, &tmp);
+        ret &= (tmp == 4) ? 1 : 0;
+        ret &= (opt_idx == 4) ? 1 : 0;
+        ret &= (!strncmp((char*)buf + (ID_ARG_IDX * (MAX_ARG_SZ + 1)), "tree",
+                         4)) ? 1 : 0;
+
+        /* Seventh Test */
+        memset(buf, 0x0, 1024);
+        optind = 1;
+        tmp = 0;
+        opt_idx = parse_opts(6, args_7, buf, &tmp);
+        ret &= (tmp == (JOBS_OPT | RECURSIVE_OPT)) ? 1 : 0;
+        ret &= (opt_idx == 5) ? 1 : 0;
+        ret &= (!strncmp((char*)buf + (JOBS_ARG_IDX * (MAX_ARG_SZ + 1)), "4",
+                         2)) ? 1 : 0;
+
+        /* Eighth Test */
+        memset(buf, 0x0, 1024);
+        optind = 1;
+        tmp = 0;
+        opt_idx = parse_opts(4, args_8, buf, &tmp);
+        ret &= (tmp == KEEP_OPT) ? 1 : 0;
+        ret &= (opt_idx == 3) ? 1 : 0;
+
+        /* Ninth Test */
+        memset(buf, 0x0, 1024);
+        optind = 1;
+        tmp = 0;
+        opt_idx = parse_opts(5, args_9, buf, &tmp);
+        ret &= (tmp == COMPRESS_OPT) ? 1 : 0;
+        ret &= (opt_idx == 4) ? 1 : 0;
+        ret &= (!strncmp((char*)buf + (COMPRESS_ARG_IDX * (MAX_ARG_SZ + 1)),
+                         "20", 3)) ? 1 : 0;
+
+        /* Tenth Test */
+        memset(buf, 0x0, 1024);
+        optind = 1;
+        tmp = 0;
+        opt_idx = parse_opts(6, args_10, buf, &tmp);
+        ret &= (tmp == (STATS_OPT | TRACE_OPT | KEEP_OPT)) ? 1 : 0;
+        ret &= (opt_idx == 5) ? 1 : 0;
+        ret &= (!strncmp((char*)buf + (TRACE_ARG_IDX * (MAX_ARG_SZ + 1)),
+                         "/tmp/t.json", 12)) ? 1 : 0;
+
+        /* Eleventh Test */
+        memset(buf, 0x0, 1024);
+        optind = 1;
+        tmp = 0;
+        opt_idx = parse_opts(5, args_11, buf, &tmp);
+        ret &= (tmp == (MEM_STATS_OPT | MEM_BUDGET_OPT)) ? 1 : 0;
+        ret &= (opt_idx == 4) ? 1 : 0;
+        ret &= (!strncmp((char*)buf + (MEM_BUDGET_ARG_IDX * (MAX_ARG_SZ + 1)),
+                         "64", 3)) ? 1 : 0;
+
+        /* Twelfth Test */
+        memset(buf, 0x0, 1024);
+        optind = 1;
+        tmp = 0;
+        opt_idx = parse_opts(3, args_12, buf, &tmp);
+        ret &= (tmp == CHUNK_OPT && opt_idx == 3) ? 1 : 0;
+        ret &= (!*((char*)buf + (CHUNK_ARG_IDX * (MAX_ARG_SZ + 1)))) ? 1 : 0;
+        optind = 1;
+        opt_idx = parse_opts(5, args_12, buf, &tmp);
+        ret &= (tmp == CHUNK_OPT && opt_idx == 4) ? 1 : 0;
+        ret &= (!strncmp((char*)buf + (CHUNK_ARG_IDX * (MAX_ARG_SZ + 1)),
+                         "8192", 5)) ? 1 : 0;
+
 	free(buf);
         return ret;
 }
@@ -0,0 +1,918 @@
+#include "cli/cmd.h"
+#include "core/config.h"
+#include "core/data-list.h"
+#include "core/obj-index.h"
+#include "core/oid-set.h"
+#include "core/object.h"
+#include "core/uring.h"
+#include "core/wrappers.h"
+#include "crypto/sha2.h"
+#include "crypto/sha2-file.h"
+#include "const/const.h"
+#include "const/err.h"
+#include "mem/slob.h"
+#include "mem/slab.h"
+#include "misc/decorations.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "unistd.h"
+#include "fcntl.h"
+#include "dirent.h"
+#include "pthread.h"
+#include "sys/stat.h"
+#include "sys/resource.h"
+
+/**
+ * @file bench.c
+ *
+ * Implements all functions and utilities used by the "bench" command.
+ *
+ * Benchmarks measure donut's building blocks in isolation, with synthetic
+ * inputs, so changes to them can be compared across versions and machines.
+ */
+
+/**
+ * @def BENCH_DL_ENTRIES
+ * Number of object IDs in the data_list benchmark.
+ */
+#define BENCH_DL_ENTRIES 10000000
+
+/**
+ * @def BENCH_IDX_ENTRIES
+ * Number of object IDs in the object index benchmark.
+ */
+#define BENCH_IDX_ENTRIES 5000000
+
+/**
+ * @def BENCH_SET_ENTRIES
+ * Number of object IDs raced for in the oid-set benchmark.
+ */
+#define BENCH_SET_ENTRIES 2000000
+
+/**
+ * @def BENCH_SET_THREADS
+ * Number of threads racing in the oid-set benchmark.
+ */
+#define BENCH_SET_THREADS ((N_CPU > 1) ? N_CPU : 2)
+
+/**
+ * @def BENCH_SLOB_LIVE
+ * Number of slobs kept alive by the slob benchmark.
+ */
+#define BENCH_SLOB_LIVE 20000
+
+/**
+ * @def BENCH_SLOB_CHURN
+ * Number of slobs freed and allocated again by the slob benchmark.
+ */
+#define BENCH_SLOB_CHURN 500000
+
+/**
+ * @def BENCH_SLAB_OBJS
+ * Number of file objects allocated by each thread of the slab benchmark.
+ */
+#define BENCH_SLAB_OBJS 2000000
+
+/**
+ * @def BENCH_HUGE_ENTRIES
+ * Number of object IDs looked up in the huge pages benchmark.
+ */
+#define BENCH_HUGE_ENTRIES 4000000
+
+/**
+ * @def BENCH_READ_TOTAL
+ * Number of bytes hashed by each run of the file reading benchmark.
+ */
+#define BENCH_READ_TOTAL (256 * 1024 * 1024)
+
+/**
+ * @def BENCH_URING_CHUNK
+ * Size of the reads in flight in the io_uring run of the file reading
+ * benchmark.
+ */
+#define BENCH_URING_CHUNK (1024 * 1024)
+
+/**
+ * @def BENCH_URING_DEPTH
+ * Number of reads in flight in the io_uring run of the file reading benchmark.
+ */
+#define BENCH_URING_DEPTH 4
+
+/**
+ * @def BENCH_CHKIN_FILES
+ * Number of files checked in by each run of the chkin benchmark.
+ */
+#define BENCH_CHKIN_FILES 1000000
+
+/**
+ * A benchmark that can be selected by name.
+ */
+struct bench {
+        const char* name;           /**< Name used to select it */
+        void (*fn)(struct slobs*);  /**< Function running it    */
+};
+
+/**
+ * Obtain the current time of the monotonic clock.
+ * @returns Time in nanoseconds.
+ */
+static uint64_t
+now_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Produce a pseudo-random object ID from a seed.
+ *
+ * The same seed always gives the same ID, so IDs can be generated again for
+ * lookups instead of being kept in memory.
+ *
+ * @param seed Seed of the ID.
+ * @param id Buffer where the ID is placed.
+ */
+static void
+bench_oid(uint64_t seed, uint8_t* id)
+{
+        uint64_t z;
+
+        for (int i = 0; i < OID_SZ / 8; i++) {
+                z = (seed += 0x9e3779b97f4a7c15ull);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                z ^= z >> 31;
+                memcpy(id + i * 8, &z, 8);
+        }
+}
+
+/**
+ * Measure insertions and lookups of the data_list.
+ *
+ * @param slobs Slob allocator used for the list.
+ */
+static void
+bench_data_list(struct slobs* slobs)
+{
+        struct data_list* list = init_data_list(slobs);
+        uint8_t id[OID_SZ];
+        uint64_t i, t, hits = 0;
+        const uint64_t n = BENCH_DL_ENTRIES;
+
+        t = now_ns();
+        for (i = 0; i < n; i++) {
+                bench_oid(i * 4, id);
+                add_file_to_list(list, id);
+        }
+        t = now_ns() - t;
+        printf("data-list: %lu entries, %lu MiB\n", (unsigned long)n,
+               (unsigned long)(data_list_mem(list) >> 20));
+        printf("  Insert: %.1f ns/op\n", (double)t / n);
+
+        t = now_ns();
+        for (i = 0; i < n; i++) {
+                bench_oid(i * 4, id);
+                hits += is_in_data_list(list, id);
+        }
+        t = now_ns() - t;
+        printf("  Lookup (hit): %.1f ns/op\n", (double)t / n);
+
+        t = now_ns();
+        for (i = 0; i < n; i++) {
+                bench_oid(i * 4 + 2, id);
+                hits += is_in_data_list(list, id);
+        }
+        t = now_ns() - t;
+        printf("  Lookup (miss): %.1f ns/op\n", (double)t / n);
+
+        if (hits != n)
+                printf(DONUT_ERROR "Expected %lu hits but got %lu.\n",
+                       (unsigned long)n, (unsigned long)hits);
+}
+
+/**
+ * Measure lookups in an object index written to the home directory.
+ *
+ * @param slobs Slob allocator used for the index.
+ */
+static void
+bench_obj_index(struct slobs* slobs)
+{
+        struct obj_index* idx;
+        uint8_t id[OID_SZ];
+        uint64_t i, t, hits = 0;
+        const uint64_t n = BENCH_IDX_ENTRIES;
+        char* dir = alloc_slob(slobs, PAGE_SIZE);
+        char* path = alloc_slob(slobs, PAGE_SIZE);
+        char* log = alloc_slob(slobs, PAGE_SIZE);
+
+        snprintf(dir, PAGE_SIZE, "%s/donut_bench_index", getenv("HOME"));
+        snprintf(path, PAGE_SIZE, "%s.idx", dir);
+        snprintf(log, PAGE_SIZE, "%s.idx.log", dir);
+        mkdir(dir, S_IRWXU);
+        remove(path);
+
+        /* Every ID is added to an empty index, which is then compacted */
+        idx = open_obj_index(slobs, path, dir, 0);
+        for (i = 0; i < n; i++) {
+                bench_oid(i * 4, id);
+                obj_index_add(idx, id);
+        }
+        t = now_ns();
+        close_obj_index(idx);
+        t = now_ns() - t;
+        printf("obj-index: %lu entries\n", (unsigned long)n);
+        printf("  Write: %.1f ms\n", (double)t / 1000000);
+
+        t = now_ns();
+        idx = open_obj_index(slobs, path, dir, 0);
+        t = now_ns() - t;
+        printf("  Open: %.1f us\n", (double)t / 1000);
+
+        t = now_ns();
+        for (i = 0; i < n; i++) {
+                bench_oid(i * 4, id);
+                hits += obj_index_has(idx, id);
+        }
+        t = now_ns() - t;
+        printf("  Lookup (hit): %.1f ns/op\n", (double)t / n);
+
+        t = now_ns();
+        for (i = 0; i < n; i++) {
+                bench_oid(i * 4 + 2, id);
+                hits += obj_index_has(idx, id);
+        }
+        t = now_ns() - t;
+        printf("  Lookup (miss): %.1f ns/op\n", (double)t / n);
+        close_obj_index(idx);
+
+        if (hits != n)
+                printf(DONUT_ERROR "Expected %lu hits but got %lu.\n",
+                       (unsigned long)n, (unsigned long)hits);
+
+        remove(log);
+        remove(path);
+        rmdir(dir);
+}
+
+/**
+ * Thread of the oid-set benchmark, claiming every ID from its own offset.
+ */
+struct bench_claimer {
+        struct oid_set* set;     /**< Set raced for, or NULL for the list  */
+        struct data_list* list;  /**< List behind a single lock            */
+        pthread_mutex_t* lock;   /**< Lock of the list                     */
+        uint64_t first;          /**< First ID claimed                     */
+        uint64_t won;            /**< Number of IDs it claimed             */
+        pthread_t tid;           /**< Thread's ID                          */
+};
+
+/**
+ * Claim every ID of the benchmark, counting those claimed by this thread.
+ */
+static void*
+bench_claim_ids(void* arg)
+{
+        struct bench_claimer* c = arg;
+        const uint64_t n = BENCH_SET_ENTRIES;
+        uint8_t id[OID_SZ];
+        uint64_t i, cnt;
+
+        for (i = 0; i < n; i++) {
+                bench_oid((c->first + i) % n, id);
+                if (c->set) {
+                        c->won += oid_set_claim(c->set, id);
+                        continue;
+                }
+
+                pthread_mutex_lock(c->lock);
+                cnt = data_list_size(c->list);
+                add_file_to_list(c->list, id);
+                c->won += data_list_size(c->list) - cnt;
+                pthread_mutex_unlock(c->lock);
+        }
+
+        return NULL;
+}
+
+/**
+ * Race threads for the same IDs, in a data_list behind a single lock and in
+ * the striped set.
+ *
+ * @param slobs Slob allocator used for the set and list.
+ */
+static void
+bench_oid_set(struct slobs* slobs)
+{
+        const unsigned int jobs = BENCH_SET_THREADS;
+        const uint64_t n = BENCH_SET_ENTRIES;
+        struct bench_claimer* c = alloc_slob(slobs, jobs *
+                                             sizeof(struct bench_claimer));
+        struct oid_set* set = init_oid_set(slobs);
+        struct data_list* list = init_data_list(slobs);
+        pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        const char* names[2] = {"Claim (single lock)", "Claim (striped)"};
+        uint64_t t, won;
+        unsigned int i;
+
+        printf("oid-set: %lu entries, %u threads\n", (unsigned long)n, jobs);
+        for (int run = 0; run < 2; run++) {
+                for (i = 0; i < jobs; i++) {
+                        c[i].set = (run) ? set : NULL;
+                        c[i].list = list;
+                        c[i].lock = &lock;
+                        c[i].first = i * (n / jobs);
+                        c[i].won = 0;
+                }
+
+                t = now_ns();
+                for (i = 0; i < jobs; i++)
+                        pthread_create(&c[i].tid, NULL, bench_claim_ids, &c[i]);
+                for (i = won = 0; i < jobs; i++) {
+                        pthread_join(c[i].tid, NULL);
+                        won += c[i].won;
+                }
+                t = now_ns() - t;
+                printf("  %s: %.1f ns/op\n", names[run],
+                       (double)t / (n * jobs));
+
+                if (won != n)
+                        printf(DONUT_ERROR "Expected %lu claims but got %lu.\n",
+                               (unsigned long)n, (unsigned long)won);
+        }
+
+        clear_oid_set(set);
+}
+
+/**
+ * Slob allocator as it was before size classes, each slob obtained with
+ * calloc and looked up when freed, kept to be compared against.
+ */
+struct legacy_slobs {
+        uint32_t slob_t; /**< Total amount of slobs                 */
+        uint32_t slob_l; /**< Amount of slobs left in the allocator */
+        uint64_t idx;    /**< Index of the next slob                */
+        void** slobs;    /**< List of aligned slobs                 */
+        void** origs;    /**< List of original unaligned slobs      */
+};
+
+static void*
+legacy_alloc(struct legacy_slobs* ptr, size_t slob_sz)
+{
+        size_t sz = (slob_sz < PAGE_SIZE) ? PAGE_SIZE : slob_sz;
+        void* mem = xcalloc(1, sz + CACHE_LINE);
+        void* ret = (void*)(((uintptr_t)mem + CACHE_LINE - 1) &
+                            ~(uintptr_t)(CACHE_LINE - 1));
+
+        if (!ptr->slob_l) {
+                ptr->slob_t += 10;
+                ptr->slob_l += 10;
+                ptr->slobs = xrealloc(ptr->slobs, ptr->slob_t *
+                                      __SIZEOF_POINTER__);
+                ptr->origs = xrealloc(ptr->origs, ptr->slob_t *
+                                      __SIZEOF_POINTER__);
+        }
+
+        ptr->origs[ptr->idx] = mem;
+        ptr->slobs[ptr->idx++] = ret;
+        ptr->slob_l--;
+        return ret;
+}
+
+static void
+legacy_free(struct legacy_slobs* ptr, void* slob)
+{
+        uint64_t i;
+
+        for (i = 0; i < ptr->idx && ptr->slobs[i] != slob; i++);
+        if (i == ptr->idx)
+                return;
+
+        free(ptr->origs[i]);
+        ptr->slob_l++;
+        ptr->idx--;
+        memmove(&ptr->slobs[i], &ptr->slobs[i + 1],
+                (ptr->idx - i) * __SIZEOF_POINTER__);
+        memmove(&ptr->origs[i], &ptr->origs[i + 1],
+                (ptr->idx - i) * __SIZEOF_POINTER__);
+}
+
+static void
+legacy_clear(struct legacy_slobs* ptr)
+{
+        for (uint64_t i = 0; i < ptr->idx; i++)
+                free(ptr->origs[i]);
+        free(ptr->origs);
+        free(ptr->slobs);
+}
+
+/**
+ * Obtain the size of the i-th slob of the slob benchmark.
+ *
+ * Sizes are drawn from those donut allocates the most: small structures,
+ * paths and pages.
+ *
+ * @param i Index of the slob.
+ * @returns Bytes of the slob.
+ */
+static size_t
+bench_slob_sz(uint64_t i)
+{
+        static const size_t sizes[8] = {24, 64, 200, 512, PATH_MAX,
+                                        PAGE_SIZE, PATH_MAX + NAME_MAX + 1,
+                                        2 * PAGE_SIZE};
+        uint64_t z = i * 0x9e3779b97f4a7c15ull;
+
+        return sizes[(z >> 61) & 7];
+}
+
+/**
+ * Measure slobs allocated and freed, with the allocator and its legacy
+ * version.
+ *
+ * Slobs are first allocated and freed in bulk, in a random order, then a
+ * random slob of those alive is replaced over and over.
+ *
+ * @param slobs Slob allocator used for the benchmark's memory.
+ */
+static void
+bench_slob(struct slobs* slobs)
+{
+        const uint64_t n = BENCH_SLOB_LIVE, churn = BENCH_SLOB_CHURN;
+        void** live = alloc_slob(slobs, n * __SIZEOF_POINTER__);
+        uint64_t* order = alloc_slob(slobs, n * sizeof(uint64_t));
+        const char* names[2] = {"legacy", "arena"};
+        struct legacy_slobs old;
+        struct slobs* arena;
+        uint64_t i, j, k, t, t_bulk, t_churn;
+
+        /* Same random order for both */
+        for (i = 0; i < n; i++)
+                order[i] = i;
+        for (i = n - 1; i > 0; i--) {
+                j = (i * 0x9e3779b97f4a7c15ull >> 17) % (i + 1);
+                k = order[i];
+                order[i] = order[j];
+                order[j] = k;
+        }
+
+        printf("slob: %lu live slobs, %lu replaced\n", (unsigned long)n,
+               (unsigned long)churn);
+        for (int run = 0; run < 2; run++) {
+                memset(&old, 0x0, sizeof(old));
+                arena = init_slobs("bench-slob");
+
+                t = now_ns();
+                for (i = 0; i < n; i++)
+                        live[i] = (run) ? alloc_slob(arena, bench_slob_sz(i)) :
+                                  legacy_alloc(&old, bench_slob_sz(i));
+                for (i = 0; i < n; i++) {
+                        if (run)
+                                free_slob(arena, live[order[i]]);
+                        else
+                                legacy_free(&old, live[order[i]]);
+                }
+                t_bulk = now_ns() - t;
+
+                for (i = 0; i < n; i++)
+                        live[i] = (run) ? alloc_slob(arena, bench_slob_sz(i)) :
+                                  legacy_alloc(&old, bench_slob_sz(i));
+                t = now_ns();
+                for (i = 0; i < churn; i++) {
+                        k = order[i % n];
+                        if (run) {
+                                free_slob(arena, live[k]);
+                                live[k] = alloc_slob(arena, bench_slob_sz(i));
+                        } else {
+                                legacy_free(&old, live[k]);
+                                live[k] = legacy_alloc(&old, bench_slob_sz(i));
+                        }
+                }
+                t_churn = now_ns() - t;
+
+                printf("  Alloc/free (%s): %.1f ns/op, replace: %.1f ns/op\n",
+                       names[run], (double)t_bulk / (2 * n),
+                       (double)t_churn / churn);
+                legacy_clear(&old);
+                clear_slobs(arena);
+        }
+}
+
+/**
+ * Measure lookups of a data_list whose tables are on base pages against one
+ * whose tables are on transparent huge pages.
+ *
+ * @param slobs Slob allocator, unused since each run has its own.
+ */
+static void
+bench_huge_pages(struct slobs* slobs)
+{
+        const uint64_t n = BENCH_HUGE_ENTRIES;
+        const unsigned int pages[2] = {SLOB_PAGES_BASE, SLOB_PAGES_THP};
+        struct slobs* arena;
+        struct data_list* list;
+        uint8_t id[OID_SZ];
+        uint64_t i, t, hits;
+
+        printf("huge-pages: %lu entries\n", (unsigned long)n);
+        for (int run = 0; run < 2; run++) {
+                arena = init_huge_slobs("bench-huge", pages[run]);
+                list = init_data_list(arena);
+                for (i = 0; i < n; i++) {
+                        bench_oid(i * 4, id);
+                        add_file_to_list(list, id);
+                }
+
+                hits = 0;
+                t = now_ns();
+                for (i = 0; i < n; i++) {
+                        bench_oid(i * 4 + (i & 1) * 2, id);
+                        hits += is_in_data_list(list, id);
+                }
+                t = now_ns() - t;
+
+                printf("  Lookup (%s): %.1f ns/op, %lu of %lu MiB on huge \
+pages\n", huge_pages_to_str(pages[run]), (double)t / n,
+                       (unsigned long)(slob_huge_mem(arena) >> 20),
+                       (unsigned long)(slob_mem(arena) >> 20));
+                if (hits != n / 2)
+                        printf(DONUT_ERROR "Expected %lu hits but got %lu.\n",
+                               (unsigned long)n / 2, (unsigned long)hits);
+                clear_slobs(arena);
+        }
+}
+
+/**
+ * Thread of the slab benchmark, allocating file objects and freeing them.
+ */
+struct bench_slab_worker {
+        struct slab* s;             /**< Cache, or NULL for malloc      */
+        union donut_objects** objs; /**< Objects allocated              */
+        pthread_t tid;              /**< Thread's ID                    */
+};
+
+/**
+ * Allocate the benchmark's objects, then free them.
+ */
+static void*
+bench_slab_thread(void* arg)
+{
+        struct bench_slab_worker* w = arg;
+        struct slab_mag* m = (w->s) ? get_slab_mag(w->s) : NULL;
+        uint64_t i;
+
+        for (i = 0; i < BENCH_SLAB_OBJS; i++) {
+                w->objs[i] = (m) ? alloc_slab(m) :
+                             calloc(1, sizeof(union donut_objects));
+                w->objs[i]->file.size = i;
+        }
+        for (i = 0; i < BENCH_SLAB_OBJS; i++) {
+                if (m)
+                        free_slab(m, w->objs[i]);
+                else
+                        free(w->objs[i]);
+        }
+
+        return NULL;
+}
+
+/**
+ * Measure file objects allocated and freed by several threads, with the
+ * object cache and with malloc.
+ *
+ * @param slobs Slob allocator used for the benchmark's memory.
+ */
+static void
+bench_slab(struct slobs* slobs)
+{
+        const unsigned int jobs = BENCH_SET_THREADS;
+        const uint64_t n = BENCH_SLAB_OBJS;
+        struct bench_slab_worker* w = alloc_slob(slobs, jobs *
+                                                 sizeof(*w));
+        const char* names[2] = {"malloc", "slab"};
+        struct slab* s;
+        uint64_t t;
+        unsigned int i;
+
+        for (i = 0; i < jobs; i++)
+                w[i].objs = alloc_slob(slobs, n * __SIZEOF_POINTER__);
+
+        printf("slab: %lu objects of %lu bytes, %u threads\n",
+               (unsigned long)n, (unsigned long)sizeof(union donut_objects),
+               jobs);
+        for (int run = 0; run < 2; run++) {
+                s = (run) ? init_slabs("bench-slab") : NULL;
+
+                t = now_ns();
+                for (i = 0; i < jobs; i++) {
+                        w[i].s = s;
+                        pthread_create(&w[i].tid, NULL, bench_slab_thread,
+                                       &w[i]);
+                }
+                for (i = 0; i < jobs; i++)
+                        pthread_join(w[i].tid, NULL);
+                t = now_ns() - t;
+                printf("  Alloc/free (%s): %.1f ns/op\n", names[run],
+                       (double)t / (2 * n * jobs));
+
+                if (s) {
+                        t = now_ns();
+                        clear_slabs(s);
+                        t = now_ns() - t;
+                        printf("  Clear: %.1f ms\n", (double)t / 1000000);
+                }
+        }
+}
+
+/**
+ * Hash a file with reads in flight on an io_uring.
+ *
+ * The reads complete in any order, but chunks are hashed in the file's order.
+ *
+ * @param r Ring used for the reads.
+ * @param fd File descriptor of the file.
+ * @param size Byte size of the file.
+ * @param bufs Array of BENCH_URING_DEPTH buffers of BENCH_URING_CHUNK bytes.
+ * @param hash Buffer for the hash state.
+ * @param out Buffer where the hash is placed.
+ */
+static void
+bench_uring_hash(struct uring* r, int fd, uint64_t size, uint8_t** bufs,
+                 void* hash, uint8_t* out)
+{
+        int32_t lens[BENCH_URING_DEPTH], res;
+        uint64_t next = 0, done = 0, tag;
+        unsigned int i;
+
+        for (i = 0; i < BENCH_URING_DEPTH; i++)
+                lens[i] = -1;
+
+        sha2_init(hash);
+        while (done < size) {
+                /* Keep every buffer not waiting to be hashed busy */
+                while (next < size && next - done <
+                       (uint64_t)BENCH_URING_DEPTH * BENCH_URING_CHUNK) {
+                        i = (next / BENCH_URING_CHUNK) % BENCH_URING_DEPTH;
+                        uring_read(r, fd, bufs[i], BENCH_URING_CHUNK, next, i);
+                        next += BENCH_URING_CHUNK;
+                }
+
+                uring_submit(r, 1);
+                while (uring_reap(r, &tag, &res))
+                        lens[tag] = (res < 0) ? 0 : res;
+
+                i = (done / BENCH_URING_CHUNK) % BENCH_URING_DEPTH;
+                while (done < size && lens[i] >= 0) {
+                        sha2_update(bufs[i], hash, lens[i]);
+                        done += BENCH_URING_CHUNK;
+                        lens[i] = -1;
+                        i = (done / BENCH_URING_CHUNK) % BENCH_URING_DEPTH;
+                }
+        }
+        sha2_final(out, hash);
+}
+
+/**
+ * Measure hashing files by reading them, mapping them or reading them through
+ * an io_uring, with their content in the page cache and evicted from it.
+ *
+ * Files of several sizes are written to the home directory. Each run hashes
+ * BENCH_READ_TOTAL bytes, so a small file is hashed many times.
+ *
+ * @param slobs Slob allocator used for the buffers.
+ */
+static void
+bench_file_read(struct slobs* slobs)
+{
+        static const char* names[3] = {"read", "mmap", "io_uring"};
+        const uint64_t sizes[3] = {128 * 1024, SHA2_MMAP_MIN,
+                                   BENCH_READ_TOTAL};
+        uint8_t* bufs[BENCH_URING_DEPTH];
+        uint8_t ref[SHA2_DIGEST_SZ], out[SHA2_DIGEST_SZ];
+        uint64_t i, t, n, reps;
+        unsigned int s, how, cold;
+        int fd, mismatch = 0;
+        void* hash = alloc_slob(slobs, SHA_STRUCT_SZ);
+        uint8_t* buf = alloc_slob(slobs, READ_BUF_SZ);
+        char* path = alloc_slob(slobs, PAGE_SIZE);
+        struct uring* r = uring_init(slobs, BENCH_URING_DEPTH);
+
+        for (i = 0; i < BENCH_URING_DEPTH; i++)
+                bufs[i] = alloc_slob(slobs, BENCH_URING_CHUNK);
+        snprintf(path, PAGE_SIZE, "%s/donut_bench_file", getenv("HOME"));
+
+        for (s = 0; s < 3; s++) {
+                fd = xopen(path, O_RDWR | O_CREAT | O_TRUNC, 0640);
+                for (n = 0; n < sizes[s]; n += OID_SZ) {
+                        bench_oid(n, buf + n % READ_BUF_SZ);
+                        if ((n + OID_SZ) % READ_BUF_SZ == 0 ||
+                            n + OID_SZ >= sizes[s])
+                                xwrite(fd, buf, n % READ_BUF_SZ + OID_SZ);
+                }
+                fdatasync(fd);
+                sha2_file(fd, sizes[s], SHA2_READ_BUF, hash, buf, ref);
+
+                reps = BENCH_READ_TOTAL / sizes[s];
+                printf("file-read: %lu KiB file, %lu MiB hashed\n",
+                       (unsigned long)(sizes[s] >> 10),
+                       (unsigned long)(BENCH_READ_TOTAL >> 20));
+
+                for (how = 0; how < 3; how++) {
+                        if (how == 2 && !r) {
+                                printf("  %s: unavailable\n", names[how]);
+                                continue;
+                        }
+
+                        for (cold = 0; cold < 2; cold++) {
+                                for (i = 0, t = 0; i < reps; i++) {
+                                        /* Evicting the file isn't measured */
+                                        if (cold)
+                                                posix_fadvise(fd, 0, 0,
+                                                        POSIX_FADV_DONTNEED);
+                                        n = now_ns();
+                                        if (how == 2)
+                                                bench_uring_hash(r, fd, sizes[s],
+                                                                 bufs, hash, out);
+                                        else
+                                                sha2_file(fd, sizes[s],
+                                                          how ? SHA2_READ_MMAP :
+                                                          SHA2_READ_BUF, hash,
+                                                          buf, out);
+                                        t += now_ns() - n;
+                                        mismatch |= memcmp(out, ref,
+                                                           SHA2_DIGEST_SZ);
+                                }
+                                printf("  %s (%s): %.1f MiB/s\n", names[how],
+                                       cold ? "cold" : "warm",
+                                       (double)BENCH_READ_TOTAL / (1 << 20) /
+                                       ((double)t / 1000000000));
+                        }
+                }
+                xclose(fd);
+        }
+
+        if (r)
+                uring_exit(r);
+        remove(path);
+
+        if (mismatch)
+                printf(DONUT_ERROR "The strategies produced different hashes.\n");
+}
+
+/**
+ * Remove a directory of the chkin benchmark along with its content.
+ *
+ * @param path String containing the path to the directory.
+ */
+static void
+bench_remove(const char* path)
+{
+        struct dirent* e;
+        struct stat st;
+        char* sub;
+        DIR* dir = opendir(path);
+
+        if (!dir)
+                return;
+
+        sub = xmalloc(PATH_MAX);
+        while ((e = readdir(dir))) {
+                if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+                        continue;
+
+                snprintf(sub, PATH_MAX, "%s/%s", path, e->d_name);
+                if (!lstat(sub, &st) && S_ISDIR(st.st_mode)) {
+                        chmod(sub, S_IRWXU);
+                        bench_remove(sub);
+                } else {
+                        remove(sub);
+                }
+        }
+
+        closedir(dir);
+        rmdir(path);
+        free(sub);
+}
+
+/**
+ * Measure the cost of checking in a file whose content takes no time to read
+ * or hash, so the time is spent by chkin's handling of every file. Besides
+ * the elapsed time, the CPU time spent by donut itself is reported, since the
+ * system calls made for every file take most of it.
+ *
+ * A repository is created in the home directory and BENCH_CHKIN_FILES files
+ * are checked in from a single folder. Tiny files all have new content and are
+ * moved into the repository, while empty files all have the same content and
+ * are left in place once the first one is stored.
+ *
+ * @param slobs Slob allocator used for the paths.
+ */
+static void
+bench_chkin(struct slobs* slobs)
+{
+        static const char* names[2] = {"tiny", "empty"};
+        const uint64_t n = BENCH_CHKIN_FILES;
+        char* cwd = xgetcwd(alloc_slob(slobs, PAGE_SIZE), PAGE_SIZE);
+        char* root = alloc_slob(slobs, PAGE_SIZE);
+        char* path = alloc_slob(slobs, PAGE_SIZE);
+        char* opts = alloc_slob(slobs, PAGE_SIZE);
+        char* argv[4] = {"donut", NULL, NULL, NULL};
+        struct rusage before, after;
+        uint64_t i, t, user;
+        int fd, ret;
+
+        snprintf(root, PAGE_SIZE, "%s/donut_bench_chkin", getenv("HOME"));
+        printf("chkin: %lu files\n", (unsigned long)n);
+        for (int run = 0; run < 2; run++) {
+                bench_remove(root);
+                mkdir(root, S_IRWXU);
+                argv[1] = "init";
+                argv[2] = root;
+                memset(opts, 0x0, PAGE_SIZE);
+                if (donut_init(3, argv, 2, opts, 0)) {
+                        printf(DONUT_ERROR "Failed to create the repository.\n");
+                        break;
+                }
+
+                mkdir("files", S_IRWXU);
+                for (i = 0; i < n; i++) {
+                        snprintf(path, PAGE_SIZE, "files/f%lu",
+                                 (unsigned long)i);
+                        fd = xopen(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+                        if (!run)
+                                xwrite(fd, &i, sizeof(i));
+                        xclose(fd);
+                }
+                sync();
+
+                argv[1] = "chkin";
+                argv[2] = "files";
+                getrusage(RUSAGE_SELF, &before);
+                t = now_ns();
+                ret = chkin(3, argv, 2, opts, 0);
+                t = now_ns() - t;
+                getrusage(RUSAGE_SELF, &after);
+                user = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) *
+                       1000000000ull + (after.ru_utime.tv_usec -
+                                        before.ru_utime.tv_usec) * 1000ull;
+
+                printf("  Check in (%s): %.1f ns/file, %.1f ns/file in user \
+space\n", names[run], (double)t / n, (double)user / n);
+                if (ret)
+                        printf(DONUT_ERROR "The check in failed.\n");
+                if (chdir(cwd))
+                        break;
+        }
+
+        bench_remove(root);
+}
+
+/**
+ * All benchmarks by the order they are run.
+ */
+static const struct bench benches[] = {
+        {"data-list", bench_data_list},
+        {"obj-index", bench_obj_index},
+        {"oid-set", bench_oid_set},
+        {"slob", bench_slob},
+        {"slab", bench_slab},
+        {"huge-pages", bench_huge_pages},
+        {"file-read", bench_file_read},
+        {"chkin", bench_chkin}
+};
+
+/**
+ * Runs the benchmark given in the arguments or all of them.
+ *
+ * @param argc Number of arguments passed
+ * @param args Array of arguments
+ * @returns In case of success returns 0 otherwise -1
+ */
+int
+bench(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags)
+{
+        const char* name = (arg_idx < argc) ? argv[arg_idx] : NULL;
+        struct slobs* slobs;
+        int ran = 0;
+
+        for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+                if (name && strcmp(name, benches[i].name))
+                        continue;
+
+                slobs = init_slobs("bench");
+                benches[i].fn(slobs);
+                clear_slobs(slobs);
+                ran++;
+        }
+
+        if (!ran) {
+                printf(DONUT_ERROR "Unknown benchmark: %s\n", name);
+                return DEF_ERR;
+        }
+
+        return 0;
+}
@@ -0,0 +1,174 @@
+#include "cli/cmd.h"
+#include "core/wrappers.h"
+#include "core/obj-file.h"
+#include "core/cdc.h"
+#include "core/pack.h"
+#include "core/shard.h"
+#include "core/config.h"
+#include "crypto/sha2.h"
+#include "mem/slob.h"
+#include "const/err.h"
+#include "const/const.h"
+#include "misc/decorations.h"
+#include "tools/validation.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "fcntl.h"
+
+/**
+ * @file cat-data.c
+ *
+ * Implements all functions and utilities used by the "cat-data" command.
+ */
+
+/**
+ * Buffers used to restore objects.
+ */
+struct cat_bufs {
+        char* path;          /**< Path to the object          */
+        size_t len;          /**< Length of the data folder   */
+        uint8_t* in;         /**< Read buffer of READ_BUF_SZ  */
+        uint8_t* out;        /**< Write buffer of READ_BUF_SZ */
+        struct packs* packs; /**< Packs of the data folder    */
+        unsigned int depth;  /**< Shards above the objects    */
+};
+
+/**
+ * Check whether a chunk list is well formed.
+ *
+ * @param list Content of the list
+ * @param size Byte size of the list
+ * @returns Returns 1 if the list is well formed or 0.
+ */
+static int
+valid_list(const uint8_t* list, uint64_t size)
+{
+        const struct cdc_list_hdr* hdr = (const struct cdc_list_hdr*)list;
+
+        if (size < sizeof(struct cdc_list_hdr))
+                return 0;
+
+        size -= sizeof(struct cdc_list_hdr);
+        return !memcmp(hdr->magic, CDC_LIST_MAGIC, sizeof(hdr->magic)) &&
+               hdr->version == CDC_LIST_VERSION &&
+               size % sizeof(struct cdc_entry) == 0 &&
+               size / sizeof(struct cdc_entry) == hdr->count;
+}
+
+/**
+ * Write an object's content to the standard output.
+ *
+ * Loose objects are looked for before packed ones. Compressed objects are
+ * decompressed and chunked files are put back together from their chunks.
+ *
+ * @param id Object ID
+ * @param b Buffers used to restore the object
+ * @returns Returns 0 on success or -1 if the object is missing or corrupt.
+ */
+static int
+cat_object(const uint8_t* id, struct cat_bufs* b)
+{
+        struct obj_file_hdr hdr;
+        struct cdc_list_hdr* list;
+        struct cdc_entry* chunks;
+        const struct pack_entry* e = NULL;
+        uint64_t end = UINT64_MAX;
+        size_t bytes;
+        off_t base = 0, off;
+        int fd, ret = 0;
+
+        shard_name(b->depth, id, b->path + b->len);
+        fd = open(b->path, O_RDONLY);
+        if (fd < 0) {
+                e = find_packed(b->packs, id, &fd);
+                if (!e) {
+                        printf(DONUT_ERROR "Object not found: %s\n",
+                               b->path + b->len);
+                        return DEF_ERR;
+                }
+                base = e->off;
+                end = e->off + e->len;
+        }
+
+        if (!obj_file_read_hdr(fd, base, id, &hdr)) {
+                for (off = base; (uint64_t)off < end; off += bytes) {
+                        bytes = (end - off < READ_BUF_SZ) ? end - off :
+                                READ_BUF_SZ;
+                        bytes = xpread(fd, b->in, bytes, off);
+                        if (!bytes)
+                                break;
+                        xwrite(STDOUT_FILENO, b->in, bytes);
+                }
+        } else if (hdr.type != OBJ_TYPE_LIST) {
+                if (obj_file_unpack(fd, base, &hdr, STDOUT_FILENO, b->out,
+                                    b->in))
+                        goto corrupt;
+        } else {
+                list = xmalloc(hdr.size);
+                if (obj_file_unpack(fd, base, &hdr, -1, (uint8_t*)list, b->in) ||
+                    !valid_list((uint8_t*)list, hdr.size)) {
+                        free(list);
+                        goto corrupt;
+                }
+
+                chunks = (struct cdc_entry*)(list + 1);
+                for (uint64_t i = 0; !ret && i < list->count; i++)
+                        ret = cat_object(chunks[i].id, b);
+                free(list);
+        }
+
+        if (!e)
+                xclose(fd);
+        return ret;
+
+corrupt:
+        if (!e)
+                xclose(fd);
+        printf(DONUT_ERROR "Object is corrupt: %s\n", b->path + b->len);
+        return DEF_ERR;
+}
+
+int
+cat_data(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags)
+{
+        int ret;
+        uint8_t id[OID_SZ];
+        struct cat_bufs b;
+        struct repo_config conf;
+        struct slobs* slobs;
+        char* df_name = opts + (NAME_ARG_IDX * MAX_ARG_SZ);
+
+        if (validate_donut_repo() || !argv[arg_idx]) {
+                printf(DONUT_ERROR "Donut isn't initialized or no object was\
+ given. Try running \"donut init\" or check your arguments.\n");
+                return DEF_ERR;
+        }
+
+        if (sha2_from_str(argv[arg_idx], id)) {
+                printf(DONUT_ERROR "Object ID is invalid: %s\n", argv[arg_idx]);
+                return DEF_ERR;
+        }
+
+        read_repo_config(CONFIG_FILE_RELATIVE, &conf);
+        slobs = init_slobs("cat-data");
+        b.path = alloc_slob(slobs, PAGE_SIZE);
+        b.path = xgetcwd(b.path, PAGE_SIZE);
+        strncat(b.path, DATA_FOLDER, 14);
+        if (*df_name && strncmp(DEFAULT_DF, df_name, 4)) {
+                strncat(b.path, df_name, strnlen(df_name, MAX_ARG_SZ));
+                strncat(b.path, "/", 2);
+        }
+        b.len = strnlen(b.path, PAGE_SIZE);
+        b.in = alloc_slob(slobs, READ_BUF_SZ);
+        b.out = alloc_slob(slobs, READ_BUF_SZ);
+        b.path[b.len] = '\0';
+        b.packs = open_packs(slobs, b.path);
+        b.depth = conf.shard_depth;
+
+        ret = cat_object(id, &b);
+        close_packs(b.packs);
+        clear_slobs(slobs);
+        return ret;
+}
@@ -3,112 +3,1322 @@
 #include "const/const.h"
 #include "misc/decorations.h"
 #include "mem/slob.h"
+#include "mem/mem_stats.h"
 #include "crypto/sha2.h"
+#include "crypto/sha2-mb.h"
+#include "crypto/sha2-tree.h"
+#include "crypto/sha2-file.h"
+#include "core/config.h"
 #include "sys/stat.h"
 #include "sys/types.h"
 #include "unistd.h"
 #include "dirent.h"
 #include "const/err.h"
 #include "core/wrappers.h"
-#include "core/data-list.h"
+#include "core/obj-index.h"
+#include "core/object.h"
+#include "core/stat-cache.h"
+#include "core/walk.h"
+#include "core/uring.h"
+#include "core/ingest.h"
+#include "core/cdc.h"
+#include "core/obj-file.h"
+#include "core/shard.h"
+#include "compress/lz.h"
 #include "tools/validation.h"
+#include "tools/stats.h"
+#include "stdlib.h"
 #include "string.h"
+#include "limits.h"
+#include "pthread.h"
+#include "errno.h"
 
 #define CTOR_MODE S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH
 
+/**
+ * @def MB_FILE_SZ
+ * Files smaller than this size are hashed by the multi-buffer engine.
+ */
+#define MB_FILE_SZ (64 * 1024)
+
 /*
  * TODO: Add more conditions to "validate_init" in the future.
- * TODO: Implement a multithread option in case of large amount of files
  */
 
-inline static void
-compute_file_sha2(int fd, void* hash, void* buf, uint8_t* str)
+/**
+ * Compute a file's object ID with the repository's ID scheme.
+ *
+ * @param fd File descriptor of the file
+ * @param size Byte size of the file
+ * @param conf Repository's configuration
+ * @param hash Buffer for the hash state
+ * @param buf Read buffer of READ_BUF_SZ bytes
+ * @param str Buffer where the object ID is placed
+ * @param threads Number of threads hashing the leaves of a tree
+ */
+static void
+compute_file_id(int fd, uint64_t size, const struct repo_config* conf,
+                void* hash, void* buf, uint8_t* str, unsigned int threads)
 {
-        off_t bytes;
+        uint64_t t = stats_begin();
 
-        sha2_init(hash);
-        do {
-                bytes = xread(fd, buf, PAGE_SIZE);
-                sha2_update(buf, str, hash, bytes);
-                memset(buf, 0x0, bytes);
-        } while (bytes);
+        if (conf->id_scheme != ID_SCHEME_TREE)
+                sha2_file(fd, size, SHA2_READ_AUTO, hash, buf, str);
+        else
+                sha2_tree_file(fd, size, conf->leaf_sz, str, threads);
+
+        stats_add(STAT_BYTES_HASHED, size);
+        stats_end(PHASE_HASH, t, size, 1);
 }
 
+/**
+ * State shared by the files checked in by a single command.
+ *
+ * The stat cache is only modified while the lock is held, the index is shared
+ * by the threads as is.
+ */
+struct chkin_ctx {
+        struct obj_index* idx;          /**< Index of the repository's objects */
+        struct stat_cache* cache;       /**< IDs of files left in place        */
+        const struct repo_config* conf; /**< Repository's configuration        */
+        pthread_mutex_t lock;           /**< Lock of the stat cache            */
+        char* cwd;                      /**< Path to the data directory        */
+        size_t cwd_len;                 /**< Length of the data directory      */
+        size_t mb_max;                  /**< Files smaller are multi-buffered  */
+        size_t off;                     /**< Bytes before a file's content     */
+        unsigned int tree_threads;      /**< Threads hashing a tree's leaves   */
+        unsigned int depth;             /**< Files read at once by a thread    */
+        int keep;                       /**< Set if files are left in place    */
+        dev_t dev;                      /**< Device of the data directory      */
+        char* tmp;                      /**< Path to the temporary objects     */
+        int method;                     /**< First ingest method to be tried   */
+        struct cdc* cdc;                /**< Chunking parameters               */
+        uint64_t chunk_min;             /**< Files this large are chunked      */
+        struct shards* shards;          /**< Shards of the data directory      */
+        int err;                        /**< Set once a file failed            */
+};
+
+/**
+ * Small file being read, or read whole and waiting on the multi-buffer engine.
+ */
+struct mb_file {
+        struct sha2_job job;   /**< Hashing job of the file     */
+        uint8_t* buf;          /**< File's content              */
+        struct stat st;        /**< File's status when listed   */
+        char* path;            /**< Path to the file            */
+        size_t len;            /**< Length of the path          */
+        int fd;                /**< Descriptor while being read */
+};
+
+/**
+ * File to be moved into the data directory.
+ */
+struct chkin_move {
+        char* src; /**< Path to the file            */
+        char* dst; /**< Path to the object          */
+};
+
+/**
+ * File whose content is new to the index, settled once every file is hashed.
+ */
+struct chkin_claim {
+        uint8_t id[OID_SZ]; /**< Object ID of the file               */
+        struct stat st;     /**< Status of the file when hashed      */
+        int hashed;         /**< Unset if the ID came from the cache */
+        char path[];        /**< Absolute path to the file           */
+};
+
+/**
+ * State owned by a single thread checking files in.
+ *
+ * Everything a file needs is allocated when the thread is set up, besides
+ * chunk lists longer than any before and the claims of new files, so files
+ * are checked in without clearing buffers.
+ */
+struct chkin_worker {
+        struct chkin_ctx* ctx;       /**< Shared state                      */
+        void* hash;                  /**< Hash state                        */
+        void* buf;                   /**< Read buffer of READ_BUF_SZ bytes  */
+        uint8_t id[OID_SZ];          /**< Object ID of the file             */
+        struct sha2_mb* mb;          /**< Multi-buffer engine               */
+        struct mb_file** free_files; /**< Slots not being read or hashed    */
+        unsigned int n_free;         /**< Number of free slots              */
+        unsigned int n_files;        /**< Number of slots                   */
+        struct uring* ring;          /**< Ring of the reads or NULL         */
+        struct chkin_move* moves;    /**< Files waiting to be moved         */
+        unsigned int n_moves;        /**< Number of files to be moved       */
+        unsigned int n_renaming;     /**< Number of renames in flight       */
+        unsigned int idx;            /**< Index of the thread               */
+        unsigned long n_tmp;         /**< Temporary objects created         */
+        unsigned long n_left;        /**< Files left out over the budget    */
+        char* tmp;                   /**< Path to the temporary object      */
+        size_t tmp_len;              /**< Length of the path without number */
+        char* obj;                   /**< Path to the object                */
+        uint8_t* zbuf;               /**< Compressed content or NULL        */
+        uint32_t* lz;                /**< Hash table of the LZ codec        */
+        uint8_t* list;               /**< Chunk list after its header       */
+        size_t list_cap;             /**< Chunks which fit in "list"        */
+        struct chkin_claim** claims; /**< Files new to the index            */
+        uint64_t n_claims;           /**< Number of claims                  */
+        uint64_t claims_cap;         /**< Capacity of "claims"              */
+        struct slobs* slobs;         /**< Slob Allocator of the claims      */
+};
+
+/**
+ * Claims settled by a single thread, which no other thread has IDs of.
+ */
+struct chkin_settle {
+        struct chkin_worker* w;      /**< Thread settling the claims    */
+        struct chkin_claim** claims; /**< Claims sorted by ID then path */
+        uint64_t n;                  /**< Number of claims              */
+        pthread_t tid;               /**< Thread's ID                   */
+        int started;                 /**< Set if the thread was created */
+};
+
+/**
+ * @def URING_DEPTH
+ * Maximum number of small files opened or read at once by a thread.
+ */
+#define URING_DEPTH 32
+
+/**
+ * @def SUBMIT_BATCH
+ * Number of operations queued on a thread's ring before they're submitted.
+ */
+#define SUBMIT_BATCH 8
+
+/**
+ * @def MOVE_BATCH
+ * Number of files gathered by a thread before they're moved together.
+ */
+#define MOVE_BATCH 32
+
+/**
+ * @def MIN_CLAIMS
+ * Number of claims a thread has room for at first.
+ */
+#define MIN_CLAIMS (PAGE_SIZE / __SIZEOF_POINTER__)
+
+/**
+ * @def TAG_CLOSE
+ * Tag of the ring's close operations, whose result is ignored.
+ */
+#define TAG_CLOSE 0
+
+/**
+ * @def TAG_MOVE
+ * Tag of the ring's rename of the i-th move. Slots are aligned, so tags of
+ * their operations are even.
+ */
+#define TAG_MOVE(i) (((uint64_t)(i) << 1) | 1)
+
+/**
+ * Claim an object for the repository.
+ *
+ * @param ctx Check in state
+ * @param id Object ID
+ * @returns Returns 1 if the object must be stored by the caller or 0.
+ */
 static int
-chkin_dir(const char* src, struct data_list* list, struct slobs* slobs,
-          char* cwd, void* hash, void* buf, uint8_t* str)
+claim_object(struct chkin_ctx* ctx, const uint8_t* id)
 {
-        DIR* dir;
-        int src_fd;
-        char* f_name;
-        size_t name_len;
-        struct dirent* entry;
+        int present;
+        uint64_t t = stats_begin();
 
-        /* Get Variables for Path Treatments */
-        size_t src_len = strlen(src);
-        size_t cwd_len = strnlen(cwd, PAGE_SIZE);
-        char* src_cp = alloc_slob(slobs, PAGE_SIZE);
+        /* Of the threads finding the same new content, one stores it */
+        present = !obj_index_claim(ctx->idx, id);
 
-        /* Directory Path Treatment */
-        strncpy(src_cp, src, src_len);
-        if (src[src_len - 1] != '/')
-                src_cp[src_len++] = '/';
+        stats_add(STAT_LOOKUPS, 1);
+        stats_add(STAT_HITS, present);
+        stats_end(PHASE_LOOKUP, t, 0, 0);
+
+        return !present;
+}
 
-        dir = xopendir(src_cp);
-        while ((entry = readdir(dir))) {
+/**
+ * Check whether an object is in the repository.
+ *
+ * @param ctx Check in state
+ * @param id Object ID
+ * @returns Returns 1 if the object is present or 0.
+ */
+static int
+has_object(struct chkin_ctx* ctx, const uint8_t* id)
+{
+        int present;
+        uint64_t t = stats_begin();
+
+        present = obj_index_has(ctx->idx, id);
+
+        stats_add(STAT_LOOKUPS, 1);
+        stats_add(STAT_HITS, present);
+        stats_end(PHASE_LOOKUP, t, 0, 0);
+
+        return present;
+}
+
+/**
+ * Leave a file in place, caching its ID to avoid hashing it again on the next
+ * check in.
+ *
+ * @param ctx Check in state
+ * @param path Absolute path to the file
+ * @param id Object ID of the file
+ * @param st Status of the file when it was hashed or NULL if it wasn't
+ */
+static void
+leave_file(struct chkin_ctx* ctx, const char* path, const uint8_t* id,
+           const struct stat* st)
+{
+        if (!st)
+                return;
+
+        pthread_mutex_lock(&ctx->lock);
+        stat_cache_put(ctx->cache, path, st, id);
+        pthread_mutex_unlock(&ctx->lock);
+}
+
+/**
+ * Leave a checked in file to be settled once every file is hashed.
+ *
+ * Of the files whose content is new to the index, the one with the smallest
+ * path is stored and the others are left in place, so which duplicate is
+ * stored doesn't depend on the threads' timing. Files which are kept, or
+ * whose content was present before the command, are left in place at once.
+ *
+ * @param w Thread which checked the file in
+ * @param path Absolute path to the file
+ * @param len Length of the path
+ * @param id Object ID of the file
+ * @param st Status of the file when it was hashed or NULL if it wasn't
+ */
+static void
+defer_file(struct chkin_worker* w, const char* path, size_t len,
+           const uint8_t* id, const struct stat* st)
+{
+        struct chkin_ctx* ctx = w->ctx;
+        struct chkin_claim** tmp;
+        struct chkin_claim* c;
+
+        if (ctx->keep ||
+            (has_object(ctx, id) && !obj_index_added(ctx->idx, id))) {
+                leave_file(ctx, path, id, st);
+                return;
+        }
+
+        if (w->n_claims == w->claims_cap) {
+                w->claims_cap = (w->claims_cap) ? w->claims_cap << 1 :
+                                MIN_CLAIMS;
+                tmp = alloc_slob(w->slobs, w->claims_cap * __SIZEOF_POINTER__);
+                if (w->claims) {
+                        memcpy(tmp, w->claims,
+                               w->n_claims * __SIZEOF_POINTER__);
+                        free_slob(w->slobs, w->claims);
+                }
+                w->claims = tmp;
+        }
+
+        c = alloc_slob(w->slobs, sizeof(struct chkin_claim) + len + 1);
+        memcpy(c->id, id, OID_SZ);
+        c->hashed = (st) ? 1 : 0;
+        if (st)
+                c->st = *st;
+        memcpy(c->path, path, len + 1);
+        w->claims[w->n_claims++] = c;
+}
+
+/**
+ * Check whether a file is split into chunks.
+ *
+ * @param ctx Check in state
+ * @param st Status of the file
+ * @returns Returns 1 if the file is chunked or 0.
+ */
+static int
+is_chunked(const struct chkin_ctx* ctx, const struct stat* st)
+{
+        return ctx->chunk_min && (uint64_t)st->st_size >= ctx->chunk_min;
+}
+
+/**
+ * Check whether a file's content is copied into the repository, rather than
+ * the file being moved into it.
+ *
+ * @param ctx Check in state
+ * @param st Status of the file
+ * @returns Returns 1 if the file's content is copied or 0.
+ */
+static int
+is_copied(const struct chkin_ctx* ctx, const struct stat* st)
+{
+        return ctx->keep || st->st_dev != ctx->dev || is_chunked(ctx, st) ||
+               ctx->conf->compress != COMPRESS_NEVER;
+}
+
+/**
+ * Write the path an object is stored at, creating its shard if it's missing.
+ *
+ * @param ctx Shared state
+ * @param id Object ID
+ * @param dst Buffer of PAGE_SIZE bytes where the path is placed
+ */
+static void
+object_path(struct chkin_ctx* ctx, const uint8_t* id, char* dst)
+{
+        memcpy(dst, ctx->cwd, ctx->cwd_len);
+        shard_name(ctx->shards->depth, id, dst + ctx->cwd_len);
+        make_shard(ctx->shards, id);
+}
+
+/**
+ * Create a thread's next temporary object.
+ *
+ * Only the object's number is written, after the prefix of the thread's
+ * temporary objects.
+ *
+ * @param w Thread writing the object
+ * @returns Descriptor of the object, whose path is in the thread's structure.
+ */
+static int
+open_tmp_object(struct chkin_worker* w)
+{
+        snprintf(w->tmp + w->tmp_len, PAGE_SIZE - w->tmp_len, "%lu",
+                 w->n_tmp++);
+        return xopen(w->tmp, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+}
+
+/**
+ * Link a thread's temporary object into the data directory and remove it.
+ *
+ * Linking fails rather than replacing an object written meanwhile.
+ *
+ * @param w Thread which wrote the object
+ * @param id Object ID
+ */
+static void
+link_tmp_object(struct chkin_worker* w, const uint8_t* id)
+{
+        struct chkin_ctx* ctx = w->ctx;
+        uint64_t t = stats_begin();
+
+        object_path(ctx, id, w->obj);
+        if (link(w->tmp, w->obj) && errno != EEXIST) {
+                printf(DONUT_ERROR "Failed to link object: %s\n", w->obj);
+                exit(DEF_ERR);
+        }
+        remove(w->tmp);
+        stats_end(PHASE_STORE, t, 0, 1);
+}
+
+/**
+ * Write a buffer as a new object.
+ *
+ * The object is compressed when the repository's policy keeps it so. Chunk
+ * lists are always placed in a container, which tells them apart from data.
+ *
+ * @param w Thread writing the object
+ * @param buf Buffer with the object's content
+ * @param len Number of bytes in the buffer
+ * @param id Object ID
+ * @param type Type of the object's content
+ */
+static void
+write_object(struct chkin_worker* w, const void* buf, size_t len,
+             const uint8_t* id, uint8_t type)
+{
+        struct obj_file_hdr hdr;
+        size_t n = 0;
+        int fd = open_tmp_object(w);
+
+        if (w->zbuf && len <= READ_BUF_SZ) {
+                n = obj_file_pack(buf, len, w->zbuf, w->lz);
+                if (!obj_file_worth(w->ctx->conf, len, sizeof(hdr) + n))
+                        n = 0;
+        }
 
-                if (entry->d_type != DT_REG)
+        if (n || type != OBJ_TYPE_DATA) {
+                obj_file_init_hdr(&hdr, (n) ? OBJ_CODEC_LZ : OBJ_CODEC_NONE,
+                                  type, len, id);
+                xwrite(fd, &hdr, sizeof(hdr));
+        }
+        if (n)
+                xwrite(fd, w->zbuf, n);
+        else
+                xwrite(fd, (void*)buf, len);
+        fchmod(fd, S_IRUSR | S_IRGRP | S_IROTH);
+        xclose(fd);
+        link_tmp_object(w, id);
+}
+
+/**
+ * Split a file into content-defined chunks and store the new ones, along with
+ * the file's chunk list.
+ *
+ * The file is read once, a buffer at a time, and every chunk is hashed. Only
+ * chunks which aren't in the repository are written, so a file which mostly
+ * matches one checked in before only costs the space of its changes. The
+ * file itself is settled once every file is hashed.
+ *
+ * The list is built in the thread's buffer, after room for its header. The
+ * buffer only grows when a file has more chunks than any before it.
+ *
+ * @param w Thread checking the file in
+ * @param src_fd Descriptor of the file
+ * @param path Absolute path to the file
+ * @param st Status of the file
+ */
+static void
+chunk_file(struct chkin_worker* w, int src_fd, const char* path,
+           const struct stat* st)
+{
+        struct chkin_ctx* ctx = w->ctx;
+        struct cdc_list_hdr hdr = {CDC_LIST_MAGIC, CDC_LIST_VERSION, 0, 0};
+        struct cdc_entry* list = (struct cdc_entry*)(w->list + sizeof(hdr));
+        uint8_t* buf = w->buf;
+        size_t have = 0, pos = 0, bytes, len;
+        off_t off = 0;
+        int eof = 0;
+        uint64_t t = stats_begin();
+
+        for (;;) {
+                /* Keep a maximum chunk in the buffer until the file ends */
+                if (!eof && have - pos < ctx->cdc->max) {
+                        memmove(buf, buf + pos, have - pos);
+                        have -= pos;
+                        pos = 0;
+                        bytes = xpread(src_fd, buf + have, READ_BUF_SZ - have,
+                                       off);
+                        eof = (bytes < READ_BUF_SZ - have) ? 1 : 0;
+                        have += bytes;
+                        off += bytes;
+                }
+
+                if (pos == have)
+                        break;
+
+                if (hdr.count == w->list_cap) {
+                        w->list_cap = (w->list_cap) ? w->list_cap * 2 :
+                                      st->st_size / ctx->cdc->avg + 1;
+                        w->list = xrealloc(w->list, sizeof(hdr) + w->list_cap *
+                                           sizeof(struct cdc_entry));
+                        list = (struct cdc_entry*)(w->list + sizeof(hdr));
+                }
+
+                len = cdc_cut(ctx->cdc, buf + pos, have - pos);
+                sha2_hash(buf + pos, list[hdr.count].id, w->hash, len);
+                list[hdr.count].len = len;
+                if (claim_object(ctx, list[hdr.count].id))
+                        write_object(w, buf + pos, len, list[hdr.count].id,
+                                     OBJ_TYPE_DATA);
+
+                hdr.count++;
+                hdr.size += len;
+                pos += len;
+        }
+
+        /* The file's ID is the hash of its list */
+        memcpy(w->list, &hdr, sizeof(hdr));
+        bytes = sizeof(hdr) + hdr.count * sizeof(struct cdc_entry);
+        sha2_hash(w->list, w->id, w->hash, bytes);
+
+        if (claim_object(ctx, w->id))
+                write_object(w, w->list, bytes, w->id, OBJ_TYPE_LIST);
+        defer_file(w, path, strlen(path), w->id, st);
+
+        stats_add(STAT_BYTES_HASHED, hdr.size);
+        stats_end(PHASE_CHUNK, t, hdr.size, 1);
+}
+
+/**
+ * Copy a file into a new object, for files which are kept or can't be moved
+ * into the data directory because they're on another filesystem.
+ *
+ * The content is cloned or copied into a temporary object, which is hashed,
+ * or otherwise read once and hashed while it's written. The file itself is
+ * settled once every file is hashed.
+ *
+ * @param w Thread checking the file in
+ * @param src_fd Descriptor of the file
+ * @param path Absolute path to the file
+ * @param st Status of the file
+ */
+static void
+ingest_file(struct chkin_worker* w, int src_fd, const char* path,
+            const struct stat* st)
+{
+        struct chkin_ctx* ctx = w->ctx;
+        struct stat tmp;
+        int tmp_fd, method, first;
+        uint64_t t = stats_begin();
+
+        tmp_fd = open_tmp_object(w);
+
+        /* Methods the filesystems don't support aren't tried again */
+        first = method = __atomic_load_n(&ctx->method, __ATOMIC_RELAXED);
+        if (method == INGEST_CLONE && ingest_clone(src_fd, tmp_fd))
+                method = INGEST_COPY;
+        if (method == INGEST_COPY && ingest_copy(src_fd, tmp_fd, st->st_size))
+                method = INGEST_STREAM;
+        if (method != first)
+                __atomic_store_n(&ctx->method, method, __ATOMIC_RELAXED);
+
+        /* Objects are hashed from their own content */
+        if (method == INGEST_STREAM) {
+                ingest_stream(src_fd, tmp_fd, ctx->conf, w->hash, w->buf, w->id);
+                stats_add(STAT_BYTES_HASHED, st->st_size);
+        } else {
+                fstat(tmp_fd, &tmp);
+                compute_file_id(tmp_fd, tmp.st_size, ctx->conf, w->hash,
+                                w->buf, w->id, ctx->tree_threads);
+        }
+        fchmod(tmp_fd, S_IRUSR | S_IRGRP | S_IROTH);
+        xclose(tmp_fd);
+
+        if (claim_object(ctx, w->id))
+                link_tmp_object(w, w->id);
+        else
+                remove(w->tmp);
+        defer_file(w, path, strlen(path), w->id, st);
+        stats_end(PHASE_COPY, t, st->st_size, 1);
+}
+
+/**
+ * Store a file compressed, when the repository's policy keeps it so.
+ *
+ * The file is read once, a buffer at a time, and each buffer is hashed and
+ * compressed into a temporary object. The file is given up on as soon as the
+ * content read so far doesn't save what the policy asks for, so data which
+ * doesn't compress is mostly read once more to be stored raw. The file
+ * itself is settled once every file is hashed.
+ *
+ * @param w Thread checking the file in
+ * @param src_fd Descriptor of the file
+ * @param path Absolute path to the file
+ * @param st Status of the file
+ * @returns Returns 1 if the file was stored or 0 if it's left to be stored raw.
+ */
+static int
+compress_file(struct chkin_worker* w, int src_fd, const char* path,
+              const struct stat* st)
+{
+        struct chkin_ctx* ctx = w->ctx;
+        const struct repo_config* conf = ctx->conf;
+        struct obj_file_hdr hdr;
+        struct sha2_tree tree;
+        uint64_t stored = sizeof(hdr);
+        size_t bytes, n;
+        off_t off = 0;
+        int tmp_fd, flat = (conf->id_scheme != ID_SCHEME_TREE);
+        uint64_t t = stats_begin();
+
+        tmp_fd = open_tmp_object(w);
+        if (flat)
+                sha2_init(w->hash);
+        else
+                sha2_tree_init(&tree, conf->leaf_sz);
+
+        do {
+                bytes = xpread(src_fd, w->buf, READ_BUF_SZ, off);
+                if (flat)
+                        sha2_update(w->buf, w->hash, bytes);
+                else
+                        sha2_tree_update(&tree, w->buf, bytes);
+
+                n = obj_file_pack(w->buf, bytes, w->zbuf, w->lz);
+                xpwrite(tmp_fd, w->zbuf, n, stored);
+                stored += n;
+                off += bytes;
+
+                if (!obj_file_worth(conf, off, stored)) {
+                        xclose(tmp_fd);
+                        remove(w->tmp);
+                        stats_end(PHASE_COMPRESS, t, off, 0);
+                        return 0;
+                }
+        } while (bytes == READ_BUF_SZ);
+
+        if (flat)
+                sha2_final(w->id, w->hash);
+        else
+                sha2_tree_final(&tree, w->id);
+
+        obj_file_init_hdr(&hdr, OBJ_CODEC_LZ, OBJ_TYPE_DATA, off, w->id);
+        xpwrite(tmp_fd, &hdr, sizeof(hdr), 0);
+        fchmod(tmp_fd, S_IRUSR | S_IRGRP | S_IROTH);
+        xclose(tmp_fd);
+
+        if (claim_object(ctx, w->id))
+                link_tmp_object(w, w->id);
+        else
+                remove(w->tmp);
+        defer_file(w, path, strlen(path), w->id, st);
+
+        stats_add(STAT_BYTES_HASHED, off);
+        stats_end(PHASE_COMPRESS, t, off, 1);
+        return 1;
+}
+
+static int reap_ring(struct chkin_worker* w, unsigned int wait);
+
+/**
+ * Move the gathered files into the data directory.
+ *
+ * With a ring the renames are submitted together. The objects are made read
+ * only once they're in place, since io_uring has no chmod operation.
+ *
+ * @param w Thread owning the files
+ */
+static void
+flush_moves(struct chkin_worker* w)
+{
+        unsigned int i, n = w->n_moves;
+        uint64_t t;
+
+        if (!n)
+                return;
+
+        /* A full queue is emptied by completing what's in flight */
+        t = stats_begin();
+        if (w->ring) {
+                for (i = 0; i < n; i++) {
+                        while (uring_renameat(w->ring, AT_FDCWD,
+                                              w->moves[i].src, AT_FDCWD,
+                                              w->moves[i].dst, TAG_MOVE(i)))
+                                if (reap_ring(w, 1))
+                                        return;
+                        w->n_renaming++;
+                }
+
+                while (w->n_renaming)
+                        if (reap_ring(w, 1))
+                                return;
+        }
+
+        /* Objects which failed to be moved have their path cleared */
+        for (i = 0; i < n; i++) {
+                if (!w->ring)
+                        xrename(w->moves[i].src, w->moves[i].dst);
+                if (*w->moves[i].dst)
+                        xchmod(w->moves[i].dst, S_IRUSR | S_IRGRP | S_IROTH);
+        }
+
+        w->n_moves = 0;
+        stats_end(PHASE_STORE, t, 0, n);
+}
+
+/**
+ * Store a file whose hash was completed by the multi-buffer engine.
+ *
+ * @param w Thread owning the engine
+ * @param job Completed job
+ */
+static void
+store_mb_file(struct chkin_worker* w, struct sha2_job* job)
+{
+        struct mb_file* file = job->tag;
+
+        defer_file(w, file->path, file->len, job->digest, &file->st);
+        w->free_files[w->n_free++] = file;
+}
+
+/**
+ * Hash a small file whose content was read.
+ *
+ * @param w Thread owning the file's slot
+ * @param file Slot of the file
+ * @param bytes Number of bytes read
+ */
+static void
+hash_mb_file(struct chkin_worker* w, struct mb_file* file, size_t bytes)
+{
+        struct sha2_job* job;
+        uint64_t t = stats_begin();
+
+        file->job.in = file->buf;
+        file->job.len = bytes + w->ctx->off;
+
+        job = sha2_mb_submit(w->mb, &file->job);
+        stats_add(STAT_BYTES_HASHED, bytes);
+        stats_end(PHASE_HASH, t, bytes, 1);
+        if (job)
+                store_mb_file(w, job);
+}
+
+/**
+ * Hash a file which grew past the multi-buffer size since it was listed.
+ *
+ * @param w Thread owning the file's slot
+ * @param file Slot of the file, whose descriptor is closed
+ */
+static void
+hash_grown_file(struct chkin_worker* w, struct mb_file* file)
+{
+        struct chkin_ctx* ctx = w->ctx;
+
+        fstat(file->fd, &file->st);
+        compute_file_id(file->fd, file->st.st_size, ctx->conf, w->hash, w->buf,
+                        w->id, ctx->tree_threads);
+        xclose(file->fd);
+        defer_file(w, file->path, file->len, w->id, &file->st);
+        w->free_files[w->n_free++] = file;
+}
+
+/**
+ * Hash a small file read through a thread's ring.
+ *
+ * @param w Thread owning the ring
+ * @param file Slot of the file, whose descriptor is open
+ * @param bytes Number of bytes read
+ */
+static void
+read_mb_file(struct chkin_worker* w, struct mb_file* file, size_t bytes)
+{
+        if (bytes >= w->ctx->mb_max) {
+                hash_grown_file(w, file);
+                return;
+        }
+
+        if (uring_close(w->ring, file->fd, TAG_CLOSE))
+                xclose(file->fd);
+        hash_mb_file(w, file, bytes);
+}
+
+/**
+ * Handle the completed operations of a thread's ring.
+ *
+ * Opened files are read, and read files are closed and hashed. Operations
+ * which don't fit in the ring's queue are done by blocking calls. A file
+ * which fails to be read or moved is reported and the check in is stopped,
+ * though the files in flight are still completed so the index only lists
+ * objects which are stored.
+ *
+ * @param w Thread owning the ring
+ * @param wait Number of completions to wait for
+ * @returns Returns 0 or -1 if the operations couldn't be submitted.
+ */
+static int
+reap_ring(struct chkin_worker* w, unsigned int wait)
+{
+        struct mb_file* file;
+        uint64_t tag, t = stats_begin();
+        int32_t res;
+
+        if (uring_submit(w->ring, wait)) {
+                printf(DONUT_ERROR "Failed to submit file operations.\n");
+                __atomic_store_n(&w->ctx->err, 1, __ATOMIC_RELAXED);
+                return -1;
+        }
+        stats_end(PHASE_IO, t, 0, 0);
+
+        while (uring_reap(w->ring, &tag, &res)) {
+                if (tag == TAG_CLOSE)
                         continue;
 
-                /* Get File Path */
-                f_name = entry->d_name;
-                name_len = PAGE_SIZE - strlen(src_cp);
-                strncat(src_cp, f_name, name_len);
-                src_fd = xopen(src_cp, O_RDONLY);
-
-                /* Read File & Compute Hash */
-                compute_file_sha2(src_fd, hash, buf, str);
-                sha2_to_strn(str, (char*)(str + SHA_BLK_SZ), DATA_FILE_NAME_SIZE - 1);
-                str += SHA_BLK_SZ;
-
-                /* Move File if it's not present */
-                if (!is_in_data_list(list, (char*)str)) {
-                        strncat(cwd, (char*)str, DATA_FILE_NAME_SIZE);
-                        xrename(src_cp, cwd);
-                        xchmod(cwd, S_IRUSR | S_IRGRP | S_IROTH);
-                        add_file_to_list(list, (char*)str);
-                        memset(cwd + cwd_len, 0x0, DATA_FILE_NAME_SIZE - 1);
+                if (tag & 1) {
+                        if (res < 0) {
+                                printf(DONUT_ERROR "Failed to move file: %s\n",
+                                       w->moves[tag >> 1].src);
+                                *w->moves[tag >> 1].dst = '\0';
+                                __atomic_store_n(&w->ctx->err, 1,
+                                                 __ATOMIC_RELAXED);
+                        }
+                        w->n_renaming--;
+                        continue;
                 }
 
-                /* Reset Variables */
-                xclose(src_fd);
-                memset(str, 0x0, DATA_FILE_NAME_SIZE - 1);
-                memset(src_cp + src_len, 0x0, name_len);
-                str -= SHA_BLK_SZ;
+                file = (struct mb_file*)(uintptr_t)tag;
+                if (res < 0) {
+                        printf(DONUT_ERROR "Failed to read file: %s\n",
+                               file->path);
+                        if (file->fd >= 0)
+                                xclose(file->fd);
+                        w->free_files[w->n_free++] = file;
+                        __atomic_store_n(&w->ctx->err, 1, __ATOMIC_RELAXED);
+                } else if (file->fd >= 0) {
+                        read_mb_file(w, file, res);
+                } else {
+                        file->fd = res;
+                        if (uring_read(w->ring, file->fd,
+                                       file->buf + w->ctx->off, w->ctx->mb_max,
+                                       0, tag))
+                                read_mb_file(w, file,
+                                             xread(file->fd, file->buf +
+                                                   w->ctx->off,
+                                                   w->ctx->mb_max));
+                }
         }
 
-        xclosedir(dir);
         return 0;
 }
 
+/**
+ * Check a file of a directory in.
+ *
+ * Small files are opened and read through the thread's ring when available,
+ * then submitted to the thread's multi-buffer engine, so they may only be
+ * stored by a later call.
+ *
+ * @param arg Pointer to the thread's chkin_worker structure
+ * @param dir_fd Descriptor of the file's directory
+ * @param path Absolute path to the file
+ * @param len Length of the path
+ * @param name File's name within its directory
+ */
+static void
+chkin_walk_file(void* arg, int dir_fd, const char* path, size_t len,
+                const char* name)
+{
+        struct chkin_worker* w = arg;
+        struct chkin_ctx* ctx = w->ctx;
+        struct mb_file* file;
+        struct stat f;
+        size_t bytes;
+        int src_fd, listed, cached;
+        uint64_t t;
+
+        /* Once a file failed, the files left are for the next run */
+        if (__atomic_load_n(&ctx->err, __ATOMIC_RELAXED))
+                return;
+
+        /* Close to the memory budget, files are left for the next run */
+        if (mem_over_budget()) {
+                w->n_left++;
+                return;
+        }
+
+        t = stats_begin();
+        /* Unchanged files left in place aren't read again */
+        listed = !fstatat(dir_fd, name, &f, AT_SYMLINK_NOFOLLOW);
+        cached = listed && stat_cache_get(ctx->cache, path, &f, w->id);
+        stats_add(STAT_FILES_SCANNED, 1);
+        stats_end(PHASE_STAT, t, 0, 1);
+        if (cached && (!is_copied(ctx, &f) || has_object(ctx, w->id))) {
+                defer_file(w, path, len, w->id, NULL);
+                return;
+        }
+
+        /* Keep many small files in flight, by path since the directory's
+         * descriptor isn't valid after this call */
+        if (w->ring && listed && (size_t)f.st_size < ctx->mb_max &&
+            !is_copied(ctx, &f)) {
+                while (!w->n_free)
+                        if (reap_ring(w, 1))
+                                return;
+
+                file = w->free_files[--w->n_free];
+                memcpy(file->path, path, len + 1);
+                file->len = len;
+                file->st = f;
+                file->fd = -1;
+                while (uring_openat(w->ring, AT_FDCWD, file->path, O_RDONLY,
+                                    (uintptr_t)file))
+                        if (reap_ring(w, 1))
+                                return;
+
+                if (uring_inflight(w->ring) % SUBMIT_BATCH == 0)
+                        reap_ring(w, 0);
+                return;
+        }
+
+        /* The status listed is the one stored in the cache */
+        src_fd = xopenat(dir_fd, name, O_RDONLY);
+        if (!listed)
+                fstat(src_fd, &f);
+
+        /* Large files are split into chunks, others compressed when it's
+         * worth it */
+        if (is_chunked(ctx, &f)) {
+                chunk_file(w, src_fd, path, &f);
+                xclose(src_fd);
+                return;
+        }
+        if (w->zbuf && compress_file(w, src_fd, path, &f)) {
+                xclose(src_fd);
+                return;
+        }
+
+        /* Files which stay in place or can't be moved are copied */
+        if (ctx->keep || f.st_dev != ctx->dev) {
+                ingest_file(w, src_fd, path, &f);
+                xclose(src_fd);
+                return;
+        }
+
+        /* Small files are read whole and hashed along with others */
+        if ((size_t)f.st_size < ctx->mb_max && w->n_free) {
+                file = w->free_files[--w->n_free];
+                t = stats_begin();
+                bytes = xread(src_fd, file->buf + ctx->off, ctx->mb_max);
+                stats_end(PHASE_IO, t, bytes, 1);
+
+                if (bytes < ctx->mb_max) {
+                        xclose(src_fd);
+                        memcpy(file->path, path, len + 1);
+                        file->len = len;
+                        file->st = f;
+                        hash_mb_file(w, file, bytes);
+                        return;
+                }
+
+                /* File grew since it was listed */
+                w->free_files[w->n_free++] = file;
+        }
+
+        /* Read File & Compute Hash */
+        compute_file_id(src_fd, f.st_size, ctx->conf, w->hash, w->buf, w->id,
+                        ctx->tree_threads);
+        xclose(src_fd);
+        defer_file(w, path, len, w->id, &f);
+}
+
+/**
+ * Store the files in flight on a thread's ring and multi-buffer engine.
+ *
+ * @param arg Pointer to the thread's chkin_worker structure
+ */
+static void
+chkin_walk_idle(void* arg)
+{
+        struct chkin_worker* w = arg;
+        struct sha2_job* job;
+        uint64_t t;
+
+        while (w->ring && uring_inflight(w->ring))
+                if (reap_ring(w, 1))
+                        return;
+
+        for (;;) {
+                t = stats_begin();
+                job = sha2_mb_flush(w->mb);
+                stats_end(PHASE_HASH, t, 0, 0);
+                if (!job)
+                        break;
+                store_mb_file(w, job);
+        }
+}
+
+/**
+ * Allocate the buffers a thread uses for every file it checks in: its hash
+ * state, read buffer and paths, with the prefix of its temporary objects
+ * written once.
+ *
+ * @param w Thread's structure to be set up
+ * @param ctx Shared state
+ * @param idx Index of the thread
+ * @param slobs Slob allocator used for the thread's memory
+ */
+static void
+init_worker_bufs(struct chkin_worker* w, struct chkin_ctx* ctx,
+                 unsigned int idx, struct slobs* slobs)
+{
+        w->ctx = ctx;
+        w->idx = idx;
+        w->hash = alloc_slob(slobs, SHA_STRUCT_SZ);
+        w->buf = alloc_slob(slobs, READ_BUF_SZ);
+        w->tmp = alloc_slob(slobs, PAGE_SIZE);
+        w->obj = alloc_slob(slobs, PAGE_SIZE);
+        w->tmp_len = snprintf(w->tmp, PAGE_SIZE, "%s/%d-%u-", ctx->tmp,
+                              (int)getpid(), idx);
+        w->n_tmp = 0;
+        w->zbuf = NULL;
+        w->lz = NULL;
+        if (ctx->conf->compress != COMPRESS_NEVER) {
+                w->zbuf = alloc_slob(slobs, obj_file_bound(READ_BUF_SZ));
+                w->lz = alloc_slob(slobs, LZ_TABLE_SZ);
+        }
+        w->list = NULL;
+        w->list_cap = 0;
+        w->claims = NULL;
+        w->n_claims = w->claims_cap = 0;
+        w->slobs = init_slobs("chkin");
+}
+
+/**
+ * Allocate the state of a thread checking files in.
+ *
+ * @param w Thread's structure to be set up
+ * @param ctx Shared state
+ * @param idx Index of the thread
+ * @param slobs Slob allocator used for the thread's memory
+ */
+static void
+init_worker(struct chkin_worker* w, struct chkin_ctx* ctx, unsigned int idx,
+            struct slobs* slobs)
+{
+        struct mb_file* files;
+        unsigned int i, n_moves;
+
+        init_worker_bufs(w, ctx, idx, slobs);
+
+        /* One file per lane of the engine, the one being read and those in
+         * flight on the ring */
+        w->mb = sha2_mb_init(slobs);
+        w->n_files = sha2_mb_lanes(w->mb) + 1;
+        n_moves = MOVE_BATCH;
+        w->ring = NULL;
+        w->n_moves = w->n_renaming = 0;
+        if (ctx->depth)
+                w->ring = uring_init(slobs, 2 * (w->n_files + ctx->depth) +
+                                     n_moves);
+        if (w->ring)
+                w->n_files += ctx->depth;
+
+        w->n_free = w->n_files;
+        files = alloc_slob(slobs, w->n_files * sizeof(struct mb_file));
+        w->free_files = alloc_slob(slobs, w->n_files * __SIZEOF_POINTER__);
+
+        for (i = 0; i < w->n_files; i++) {
+                files[i].buf = alloc_slob(slobs, MB_FILE_SZ + 1);
+                files[i].buf[0] = TREE_LEAF_PREFIX;
+                files[i].path = alloc_slob(slobs, PATH_MAX + NAME_MAX + 1);
+                files[i].job.tag = &files[i];
+                w->free_files[i] = &files[i];
+        }
+
+        w->moves = alloc_slob(slobs, n_moves * sizeof(struct chkin_move));
+        for (i = 0; i < n_moves; i++) {
+                w->moves[i].src = alloc_slob(slobs, PATH_MAX + NAME_MAX + 1);
+                w->moves[i].dst = alloc_slob(slobs, PAGE_SIZE);
+        }
+}
 
+/**
+ * Move a single file into the data directory as its object.
+ *
+ * @param ctx Check in state
+ * @param src Absolute path to the file
+ * @param id Object ID of the file
+ * @param obj Buffer of PAGE_SIZE bytes where the object's path is placed
+ */
+static void
+move_file(struct chkin_ctx* ctx, const char* src, const uint8_t* id, char* obj)
+{
+        uint64_t t = stats_begin();
+
+        object_path(ctx, id, obj);
+        xrename(src, obj);
+        xchmod(obj, S_IRUSR | S_IRGRP | S_IROTH);
+        stats_end(PHASE_STORE, t, 0, 1);
+}
+
+/**
+ * Order claims by object ID, then by path.
+ *
+ * @param a Pointer to a claim's pointer
+ * @param b Pointer to a claim's pointer
+ * @returns Returns a value below, equal to or above 0 as "a" sorts before,
+ * along with or after "b".
+ */
 static int
-chkin_file(const char* src, struct data_list* list, char* cwd, void* hash,
-           void* buf, uint8_t* str)
+cmp_claim(const void* a, const void* b)
+{
+        const struct chkin_claim* x = *(struct chkin_claim* const*)a;
+        const struct chkin_claim* y = *(struct chkin_claim* const*)b;
+        int cmp = memcmp(x->id, y->id, OID_SZ);
+
+        return (cmp) ? cmp : strcmp(x->path, y->path);
+}
+
+/**
+ * Store the first file of every group of claims with the same ID and leave
+ * the others in place.
+ *
+ * @param arg Pointer to the chkin_settle structure of the claims
+ * @returns Returns NULL.
+ */
+static void*
+settle_claims(void* arg)
 {
-        int src_fd = xopen(src, O_RDONLY);
+        struct chkin_settle* s = arg;
+        struct chkin_worker* w = s->w;
+        struct chkin_ctx* ctx = w->ctx;
+        struct chkin_claim* c;
+        struct chkin_move* m;
+        uint64_t i;
+
+        for (i = 0; i < s->n; i++) {
+                c = s->claims[i];
+                if (i && !memcmp(c->id, s->claims[i - 1]->id, OID_SZ)) {
+                        leave_file(ctx, c->path, c->id,
+                                   (c->hashed) ? &c->st : NULL);
+                        continue;
+                }
 
-        compute_file_sha2(src_fd, hash, buf, str);
-        sha2_to_strn(str, (char*)(str + SHA_BLK_SZ), DATA_FILE_NAME_SIZE - 1);
-        str += SHA_BLK_SZ;
+                /* Content copied while the files were hashed is in place */
+                if (!claim_object(ctx, c->id)) {
+                        remove(c->path);
+                        continue;
+                }
 
-        if (!is_in_data_list(list, (char*)str)) {
-                strncat(cwd, (char*)str, DATA_FILE_NAME_SIZE);
-                xrename(src, cwd);
-                xchmod(cwd, S_IRUSR | S_IRGRP | S_IROTH);
+                if (!w->ring) {
+                        move_file(ctx, c->path, c->id, w->obj);
+                        continue;
+                }
+                m = &w->moves[w->n_moves++];
+                strcpy(m->src, c->path);
+                object_path(ctx, c->id, m->dst);
+                if (w->n_moves == MOVE_BATCH)
+                        flush_moves(w);
         }
 
-        xclose(src_fd);
+        flush_moves(w);
+        return NULL;
+}
+
+/**
+ * Settle the files claimed by the threads once every file is hashed.
+ *
+ * Claims are sorted so the smallest path of each content is stored whatever
+ * the number of threads, then split between the threads without splitting
+ * the claims of a content.
+ *
+ * @param workers Threads which checked the files in
+ * @param jobs Number of threads
+ * @param slobs Slob allocator used for the sorted claims
+ */
+static void
+settle_files(struct chkin_worker* workers, unsigned int jobs,
+             struct slobs* slobs)
+{
+        struct chkin_settle* s;
+        struct chkin_claim** claims;
+        uint64_t start, end, n = 0;
+        unsigned int i;
+
+        for (i = 0; i < jobs; i++)
+                n += workers[i].n_claims;
+        if (!n)
+                return;
+
+        claims = alloc_slob(slobs, n * __SIZEOF_POINTER__);
+        for (i = 0, n = 0; i < jobs; i++) {
+                memcpy(claims + n, workers[i].claims,
+                       workers[i].n_claims * __SIZEOF_POINTER__);
+                n += workers[i].n_claims;
+        }
+        qsort(claims, n, __SIZEOF_POINTER__, cmp_claim);
+
+        s = alloc_slob(slobs, jobs * sizeof(struct chkin_settle));
+        for (i = 0, start = 0; i < jobs; i++, start = end) {
+                end = n * (i + 1) / jobs;
+                if (end < start)
+                        end = start;
+                while (end > start && end < n &&
+                       !memcmp(claims[end]->id, claims[end - 1]->id, OID_SZ))
+                        end++;
+
+                s[i].w = &workers[i];
+                s[i].claims = claims + start;
+                s[i].n = end - start;
+        }
+
+        /* The calling thread settles claims as well */
+        for (i = 1; i < jobs; i++)
+                s[i].started = !pthread_create(&s[i].tid, NULL, settle_claims,
+                                               &s[i]);
+        settle_claims(&s[0]);
+        for (i = 1; i < jobs; i++) {
+                if (s[i].started)
+                        pthread_join(s[i].tid, NULL);
+                else
+                        settle_claims(&s[i]);
+        }
+
+        free_slob(slobs, s);
+        free_slob(slobs, claims);
+}
+
+static int
+chkin_dir(const char* src, struct chkin_ctx* ctx, unsigned int jobs,
+          int recursive, struct slobs* slobs)
+{
+        struct chkin_worker* workers = alloc_slob(slobs, jobs *
+                                                  sizeof(struct chkin_worker));
+        void** args = alloc_slob(slobs, jobs * __SIZEOF_POINTER__);
+        unsigned long n_left = 0;
+        unsigned int i;
+
+        /*
+         * Descriptors are kept within OPEN_MAX. Each thread has its ring, a
+         * file and a temporary object open besides the files in flight. Files
+         * which are kept or compressed don't go through the ring.
+         */
+        ctx->depth = OPEN_MAX / 2 / jobs;
+        ctx->depth = (ctx->keep || ctx->conf->compress != COMPRESS_NEVER) ? 0 :
+                     (ctx->depth > URING_DEPTH + 4) ? URING_DEPTH :
+                     (ctx->depth > 4) ? ctx->depth - 4 : 0;
+
+        for (i = 0; i < jobs; i++) {
+                init_worker(&workers[i], ctx, i, slobs);
+                args[i] = &workers[i];
+        }
+
+        /* The budget left once the threads are set up is for the files */
+        mem_set_base();
+        if (mem_exceeded()) {
+                printf(DONUT_ERROR "The memory budget is too small to start\
+ checking files in. Try a larger budget or fewer jobs.\n");
+        } else {
+                walk_tree(src, recursive, jobs, ctx->depth + 3, args,
+                          chkin_walk_file, chkin_walk_idle);
+                settle_files(workers, jobs, slobs);
+        }
+
+        for (i = 0; i < jobs; i++) {
+                if (workers[i].ring)
+                        uring_exit(workers[i].ring);
+                free(workers[i].list);
+                clear_slobs(workers[i].slobs);
+                n_left += workers[i].n_left;
+        }
+
+        if (n_left) {
+                printf(DONUT_ERROR "The memory budget was reached, %lu files\
+ were left in place. Run chkin again to check them in.\n", n_left);
+                return DEF_ERR;
+        }
+        return (ctx->err || mem_exceeded()) ? DEF_ERR : 0;
+}
+
+
+static int
+chkin_file(const char* src, struct chkin_ctx* ctx, struct slobs* slobs)
+{
+        int src_fd;
+        struct stat f;
+        struct chkin_worker w = {0};
+        struct chkin_settle s = {0};
+
+        /* The cache is shared by the dataframes, so a cached file may still
+         * be new to this one */
+        init_worker_bufs(&w, ctx, 0, slobs);
+        if (!stat(src, &f) && stat_cache_get(ctx->cache, src, &f, w.id) &&
+            (!is_copied(ctx, &f) || has_object(ctx, w.id))) {
+                defer_file(&w, src, strlen(src), w.id, NULL);
+        } else {
+                src_fd = xopen(src, O_RDONLY);
+                fstat(src_fd, &f);
+                if (is_chunked(ctx, &f)) {
+                        chunk_file(&w, src_fd, src, &f);
+                } else if (!w.zbuf || !compress_file(&w, src_fd, src, &f)) {
+                        if (ctx->keep || f.st_dev != ctx->dev) {
+                                ingest_file(&w, src_fd, src, &f);
+                        } else {
+                                compute_file_id(src_fd, f.st_size, ctx->conf,
+                                                w.hash, w.buf, w.id, N_CPU);
+                                defer_file(&w, src, strlen(src), w.id, &f);
+                        }
+                }
+                xclose(src_fd);
+        }
+
+        s.w = &w;
+        s.claims = w.claims;
+        s.n = w.n_claims;
+        settle_claims(&s);
+
+        free(w.list);
+        clear_slobs(w.slobs);
         return 0;
 }
 
@@ -117,9 +1327,14 @@ chkin(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags)
 {
         char* src;
         char* df_name = opts + (NAME_ARG_IDX * MAX_ARG_SZ);
+        char* jobs_arg = opts + (JOBS_ARG_IDX * (MAX_ARG_SZ + 1));
         register int ret;
         register mode_t f_tp;
         struct stat f, dir;
+        struct repo_config conf;
+        struct chkin_ctx ctx = {0};
+        unsigned long jobs = N_CPU;
+        uint64_t t;
 
         if (validate_donut_repo() || !(argc - 2)) {
                 printf(DONUT_ERROR "Donut isn't initialized or no path/file was\
@@ -127,18 +1342,33 @@ chkin(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags)
                 return DEF_ERR;
         }
 
-        src = argv[arg_idx];
         if (stat(argv[arg_idx], &f)) {
                 printf(DONUT_ERROR "Path provided is invalid.\n");
                 return DEF_ERR;
         }
 
-        /* Get memory */
-        struct slobs* slobs = init_slobs();
+        if (oflags & JOBS_OPT) {
+                jobs = strtoul(jobs_arg, &src, 10);
+                if (*src || !jobs || jobs > MAX_JOBS) {
+                        printf(DONUT_ERROR "The number of jobs must be between\
+ 1 and %d.\n", MAX_JOBS);
+                        return DEF_ERR;
+                }
+        }
+
+        read_repo_config(CONFIG_FILE_RELATIVE, &conf);
+
+        /* Get memory, the index's tables on huge pages if configured */
+        struct slobs* slobs = init_huge_slobs("chkin", conf.huge_pages);
         char* cwd = alloc_slob(slobs, PAGE_SIZE);
-        void* hash = alloc_slob(slobs, PAGE_SIZE);
-        void* buf = alloc_slob(slobs, PAGE_SIZE);
-        uint8_t* str = ((uint8_t*)hash + SHA_STRUCT_SZ);
+
+        /* Cached IDs are keyed by the file's absolute path */
+        src = realpath(argv[arg_idx], alloc_slob(slobs, PATH_MAX));
+        if (!src) {
+                printf(DONUT_ERROR "Path provided is invalid.\n");
+                clear_slobs(slobs);
+                return DEF_ERR;
+        }
 
         /* Build CWD & open file */
         cwd = xgetcwd(cwd, PAGE_SIZE);
@@ -152,20 +1382,248 @@ chkin(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags)
                 strncat(cwd, "/", 2);
         }
 
+        /* Objects are linked in from a folder on the same filesystem */
+        if (stat(cwd, &dir)) {
+                printf(DONUT_ERROR "Failed to obtain the data folder's status.\n");
+                clear_slobs(slobs);
+                return DEF_ERR;
+        }
+        ctx.dev = dir.st_dev;
+        ctx.tmp = alloc_slob(slobs, PAGE_SIZE);
+        ctx.tmp = xgetcwd(ctx.tmp, PAGE_SIZE);
+        strncat(ctx.tmp, "/" TMP_FOLDER_RELATIVE, PAGE_SIZE - strlen(ctx.tmp) - 1);
+        mkdir(TMP_FOLDER_RELATIVE, CTOR_MODE);
+
         /* Get data in the current Dataframe or General Repository */
-        struct data_list* list = init_data_list(slobs);
-        get_repo_data_list(list, cwd);
+        char* idx_path = alloc_slob(slobs, PAGE_SIZE);
+        snprintf(idx_path, PAGE_SIZE, META_FOLDER_RELATIVE "/%s" INDEX_FILE_EXT,
+                 (*df_name) ? df_name : DEFAULT_DF);
+        mkdir(META_FOLDER_RELATIVE, CTOR_MODE);
+
+        t = stats_begin();
+        ctx.idx = open_obj_index(slobs, idx_path, cwd, conf.shard_depth);
+        ctx.cache = open_stat_cache(slobs, STAT_CACHE_FILE_RELATIVE,
+                                    conf.id_scheme);
+        stats_end(PHASE_INDEX, t, 0, 0);
+        ctx.conf = &conf;
+        ctx.cwd = cwd;
+        ctx.cwd_len = strnlen(cwd, PAGE_SIZE);
+        ctx.shards = open_shards(slobs, cwd, conf.shard_depth);
+        ctx.tree_threads = (N_CPU > jobs) ? N_CPU / jobs : 1;
+        ctx.keep = (oflags & KEEP_OPT) ? 1 : 0;
+        if (conf.chunk_sz) {
+                ctx.cdc = alloc_slob(slobs, sizeof(struct cdc));
+                cdc_init(ctx.cdc, conf.chunk_sz);
+                ctx.chunk_min = ctx.cdc->avg * CDC_FILE_CHUNKS;
+        }
+
+
+        /*
+         * A file that fits in a single leaf has the leaf's hash as its tree
+         * ID, so the leaf prefix is placed before the content and hashed by
+         * the engine along with it.
+         */
+        ctx.off = (conf.id_scheme == ID_SCHEME_TREE) ? 1 : 0;
+        ctx.mb_max = (ctx.off && conf.leaf_sz < MB_FILE_SZ) ? conf.leaf_sz + 1 :
+                     MB_FILE_SZ;
 
         f_tp = f.st_mode;
+        pthread_mutex_init(&ctx.lock, NULL);
         if (f_tp & S_IFDIR)
-                ret = chkin_dir(src, list, slobs, cwd, hash, buf, str);
-        else if (f_tp & S_IFREG)
-                ret = chkin_file(src, list, cwd, hash, buf, str);
-        else {
+                ret = chkin_dir(src, &ctx, jobs, oflags & RECURSIVE_OPT, slobs);
+        else if (f_tp & S_IFREG) {
+                ret = chkin_file(src, &ctx, slobs);
+        } else {
                 printf(DONUT_ERROR "Path given is not a directory or regular file.\n");
                 ret = DEF_ERR;
         }
 
+        t = stats_begin();
+        close_stat_cache(ctx.cache);
+        close_obj_index(ctx.idx);
+        stats_end(PHASE_INDEX, t, 0, 0);
         clear_slobs(slobs);
         return ret;
 }
+
+/**
+ * Remove a directory of the chkin test along with its content.
+ *
+ * @param path String containing the path to the directory.
+ */
+static void
+test_chkin_remove(const char* path)
+{
+        struct dirent* e;
+        struct stat st;
+        char* sub;
+        DIR* dir = opendir(path);
+
+        if (!dir)
+                return;
+
+        sub = xmalloc(PATH_MAX);
+        while ((e = readdir(dir))) {
+                if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+                        continue;
+
+                snprintf(sub, PATH_MAX, "%s/%s", path, e->d_name);
+                if (!lstat(sub, &st) && S_ISDIR(st.st_mode))
+                        test_chkin_remove(sub);
+                else
+                        remove(sub);
+        }
+
+        closedir(dir);
+        rmdir(path);
+        free(sub);
+}
+
+/**
+ * Count the files of a directory and its subdirectories.
+ *
+ * @param path String containing the path to the directory.
+ * @returns Number of files found.
+ */
+static unsigned int
+test_chkin_count(const char* path)
+{
+        struct dirent* e;
+        struct stat st;
+        char* sub;
+        unsigned int n = 0;
+        DIR* dir = opendir(path);
+
+        if (!dir)
+                return 0;
+
+        sub = xmalloc(PATH_MAX);
+        while ((e = readdir(dir))) {
+                if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+                        continue;
+
+                snprintf(sub, PATH_MAX, "%s/%s", path, e->d_name);
+                if (!lstat(sub, &st) && S_ISDIR(st.st_mode))
+                        n += test_chkin_count(sub);
+                else
+                        n++;
+        }
+
+        closedir(dir);
+        free(sub);
+        return n;
+}
+
+int
+test_chkin(void)
+{
+        int fd, ret = 1;
+        char* cwd = xgetcwd(xmalloc(PAGE_SIZE), PAGE_SIZE);
+        char* root = xmalloc(PAGE_SIZE);
+        char* path = xmalloc(PAGE_SIZE);
+        char* opts = xcalloc(1, PAGE_SIZE);
+        char* argv[3] = {"donut", "init", root};
+
+        snprintf(root, PAGE_SIZE, "%s/donut_test_chkin", getenv("HOME"));
+        test_chkin_remove(root);
+        mkdir(root, S_IRWXU);
+        if (donut_init(3, argv, 2, opts, 0)) {
+                ret = 0;
+                goto out;
+        }
+
+        /* Two files with the same content, changed long enough ago to be
+         * cached */
+        mkdir("src", S_IRWXU);
+        for (int i = 0; i < 2; i++) {
+                snprintf(path, PAGE_SIZE, "%s/src/%c", root, 'a' + i);
+                fd = xopen(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+                xwrite(fd, "donut", 5);
+                xclose(fd);
+        }
+        sleep(STAT_CACHE_RACY_NS / 1000000000 + 1);
+
+        /* The second file is left in place as a duplicate, and cached */
+        argv[1] = "chkin";
+        argv[2] = path;
+        snprintf(path, PAGE_SIZE, "%s/src/a", root);
+        ret &= !chkin(3, argv, 2, opts, 0);
+        snprintf(path, PAGE_SIZE, "%s/src/b", root);
+        ret &= !chkin(3, argv, 2, opts, 0);
+        ret &= !access(path, F_OK);
+
+        /* The cached file is new to another dataframe, which stores it */
+        snprintf(opts + NAME_ARG_IDX * MAX_ARG_SZ, MAX_ARG_SZ, "other");
+        ret &= !chkin(3, argv, 2, opts, NAME_OPT);
+        ret &= access(path, F_OK) ? 1 : 0;
+        ret &= (test_chkin_count(DATA_FOLDER_RELATIVE "/other") == 1) ? 1 : 0;
+
+        /* The same tree of duplicates, checked in by one thread and many */
+        for (int i = 0; i < 2; i++) {
+                snprintf(path, PAGE_SIZE, "%s/j%d", root, i);
+                mkdir(path, S_IRWXU);
+                for (int j = 0; j < 8; j++) {
+                        snprintf(path, PAGE_SIZE, "%s/j%d/%d", root, i, j);
+                        mkdir(path, S_IRWXU);
+                        for (int k = 0; k < 16; k++) {
+                                snprintf(path, PAGE_SIZE, "%s/j%d/%d/%d", root,
+                                         i, j, k);
+                                fd = xopen(path, O_WRONLY | O_CREAT | O_TRUNC,
+                                           0640);
+                                dprintf(fd, "donut %d", (j * 16 + k) % 5);
+                                xclose(fd);
+                        }
+                }
+        }
+
+        for (int i = 0; i < 2; i++) {
+                snprintf(path, PAGE_SIZE, "%s/j%d", root, i);
+                snprintf(opts + NAME_ARG_IDX * MAX_ARG_SZ, MAX_ARG_SZ, "j%d",
+                         i);
+                snprintf(opts + JOBS_ARG_IDX * (MAX_ARG_SZ + 1), MAX_ARG_SZ,
+                         "%d", (i) ? 4 : 1);
+                ret &= !chkin(3, argv, 2, opts,
+                              NAME_OPT | JOBS_OPT | RECURSIVE_OPT);
+        }
+
+        /* The same duplicate of each content is stored */
+        ret &= (test_chkin_count(DATA_FOLDER_RELATIVE "/j0") == 5) ? 1 : 0;
+        ret &= (test_chkin_count(DATA_FOLDER_RELATIVE "/j1") == 5) ? 1 : 0;
+        for (int j = 0; j < 8; j++) {
+                for (int k = 0; k < 16; k++) {
+                        snprintf(path, PAGE_SIZE, "%s/j0/%d/%d", root, j, k);
+                        fd = access(path, F_OK);
+                        snprintf(path, PAGE_SIZE, "%s/j1/%d/%d", root, j, k);
+                        ret &= (fd == access(path, F_OK)) ? 1 : 0;
+                }
+        }
+        snprintf(path, PAGE_SIZE, "%s/j0", root);
+        ret &= (test_chkin_count(path) == 8 * 16 - 5) ? 1 : 0;
+
+        /* Past the budget the files are left in place for the next run */
+        snprintf(path, PAGE_SIZE, "%s/b", root);
+        mkdir(path, S_IRWXU);
+        for (int i = 0; i < 3; i++) {
+                snprintf(path, PAGE_SIZE, "%s/b/%d", root, i);
+                fd = xopen(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+                dprintf(fd, "budget %d", i);
+                xclose(fd);
+        }
+        snprintf(path, PAGE_SIZE, "%s/b", root);
+        snprintf(opts + NAME_ARG_IDX * MAX_ARG_SZ, MAX_ARG_SZ, "budget");
+        mem_set_budget(1 << 20);
+        ret &= chkin(3, argv, 2, opts, NAME_OPT | RECURSIVE_OPT) ? 1 : 0;
+        ret &= (test_chkin_count(path) == 3) ? 1 : 0;
+        mem_set_budget(0);
+        ret &= !chkin(3, argv, 2, opts, NAME_OPT | RECURSIVE_OPT);
+        ret &= !test_chkin_count(path);
+
+out:
+        ret &= !chdir(cwd);
+        test_chkin_remove(root);
+        free(opts);
+        free(path);
+        free(root);
+        free(cwd);
+        return ret;
+}
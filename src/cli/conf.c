@@ -1,5 +1,14 @@
 #include "cli/cmd.h"
 #include "stdio.h"
+#include "crypto/sha2.h"
+#include "core/config.h"
+#include "core/bloom.h"
+#include "core/obj-index.h"
+#include "mem/slob.h"
+#include "const/const.h"
+#include "tools/validation.h"
+#include "string.h"
+#include "unistd.h"
 
 /**
  * @file conf.c
@@ -7,6 +16,41 @@
  * Implements all functions and utlities used by the "conf" command.
  */
 
+/**
+ * Print the system's huge pages, the mode of transparent huge pages and the
+ * reserved pool of hugetlbfs.
+ */
+static void
+print_system_huge_pages(void)
+{
+        char line[PAGE_SIZE] = {0};
+        unsigned long total = 0, free = 0;
+        char* mode;
+        char* end;
+        FILE* f;
+
+        /* The mode in use is the one in brackets */
+        f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+        if (f) {
+                if (fgets(line, sizeof(line), f) &&
+                    (mode = strchr(line, '[')) && (end = strchr(mode, ']'))) {
+                        *end = '\0';
+                        printf("Transparent Huge Pages: %s\n", mode + 1);
+                }
+                fclose(f);
+        }
+
+        f = fopen("/proc/meminfo", "r");
+        if (!f)
+                return;
+        while (fgets(line, sizeof(line), f)) {
+                sscanf(line, "HugePages_Total: %lu", &total);
+                sscanf(line, "HugePages_Free: %lu", &free);
+        }
+        fclose(f);
+        printf("Reserved Huge Pages: %lu free of %lu\n", free, total);
+}
+
 /**
  * Prints the current configuration detected and being used by donut.
  *
@@ -16,16 +60,70 @@
 void
 conf(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags)
 {
+        struct repo_config repo;
+        struct slobs* slobs;
+        struct bloom* filter;
+        struct obj_index* idx;
+        uint64_t mem, huge;
+
         printf("Page Size: %u\n\
 Cache Line Size: %u\n\
 L1 Cache Data Size: %u\n\
 L1 Cache Instruction Size: %u\n\
 Max Amount of Open Files: %u\n\
-Number of CPUs: %u\n",
+Number of CPUs: %u\n\
+SHA-2 Backend: %s\n",
                PAGE_SIZE,
                CACHE_LINE,
                D_CACHE,
                I_CACHE,
                OPEN_MAX,
-               N_CPU);
+               N_CPU,
+               sha2_backend());
+
+        if (validate_donut_repo())
+                return;
+
+        read_repo_config(CONFIG_FILE_RELATIVE, &repo);
+        printf("Object ID Scheme: %s\n", id_scheme_to_str(repo.id_scheme));
+        if (repo.id_scheme == ID_SCHEME_TREE)
+                printf("Tree Leaf Size: %lu\n", (unsigned long)repo.leaf_sz);
+        if (repo.chunk_sz)
+                printf("Average Chunk Size: %lu\n", (unsigned long)repo.chunk_sz);
+        else
+                printf("Average Chunk Size: off\n");
+        if (repo.compress == COMPRESS_SAVING)
+                printf("Compression: saving at least %u%%\n", repo.min_saving);
+        else
+                printf("Compression: %s\n", compress_to_str(repo.compress));
+        printf("Shard Depth: %u\n", repo.shard_depth);
+        printf("Huge Pages: %s\n", huge_pages_to_str(repo.huge_pages));
+        print_system_huge_pages();
+
+        /* Load the object index the way chkin does to see where it ends up */
+        slobs = init_huge_slobs("conf", repo.huge_pages);
+        if (!access(META_FOLDER_RELATIVE "/" DEFAULT_DF INDEX_FILE_EXT, F_OK)) {
+                idx = open_obj_index(slobs, META_FOLDER_RELATIVE "/" DEFAULT_DF
+                                     INDEX_FILE_EXT, DATA_FOLDER_RELATIVE "/",
+                                     repo.shard_depth);
+                mem = obj_index_mem(idx, &huge);
+                printf("Object Index Memory: %lu KiB\n\
+Object Index Memory on Huge Pages: %lu KiB\n", (unsigned long)(mem >> 10),
+                       (unsigned long)(huge >> 10));
+                close_obj_index(idx);
+        }
+
+
+        filter = open_bloom(slobs, META_FOLDER_RELATIVE "/" DEFAULT_DF
+                            INDEX_FILE_EXT FILTER_FILE_EXT);
+        if (filter) {
+                printf("Object Filter Entries: %lu\n\
+Object Filter Memory: %lu KiB\n\
+Object Filter False Positive Rate: %.3g%%\n",
+                       (unsigned long)bloom_count(filter),
+                       (unsigned long)(bloom_mem(filter) >> 10),
+                       bloom_fp_rate(filter) * 100);
+                close_bloom(filter);
+        }
+        clear_slobs(slobs);
 }
@@ -1,12 +1,31 @@
 #include "cli/cmd.h"
 #include "mem/slob.h"
+#include "mem/slab.h"
 #include "mem/mem_utils.h"
+#include "mem/mem_stats.h"
 #include "core/wrappers.h"
 #include "string.h"
 #include "misc/colour.h"
 #include "crypto/sha2.h"
+#include "crypto/sha2-mb.h"
+#include "crypto/sha2-tree.h"
+#include "crypto/sha2-file.h"
 #include "core/data-list.h"
+#include "core/config.h"
+#include "core/obj-index.h"
+#include "core/bloom.h"
+#include "core/stat-cache.h"
+#include "core/walk.h"
+#include "core/uring.h"
+#include "core/ingest.h"
+#include "core/cdc.h"
+#include "core/obj-file.h"
+#include "core/pack.h"
+#include "core/shard.h"
+#include "core/oid-set.h"
+#include "compress/lz.h"
 #include "cli/arg-parse.h"
+#include "tools/stats.h"
 
 /**
  * @file doctor.c
@@ -43,6 +62,32 @@ test_mem_slob(void)
                 printf(GREEN "- free_slob: passed" RESET "\n");
         else
                 printf(RED "- free_slob: failed" RESET "\n");
+
+        if (test_huge_slob())
+                printf(GREEN "- huge_slob: passed" RESET "\n");
+        else
+                printf(RED "- huge_slob: failed" RESET "\n");
+}
+
+/**
+ * Execute all slab allocator module's unit tests.
+ *
+ * Executes all unit tests for the slab allocator module and prints onto the
+ * screen if they passed or failed.
+ */
+static void
+test_mem_slab(void)
+{
+        printf("\n[Slab Module]\n");
+        if (test_init_slabs())
+                printf(GREEN "- init_slabs: passed" RESET "\n");
+        else
+                printf(RED "- init_slabs: failed" RESET "\n");
+
+        if (test_slabs())
+                printf(GREEN "- slabs: passed" RESET "\n");
+        else
+                printf(RED "- slabs: failed" RESET "\n");
 }
 
 /**
@@ -60,6 +105,11 @@ test_core_wrappers(void)
         else
                 printf(RED "- xopen: failed" RESET "\n");
 
+        if (test_xopenat())
+                printf(GREEN "- xopenat: passed" RESET "\n");
+        else
+                printf(RED "- xopenat: failed" RESET "\n");
+
         if (test_xclose())
                 printf(GREEN "- xclose: passed" RESET "\n");
         else
@@ -149,6 +199,31 @@ test_crypto(void)
         else
                 printf(RED "- SHA2: failed" RESET "\n");
 
+        if (test_sha2_backends())
+                printf(GREEN "- sha2 backends: passed" RESET "\n");
+        else
+                printf(RED "- sha2 backends: failed" RESET "\n");
+
+        if (test_sha2_mb())
+                printf(GREEN "- sha2 multi-buffer: passed" RESET "\n");
+        else
+                printf(RED "- sha2 multi-buffer: failed" RESET "\n");
+
+        if (test_sha2_update())
+                printf(GREEN "- sha2_update: passed" RESET "\n");
+        else
+                printf(RED "- sha2_update: failed" RESET "\n");
+
+        if (test_sha2_tree())
+                printf(GREEN "- sha2 tree: passed" RESET "\n");
+        else
+                printf(RED "- sha2 tree: failed" RESET "\n");
+
+        if (test_sha2_file())
+                printf(GREEN "- sha2 file: passed" RESET "\n");
+        else
+                printf(RED "- sha2 file: failed" RESET "\n");
+
         if (test_sha2_init())
                 printf(GREEN "- sha2_init: passed" RESET "\n");
         else
@@ -163,6 +238,11 @@ test_crypto(void)
                 printf(GREEN "- sha2_to_strn: passed" RESET "\n");
         else
                 printf(RED "- sha2_to_strn: failed" RESET "\n");
+
+        if (test_sha2_from_str())
+                printf(GREEN "- sha2_from_str: passed" RESET "\n");
+        else
+                printf(RED "- sha2_from_str: failed" RESET "\n");
 }
 
 /**
@@ -179,6 +259,11 @@ test_memory_utilities(void)
                 printf(GREEN "- const_memcmp: passed" RESET "\n");
         else
                 printf(RED "- const_memcmp: failed" RESET "\n");
+
+        if (test_mem_stats())
+                printf(GREEN "- mem_stats: passed" RESET "\n");
+        else
+                printf(RED "- mem_stats: failed" RESET "\n");
 }
 
 static void
@@ -189,14 +274,94 @@ test_core_module(void)
                 printf(GREEN "- init_data_list: passed" RESET "\n");
         else
                 printf(RED "- init_data_list: failed" RESET "\n");
-        if (test_get_data_list_index())
-                printf(GREEN "- get_data_list_index: passed" RESET "\n");
+        if (test_data_list_growth())
+                printf(GREEN "- data_list growth: passed" RESET "\n");
         else
-                printf(RED "- get_data_list_index: failed" RESET "\n");
+                printf(RED "- data_list growth: failed" RESET "\n");
         if (test_add_file_to_data_list())
                 printf(GREEN "- add_file_to_list: passed" RESET "\n");
         else
                 printf(RED "- add_file_to_list: failed" RESET "\n");
+        if (test_bloom())
+                printf(GREEN "- bloom: passed" RESET "\n");
+        else
+                printf(RED "- bloom: failed" RESET "\n");
+        if (test_obj_index())
+                printf(GREEN "- obj_index: passed" RESET "\n");
+        else
+                printf(RED "- obj_index: failed" RESET "\n");
+        if (test_stat_cache())
+                printf(GREEN "- stat_cache: passed" RESET "\n");
+        else
+                printf(RED "- stat_cache: failed" RESET "\n");
+        if (test_walk_tree())
+                printf(GREEN "- walk_tree: passed" RESET "\n");
+        else
+                printf(RED "- walk_tree: failed" RESET "\n");
+        if (test_uring())
+                printf(GREEN "- uring: passed" RESET "\n");
+        else
+                printf(RED "- uring: failed" RESET "\n");
+        if (test_ingest())
+                printf(GREEN "- ingest: passed" RESET "\n");
+        else
+                printf(RED "- ingest: failed" RESET "\n");
+        if (test_cdc())
+                printf(GREEN "- cdc: passed" RESET "\n");
+        else
+                printf(RED "- cdc: failed" RESET "\n");
+        if (test_obj_file())
+                printf(GREEN "- obj_file: passed" RESET "\n");
+        else
+                printf(RED "- obj_file: failed" RESET "\n");
+        if (test_pack())
+                printf(GREEN "- pack: passed" RESET "\n");
+        else
+                printf(RED "- pack: failed" RESET "\n");
+        if (test_shard())
+                printf(GREEN "- shard: passed" RESET "\n");
+        else
+                printf(RED "- shard: failed" RESET "\n");
+        if (test_oid_set())
+                printf(GREEN "- oid_set: passed" RESET "\n");
+        else
+                printf(RED "- oid_set: failed" RESET "\n");
+        if (test_repo_config())
+                printf(GREEN "- repo_config: passed" RESET "\n");
+        else
+                printf(RED "- repo_config: failed" RESET "\n");
+}
+
+/**
+ * Execute all compression module's unit tests.
+ *
+ * Executes all unit tests for the compression module and prints onto the
+ * screen if they passed or failed.
+ */
+static void
+test_compression(void)
+{
+        printf("\n[Compression Module]\n");
+        if (test_lz())
+                printf(GREEN "- lz: passed" RESET "\n");
+        else
+                printf(RED "- lz: failed" RESET "\n");
+}
+
+/**
+ * Execute all tools module's unit tests.
+ *
+ * Executes all unit tests for the tools module and prints onto the screen if
+ * they passed or failed.
+ */
+static void
+test_tools(void)
+{
+        printf("\n[Tools Module]\n");
+        if (test_stats())
+                printf(GREEN "- stats: passed" RESET "\n");
+        else
+                printf(RED "- stats: failed" RESET "\n");
 }
 
 static void
@@ -209,6 +374,22 @@ test_cli_arg_parsing(void)
                 printf(RED "- parse_opts: failed" RESET "\n");
 }
 
+/**
+ * Execute all commands' unit tests.
+ *
+ * Executes all unit tests for the commands and prints onto the screen if they
+ * passed or failed.
+ */
+static void
+test_cli_commands(void)
+{
+        printf("\n[Commands Module]\n");
+        if (test_chkin())
+                printf(GREEN "- chkin: passed" RESET "\n");
+        else
+                printf(RED "- chkin: failed" RESET "\n");
+}
+
 /**
  * Display all unit tests results to the user.
  *
@@ -219,10 +400,14 @@ int
 doctor(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags)
 {
         test_mem_slob();
+        test_mem_slab();
         test_core_wrappers();
         test_crypto();
         test_memory_utilities();
         test_core_module();
+        test_compression();
+        test_tools();
         test_cli_arg_parsing();
+        test_cli_commands();
         return 0;
 }
@@ -1,8 +1,12 @@
 #include "cli/cmd.h"
+#include "core/config.h"
+#include "core/cdc.h"
+#include "core/shard.h"
 #include "mem/slob.h"
 #include "errno.h"
 #include "unistd.h"
 #include "stdio.h"
+#include "stdlib.h"
 #include "const/const.h"
 #include "misc/decorations.h"
 #include "sys/stat.h"
@@ -34,7 +38,53 @@ int
 donut_init(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags)
 {
         register int st;
+        struct repo_config conf;
         char* path = argv[arg_idx];
+        char* scheme = opts + (ID_ARG_IDX * (MAX_ARG_SZ + 1));
+        char* policy = opts + (COMPRESS_ARG_IDX * (MAX_ARG_SZ + 1));
+        char* chunk = opts + (CHUNK_ARG_IDX * (MAX_ARG_SZ + 1));
+        char* end;
+
+        /* New repositories shard their objects and place large tables on
+         * transparent huge pages */
+        default_repo_config(&conf);
+        conf.shard_depth = SHARD_DEPTH_DEF;
+        conf.huge_pages = SLOB_PAGES_THP;
+        if (oflags & ID_OPT) {
+                st = id_scheme_from_str(scheme);
+                if (st < 0) {
+                        printf(DONUT_ERROR "Unsupported object ID scheme: %s\n",
+                               scheme);
+                        return -1;
+                }
+                conf.id_scheme = st;
+        }
+
+        /* A percentage only keeps objects compressed when they shrink by it */
+        if (oflags & COMPRESS_OPT) {
+                st = compress_from_str(policy);
+                conf.min_saving = strtoul(policy, &end, 10);
+                if (st < 0 && (*end || end == policy || conf.min_saving > 100)) {
+                        printf(DONUT_ERROR "Unsupported compression policy: %s\n",
+                               policy);
+                        return -1;
+                }
+                conf.compress = (st < 0) ? COMPRESS_SAVING : st;
+                if (st >= 0)
+                        conf.min_saving = COMPRESS_MIN_SAVING;
+        }
+
+        /* Chunking is opt-in, since a chunked file's ID is its list's */
+        if (oflags & CHUNK_OPT) {
+                conf.chunk_sz = (*chunk) ? strtoull(chunk, &end, 10) :
+                                CDC_AVG_SZ;
+                if ((*chunk && *end) || conf.chunk_sz < CDC_MIN_AVG ||
+                    conf.chunk_sz > CDC_MAX_AVG) {
+                        printf(DONUT_ERROR "The average chunk size must be\
+ between %d and %d bytes.\n", CDC_MIN_AVG, CDC_MAX_AVG);
+                        return -1;
+                }
+        }
 
         path = (path) ? path : ".";
         st = chdir(path);
@@ -50,8 +100,14 @@ donut_init(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags
         }
 
         st |= mkdir(DATA_FOLDER_RELATIVE, DIR_CTOR_MODE);
+        st |= mkdir(META_FOLDER_RELATIVE, DIR_CTOR_MODE);
+        st |= mkdir(TMP_FOLDER_RELATIVE, DIR_CTOR_MODE);
+        st |= write_repo_config(CONFIG_FILE_RELATIVE, &conf);
         if (st) {
                 printf(DONUT_ERROR "Failed initialization.\n");
+                remove(CONFIG_FILE_RELATIVE);
+                rmdir(TMP_FOLDER_RELATIVE);
+                rmdir(META_FOLDER_RELATIVE);
                 rmdir(DATA_FOLDER_RELATIVE);
                 rmdir(DONUT_FOLDER_RELATIVE);
                 return -1;
@@ -1,6 +1,10 @@
 #include "stdio.h"
 #include "string.h"
 #include "core/wrappers.h"
+#include "core/pack.h"
+#include "core/shard.h"
+#include "core/config.h"
+#include "crypto/sha2.h"
 #include "cli/cmd.h"
 #include "sys/stat.h"
 #include "mem/slob.h"
@@ -9,6 +13,22 @@
 #include "misc/decorations.h"
 #include "tools/validation.h"
 
+/**
+ * Print a loose object of a data directory.
+ *
+ * @param arg String containing the dataframe's name
+ * @param id Object ID
+ * @param path Path to the object
+ */
+static void
+print_object(void* arg, const uint8_t* id, const char* path)
+{
+        struct stat f;
+
+        if (!stat(path, &f))
+                printf("%s\t%19li\t%64s\n", (char*)arg, f.st_size,
+                       path + strlen(path) - (OID_STR_SZ - 1));
+}
 
 int
 ls_data(const int argc, char** argv, int arg_idx, char* opts,
@@ -20,9 +40,7 @@ ls_data(const int argc, char** argv, int arg_idx, char* opts,
                 return DEF_ERR;
         }
 
-        struct stat f;
-        struct dirent* entry;
-        struct slobs* slobs = init_slobs();
+        struct slobs* slobs = init_slobs("ls-data");
         char* cwd = alloc_slob(slobs, PAGE_SIZE);
         cwd = xgetcwd(cwd, PAGE_SIZE);
         strncat(cwd, DATA_FOLDER, 14);
@@ -35,20 +53,21 @@ ls_data(const int argc, char** argv, int arg_idx, char* opts,
                 df_name = "main";
         }
 
-        DIR* dir = xopendir(cwd);
-        size_t n_len, len = strnlen(cwd, PAGE_SIZE);
-        while ((entry = readdir(dir))) {
-                if (entry->d_type != DT_REG)
-                        continue;
+        struct repo_config conf;
+        read_repo_config(CONFIG_FILE_RELATIVE, &conf);
+        walk_objects(cwd, conf.shard_depth, print_object, df_name);
 
-                n_len = PAGE_SIZE - strlen(cwd);
-                strncat(cwd, entry->d_name, n_len);
-                stat(cwd, &f);
-                printf("%s\t%19li\t%32s\n", df_name, f.st_size, entry->d_name);
-                memset(cwd + len, 0x0, n_len);
+        /* Packed objects are listed after the loose ones */
+        char name[OID_STR_SZ];
+        struct packs* packs = open_packs(slobs, cwd);
+        for (unsigned int i = 0; i < packs->n; i++) {
+                for (uint64_t j = 0; j < packs->packs[i].hdr->count; j++) {
+                        sha2_to_str(packs->packs[i].entries[j].id, name);
+                        printf("%s\t%19li\t%64s\n", df_name,
+                               (long)packs->packs[i].entries[j].len, name);
+                }
         }
-
-        xclosedir(dir);
+        close_packs(packs);
         clear_slobs(slobs);
         return 0;
 }
@@ -0,0 +1,137 @@
+#include "cli/cmd.h"
+#include "core/wrappers.h"
+#include "core/pack.h"
+#include "core/shard.h"
+#include "core/config.h"
+#include "crypto/sha2.h"
+#include "mem/slob.h"
+#include "const/err.h"
+#include "const/const.h"
+#include "misc/decorations.h"
+#include "tools/validation.h"
+#include "tools/stats.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "fcntl.h"
+#include "sys/stat.h"
+
+/**
+ * @file repack.c
+ *
+ * Implements all functions and utilities used by the "repack" command.
+ */
+
+#define CTOR_MODE S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH
+
+/**
+ * State of a repack.
+ */
+struct repack_state {
+        struct packs* packs;    /**< Packs already in place          */
+        struct pack_writer* pw; /**< Pack being written              */
+        uint8_t* ids;           /**< Objects packed                  */
+        uint64_t n;             /**< Number of objects packed        */
+        uint64_t cap;           /**< Capacity of "ids"               */
+        uint64_t bytes;         /**< Number of bytes packed          */
+        uint64_t dropped;       /**< Loose copies of packed objects  */
+};
+
+/**
+ * Pack a loose object if it's small enough.
+ *
+ * @param arg State of the repack
+ * @param id Object ID
+ * @param path Path to the object
+ */
+static void
+repack_object(void* arg, const uint8_t* id, const char* path)
+{
+        struct repack_state* r = arg;
+        struct stat st;
+        int fd, pack_fd;
+
+        /* Copies left behind by an interrupted repack are dropped */
+        if (find_packed(r->packs, id, &pack_fd)) {
+                remove(path);
+                r->dropped++;
+                return;
+        }
+
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return;
+        if (!fstat(fd, &st) && st.st_size < PACK_OBJ_MAX) {
+                uint64_t t = stats_begin();
+
+                pack_object(r->pw, id, fd, st.st_size);
+                stats_end(PHASE_PACK, t, st.st_size, 1);
+                if (r->n == r->cap) {
+                        r->cap = (r->cap) ? r->cap << 1 : 1024;
+                        r->ids = xrealloc(r->ids, r->cap * OID_SZ);
+                }
+                memcpy(r->ids + r->n++ * OID_SZ, id, OID_SZ);
+                r->bytes += st.st_size;
+        }
+        xclose(fd);
+}
+
+int
+repack(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags)
+{
+        struct repack_state r = {0};
+        struct repo_config conf;
+        char name[OID_STR_SZ];
+        size_t len;
+        struct slobs* slobs;
+        char* path;
+        char* tmp;
+        char* df_name = opts + (NAME_ARG_IDX * MAX_ARG_SZ);
+
+        if (validate_donut_repo()) {
+                printf(DONUT_ERROR "Donut isn't initialized. Try running\
+ \"donut init\".\n");
+                return DEF_ERR;
+        }
+
+        read_repo_config(CONFIG_FILE_RELATIVE, &conf);
+        slobs = init_slobs("repack");
+        path = alloc_slob(slobs, PAGE_SIZE);
+        path = xgetcwd(path, PAGE_SIZE);
+        strncat(path, DATA_FOLDER, 14);
+        if (*df_name && strncmp(DEFAULT_DF, df_name, 4)) {
+                strncat(path, df_name, strnlen(df_name, MAX_ARG_SZ));
+                strncat(path, "/", 2);
+        }
+        len = strnlen(path, PAGE_SIZE);
+        tmp = alloc_slob(slobs, PAGE_SIZE);
+        tmp = xgetcwd(tmp, PAGE_SIZE);
+        strncat(tmp, "/" TMP_FOLDER_RELATIVE, PAGE_SIZE - strlen(tmp) - 1);
+        mkdir(TMP_FOLDER_RELATIVE, CTOR_MODE);
+
+        r.packs = open_packs(slobs, path);
+        r.pw = begin_pack(slobs, tmp);
+        walk_objects(path, conf.shard_depth, repack_object, &r);
+
+        /* Loose copies are only removed once the pack is in place */
+        if (end_pack(r.pw, path, name)) {
+                for (uint64_t i = 0; i < r.n; i++) {
+                        shard_name(conf.shard_depth, r.ids + i * OID_SZ,
+                                   path + len);
+                        remove(path);
+                }
+                printf(DONUT "Packed %lu objects (%lu bytes) into pack-%s\n",
+                       (unsigned long)r.n, (unsigned long)r.bytes, name);
+        } else {
+                printf(DONUT "No loose objects to pack\n");
+        }
+        if (r.dropped)
+                printf(DONUT "Removed %lu loose objects already packed\n",
+                       (unsigned long)r.dropped);
+
+        close_packs(r.packs);
+        free(r.ids);
+        clear_slobs(slobs);
+        return 0;
+}
@@ -0,0 +1,220 @@
+#include "cli/cmd.h"
+#include "core/wrappers.h"
+#include "core/config.h"
+#include "core/shard.h"
+#include "mem/slob.h"
+#include "const/err.h"
+#include "const/const.h"
+#include "misc/decorations.h"
+#include "tools/validation.h"
+#include "tools/stats.h"
+#include "dirent.h"
+#include "limits.h"
+#include "pthread.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+/**
+ * @file reshard.c
+ *
+ * Implements all functions and utilities used by the "reshard" command.
+ */
+
+/**
+ * @def MOVE_BATCH
+ * Number of objects a thread moves before claiming more.
+ */
+#define MOVE_BATCH 256
+
+/**
+ * Objects of a data directory being moved to a new depth.
+ */
+struct reshard {
+        struct shards* shards; /**< Shards of the new layout     */
+        unsigned int from;     /**< Depth of the old layout      */
+        uint8_t* ids;          /**< Objects to be moved          */
+        uint64_t n;            /**< Number of objects            */
+        uint64_t cap;          /**< Capacity of "ids"            */
+        uint64_t next;         /**< Next object to be claimed    */
+};
+
+/**
+ * Thread moving objects to their new shard.
+ */
+struct reshard_worker {
+        struct reshard* r; /**< Objects being moved          */
+        pthread_t tid;     /**< Thread's ID                  */
+        int started;       /**< Set if the thread is running */
+};
+
+/**
+ * Gather an object found in the old layout.
+ */
+static void
+found_object(void* arg, const uint8_t* id, const char* path)
+{
+        struct reshard* r = arg;
+
+        if (r->n == r->cap) {
+                r->cap = (r->cap) ? r->cap << 1 : 4096;
+                r->ids = xrealloc(r->ids, r->cap * OID_SZ);
+        }
+        memcpy(r->ids + r->n++ * OID_SZ, id, OID_SZ);
+}
+
+/**
+ * Move batches of objects until every object is claimed.
+ *
+ * @param arg Thread's structure
+ * @returns NULL
+ */
+static void*
+move_objects(void* arg)
+{
+        struct reshard* r = ((struct reshard_worker*)arg)->r;
+        struct shards* s = r->shards;
+        char src[PATH_MAX], dst[PATH_MAX];
+        const uint8_t* id;
+        uint64_t i, end, n, t;
+
+        memcpy(src, s->dir, s->len);
+        memcpy(dst, s->dir, s->len);
+        while ((i = __atomic_fetch_add(&r->next, MOVE_BATCH,
+                                       __ATOMIC_RELAXED)) < r->n) {
+                end = (i + MOVE_BATCH < r->n) ? i + MOVE_BATCH : r->n;
+                t = stats_begin();
+                n = end - i;
+                for (; i < end; i++) {
+                        id = r->ids + i * OID_SZ;
+                        shard_name(r->from, id, src + s->len);
+                        shard_name(s->depth, id, dst + s->len);
+                        make_shard(s, id);
+                        xrename(src, dst);
+                }
+                stats_end(PHASE_STORE, t, 0, n);
+        }
+
+        return NULL;
+}
+
+/**
+ * Move the objects of a data directory to a new depth.
+ *
+ * @param slobs Slob allocator
+ * @param dir String containing the path to the data directory
+ * @param from Depth of the old layout
+ * @param to Depth of the new layout
+ * @param jobs Number of threads moving objects
+ * @returns Number of objects moved.
+ */
+static uint64_t
+reshard_dir(struct slobs* slobs, const char* dir, unsigned int from,
+            unsigned int to, unsigned int jobs)
+{
+        struct reshard r = {0};
+        struct reshard_worker* workers;
+        unsigned int i;
+
+        r.from = from;
+        r.shards = open_shards(slobs, dir, to);
+        walk_objects(dir, from, found_object, &r);
+
+        /* The calling thread moves objects as well */
+        workers = alloc_slob(slobs, jobs * sizeof(struct reshard_worker));
+        for (i = 0; i < jobs; i++)
+                workers[i].r = &r;
+        for (i = 1; i < jobs; i++)
+                workers[i].started = !pthread_create(&workers[i].tid, NULL,
+                                                     move_objects, &workers[i]);
+        move_objects(&workers[0]);
+        for (i = 1; i < jobs; i++)
+                if (workers[i].started)
+                        pthread_join(workers[i].tid, NULL);
+
+        prune_shards(dir, from);
+        free_slob(slobs, workers);
+        free(r.ids);
+        return r.n;
+}
+
+int
+reshard(const int argc, char** argv, int arg_idx, char* opts, uint64_t oflags)
+{
+        struct repo_config conf;
+        struct dirent* entry;
+        unsigned long depth, jobs = N_CPU;
+        uint64_t n;
+        size_t len;
+        char* end;
+        char* path;
+        DIR* dir;
+        struct slobs* slobs;
+        char* jobs_arg = opts + (JOBS_ARG_IDX * (MAX_ARG_SZ + 1));
+
+        if (validate_donut_repo() || !argv[arg_idx]) {
+                printf(DONUT_ERROR "Donut isn't initialized or no depth was\
+ given. Try running \"donut init\" or check your arguments.\n");
+                return DEF_ERR;
+        }
+
+        depth = strtoul(argv[arg_idx], &end, 10);
+        if (*end || end == argv[arg_idx] || depth > SHARD_DEPTH_MAX) {
+                printf(DONUT_ERROR "The shard depth must be between 0 and %d.\n",
+                       SHARD_DEPTH_MAX);
+                return DEF_ERR;
+        }
+
+        if (oflags & JOBS_OPT) {
+                jobs = strtoul(jobs_arg, &end, 10);
+                if (*end || !jobs || jobs > MAX_JOBS) {
+                        printf(DONUT_ERROR "The number of jobs must be between\
+ 1 and %d.\n", MAX_JOBS);
+                        return DEF_ERR;
+                }
+        }
+
+        read_repo_config(CONFIG_FILE_RELATIVE, &conf);
+        if (conf.shard_depth == depth) {
+                printf(DONUT "Objects are already at a shard depth of %lu\n",
+                       depth);
+                return 0;
+        }
+
+        slobs = init_slobs("reshard");
+        path = alloc_slob(slobs, PAGE_SIZE);
+        path = xgetcwd(path, PAGE_SIZE);
+        strncat(path, DATA_FOLDER, 14);
+        len = strnlen(path, PAGE_SIZE);
+
+        /*
+         * Dataframes share the repository's depth. Folders named like shards
+         * are taken for shards, even those left by an interrupted run.
+         */
+        n = 0;
+        dir = xopendir(path);
+        while ((entry = readdir(dir))) {
+                if (entry->d_type != DT_DIR || entry->d_name[0] == '.' ||
+                    is_shard(entry->d_name))
+                        continue;
+
+                snprintf(path + len, PAGE_SIZE - len, "%s/", entry->d_name);
+                n += reshard_dir(slobs, path, conf.shard_depth, depth, jobs);
+        }
+        xclosedir(dir);
+        path[len] = '\0';
+        n += reshard_dir(slobs, path, conf.shard_depth, depth, jobs);
+
+        /* Only switched once every object is in place, a rerun resumes */
+        conf.shard_depth = depth;
+        if (write_repo_config(CONFIG_FILE_RELATIVE, &conf)) {
+                printf(DONUT_ERROR "Failed to write the configuration.\n");
+                clear_slobs(slobs);
+                return DEF_ERR;
+        }
+
+        printf(DONUT "Moved %lu objects to a shard depth of %lu\n",
+               (unsigned long)n, depth);
+        clear_slobs(slobs);
+        return 0;
+}
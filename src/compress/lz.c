@@ -0,0 +1,305 @@
+#include "compress/lz.h"
+#include "stdlib.h"
+#include "string.h"
+
+/**
+ * @file lz.c
+ * Implementation of donut's LZ codec.
+ */
+
+/**
+ * @def LZ_LAST_LITERALS
+ * Number of bytes at the end of a buffer which are always literals.
+ */
+#define LZ_LAST_LITERALS 5
+
+/**
+ * @def LZ_MF_LIMIT
+ * Matches don't start in this many bytes at the end of a buffer.
+ */
+#define LZ_MF_LIMIT 12
+
+/**
+ * @def LZ_SKIP_TRIGGER
+ * Bytes without a match before the search starts skipping over data.
+ */
+#define LZ_SKIP_TRIGGER 6
+
+/**
+ * Load 4 bytes from an unaligned address.
+ *
+ * @param p Address of the bytes.
+ * @returns The bytes as an integer.
+ */
+static inline uint32_t
+lz_load(const uint8_t* p)
+{
+        uint32_t v;
+
+        memcpy(&v, p, sizeof(v));
+        return v;
+}
+
+/**
+ * Hash a sequence of 4 bytes.
+ *
+ * @param v Sequence's bytes.
+ * @returns Index of the sequence in the hash table.
+ */
+static inline uint32_t
+lz_hash(uint32_t v)
+{
+        return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * Write a length in a token's nibble and the extra length bytes.
+ *
+ * @param op Position where the extra bytes are written.
+ * @param token Token with the nibble.
+ * @param shift Position of the nibble within the token.
+ * @param len Length to be written.
+ * @returns Position after the extra bytes.
+ */
+static inline uint8_t*
+lz_put_len(uint8_t* op, uint8_t* token, int shift, size_t len)
+{
+        if (len < 15) {
+                *token |= (uint8_t)(len << shift);
+                return op;
+        }
+
+        *token |= (uint8_t)(15 << shift);
+        for (len -= 15; len >= 255; len -= 255)
+                *op++ = 255;
+        *op++ = (uint8_t)len;
+        return op;
+}
+
+/**
+ * Write a sequence.
+ *
+ * @param op Position where the sequence is written.
+ * @param oend End of the output buffer.
+ * @param lit Literals of the sequence.
+ * @param n_lit Number of literals.
+ * @param off Offset of the match or 0 if the sequence is the last.
+ * @param n_match Length of the match.
+ * @returns Position after the sequence or NULL if it doesn't fit the output.
+ */
+static uint8_t*
+lz_put_seq(uint8_t* op, const uint8_t* oend, const uint8_t* lit, size_t n_lit,
+           size_t off, size_t n_match)
+{
+        uint8_t* token = op++;
+
+        if ((size_t)(oend - op) < n_lit + n_lit / 255 + n_match / 255 + 4)
+                return NULL;
+
+        *token = 0;
+        op = lz_put_len(op, token, 4, n_lit);
+        memcpy(op, lit, n_lit);
+        op += n_lit;
+        if (!off)
+                return op;
+
+        *op++ = (uint8_t)off;
+        *op++ = (uint8_t)(off >> 8);
+        return lz_put_len(op, token, 0, n_match - LZ_MIN_MATCH);
+}
+
+size_t
+lz_bound(size_t len)
+{
+        return len + len / 255 + 16;
+}
+
+size_t
+lz_compress(const uint8_t* in, size_t len, uint8_t* out, size_t cap,
+            uint32_t* table)
+{
+        const uint8_t* ip = in;
+        const uint8_t* anchor = in;
+        const uint8_t* end = in + len;
+        const uint8_t* mflimit;
+        const uint8_t* mlimit;
+        const uint8_t* ref;
+        const uint8_t* m;
+        const uint8_t* oend = out + cap;
+        uint8_t* op = out;
+        uint32_t seq, h;
+
+        if (!cap)
+                return 0;
+
+        /* Empty slots point at the start, which is ruled out by the compare */
+        memset(table, 0x0, LZ_TABLE_SZ);
+        if (len < LZ_MF_LIMIT + 1)
+                goto last_literals;
+
+        mflimit = end - LZ_MF_LIMIT;
+        mlimit = end - LZ_LAST_LITERALS;
+
+        for (ip++; ip < mflimit;) {
+                seq = lz_load(ip);
+                h = lz_hash(seq);
+                ref = in + table[h];
+                table[h] = (uint32_t)(ip - in);
+
+                if (ip - ref > LZ_MAX_OFFSET || ref >= ip ||
+                    lz_load(ref) != seq) {
+                        ip += 1 + ((ip - anchor) >> LZ_SKIP_TRIGGER);
+                        continue;
+                }
+
+                while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+                        ip--;
+                        ref--;
+                }
+
+                for (m = ip + LZ_MIN_MATCH; m < mlimit && *m == ref[m - ip]; m++)
+                        ;
+
+                op = lz_put_seq(op, oend, anchor, ip - anchor, ip - ref, m - ip);
+                if (!op)
+                        return 0;
+                anchor = ip = m;
+        }
+
+last_literals:
+        op = lz_put_seq(op, oend, anchor, end - anchor, 0, 0);
+        return (op) ? (size_t)(op - out) : 0;
+}
+
+/**
+ * Read a length's extra bytes.
+ *
+ * @param ip Position of the extra bytes, moved past them.
+ * @param iend End of the input buffer.
+ * @param len Length in the token's nibble, which is increased.
+ * @returns Returns 0 on success or -1 if the input ends.
+ */
+static inline int
+lz_get_len(const uint8_t** ip, const uint8_t* iend, size_t* len)
+{
+        uint8_t b;
+
+        if (*len != 15)
+                return 0;
+
+        do {
+                if (*ip >= iend)
+                        return -1;
+                b = *(*ip)++;
+                *len += b;
+        } while (b == 255);
+
+        return 0;
+}
+
+int
+lz_decompress(const uint8_t* in, size_t len, uint8_t* out, size_t size)
+{
+        const uint8_t* ip = in;
+        const uint8_t* iend = in + len;
+        uint8_t* op = out;
+        uint8_t* oend = out + size;
+        size_t n_lit, n_match, off;
+        uint8_t token;
+
+        while (ip < iend) {
+                token = *ip++;
+                n_lit = token >> 4;
+                if (lz_get_len(&ip, iend, &n_lit) ||
+                    n_lit > (size_t)(iend - ip) || n_lit > (size_t)(oend - op))
+                        return -1;
+
+                memcpy(op, ip, n_lit);
+                ip += n_lit;
+                op += n_lit;
+                if (ip == iend)
+                        break;
+
+                if (iend - ip < 2)
+                        return -1;
+                off = ip[0] | (ip[1] << 8);
+                ip += 2;
+
+                n_match = token & 15;
+                if (lz_get_len(&ip, iend, &n_match))
+                        return -1;
+                n_match += LZ_MIN_MATCH;
+                if (!off || off > (size_t)(op - out) ||
+                    n_match > (size_t)(oend - op))
+                        return -1;
+
+                /* Overlapping matches repeat the bytes just written */
+                if (off >= n_match) {
+                        memcpy(op, op - off, n_match);
+                        op += n_match;
+                } else {
+                        for (; n_match; n_match--, op++)
+                                *op = op[-off];
+                }
+        }
+
+        return (op == oend && ip == iend) ? 0 : -1;
+}
+
+int
+test_lz(void)
+{
+        int ret = 1;
+        size_t i, n, len = 256 * 1024, lens[5] = {0, 1, 13, 4096, len};
+        uint64_t x = 0x9e3779b97f4a7c15ull;
+        uint8_t* in = malloc(len);
+        uint8_t* out = malloc(lz_bound(len));
+        uint8_t* dec = malloc(len);
+        uint32_t* table = malloc(LZ_TABLE_SZ);
+        const char* words[4] = {"id,", "name,", "3.14159,", "\"donut\"\n"};
+
+        /* Text-like data shrinks, random data stays close to its size */
+        for (int t = 0; t < 3; t++) {
+                for (i = 0; i < len; i++) {
+                        x ^= x << 13;
+                        x ^= x >> 7;
+                        x ^= x << 17;
+                        in[i] = (t == 1) ? (uint8_t)x : 0;
+                }
+
+                /* Rows of random fields, like a CSV file */
+                for (i = 0; t == 0 && i < len; i += n) {
+                        x ^= x << 13;
+                        x ^= x >> 7;
+                        x ^= x << 17;
+                        n = strlen(words[x % 4]);
+                        memcpy(in + i, words[x % 4], (len - i < n) ? len - i : n);
+                }
+
+                for (int l = 0; l < 5; l++) {
+                        n = lz_compress(in, lens[l], out, lz_bound(lens[l]),
+                                        table);
+                        ret &= (n && n <= lz_bound(lens[l])) ? 1 : 0;
+                        ret &= !lz_decompress(out, n, dec, lens[l]);
+                        ret &= !memcmp(in, dec, lens[l]);
+                }
+
+                n = lz_compress(in, len, out, lz_bound(len), table);
+                ret &= (t != 1 && n < len / 2) || (t == 1 && n > len) ? 1 : 0;
+        }
+
+        /* Output which doesn't fit and corrupt data are reported */
+        n = lz_compress(in, len, out, lz_bound(len), table);
+        ret &= (lz_compress(in, len, out, n - 1, table) == 0) ? 1 : 0;
+        ret &= (lz_decompress(out, n, dec, len - 1) == -1) ? 1 : 0;
+        ret &= (lz_decompress(out, n - 1, dec, len) == -1) ? 1 : 0;
+        out[1] = 0xff;
+        out[2] = 0xff;
+        ret &= (lz_decompress(out, n, dec, len) == -1) ? 1 : 0;
+
+        free(table);
+        free(dec);
+        free(out);
+        free(in);
+        return ret;
+}
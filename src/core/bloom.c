@@ -0,0 +1,334 @@
+#include "core/bloom.h"
+#include "core/object.h"
+#include "core/wrappers.h"
+#include "crypto/sha2.h"
+#include "const/const.h"
+#include "const/err.h"
+#include "misc/decorations.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+
+/**
+ * @file bloom.c
+ * Implementation of the persistent blocked Bloom filters.
+ */
+
+/**
+ * @def BLOOM_MAGIC
+ * Bytes "DBLM" identifying a filter, read in host byte order.
+ */
+#define BLOOM_MAGIC 0x4d4c4244
+
+/**
+ * @def BLOOM_VERSION
+ * Version of the filter's format.
+ */
+#define BLOOM_VERSION 1
+
+/**
+ * @def BLOCK_SZ
+ * Byte size of a block, which holds all the bits of an ID.
+ */
+#define BLOCK_SZ 64
+
+/**
+ * @def BITS_PER_ID
+ * Number of filter bits reserved for each ID of the capacity.
+ */
+#define BITS_PER_ID 16
+
+/**
+ * @def N_HASHES
+ * Number of bits set in a block for each ID.
+ */
+#define N_HASHES 8
+
+/**
+ * @def TMP_EXT
+ * Extension appended to the filter's path while a new one is populated.
+ */
+#define TMP_EXT ".tmp"
+
+/**
+ * Header at the start of a filter's file, padded to a block.
+ */
+struct bloom_header {
+        uint32_t magic;    /**< Must be BLOOM_MAGIC           */
+        uint32_t version;  /**< Must be BLOOM_VERSION         */
+        uint64_t n_blocks; /**< Number of blocks              */
+        uint64_t capacity; /**< Number of IDs it's sized for  */
+        uint64_t count;    /**< Number of IDs added           */
+        uint8_t pad[BLOCK_SZ - 32];
+};
+
+struct bloom {
+        struct bloom_header* hdr; /**< Mapped file                      */
+        uint64_t* blocks;         /**< Blocks following the header       */
+        size_t map_sz;            /**< Size of the mapping               */
+        char* path;               /**< Path to the filter                */
+        char* tmp;                /**< Path while being created or NULL  */
+};
+
+/**
+ * Map a filter's file and set up its bookkeeping.
+ *
+ * @param slobs Slob allocator used for the bookkeeping.
+ * @param fd File descriptor of the filter's file.
+ * @param sz Size of the file.
+ * @returns Pointer to the filter or NULL if the file couldn't be mapped.
+ */
+static struct bloom*
+map_bloom(struct slobs* slobs, int fd, size_t sz)
+{
+        struct bloom* b;
+        void* mem = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (mem == MAP_FAILED)
+                return NULL;
+
+        b = alloc_slob(slobs, sizeof(struct bloom));
+        b->hdr = mem;
+        b->blocks = (uint64_t*)((uint8_t*)mem + sizeof(struct bloom_header));
+        b->map_sz = sz;
+        return b;
+}
+
+struct bloom*
+open_bloom(struct slobs* slobs, const char* path)
+{
+        struct stat st;
+        struct bloom* b = NULL;
+        int fd = open(path, O_RDWR);
+
+        if (fd < 0)
+                return NULL;
+
+        if (!fstat(fd, &st) && (size_t)st.st_size >= sizeof(struct bloom_header))
+                b = map_bloom(slobs, fd, st.st_size);
+        xclose(fd);
+
+        if (!b)
+                return NULL;
+
+        if (b->hdr->magic != BLOOM_MAGIC || b->hdr->version != BLOOM_VERSION ||
+            !b->hdr->n_blocks || (size_t)st.st_size !=
+            sizeof(struct bloom_header) + b->hdr->n_blocks * BLOCK_SZ) {
+                close_bloom(b);
+                return NULL;
+        }
+
+        b->path = alloc_slob(slobs, PAGE_SIZE);
+        snprintf(b->path, PAGE_SIZE, "%s", path);
+        return b;
+}
+
+struct bloom*
+create_bloom(struct slobs* slobs, const char* path, uint64_t capacity)
+{
+        struct bloom* b;
+        char* tmp = alloc_slob(slobs, PAGE_SIZE);
+        uint64_t n_blocks = (capacity * BITS_PER_ID + BLOCK_SZ * 8 - 1) /
+                            (BLOCK_SZ * 8);
+        size_t sz;
+        int fd;
+
+        n_blocks = (n_blocks) ? n_blocks : 1;
+        sz = sizeof(struct bloom_header) + n_blocks * BLOCK_SZ;
+
+        snprintf(tmp, PAGE_SIZE, "%s" TMP_EXT, path);
+        fd = xopen(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (ftruncate(fd, sz) || !(b = map_bloom(slobs, fd, sz))) {
+                printf(DONUT_ERROR "Failed to create the object filter: %s\n",
+                       path);
+                exit(DEF_ERR);
+        }
+        xclose(fd);
+
+        b->hdr->magic = BLOOM_MAGIC;
+        b->hdr->version = BLOOM_VERSION;
+        b->hdr->n_blocks = n_blocks;
+        b->hdr->capacity = capacity;
+        b->path = alloc_slob(slobs, PAGE_SIZE);
+        snprintf(b->path, PAGE_SIZE, "%s", path);
+        b->tmp = tmp;
+        return b;
+}
+
+void
+save_bloom(struct bloom* b)
+{
+        msync(b->hdr, b->map_sz, MS_SYNC);
+        if (b->tmp) {
+                xrename(b->tmp, b->path);
+                b->tmp = NULL;
+        }
+}
+
+void
+close_bloom(struct bloom* b)
+{
+        munmap(b->hdr, b->map_sz);
+        if (b->tmp)
+                remove(b->tmp);
+}
+
+/**
+ * Obtain the block of an ID.
+ *
+ * IDs are SHA-2 digests, so their bytes are used as the hash. The bytes used
+ * by the data_list's hash table are skipped.
+ *
+ * @param b Filter whose block is obtained.
+ * @param id Object ID.
+ * @returns Pointer to the block's 8 words.
+ */
+inline static uint64_t*
+id_block(struct bloom* b, const uint8_t* id)
+{
+        uint64_t h;
+
+        memcpy(&h, id + 8, sizeof(h));
+        return b->blocks + (h % b->hdr->n_blocks) * (BLOCK_SZ / 8);
+}
+
+/**
+ * Obtain the N_HASHES bit positions of an ID within its block.
+ *
+ * @param id Object ID.
+ * @param bits Array where the positions are placed.
+ */
+inline static void
+id_bits(const uint8_t* id, uint16_t* bits)
+{
+        for (int i = 0; i < N_HASHES; i++)
+                bits[i] = (id[16 + 2 * i] | (id[17 + 2 * i] << 8)) &
+                          (BLOCK_SZ * 8 - 1);
+}
+
+void
+bloom_add(struct bloom* b, const uint8_t* id)
+{
+        uint64_t* blk = id_block(b, id);
+        uint16_t bits[N_HASHES];
+
+        id_bits(id, bits);
+        for (int i = 0; i < N_HASHES; i++)
+                __atomic_fetch_or(&blk[bits[i] >> 6], 1ull << (bits[i] & 63),
+                                  __ATOMIC_RELAXED);
+
+        __atomic_fetch_add(&b->hdr->count, 1, __ATOMIC_RELAXED);
+}
+
+int
+bloom_has(struct bloom* b, const uint8_t* id)
+{
+        uint64_t* blk = id_block(b, id);
+        uint64_t mask[BLOCK_SZ / 8] = {0};
+        uint16_t bits[N_HASHES];
+        uint64_t miss = 0;
+
+        id_bits(id, bits);
+        for (int i = 0; i < N_HASHES; i++)
+                mask[bits[i] >> 6] |= 1ull << (bits[i] & 63);
+
+        for (int i = 0; i < BLOCK_SZ / 8; i++)
+                miss |= mask[i] & ~__atomic_load_n(&blk[i], __ATOMIC_RELAXED);
+
+        return !miss;
+}
+
+uint64_t
+bloom_count(struct bloom* b)
+{
+        return __atomic_load_n(&b->hdr->count, __ATOMIC_RELAXED);
+}
+
+uint64_t
+bloom_capacity(struct bloom* b)
+{
+        return b->hdr->capacity;
+}
+
+uint64_t
+bloom_mem(struct bloom* b)
+{
+        return b->map_sz;
+}
+
+double
+bloom_fp_rate(struct bloom* b)
+{
+        double fp = 0, fill, p;
+        uint64_t i, set;
+        int j;
+
+        /* An absent ID is found if its bits fall on set bits of its block */
+        for (i = 0; i < b->hdr->n_blocks; i++) {
+                set = 0;
+                for (j = 0; j < BLOCK_SZ / 8; j++)
+                        set += __builtin_popcountll(b->blocks[i * 8 + j]);
+
+                fill = (double)set / (BLOCK_SZ * 8);
+                for (p = 1, j = 0; j < N_HASHES; j++)
+                        p *= fill;
+                fp += p;
+        }
+
+        return fp / b->hdr->n_blocks;
+}
+
+int
+test_bloom(void)
+{
+        int ret = 1;
+        uint8_t id[OID_SZ];
+        uint32_t i, j, fp = 0, n = 10000;
+        void* state = calloc(1, SHA_STRUCT_SZ);
+        char* path = calloc(1, PAGE_SIZE);
+        struct slobs* slobs = init_slobs("test");
+        struct bloom* b;
+
+        snprintf(path, PAGE_SIZE, "%s/donut_test_bloom", getenv("HOME"));
+        remove(path);
+
+        /* Created filters aren't visible until saved */
+        b = create_bloom(slobs, path, n);
+        ret &= (access(path, F_OK) == -1) ? 1 : 0;
+        ret &= (bloom_fp_rate(b) == 0) ? 1 : 0;
+
+        for (i = 0; i < n; i++) {
+                sha2_hash((uint8_t*)&i, id, state, sizeof(i));
+                bloom_add(b, id);
+        }
+        save_bloom(b);
+        close_bloom(b);
+
+        /* Every ID added is found after reopening */
+        b = open_bloom(slobs, path);
+        ret &= (b && bloom_count(b) == n && bloom_capacity(b) == n) ? 1 : 0;
+        for (i = 0; b && i < n; i++) {
+                sha2_hash((uint8_t*)&i, id, state, sizeof(i));
+                ret &= bloom_has(b, id);
+        }
+
+        /* Absent IDs are rarely found, as estimated */
+        for (i = 0; b && i < n; i++) {
+                j = i + n;
+                sha2_hash((uint8_t*)&j, id, state, sizeof(j));
+                fp += bloom_has(b, id);
+        }
+        ret &= (fp < n / 100) ? 1 : 0;
+        ret &= (b && bloom_fp_rate(b) < 0.01) ? 1 : 0;
+
+        if (b)
+                close_bloom(b);
+        remove(path);
+        clear_slobs(slobs);
+        free(state);
+        free(path);
+        return ret;
+}
@@ -0,0 +1,175 @@
+#include "core/cdc.h"
+#include "crypto/sha2.h"
+#include "stdlib.h"
+#include "string.h"
+
+/**
+ * @file cdc.c
+ * Implementation of the content-defined chunking.
+ */
+
+/**
+ * @def CDC_GEAR_SEED
+ * Seed of the Gear values. Changing it moves every chunk boundary.
+ */
+#define CDC_GEAR_SEED 0x646f6e7574636463ull
+
+/**
+ * Obtain a mask with a number of bits set below the hash's top bit.
+ *
+ * The top bits of a Gear hash depend on the most bytes, while the top bit is
+ * left clear so the mask can be shifted for the two byte step.
+ *
+ * @param bits Number of bits set.
+ * @returns The mask.
+ */
+static uint64_t
+cdc_mask(unsigned int bits)
+{
+        return ((1ull << bits) - 1) << (63 - bits);
+}
+
+void
+cdc_init(struct cdc* c, uint64_t avg)
+{
+        uint64_t z, seed = CDC_GEAR_SEED;
+        unsigned int bits = 0;
+
+        avg = (avg < CDC_MIN_AVG) ? CDC_MIN_AVG :
+              (avg > CDC_MAX_AVG) ? CDC_MAX_AVG : avg;
+        while ((2ull << bits) <= avg)
+                bits++;
+
+        c->avg = 1ull << bits;
+        c->min = c->avg / 4;
+        c->max = c->avg * 8;
+        c->mask_s = cdc_mask(bits + 2);
+        c->mask_l = cdc_mask(bits - 2);
+
+        for (int i = 0; i < 256; i++) {
+                z = (seed += 0x9e3779b97f4a7c15ull);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                c->gear[i] = z ^ (z >> 31);
+                c->gear_ls[i] = c->gear[i] << 1;
+        }
+}
+
+size_t
+cdc_cut(const struct cdc* c, const uint8_t* in, size_t len)
+{
+        const uint64_t mask_s = c->mask_s, mask_l = c->mask_l;
+        uint64_t h = 0;
+        size_t i, normal;
+
+        if (len <= c->min)
+                return len;
+        if (len > c->max)
+                len = c->max;
+        normal = (len < c->avg) ? len : c->avg;
+
+        /*
+         * Bytes before the minimum size are skipped. The first byte of a pair
+         * leaves the hash shifted by one, so it's checked with shifted masks.
+         */
+        for (i = c->min; i + 1 < normal; i += 2) {
+                h = (h << 2) + c->gear_ls[in[i]];
+                if (!(h & (mask_s << 1)))
+                        return i + 1;
+                h += c->gear[in[i + 1]];
+                if (!(h & mask_s))
+                        return i + 2;
+        }
+
+        for (; i + 1 < len; i += 2) {
+                h = (h << 2) + c->gear_ls[in[i]];
+                if (!(h & (mask_l << 1)))
+                        return i + 1;
+                h += c->gear[in[i + 1]];
+                if (!(h & mask_l))
+                        return i + 2;
+        }
+
+        return len;
+}
+
+/**
+ * Split a buffer into chunks and hash them.
+ *
+ * @param c Chunking parameters.
+ * @param in Buffer with the data.
+ * @param len Number of bytes in the buffer.
+ * @param ids Buffer where the hashes of the chunks are placed.
+ * @param state Buffer for the hash state.
+ * @returns Number of chunks or 0 if a chunk broke the size bounds.
+ */
+static size_t
+test_cdc_split(const struct cdc* c, uint8_t* in, size_t len, uint8_t* ids,
+               void* state)
+{
+        size_t n = 0, off = 0, cut;
+
+        while (off < len) {
+                cut = cdc_cut(c, in + off, len - off);
+                if (!cut || cut > c->max || (cut < c->min && off + cut < len))
+                        return 0;
+
+                sha2_hash(in + off, ids + n++ * OID_SZ, state, cut);
+                off += cut;
+        }
+
+        return n;
+}
+
+int
+test_cdc(void)
+{
+        int ret = 1;
+        struct cdc* c = malloc(sizeof(struct cdc));
+        size_t i, j, n_a, n_b, shared = 0, len = 4 * 1024 * 1024;
+        uint64_t x;
+        uint8_t* a = malloc(len);
+        uint8_t* b = malloc(len + 100);
+        uint8_t* ids_a = malloc(len / 256 * OID_SZ);
+        uint8_t* ids_b = malloc(len / 256 * OID_SZ);
+        void* state = malloc(SHA_STRUCT_SZ);
+
+        cdc_init(c, 8 * 1024);
+        ret &= (c->avg == 8 * 1024 && c->min == 2048 && c->max == 65536) ? 1 : 0;
+
+        for (i = 0, x = CDC_GEAR_SEED; i < len; i++) {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                a[i] = (uint8_t)x;
+        }
+
+        /* Insert bytes in the middle */
+        memcpy(b, a, len / 2);
+        memset(b + len / 2, 'x', 100);
+        memcpy(b + len / 2 + 100, a + len / 2, len / 2);
+
+        n_a = test_cdc_split(c, a, len, ids_a, state);
+        n_b = test_cdc_split(c, b, len + 100, ids_b, state);
+        ret &= (n_a > len / (c->avg * 2) && n_a < len / (c->avg / 2)) ? 1 : 0;
+
+        for (i = 0; i < n_b; i++)
+                for (j = 0; j < n_a; j++)
+                        if (!memcmp(ids_b + i * OID_SZ, ids_a + j * OID_SZ,
+                                    OID_SZ)) {
+                                shared++;
+                                break;
+                        }
+
+        /* Only the chunks around the insertion are new: the one edited, which
+         * may be split, and those before the boundaries line up again */
+        ret &= (n_b && shared + 4 >= n_b) ? 1 : 0;
+
+        free(state);
+        free(ids_b);
+        free(ids_a);
+        free(b);
+        free(a);
+        free(c);
+        return ret;
+}
@@ -0,0 +1,250 @@
+#include "core/config.h"
+#include "core/wrappers.h"
+#include "core/shard.h"
+#include "const/const.h"
+#include "const/err.h"
+#include "misc/decorations.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+
+/**
+ * @file config.c
+ * Implementation of the repository's configuration file.
+ */
+
+/**
+ * @def CONF_KEY_SZ
+ * Maximum number of characters in a configuration key.
+ */
+#define CONF_KEY_SZ 63
+
+/**
+ * @def CONF_VAL_SZ
+ * Maximum number of characters in a configuration value.
+ */
+#define CONF_VAL_SZ 127
+
+/**
+ * Names of the object ID schemes indexed by their ID.
+ */
+static const char* id_schemes[] = {"sha256", "tree"};
+
+/**
+ * Names of the compression policies indexed by their ID.
+ */
+static const char* compress_policies[] = {"never", "always", "saving"};
+
+/**
+ * Names of the pages backing large tables indexed by SLOB_PAGES_*.
+ */
+static const char* huge_pages[] = {"off", "transparent", "hugetlb"};
+
+void
+default_repo_config(struct repo_config* conf)
+{
+        memset(conf, 0x0, sizeof(struct repo_config));
+        conf->id_scheme = ID_SCHEME_SHA256;
+        conf->leaf_sz = TREE_LEAF_SZ;
+        conf->compress = COMPRESS_NEVER;
+        conf->min_saving = COMPRESS_MIN_SAVING;
+}
+
+int
+id_scheme_from_str(const char* name)
+{
+        for (size_t i = 0; i < sizeof(id_schemes) / sizeof(id_schemes[0]); i++)
+                if (!strncmp(id_schemes[i], name, CONF_VAL_SZ))
+                        return i;
+
+        return DEF_ERR;
+}
+
+const char*
+id_scheme_to_str(uint32_t scheme)
+{
+        return id_schemes[scheme];
+}
+
+int
+compress_from_str(const char* name)
+{
+        for (size_t i = 0; i < sizeof(compress_policies) /
+             sizeof(compress_policies[0]); i++)
+                if (!strncmp(compress_policies[i], name, CONF_VAL_SZ))
+                        return i;
+
+        return DEF_ERR;
+}
+
+const char*
+compress_to_str(uint32_t policy)
+{
+        return compress_policies[policy];
+}
+
+int
+huge_pages_from_str(const char* name)
+{
+        for (size_t i = 0; i < sizeof(huge_pages) / sizeof(huge_pages[0]); i++)
+                if (!strncmp(huge_pages[i], name, CONF_VAL_SZ))
+                        return i;
+
+        return DEF_ERR;
+}
+
+const char*
+huge_pages_to_str(uint32_t pages)
+{
+        return huge_pages[pages];
+}
+
+/**
+ * Update the configuration with a single "key = value" line.
+ *
+ * Unknown keys are ignored so that older versions of donut are able to read
+ * configurations written by newer ones.
+ *
+ * @param line String containing the line.
+ * @param conf Configuration to be updated.
+ */
+static void
+parse_config_line(const char* line, struct repo_config* conf)
+{
+        char key[CONF_KEY_SZ + 1], val[CONF_VAL_SZ + 1];
+        int scheme, policy, pages;
+
+        if (sscanf(line, " %63[^= \t] = %127s", key, val) != 2)
+                return;
+
+        if (!strncmp(key, "id_scheme", CONF_KEY_SZ)) {
+                scheme = id_scheme_from_str(val);
+                if (scheme < 0) {
+                        printf(DONUT_ERROR "Unsupported object ID scheme: %s\n",
+                               val);
+                        exit(DEF_ERR);
+                }
+                conf->id_scheme = scheme;
+        } else if (!strncmp(key, "leaf_size", CONF_KEY_SZ)) {
+                conf->leaf_sz = strtoull(val, NULL, 10);
+        } else if (!strncmp(key, "chunk_size", CONF_KEY_SZ)) {
+                conf->chunk_sz = strtoull(val, NULL, 10);
+        } else if (!strncmp(key, "compression", CONF_KEY_SZ)) {
+                policy = compress_from_str(val);
+                if (policy < 0) {
+                        printf(DONUT_ERROR "Unsupported compression policy: %s\n",
+                               val);
+                        exit(DEF_ERR);
+                }
+                conf->compress = policy;
+        } else if (!strncmp(key, "min_saving", CONF_KEY_SZ)) {
+                conf->min_saving = strtoul(val, NULL, 10);
+        } else if (!strncmp(key, "shard_depth", CONF_KEY_SZ)) {
+                conf->shard_depth = strtoul(val, NULL, 10);
+                if (conf->shard_depth > SHARD_DEPTH_MAX) {
+                        printf(DONUT_ERROR "Unsupported shard depth: %s\n", val);
+                        exit(DEF_ERR);
+                }
+        } else if (!strncmp(key, "huge_pages", CONF_KEY_SZ)) {
+                pages = huge_pages_from_str(val);
+                if (pages < 0) {
+                        printf(DONUT_ERROR "Unsupported huge pages: %s\n", val);
+                        exit(DEF_ERR);
+                }
+                conf->huge_pages = pages;
+        }
+}
+
+void
+read_repo_config(const char* path, struct repo_config* conf)
+{
+        int fd;
+        size_t bytes;
+        char* line;
+        char* save;
+        char* buf;
+
+        default_repo_config(conf);
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return;
+
+        buf = xcalloc(1, PAGE_SIZE);
+        bytes = xread(fd, buf, PAGE_SIZE - 1);
+        buf[bytes] = '\0';
+        xclose(fd);
+
+        for (line = strtok_r(buf, "\n", &save); line;
+             line = strtok_r(NULL, "\n", &save))
+                parse_config_line(line, conf);
+
+        if (!conf->leaf_sz)
+                conf->leaf_sz = TREE_LEAF_SZ;
+
+        free(buf);
+}
+
+int
+write_repo_config(const char* path, const struct repo_config* conf)
+{
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (fd < 0)
+                return DEF_ERR;
+
+        dprintf(fd, "id_scheme = %s\n", id_scheme_to_str(conf->id_scheme));
+        dprintf(fd, "leaf_size = %lu\n", (unsigned long)conf->leaf_sz);
+        dprintf(fd, "chunk_size = %lu\n", (unsigned long)conf->chunk_sz);
+        dprintf(fd, "compression = %s\n", compress_to_str(conf->compress));
+        dprintf(fd, "min_saving = %u\n", conf->min_saving);
+        dprintf(fd, "shard_depth = %u\n", conf->shard_depth);
+        dprintf(fd, "huge_pages = %s\n", huge_pages_to_str(conf->huge_pages));
+        xclose(fd);
+        return 0;
+}
+
+int
+test_repo_config(void)
+{
+        int ret = 1;
+        struct repo_config in, out;
+        char* path = calloc(1, PAGE_SIZE);
+        const char* home = getenv("HOME");
+
+        strncpy(path, home, PAGE_SIZE - 1);
+        strncat(path, "/donut_test_config", 19);
+
+        /* Missing file provides the defaults */
+        remove(path);
+        read_repo_config(path, &out);
+        ret &= (out.id_scheme == ID_SCHEME_SHA256) ? 1 : 0;
+        ret &= (out.leaf_sz == TREE_LEAF_SZ) ? 1 : 0;
+        ret &= (!out.chunk_sz) ? 1 : 0;
+        ret &= (out.compress == COMPRESS_NEVER) ? 1 : 0;
+        ret &= (!out.shard_depth) ? 1 : 0;
+        ret &= (out.huge_pages == SLOB_PAGES_BASE) ? 1 : 0;
+
+        /* Written values are read back */
+        default_repo_config(&in);
+        in.id_scheme = ID_SCHEME_TREE;
+        in.leaf_sz = 4096;
+        in.chunk_sz = 8192;
+        in.compress = COMPRESS_SAVING;
+        in.min_saving = 25;
+        in.shard_depth = 2;
+        in.huge_pages = SLOB_PAGES_HUGETLB;
+        ret &= !write_repo_config(path, &in);
+        read_repo_config(path, &out);
+        ret &= (out.id_scheme == ID_SCHEME_TREE) ? 1 : 0;
+        ret &= (out.leaf_sz == 4096) ? 1 : 0;
+        ret &= (out.chunk_sz == 8192) ? 1 : 0;
+        ret &= (out.compress == COMPRESS_SAVING) ? 1 : 0;
+        ret &= (out.min_saving == 25) ? 1 : 0;
+        ret &= (out.shard_depth == 2) ? 1 : 0;
+        ret &= (out.huge_pages == SLOB_PAGES_HUGETLB) ? 1 : 0;
+
+        remove(path);
+        free(path);
+        return ret;
+}
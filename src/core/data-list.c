@@ -1,28 +1,62 @@
 #include "core/data-list.h"
+#include "core/object.h"
+#include "core/pack.h"
+#include "core/shard.h"
 #include "const/const.h"
 #include "misc/decorations.h"
 #include "sys/stat.h"
-#include "core/wrappers.h"
-#include "dirent.h"
 #include "stdio.h"
 #include "string.h"
 
-#define GROWTH_FACTOR ((PAGE_SIZE) / (__SIZEOF_POINTER__))
-#define ELEM_PER_PG ((PAGE_SIZE) / (DATA_FILE_NAME_SIZE))
+/**
+ * @file data-list.c
+ *
+ * The data_list is an open addressing hash table of object IDs.
+ *
+ * Slots are split in groups of GROUP_SZ. Each slot has a control byte which is
+ * either CTRL_EMPTY or the lower 7 bits of the ID's hash, so a whole group is
+ * probed with a single SIMD compare and only the slots whose control byte
+ * matches have their ID compared. Groups are visited by triangular probing,
+ * which visits every group once since their number is a power of 2. Object IDs
+ * are SHA-2 digests, therefore their first bytes are used as the hash.
+ */
+
+/**
+ * @def GROUP_SZ
+ * Number of slots probed at once.
+ */
+#define GROUP_SZ 16
+
+/**
+ * @def CTRL_EMPTY
+ * Control byte of a slot without an ID.
+ */
+#define CTRL_EMPTY 0x80
+
+/**
+ * @def MIN_SLOTS
+ * Number of slots allocated on the first insertion.
+ */
+#define MIN_SLOTS ((PAGE_SIZE) / (OID_SZ))
+
+/**
+ * @def MAX_LOAD
+ * Maximum number of IDs in a table of n slots before it's grown.
+ */
+#define MAX_LOAD(n) (((n) >> 3) * 7)
 
 struct data_list {
-        uint32_t idx;        /**< Next index to be populated */
-        uint32_t pg_cnt;     /**< Current number of first level pages */
-        uint32_t elem_l;     /**< Elements lefts */
-        uint32_t elem_t;     /**< Maximum array capacity */
-        void** pgs;          /**< Allocated Pages */
+        uint64_t cnt;        /**< Number of IDs in the table */
+        uint64_t slots;      /**< Number of slots, a power of 2 */
+        uint8_t* ctrl;       /**< Control byte of each slot */
+        uint8_t* ids;        /**< Object ID of each slot */
         struct slobs* slobs; /**< Slob Allocator */
 };
 
 struct data_list*
 init_data_list(struct slobs* slobs)
 {
-        struct data_list* ret = calloc(1, sizeof(struct data_list));
+        struct data_list* ret = alloc_slob(slobs, sizeof(struct data_list));
         ret->slobs = slobs;
         return ret;
 }
@@ -31,158 +65,281 @@ int
 test_data_list_init(void)
 {
         int ret = 0;
-        struct slobs* slobs = init_slobs();
+        struct slobs* slobs = init_slobs("test");
         struct data_list* buf = init_data_list(slobs);
-        ret |= (buf->idx == 0) ? 1 : 0;
-        ret &= (buf->pg_cnt == 0) ? 1 : 0;
-        ret &= (buf->elem_l == 0) ? 1 : 0;
-        ret &= (buf->elem_t == 0) ? 1 : 0;
-        ret &= (buf->pgs == 0x0) ? 1 : 0;
+        ret |= (buf->cnt == 0) ? 1 : 0;
+        ret &= (buf->slots == 0) ? 1 : 0;
+        ret &= (buf->ctrl == 0x0) ? 1 : 0;
+        ret &= (buf->ids == 0x0) ? 1 : 0;
         ret &= (buf->slobs != 0x0) ? 1 : 0;
 
-        free(buf);
         clear_slobs(slobs);
         return ret;
 }
 
-char*
-get_data_list_index(struct data_list* restrict data, uint32_t idx)
+/**
+ * Obtain the hash of an object ID.
+ *
+ * @param id Object ID.
+ * @returns The ID's first 8 bytes.
+ */
+inline static uint64_t
+oid_hash(const uint8_t* id)
 {
-        char* ret;
-        uint32_t index = idx + 1;
-        uint32_t p_idx = (index / ELEM_PER_PG) + (index % ELEM_PER_PG) ? 1 : 0;
-        uint32_t e_idx = idx - ((p_idx - 1) * ELEM_PER_PG);
-
-        if (p_idx >= data->pg_cnt || e_idx >= ELEM_PER_PG) {
-                printf(DONUT_ERROR "Data-List index out of bounds.\n");
-                exit(1);
+        uint64_t h;
+
+        memcpy(&h, id, sizeof(h));
+        return h;
+}
+
+/**
+ * Find the slots of a group whose control byte is equal to the given one.
+ *
+ * @param ctrl Control bytes of the group.
+ * @param b Control byte to be found.
+ * @returns Bit mask where bit i is set if the slot i matched.
+ */
+inline static uint32_t
+group_match(const uint8_t* ctrl, uint8_t b)
+{
+#if defined(__SSE2__)
+        __m128i grp = _mm_load_si128((const __m128i*)ctrl);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(grp, _mm_set1_epi8(b)));
+#elif defined(__aarch64__)
+        static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                         1, 2, 4, 8, 16, 32, 64, 128};
+        uint8x16_t eq = vandq_u8(vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(b)),
+                                 vld1q_u8(bits));
+        return vaddv_u8(vget_low_u8(eq)) | (vaddv_u8(vget_high_u8(eq)) << 8);
+#else
+        uint32_t mask = 0;
+
+        for (int i = 0; i < GROUP_SZ; i++)
+                mask |= (uint32_t)(ctrl[i] == b) << i;
+        return mask;
+#endif
+}
+
+/**
+ * Find the slot of an ID, or the empty slot where it should be placed.
+ *
+ * The table must have at least one empty slot.
+ *
+ * @param list data_list to be probed.
+ * @param id Object ID to be found.
+ * @param found Set to 1 if the ID is in the table otherwise to 0.
+ * @returns Index of the slot.
+ */
+static uint64_t
+find_slot(struct data_list* restrict list, const uint8_t* id, int* found)
+{
+        uint64_t h = oid_hash(id);
+        uint64_t gmask = (list->slots / GROUP_SZ) - 1;
+        uint64_t g = (h >> 7) & gmask;
+        uint8_t tag = h & 0x7f;
+        uint32_t match;
+        uint64_t step = 0, slot;
+
+        for (;;) {
+                slot = g * GROUP_SZ;
+                match = group_match(list->ctrl + slot, tag);
+                while (match) {
+                        if (oid_eq(list->ids + (slot + __builtin_ctz(match)) *
+                                   OID_SZ, id)) {
+                                *found = 1;
+                                return slot + __builtin_ctz(match);
+                        }
+                        match &= match - 1;
+                }
+
+                match = group_match(list->ctrl + slot, CTRL_EMPTY);
+                if (match) {
+                        *found = 0;
+                        return slot + __builtin_ctz(match);
+                }
+
+                g = (g + ++step) & gmask;
         }
+}
 
-        ret = ((char*)(data->pgs[--p_idx])) + (e_idx * DATA_FILE_NAME_SIZE);
-        return ret;
+/**
+ * Double the number of slots of the table and re-insert all IDs.
+ *
+ * @param list data_list to be grown.
+ */
+static void
+grow_data_list(struct data_list* restrict list)
+{
+        uint8_t* ctrl = list->ctrl;
+        uint8_t* ids = list->ids;
+        uint64_t i, slot, slots = list->slots;
+        int found;
+
+        list->slots = (slots) ? slots << 1 : MIN_SLOTS;
+        list->ctrl = alloc_slob(list->slobs, list->slots);
+        list->ids = alloc_slob(list->slobs, list->slots * OID_SZ);
+        memset(list->ctrl, CTRL_EMPTY, list->slots);
+
+        for (i = 0; i < slots; i++) {
+                if (ctrl[i] == CTRL_EMPTY)
+                        continue;
+
+                slot = find_slot(list, ids + i * OID_SZ, &found);
+                list->ctrl[slot] = ctrl[i];
+                memcpy(list->ids + slot * OID_SZ, ids + i * OID_SZ, OID_SZ);
+        }
+
+        if (slots) {
+                free_slob(list->slobs, ctrl);
+                free_slob(list->slobs, ids);
+        }
 }
 
 int
-test_get_data_list_index()
+test_data_list_growth(void)
 {
         int ret = 1;
-        void* get;
-        char* test = "123456789";
-        struct slobs* slobs = init_slobs();
+        uint8_t id[OID_SZ] = {0};
+        struct slobs* slobs = init_slobs("test");
         struct data_list* buf = init_data_list(slobs);
+        uint32_t i, n = 4 * MIN_SLOTS;
 
-        /* Add 1 element to trigger array growth */
-        add_file_to_list(buf, test);
-
-        /* Check if all indices of the first page are in the expected locations */
-        for (uint32_t i = 0; i < ELEM_PER_PG; i++) {
-                get = get_data_list_index(buf, i);
-                ret &= (get == ((char*)buf->pgs[0] + (i * DATA_FILE_NAME_SIZE))) ? 1 : 0;
+        /* Fill the table past several growths */
+        for (i = 0; i < n; i++) {
+                memcpy(id, &i, sizeof(i));
+                id[OID_SZ - 1] = i * 7;
+                add_file_to_list(buf, id);
+        }
+        ret &= (buf->cnt == n) ? 1 : 0;
+        ret &= (buf->slots >= n && buf->cnt <= MAX_LOAD(buf->slots)) ? 1 : 0;
+
+        /* Every ID must still be found after being moved */
+        for (i = 0; i < n; i++) {
+                memcpy(id, &i, sizeof(i));
+                id[OID_SZ - 1] = i * 7;
+                ret &= is_in_data_list(buf, id);
         }
 
-        free(buf);
+        /* Duplicates aren't added twice */
+        add_file_to_list(buf, id);
+        ret &= (buf->cnt == n) ? 1 : 0;
+
         clear_slobs(slobs);
         return ret;
 }
 
 void
-add_file_to_list(struct data_list* restrict data, char* f_name)
+add_file_to_list(struct data_list* restrict data, const uint8_t* id)
 {
-        if (!data->elem_l) {
-
-                /* Grow number of pages suppported */
-                uint32_t new_pgs = data->pg_cnt + GROWTH_FACTOR;
-                void** tmp = alloc_slob(data->slobs, new_pgs * __SIZEOF_POINTER__);
-                memcpy(tmp, data->pgs, data->pg_cnt * __SIZEOF_POINTER__);
-
-                /* Allocate new pages */
-                while (data->pg_cnt < new_pgs)
-                        tmp[data->pg_cnt++] = alloc_slob(data->slobs, PAGE_SIZE);
-
-                /* Update bookkeeping state */
-                free_slob(data->slobs, data->pgs);
-                data->pgs = (void**)tmp;
-                data->elem_l += (GROWTH_FACTOR * ELEM_PER_PG);
-                data->elem_t += (GROWTH_FACTOR * ELEM_PER_PG);
-        }
+        uint64_t slot;
+        int found;
+
+        if (data->cnt >= MAX_LOAD(data->slots))
+                grow_data_list(data);
 
-        /* Get relative page & element index */
-        char* elem = get_data_list_index(data, data->idx);
+        slot = find_slot(data, id, &found);
+        if (found)
+                return;
 
-        data->idx++;
-        data->elem_l--;
-        strncpy(elem, f_name, DATA_FILE_NAME_SIZE);
+        data->ctrl[slot] = oid_hash(id) & 0x7f;
+        memcpy(data->ids + slot * OID_SZ, id, OID_SZ);
+        data->cnt++;
 }
 
 int
 test_add_file_to_data_list(void)
 {
         int ret = 0;
-        char* test = "123456789";
-        struct slobs* slobs = init_slobs();
+        uint8_t test[OID_SZ] = {0x12, 0x34, 0x56, 0x78, 0x9};
+        struct slobs* slobs = init_slobs("test");
         struct data_list* buf = init_data_list(slobs);
+        uint64_t slot;
+        int found;
 
         /* Add first item to the list */
         add_file_to_list(buf, test);
-        ret |= (buf->elem_t == (GROWTH_FACTOR * ELEM_PER_PG)) ? 1 : 0;
-        ret &= (buf->elem_l == ((GROWTH_FACTOR * ELEM_PER_PG)) - 1) ? 1 : 0;
-        ret &= (buf->idx == 1) ? 1 : 0;
-        ret &= (buf->pg_cnt == GROWTH_FACTOR) ? 1 : 0;
-
-        /* Check first item content is correct and starts at the right index */
-        char* data = buf->pgs[0];
-        ret &= !strncmp(data, test, 31);
-
-        /* Add second item to the list */
+        ret |= (buf->slots == MIN_SLOTS) ? 1 : 0;
+        ret &= (buf->cnt == 1) ? 1 : 0;
+
+        /* Check item content is correct and is in its slot */
+        slot = find_slot(buf, test, &found);
+        ret &= found;
+        ret &= !memcmp(buf->ids + slot * OID_SZ, test, OID_SZ);
+        ret &= (buf->ctrl[slot] == (oid_hash(test) & 0x7f)) ? 1 : 0;
+        ret &= is_in_data_list(buf, test);
+
+        /* Add second item with the same hash and control byte */
+        test[OID_SZ - 1] ^= 0x1;
+        ret &= !is_in_data_list(buf, test);
         add_file_to_list(buf, test);
-        ret &= (buf->elem_t == (GROWTH_FACTOR * ELEM_PER_PG)) ? 1 : 0;
-        ret &= (buf->elem_l == ((GROWTH_FACTOR * ELEM_PER_PG)) - 2) ? 1 : 0;
-        ret &= (buf->idx == 2) ? 1 : 0;
-        ret &= (buf->pg_cnt == GROWTH_FACTOR) ? 1 : 0;
+        ret &= (buf->cnt == 2) ? 1 : 0;
+        ret &= is_in_data_list(buf, test);
 
-        /* Check second item content is correct and starts at the right index */
-        data = ((char*)buf->pgs[0]) + 1 * 32;
-        ret &= !strncmp(data, test, 31);
+        /* Check the first item is still found */
+        test[OID_SZ - 1] ^= 0x1;
+        ret &= is_in_data_list(buf, test);
 
-        free(buf);
         clear_slobs(slobs);
         return ret;
 }
 
 int
-is_in_data_list(struct data_list* restrict list, char* str)
+is_in_data_list(struct data_list* restrict list, const uint8_t* id)
 {
-        int ret = 0;
-        char* base_addr;
-        uint32_t i, j;
+        int found;
 
-        for (i = 0; i < list->pg_cnt ; i++) {
-                base_addr = list->pgs[i];
+        if (!list->cnt)
+                return 0;
 
-                if (ret || *base_addr == 0x0)
-                        return ret;
+        find_slot(list, id, &found);
+        return found;
+}
 
-                j = 0;
-                while (j < ELEM_PER_PG && !ret)
-                        ret |= !strncmp(base_addr + (j++ * DATA_FILE_NAME_SIZE),
-                                        str, DATA_FILE_NAME_SIZE);
-        }
+uint64_t
+data_list_size(struct data_list* list)
+{
+        return list->cnt;
+}
 
-        return ret;
+uint64_t
+data_list_mem(struct data_list* list)
+{
+        return list->slots * (OID_SZ + 1);
 }
 
-void
-get_repo_data_list(struct data_list* list, char* path)
+uint64_t
+copy_data_list(struct data_list* list, uint8_t* dst)
 {
-        struct dirent* entry;
-        DIR* dir = xopendir(path);
+        uint64_t i, n = 0;
 
-        while ((entry = readdir(dir))) {
-                if (entry->d_type != DT_REG)
-                        continue;
+        for (i = 0; i < list->slots; i++)
+                if (list->ctrl[i] != CTRL_EMPTY)
+                        memcpy(dst + n++ * OID_SZ, list->ids + i * OID_SZ,
+                               OID_SZ);
 
-                add_file_to_list(list, entry->d_name);
-        }
+        return n;
+}
+
+/**
+ * Add an object found in a data directory to a list.
+ */
+static void
+add_found_object(void* arg, const uint8_t* id, const char* path)
+{
+        add_file_to_list(arg, id);
+}
+
+void
+get_repo_data_list(struct data_list* list, char* path, unsigned int depth)
+{
+        struct packs* packs;
+
+        walk_objects(path, depth, add_found_object, list);
 
-        xclosedir(dir);
+        packs = open_packs(list->slobs, path);
+        for (unsigned int i = 0; i < packs->n; i++)
+                for (uint64_t j = 0; j < packs->packs[i].hdr->count; j++)
+                        add_file_to_list(list, packs->packs[i].entries[j].id);
+        close_packs(packs);
+        free_slob(list->slobs, packs);
 }
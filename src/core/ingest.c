@@ -0,0 +1,167 @@
+#include "core/ingest.h"
+#include "core/wrappers.h"
+#include "crypto/sha2.h"
+#include "crypto/sha2-tree.h"
+#include "const/const.h"
+#include "const/err.h"
+#include "misc/decorations.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "errno.h"
+#include "fcntl.h"
+#include "sys/stat.h"
+
+#if defined(__linux__)
+#include "sys/ioctl.h"
+#include "sys/syscall.h"
+#include "linux/fs.h"
+#endif
+
+/**
+ * @file ingest.c
+ * Implementation of the copies of files into new objects.
+ */
+
+int
+ingest_clone(int src_fd, int dst_fd)
+{
+#if defined(FICLONE)
+        return (ioctl(dst_fd, FICLONE, src_fd)) ? -1 : 0;
+#else
+        return -1;
+#endif
+}
+
+int
+ingest_copy(int src_fd, int dst_fd, uint64_t size)
+{
+#if defined(SYS_copy_file_range)
+        loff_t in = 0, out = 0;
+        long bytes;
+
+        while ((uint64_t)in < size) {
+                bytes = syscall(SYS_copy_file_range, src_fd, &in, dst_fd, &out,
+                                size - in, 0);
+                if (!bytes)
+                        break;
+                if (bytes > 0)
+                        continue;
+                if (errno == EINTR)
+                        continue;
+
+                /* Filesystems which can't copy between the files fail at once */
+                if (!in && (errno == EXDEV || errno == EINVAL ||
+                            errno == ENOSYS || errno == EOPNOTSUPP))
+                        return -1;
+
+                printf(DONUT_ERROR "Failed to copy a file with error: %d.\n",
+                       errno);
+                exit(DEF_ERR);
+        }
+
+        return 0;
+#else
+        return -1;
+#endif
+}
+
+void
+ingest_stream(int src_fd, int dst_fd, const struct repo_config* conf,
+              void* hash, void* buf, uint8_t* id)
+{
+        struct sha2_tree tree;
+        size_t bytes;
+        off_t off = 0;
+        int flat = (conf->id_scheme != ID_SCHEME_TREE);
+
+        if (flat)
+                sha2_init(hash);
+        else
+                sha2_tree_init(&tree, conf->leaf_sz);
+
+        while ((bytes = xpread(src_fd, buf, READ_BUF_SZ, off))) {
+                if (flat)
+                        sha2_update(buf, hash, bytes);
+                else
+                        sha2_tree_update(&tree, buf, bytes);
+                xwrite(dst_fd, buf, bytes);
+                off += bytes;
+        }
+
+        if (flat)
+                sha2_final(id, hash);
+        else
+                sha2_tree_final(&tree, id);
+}
+
+int
+test_ingest(void)
+{
+        int src_fd, dst_fd, ret = 1;
+        size_t i, len = 3 * 4096 + 5;
+        unsigned int m;
+        uint8_t ref[SHA2_DIGEST_SZ], id[SHA2_DIGEST_SZ];
+        struct repo_config conf = {0};
+        uint8_t* in = malloc(len);
+        uint8_t* out = malloc(READ_BUF_SZ);
+        void* state = malloc(SHA_STRUCT_SZ);
+        char* src = calloc(1, PAGE_SIZE);
+        char* dst = calloc(1, PAGE_SIZE);
+
+        snprintf(src, PAGE_SIZE, "%s/donut_test_ingest_a", getenv("HOME"));
+        snprintf(dst, PAGE_SIZE, "%s/donut_test_ingest_b", getenv("HOME"));
+        for (i = 0; i < len; i++)
+                in[i] = (uint8_t)((i * 2654435761u) >> 9);
+
+        src_fd = open(src, O_RDWR | O_CREAT | O_TRUNC, 0640);
+        if (src_fd < 0) {
+                ret = 0;
+                goto cleanup_return;
+        }
+        xwrite(src_fd, in, len);
+
+        /* Methods not supported by the filesystem are skipped */
+        for (m = INGEST_CLONE; m <= INGEST_STREAM + 1 && ret; m++) {
+                dst_fd = open(dst, O_RDWR | O_CREAT | O_TRUNC, 0640);
+                if (dst_fd < 0) {
+                        ret = 0;
+                        break;
+                }
+
+                /* Streams are checked with both ID schemes */
+                conf.id_scheme = (m > INGEST_STREAM) ? ID_SCHEME_TREE :
+                                 ID_SCHEME_SHA256;
+                conf.leaf_sz = 4096;
+                if (m == INGEST_CLONE && ingest_clone(src_fd, dst_fd))
+                        goto next;
+                if (m == INGEST_COPY && ingest_copy(src_fd, dst_fd, len))
+                        goto next;
+
+                if (m >= INGEST_STREAM) {
+                        ingest_stream(src_fd, dst_fd, &conf, state, out, id);
+                        if (m == INGEST_STREAM)
+                                sha2_hash(in, ref, state, len);
+                        else
+                                sha2_tree_file(src_fd, len, 4096, ref, 1);
+                        ret &= !memcmp(id, ref, SHA2_DIGEST_SZ);
+                }
+
+                ret &= (xpread(dst_fd, out, READ_BUF_SZ, 0) == len) ? 1 : 0;
+                ret &= !memcmp(in, out, len);
+next:
+                xclose(dst_fd);
+        }
+        xclose(src_fd);
+
+cleanup_return:
+        remove(src);
+        remove(dst);
+        free(dst);
+        free(src);
+        free(state);
+        free(out);
+        free(in);
+        return ret;
+}
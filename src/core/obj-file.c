@@ -0,0 +1,299 @@
+#include "core/obj-file.h"
+#include "core/wrappers.h"
+#include "compress/lz.h"
+#include "crypto/sha2.h"
+#include "const/const.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "fcntl.h"
+
+/**
+ * @file obj-file.c
+ * Implementation of the objects' container.
+ */
+
+/**
+ * Store a block's length.
+ *
+ * @param p Address where the length is placed.
+ * @param v Length with its flags.
+ */
+static inline void
+put_block_len(uint8_t* p, uint32_t v)
+{
+        p[0] = (uint8_t)v;
+        p[1] = (uint8_t)(v >> 8);
+        p[2] = (uint8_t)(v >> 16);
+        p[3] = (uint8_t)(v >> 24);
+}
+
+/**
+ * Load a block's length.
+ *
+ * @param p Address of the length.
+ * @returns Length with its flags.
+ */
+static inline uint32_t
+get_block_len(const uint8_t* p)
+{
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void
+obj_file_init_hdr(struct obj_file_hdr* hdr, uint8_t codec, uint8_t type,
+                  uint64_t size, const uint8_t* id)
+{
+        memset(hdr, 0x0, sizeof(struct obj_file_hdr));
+        memcpy(hdr->magic, OBJ_FILE_MAGIC, sizeof(hdr->magic));
+        hdr->version = OBJ_FILE_VERSION;
+        hdr->codec = codec;
+        hdr->type = type;
+        hdr->size = size;
+        memcpy(hdr->id, id, OID_SZ);
+}
+
+size_t
+obj_file_bound(size_t len)
+{
+        return len + 4 * ((len + OBJ_BLOCK_SZ - 1) / OBJ_BLOCK_SZ);
+}
+
+size_t
+obj_file_pack(const uint8_t* in, size_t len, uint8_t* out, uint32_t* table)
+{
+        size_t pos, blk, n;
+        uint8_t* op = out;
+
+        for (pos = 0; pos < len; pos += blk) {
+                blk = (len - pos < OBJ_BLOCK_SZ) ? len - pos : OBJ_BLOCK_SZ;
+
+                /* Blocks which don't shrink are stored raw */
+                n = lz_compress(in + pos, blk, op + 4, blk - 1, table);
+                if (n) {
+                        put_block_len(op, n);
+                } else {
+                        memcpy(op + 4, in + pos, blk);
+                        put_block_len(op, blk | OBJ_BLOCK_RAW);
+                        n = blk;
+                }
+                op += 4 + n;
+        }
+
+        return op - out;
+}
+
+int
+obj_file_worth(const struct repo_config* conf, uint64_t size, uint64_t stored)
+{
+        switch (conf->compress) {
+                case COMPRESS_ALWAYS:
+                        return 1;
+                case COMPRESS_SAVING:
+                        return stored < size &&
+                               (size - stored) * 100 >= size * conf->min_saving;
+                default:
+                        return 0;
+        }
+}
+
+int
+obj_file_read_hdr(int fd, off_t base, const uint8_t* id,
+                  struct obj_file_hdr* hdr)
+{
+        if (xpread(fd, hdr, sizeof(struct obj_file_hdr), base) !=
+            sizeof(struct obj_file_hdr))
+                return 0;
+
+        return !memcmp(hdr->magic, OBJ_FILE_MAGIC, sizeof(hdr->magic)) &&
+               oid_eq(hdr->id, id);
+}
+
+/**
+ * Restore content stored as it is.
+ *
+ * @param fd Descriptor of the object
+ * @param base Offset of the container in the file
+ * @param hdr Container's header
+ * @param out_fd Descriptor where the content is written or -1
+ * @param out Buffer of READ_BUF_SZ bytes, or of the content's size
+ * @returns Returns 0 on success or -1 if the container is truncated.
+ */
+static int
+unpack_none(int fd, off_t base, const struct obj_file_hdr* hdr, int out_fd,
+            uint8_t* out)
+{
+        uint64_t done = 0;
+        size_t bytes, len;
+
+        while (done < hdr->size) {
+                len = (hdr->size - done < READ_BUF_SZ) ? hdr->size - done :
+                      READ_BUF_SZ;
+                bytes = xpread(fd, (out_fd < 0) ? out + done : out, len,
+                               base + sizeof(struct obj_file_hdr) + done);
+                if (bytes != len)
+                        return -1;
+                if (out_fd >= 0)
+                        xwrite(out_fd, out, bytes);
+                done += bytes;
+        }
+
+        return 0;
+}
+
+int
+obj_file_unpack(int fd, off_t base, const struct obj_file_hdr* hdr,
+                int out_fd, uint8_t* out, uint8_t* in)
+{
+        off_t off = base + sizeof(struct obj_file_hdr);
+        uint64_t done = 0;
+        size_t have = 0, pos = 0, used = 0, blk, len, bytes;
+        uint8_t* dst;
+        uint32_t word;
+        int eof = 0;
+
+        if (hdr->version != OBJ_FILE_VERSION)
+                return -1;
+        if (hdr->codec == OBJ_CODEC_NONE)
+                return unpack_none(fd, base, hdr, out_fd, out);
+        if (hdr->codec != OBJ_CODEC_LZ)
+                return -1;
+
+        while (done < hdr->size) {
+                blk = (hdr->size - done < OBJ_BLOCK_SZ) ? hdr->size - done :
+                      OBJ_BLOCK_SZ;
+
+                /* Keep a whole stored block in the read buffer */
+                if (!eof && have - pos < 4 + blk) {
+                        memmove(in, in + pos, have - pos);
+                        have -= pos;
+                        pos = 0;
+                        bytes = xpread(fd, in + have, READ_BUF_SZ - have, off);
+                        eof = (bytes < READ_BUF_SZ - have) ? 1 : 0;
+                        have += bytes;
+                        off += bytes;
+                }
+
+                if (have - pos < 4)
+                        return -1;
+                word = get_block_len(in + pos);
+                len = word & ~OBJ_BLOCK_RAW;
+                if (len > have - pos - 4)
+                        return -1;
+
+                dst = (out_fd < 0) ? out + done : out + used;
+                if (word & OBJ_BLOCK_RAW) {
+                        if (len != blk)
+                                return -1;
+                        memcpy(dst, in + pos + 4, blk);
+                } else if (lz_decompress(in + pos + 4, len, dst, blk)) {
+                        return -1;
+                }
+
+                pos += 4 + len;
+                done += blk;
+                used += blk;
+                if (out_fd >= 0 && (used + OBJ_BLOCK_SZ > READ_BUF_SZ ||
+                                    done == hdr->size)) {
+                        xwrite(out_fd, out, used);
+                        used = 0;
+                }
+        }
+
+        return 0;
+}
+
+int
+test_obj_file(void)
+{
+        int fd, out_fd, ret = 1;
+        struct obj_file_hdr hdr, got;
+        struct repo_config conf = {0};
+        size_t i, n, len = 5 * OBJ_BLOCK_SZ + 1234;
+        uint8_t id[OID_SZ], other[OID_SZ];
+        uint8_t* data = malloc(len);
+        uint8_t* packed = malloc(obj_file_bound(len));
+        uint8_t* out = malloc(READ_BUF_SZ);
+        uint8_t* in = malloc(READ_BUF_SZ);
+        uint32_t* table = malloc(LZ_TABLE_SZ);
+        void* state = malloc(SHA_STRUCT_SZ);
+        char* path = calloc(1, PAGE_SIZE);
+        char* copy = calloc(1, PAGE_SIZE);
+
+        snprintf(path, PAGE_SIZE, "%s/donut_test_obj_file", getenv("HOME"));
+        snprintf(copy, PAGE_SIZE, "%s/donut_test_obj_copy", getenv("HOME"));
+
+        /* Compressible blocks followed by random ones, stored raw */
+        for (i = 0; i < len; i++)
+                data[i] = (i < 3 * OBJ_BLOCK_SZ) ? "donut,42\n"[i % 9] :
+                          (uint8_t)((i * 2654435761u) >> 13);
+        sha2_hash(data, id, state, len);
+        memcpy(other, id, OID_SZ);
+        other[0] ^= 1;
+
+        /* Packing a buffer at a time matches packing it whole */
+        n = obj_file_pack(data, 2 * OBJ_BLOCK_SZ, packed, table);
+        n += obj_file_pack(data + 2 * OBJ_BLOCK_SZ, len - 2 * OBJ_BLOCK_SZ,
+                           packed + n, table);
+        ret &= (n < len && n == obj_file_pack(data, len, packed, table)) ? 1 : 0;
+
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0640);
+        out_fd = open(copy, O_RDWR | O_CREAT | O_TRUNC, 0640);
+        if (fd < 0 || out_fd < 0) {
+                ret = 0;
+                goto cleanup_return;
+        }
+
+        /* Content is restored whole and through a descriptor */
+        obj_file_init_hdr(&hdr, OBJ_CODEC_LZ, OBJ_TYPE_DATA, len, id);
+        xwrite(fd, &hdr, sizeof(hdr));
+        xwrite(fd, packed, n);
+        ret &= obj_file_read_hdr(fd, 0, id, &got);
+        ret &= !obj_file_read_hdr(fd, 0, other, &got);
+        ret &= !obj_file_unpack(fd, 0, &got, -1, out, in);
+        ret &= !memcmp(out, data, len);
+        ret &= !obj_file_unpack(fd, 0, &got, out_fd, out, in);
+        ret &= (xpread(out_fd, out, READ_BUF_SZ, 0) == len) ? 1 : 0;
+        ret &= !memcmp(out, data, len);
+
+        /* Truncated containers are reported */
+        ret &= (ftruncate(fd, sizeof(hdr) + n - 1) == 0) ? 1 : 0;
+        ret &= (obj_file_unpack(fd, 0, &got, -1, out, in) == -1) ? 1 : 0;
+
+        /* Content stored as it is */
+        obj_file_init_hdr(&hdr, OBJ_CODEC_NONE, OBJ_TYPE_LIST, len, id);
+        xpwrite(fd, &hdr, sizeof(hdr), 0);
+        xpwrite(fd, data, len, sizeof(hdr));
+        ret &= obj_file_read_hdr(fd, 0, id, &got) && got.type == OBJ_TYPE_LIST;
+        ret &= !obj_file_unpack(fd, 0, &got, -1, out, in);
+        ret &= !memcmp(out, data, len);
+
+        /* Raw objects aren't taken for containers */
+        ret &= (ftruncate(fd, 0) == 0) ? 1 : 0;
+        xpwrite(fd, data, len, 0);
+        ret &= !obj_file_read_hdr(fd, 0, id, &got);
+
+        /* Policy */
+        ret &= !obj_file_worth(&conf, 100, 10);
+        conf.compress = COMPRESS_ALWAYS;
+        ret &= obj_file_worth(&conf, 100, 120);
+        conf.compress = COMPRESS_SAVING;
+        conf.min_saving = 20;
+        ret &= obj_file_worth(&conf, 100, 80);
+        ret &= !obj_file_worth(&conf, 100, 81);
+        xclose(out_fd);
+        xclose(fd);
+
+cleanup_return:
+        remove(path);
+        remove(copy);
+        free(copy);
+        free(path);
+        free(state);
+        free(table);
+        free(in);
+        free(out);
+        free(packed);
+        free(data);
+        return ret;
+}
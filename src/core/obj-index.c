@@ -0,0 +1,717 @@
+#include "core/obj-index.h"
+#include "core/pack.h"
+#include "core/shard.h"
+#include "core/data-list.h"
+#include "core/oid-set.h"
+#include "core/bloom.h"
+#include "core/object.h"
+#include "core/wrappers.h"
+#include "crypto/sha2.h"
+#include "const/const.h"
+#include "const/err.h"
+#include "misc/decorations.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "stddef.h"
+#include "unistd.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+
+/**
+ * @file obj-index.c
+ * Implementation of the persistent object index.
+ */
+
+/**
+ * @def IDX_MAGIC
+ * Bytes "DIDX" identifying a base file, read in host byte order.
+ */
+#define IDX_MAGIC 0x58444944
+
+/**
+ * @def IDX_VERSION
+ * Version of the base file's format.
+ */
+#define IDX_VERSION 1
+
+/**
+ * @def LOG_EXT
+ * Extension appended to the base file's path to obtain the log's path.
+ */
+#define LOG_EXT ".log"
+
+/**
+ * @def TMP_EXT
+ * Extension appended to the base file's path while a new one is written.
+ */
+#define TMP_EXT ".tmp"
+
+/**
+ * @def LOG_MIN
+ * Number of IDs the log may hold before it's considered for compaction.
+ */
+#define LOG_MIN 4096
+
+/**
+ * @def FILTER_MIN_CAP
+ * Minimum number of IDs the index's filter is sized for.
+ */
+#define FILTER_MIN_CAP 65536
+
+/**
+ * @def WRITE_BUF_SZ
+ * Size of the buffer used to write a base file.
+ */
+#define WRITE_BUF_SZ (1024 * 1024)
+
+/**
+ * Header at the start of a base file, followed by the sorted IDs.
+ */
+struct idx_header {
+        uint32_t magic;       /**< Must be IDX_MAGIC                      */
+        uint32_t version;     /**< Must be IDX_VERSION                    */
+        uint64_t count;       /**< Number of IDs in the file              */
+        uint32_t fanout[256]; /**< Number of IDs whose first byte is <= i */
+};
+
+struct obj_index {
+        char* path;                   /**< Path to the base file          */
+        char* log;                    /**< Path to the log file           */
+        const struct idx_header* hdr; /**< Mapped base file or NULL       */
+        const uint8_t* ids;           /**< Sorted IDs of the base file    */
+        size_t map_sz;                /**< Size of the mapping            */
+        struct data_list* logged;     /**< IDs read from the log          */
+        struct oid_set* recent;       /**< IDs added since it was opened  */
+        struct bloom* filter;         /**< Filter with all IDs            */
+        uint8_t* added;               /**< IDs in the log, then new ones
+                                           once gathered                  */
+        uint64_t n_log;               /**< Number of IDs read from log    */
+        uint64_t n_added;             /**< Number of IDs in "added"       */
+        uint64_t cap;                 /**< Capacity of "added" in IDs     */
+        struct slobs* slobs;          /**< Slob Allocator                 */
+};
+
+/**
+ * Compare two object IDs for sorting.
+ */
+static int
+cmp_oid(const void* a, const void* b)
+{
+        return memcmp(a, b, OID_SZ);
+}
+
+/**
+ * Append an ID to a growable array allocated with a slob allocator.
+ *
+ * @param slobs Slob allocator of the array.
+ * @param arr Pointer to the array.
+ * @param n Pointer to the number of IDs in the array.
+ * @param cap Pointer to the array's capacity.
+ * @param id ID to be appended.
+ */
+static void
+append_oid(struct slobs* slobs, uint8_t** arr, uint64_t* n, uint64_t* cap,
+           const uint8_t* id)
+{
+        uint8_t* tmp;
+
+        if (*n == *cap) {
+                *cap = (*cap) ? *cap << 1 : PAGE_SIZE / OID_SZ;
+                tmp = alloc_slob(slobs, *cap * OID_SZ);
+                if (*arr) {
+                        memcpy(tmp, *arr, *n * OID_SZ);
+                        free_slob(slobs, *arr);
+                }
+                *arr = tmp;
+        }
+
+        memcpy(*arr + (*n)++ * OID_SZ, id, OID_SZ);
+}
+
+/**
+ * Write a base file with the union of two sorted arrays of IDs.
+ *
+ * The file is written next to its final path and renamed over it once
+ * complete, so readers see either the old or the new index.
+ *
+ * @param idx Index whose base file is written.
+ * @param a First array of sorted IDs.
+ * @param na Number of IDs in the first array.
+ * @param b Second array of sorted IDs.
+ * @param nb Number of IDs in the second array.
+ */
+static void
+write_base(struct obj_index* idx, const uint8_t* a, uint64_t na,
+           const uint8_t* b, uint64_t nb)
+{
+        struct idx_header hdr = {IDX_MAGIC, IDX_VERSION, 0, {0}};
+        uint8_t* buf = alloc_slob(idx->slobs, WRITE_BUF_SZ);
+        char* tmp = alloc_slob(idx->slobs, PAGE_SIZE);
+        const uint8_t* id;
+        const uint8_t* last = NULL;
+        size_t used = 0;
+        int fd;
+
+        snprintf(tmp, PAGE_SIZE, "%s" TMP_EXT, idx->path);
+        fd = xopen(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        lseek(fd, sizeof(hdr), SEEK_SET);
+
+        while (na || nb) {
+                if (!nb || (na && memcmp(a, b, OID_SZ) <= 0)) {
+                        id = a;
+                        a += OID_SZ;
+                        na--;
+                } else {
+                        id = b;
+                        b += OID_SZ;
+                        nb--;
+                }
+
+                if (last && oid_eq(last, id))
+                        continue;
+
+                if (used == WRITE_BUF_SZ) {
+                        xwrite(fd, buf, used);
+                        used = 0;
+                }
+                memcpy(buf + used, id, OID_SZ);
+                last = buf + used;
+                used += OID_SZ;
+                hdr.fanout[id[0]]++;
+                hdr.count++;
+        }
+
+        xwrite(fd, buf, used);
+        for (int i = 1; i < 256; i++)
+                hdr.fanout[i] += hdr.fanout[i - 1];
+        xpwrite(fd, &hdr, sizeof(hdr), 0);
+        fsync(fd);
+        xclose(fd);
+        xrename(tmp, idx->path);
+
+        free_slob(idx->slobs, tmp);
+        free_slob(idx->slobs, buf);
+}
+
+/**
+ * Check that a base file's fan-out table only points within its IDs.
+ *
+ * @param hdr Header of the base file.
+ * @returns Returns 1 if the table never decreases nor exceeds the count or 0.
+ */
+static int
+valid_fanout(const struct idx_header* hdr)
+{
+        for (int i = 0; i < 256; i++)
+                if (hdr->fanout[i] > hdr->count ||
+                    (i && hdr->fanout[i] < hdr->fanout[i - 1]))
+                        return 0;
+
+        return 1;
+}
+
+/**
+ * Map the base file if it's present and valid.
+ *
+ * @param idx Index whose base file is mapped.
+ * @returns 0 if the base file was mapped otherwise -1.
+ */
+static int
+map_base(struct obj_index* idx)
+{
+        struct stat st;
+        const struct idx_header* hdr;
+        int fd = open(idx->path, O_RDONLY);
+
+        if (fd < 0)
+                return -1;
+
+        if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*hdr)) {
+                xclose(fd);
+                return -1;
+        }
+
+        hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        xclose(fd);
+        if (hdr == MAP_FAILED)
+                return -1;
+
+        if (hdr->magic != IDX_MAGIC || hdr->version != IDX_VERSION ||
+            hdr->fanout[255] != hdr->count ||
+            (size_t)st.st_size != sizeof(*hdr) + hdr->count * OID_SZ ||
+            !valid_fanout(hdr)) {
+                munmap((void*)hdr, st.st_size);
+                return -1;
+        }
+
+        idx->hdr = hdr;
+        idx->ids = (const uint8_t*)(hdr + 1);
+        idx->map_sz = st.st_size;
+        return 0;
+}
+
+/**
+ * Release the mapping of the base file.
+ *
+ * @param idx Index whose base file is unmapped.
+ */
+static void
+unmap_base(struct obj_index* idx)
+{
+        if (idx->hdr)
+                munmap((void*)idx->hdr, idx->map_sz);
+
+        idx->hdr = NULL;
+        idx->ids = NULL;
+        idx->map_sz = 0;
+}
+
+/**
+ * IDs gathered while walking a data directory.
+ */
+struct found_ids {
+        struct slobs* slobs; /**< Slob Allocator        */
+        uint8_t* ids;        /**< IDs found             */
+        uint64_t n;          /**< Number of IDs found   */
+        uint64_t cap;        /**< Capacity of "ids"     */
+};
+
+/**
+ * Append an object found in a data directory.
+ */
+static void
+found_object(void* arg, const uint8_t* id, const char* path)
+{
+        struct found_ids* f = arg;
+
+        append_oid(f->slobs, &f->ids, &f->n, &f->cap, id);
+}
+
+/**
+ * Write a base file with all the objects in a data directory.
+ *
+ * @param idx Index whose base file is rebuilt.
+ * @param data_dir String containing the path to the data directory.
+ * @param depth Number of shard directories above the objects.
+ */
+static void
+rebuild_base(struct obj_index* idx, const char* data_dir, unsigned int depth)
+{
+        struct packs* packs;
+        struct found_ids f = {idx->slobs, NULL, 0, 0};
+        uint8_t* ids;
+        uint64_t i, j, n;
+
+        walk_objects(data_dir, depth, found_object, &f);
+
+        packs = open_packs(idx->slobs, data_dir);
+        for (i = 0; i < packs->n; i++)
+                for (j = 0; j < packs->packs[i].hdr->count; j++)
+                        append_oid(idx->slobs, &f.ids, &f.n, &f.cap,
+                                   packs->packs[i].entries[j].id);
+        close_packs(packs);
+        free_slob(idx->slobs, packs);
+        ids = f.ids;
+        n = f.n;
+
+        /* An object may still be loose after it was packed */
+        qsort(ids, n, OID_SZ, cmp_oid);
+        for (i = j = 0; i < n; i++)
+                if (!j || !oid_eq(ids + (j - 1) * OID_SZ, ids + i * OID_SZ))
+                        memmove(ids + j++ * OID_SZ, ids + i * OID_SZ, OID_SZ);
+        n = j;
+        write_base(idx, ids, n, NULL, 0);
+        remove(idx->log);
+
+        if (ids)
+                free_slob(idx->slobs, ids);
+}
+
+/**
+ * Write a new filter with every ID in the index.
+ *
+ * The filter is sized for twice the IDs in the index, so it's rebuilt
+ * whenever the index has doubled.
+ *
+ * @param idx Index whose filter is rebuilt.
+ */
+static void
+rebuild_filter(struct obj_index* idx)
+{
+        char* path = alloc_slob(idx->slobs, PAGE_SIZE);
+        uint64_t i, cap = 2 * obj_index_size(idx);
+
+        if (idx->filter)
+                close_bloom(idx->filter);
+
+        snprintf(path, PAGE_SIZE, "%s" FILTER_FILE_EXT, idx->path);
+        idx->filter = create_bloom(idx->slobs, path,
+                                   (cap > FILTER_MIN_CAP) ? cap : FILTER_MIN_CAP);
+        for (i = 0; i < idx->hdr->count; i++)
+                bloom_add(idx->filter, idx->ids + i * OID_SZ);
+        for (i = 0; i < idx->n_added; i++)
+                bloom_add(idx->filter, idx->added + i * OID_SZ);
+        save_bloom(idx->filter);
+
+        free_slob(idx->slobs, path);
+}
+
+/**
+ * Open the index's filter, rebuilding it if it may miss IDs of the index or
+ * it's full.
+ *
+ * @param idx Index whose filter is opened.
+ * @param rebuild Set if the filter must be rebuilt.
+ */
+static void
+open_filter(struct obj_index* idx, int rebuild)
+{
+        char* path = alloc_slob(idx->slobs, PAGE_SIZE);
+        uint64_t n = obj_index_size(idx);
+
+        snprintf(path, PAGE_SIZE, "%s" FILTER_FILE_EXT, idx->path);
+        idx->filter = open_bloom(idx->slobs, path);
+        if (rebuild || !idx->filter || bloom_count(idx->filter) < n ||
+            bloom_capacity(idx->filter) < n)
+                rebuild_filter(idx);
+
+        free_slob(idx->slobs, path);
+}
+
+/**
+ * Read the IDs of the log file into memory.
+ *
+ * A partially written ID at the end of the log is ignored.
+ *
+ * @param idx Index whose log is read.
+ */
+static void
+read_log(struct obj_index* idx)
+{
+        struct stat st;
+        uint64_t n;
+        int fd = open(idx->log, O_RDONLY);
+
+        if (fd < 0)
+                return;
+
+        if (!fstat(fd, &st) && (n = st.st_size / OID_SZ)) {
+                idx->cap = n + PAGE_SIZE / OID_SZ;
+                idx->added = alloc_slob(idx->slobs, idx->cap * OID_SZ);
+                idx->n_log = xread(fd, idx->added, n * OID_SZ) / OID_SZ;
+                idx->n_added = idx->n_log;
+
+                for (uint64_t i = 0; i < idx->n_log; i++)
+                        add_file_to_list(idx->logged, idx->added + i * OID_SZ);
+        }
+
+        xclose(fd);
+}
+
+struct obj_index*
+open_obj_index(struct slobs* slobs, const char* path, const char* data_dir,
+               unsigned int depth)
+{
+        struct obj_index* idx = alloc_slob(slobs, sizeof(struct obj_index));
+        int rebuilt = 0;
+
+        idx->slobs = init_huge_slobs("obj-index", slob_pages(slobs));
+        idx->logged = init_data_list(idx->slobs);
+        idx->recent = init_oid_set(idx->slobs);
+        idx->path = alloc_slob(idx->slobs, PAGE_SIZE);
+        idx->log = alloc_slob(idx->slobs, PAGE_SIZE);
+        snprintf(idx->path, PAGE_SIZE, "%s", path);
+        snprintf(idx->log, PAGE_SIZE, "%s" LOG_EXT, path);
+
+        if (map_base(idx)) {
+                rebuild_base(idx, data_dir, depth);
+                rebuilt = 1;
+                if (map_base(idx)) {
+                        printf(DONUT_ERROR "Failed to open the object index: %s\n",
+                               path);
+                        exit(DEF_ERR);
+                }
+        }
+
+        read_log(idx);
+        open_filter(idx, rebuilt);
+        return idx;
+}
+
+/**
+ * Binary search an ID in the base file.
+ *
+ * The fan-out table narrows the search to the IDs with the same first byte.
+ *
+ * @param idx Index to be searched.
+ * @param id ID to be found.
+ * @returns Returns 1 if the ID is found and 0 otherwise.
+ */
+static int
+search_base(struct obj_index* idx, const uint8_t* id)
+{
+        uint64_t lo = (id[0]) ? idx->hdr->fanout[id[0] - 1] : 0;
+        uint64_t hi = idx->hdr->fanout[id[0]];
+        uint64_t mid;
+        int cmp;
+
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                cmp = memcmp(idx->ids + mid * OID_SZ, id, OID_SZ);
+                if (!cmp)
+                        return 1;
+                else if (cmp < 0)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        return 0;
+}
+
+int
+obj_index_has(struct obj_index* idx, const uint8_t* id)
+{
+        /* Most IDs looked up are new, so the filter answers most lookups */
+        if (!bloom_has(idx->filter, id))
+                return 0;
+
+        return is_in_data_list(idx->logged, id) ||
+               oid_set_has(idx->recent, id) || search_base(idx, id);
+}
+
+int
+obj_index_claim(struct obj_index* idx, const uint8_t* id)
+{
+        /* IDs of the base and log are read-only, only new IDs are raced for */
+        if (bloom_has(idx->filter, id) &&
+            (is_in_data_list(idx->logged, id) || search_base(idx, id)))
+                return 0;
+
+        if (!oid_set_claim(idx->recent, id))
+                return 0;
+
+        bloom_add(idx->filter, id);
+        return 1;
+}
+
+int
+obj_index_added(struct obj_index* idx, const uint8_t* id)
+{
+        return oid_set_has(idx->recent, id);
+}
+
+void
+obj_index_add(struct obj_index* idx, const uint8_t* id)
+{
+        obj_index_claim(idx, id);
+}
+
+uint64_t
+obj_index_size(struct obj_index* idx)
+{
+        return idx->hdr->count + idx->n_log + oid_set_size(idx->recent);
+}
+
+/**
+ * Append the IDs added since the index was opened to the log's IDs.
+ *
+ * Only the first call appends them, no ID may be added afterwards.
+ *
+ * @param idx Index whose new IDs are gathered.
+ */
+static void
+gather_added(struct obj_index* idx)
+{
+        uint64_t n = oid_set_size(idx->recent);
+        uint8_t* tmp;
+
+        if (!n || idx->n_added != idx->n_log)
+                return;
+
+        if (idx->n_log + n > idx->cap) {
+                idx->cap = idx->n_log + n;
+                tmp = alloc_slob(idx->slobs, idx->cap * OID_SZ);
+                if (idx->added) {
+                        memcpy(tmp, idx->added, idx->n_log * OID_SZ);
+                        free_slob(idx->slobs, idx->added);
+                }
+                idx->added = tmp;
+        }
+
+        idx->n_added += oid_set_copy(idx->recent, idx->added +
+                                     idx->n_log * OID_SZ);
+}
+
+/**
+ * Merge the log and new IDs into a new base file and remove the log.
+ *
+ * @param idx Index to be compacted.
+ */
+static void
+compact_obj_index(struct obj_index* idx)
+{
+        gather_added(idx);
+        qsort(idx->added, idx->n_added, OID_SZ, cmp_oid);
+        write_base(idx, idx->ids, idx->hdr->count, idx->added, idx->n_added);
+        remove(idx->log);
+}
+
+uint64_t
+obj_index_mem(struct obj_index* idx, uint64_t* huge)
+{
+        *huge = slob_huge_mem(idx->slobs);
+        return slob_mem(idx->slobs);
+}
+
+void
+close_obj_index(struct obj_index* idx)
+{
+        uint64_t n_new;
+        int fd;
+
+        gather_added(idx);
+        n_new = idx->n_added - idx->n_log;
+        if (idx->n_added > LOG_MIN && idx->n_added > idx->hdr->count / 8) {
+                compact_obj_index(idx);
+        } else if (n_new) {
+                fd = xopen(idx->log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+                xwrite(fd, idx->added + idx->n_log * OID_SZ, n_new * OID_SZ);
+                xclose(fd);
+        }
+
+        /* Resize a full filter now rather than on the next open */
+        if (bloom_count(idx->filter) > bloom_capacity(idx->filter))
+                rebuild_filter(idx);
+
+        close_bloom(idx->filter);
+        clear_oid_set(idx->recent);
+        unmap_base(idx);
+        clear_slobs(idx->slobs);
+        idx->slobs = NULL;
+}
+
+int
+test_obj_index(void)
+{
+        int ret = 1;
+        uint8_t id[OID_SZ] = {0};
+        char name[OID_STR_SZ];
+        char* dir = calloc(1, PAGE_SIZE);
+        char* path = calloc(1, PAGE_SIZE);
+        char* file = calloc(1, PAGE_SIZE);
+        struct slobs* slobs = init_slobs("test");
+        struct obj_index* idx;
+        const char* home = getenv("HOME");
+        uint32_t i;
+        int fd;
+
+        snprintf(dir, PAGE_SIZE, "%s/donut_test_index/", home);
+        snprintf(path, PAGE_SIZE, "%s/donut_test_index.idx", home);
+        mkdir(dir, S_IRWXU);
+
+        /* Objects already in the data directory, and a file which isn't one */
+        for (i = 0; i < 3; i++) {
+                id[0] = i * 100;
+                sha2_to_str(id, name);
+                snprintf(file, PAGE_SIZE, "%s%s", dir, name);
+                fd = xopen(file, O_WRONLY | O_CREAT, 0644);
+                xclose(fd);
+        }
+        snprintf(file, PAGE_SIZE, "%snot-an-object", dir);
+        fd = xopen(file, O_WRONLY | O_CREAT, 0644);
+        xclose(fd);
+
+        /* Missing base file is rebuilt from the directory */
+        remove(path);
+        idx = open_obj_index(slobs, path, dir, 0);
+        ret &= (obj_index_size(idx) == 3) ? 1 : 0;
+        for (i = 0; i < 3; i++) {
+                id[0] = i * 100;
+                ret &= obj_index_has(idx, id);
+        }
+        id[0] = 1;
+        ret &= !obj_index_has(idx, id);
+
+        /* New IDs are found at once and after being read from the log */
+        for (i = 0; i < 10; i++) {
+                id[1] = i + 1;
+                obj_index_add(idx, id);
+        }
+        ret &= !obj_index_claim(idx, id);
+        ret &= obj_index_has(idx, id) && obj_index_added(idx, id);
+        close_obj_index(idx);
+
+        /* IDs of the log aren't added by this opening */
+        idx = open_obj_index(slobs, path, dir, 0);
+        ret &= (obj_index_size(idx) == 13) ? 1 : 0;
+        for (i = 0; i < 10; i++) {
+                id[1] = i + 1;
+                ret &= obj_index_has(idx, id) && !obj_index_added(idx, id);
+        }
+
+        /* A missing filter is rebuilt with every ID */
+        close_obj_index(idx);
+        snprintf(file, PAGE_SIZE, "%s" FILTER_FILE_EXT, path);
+        remove(file);
+        idx = open_obj_index(slobs, path, dir, 0);
+        ret &= (access(file, F_OK) == 0) ? 1 : 0;
+        for (i = 0; i < 10; i++) {
+                id[1] = i + 1;
+                ret &= obj_index_has(idx, id);
+        }
+
+        /* Compaction moves every ID into the base file */
+        id[1] = 0xff;
+        obj_index_add(idx, id);
+        compact_obj_index(idx);
+        close_bloom(idx->filter);
+        clear_oid_set(idx->recent);
+        unmap_base(idx);
+        ret &= (access(idx->log, F_OK) == -1) ? 1 : 0;
+        clear_slobs(idx->slobs);
+
+        idx = open_obj_index(slobs, path, dir, 0);
+        ret &= (idx->hdr->count == 14 && !idx->n_log) ? 1 : 0;
+        ret &= obj_index_has(idx, id);
+        for (i = 0; i < 3; i++) {
+                id[0] = i * 100;
+                id[1] = 0;
+                ret &= obj_index_has(idx, id);
+        }
+        close_obj_index(idx);
+
+        /* A fan-out pointing past the IDs is rebuilt from the directory */
+        i = 15;
+        fd = xopen(path, O_WRONLY, 0);
+        xpwrite(fd, &i, sizeof(i), offsetof(struct idx_header, fanout[10]));
+        xclose(fd);
+        idx = open_obj_index(slobs, path, dir, 0);
+        ret &= (idx->hdr->count == 3 && valid_fanout(idx->hdr)) ? 1 : 0;
+        for (i = 0; i < 3; i++) {
+                id[0] = i * 100;
+                ret &= obj_index_has(idx, id);
+        }
+        close_obj_index(idx);
+
+        /* Cleanup */
+        for (i = 0; i < 3; i++) {
+                memset(id, 0x0, OID_SZ);
+                id[0] = i * 100;
+                sha2_to_str(id, name);
+                snprintf(file, PAGE_SIZE, "%s%s", dir, name);
+                remove(file);
+        }
+        snprintf(file, PAGE_SIZE, "%snot-an-object", dir);
+        remove(file);
+        remove(dir);
+        remove(path);
+        snprintf(file, PAGE_SIZE, "%s" FILTER_FILE_EXT, path);
+        remove(file);
+        clear_slobs(slobs);
+        free(file);
+        free(path);
+        free(dir);
+        return ret;
+}
@@ -0,0 +1,227 @@
+#include "core/oid-set.h"
+#include "core/data-list.h"
+#include "core/object.h"
+#include "core/wrappers.h"
+#include "const/const.h"
+#include "pthread.h"
+#include "stdlib.h"
+#include "string.h"
+
+/**
+ * @file oid-set.c
+ * Implementation of the striped set of object IDs.
+ */
+
+/**
+ * Part of a set guarded by its own lock.
+ *
+ * Stripes are cache line aligned, so threads working on different stripes
+ * don't write to the same line.
+ */
+struct oid_stripe {
+        pthread_mutex_t lock;    /**< Guards the list              */
+        struct data_list* list;  /**< IDs of the stripe or NULL    */
+        struct slobs* slobs;     /**< Slob Allocator of the list   */
+} __attribute__((aligned(CACHE_LINE)));
+
+struct oid_set {
+        uint32_t n;                   /**< Number of stripes, a power of 2 */
+        unsigned int pages;           /**< Pages backing the stripes       */
+        struct oid_stripe stripes[];  /**< Stripes of the set              */
+};
+
+/**
+ * Obtain the stripe of an object ID.
+ *
+ * The data_list hashes the first bytes of an ID, so the stripe is picked by
+ * the last one, which keeps IDs spread over the slots of every stripe.
+ *
+ * @param set Set of the stripe.
+ * @param id Object ID.
+ * @returns Pointer to the stripe.
+ */
+static inline struct oid_stripe*
+get_stripe(struct oid_set* set, const uint8_t* id)
+{
+        return &set->stripes[id[OID_SZ - 1] & (set->n - 1)];
+}
+
+struct oid_set*
+init_oid_set(struct slobs* slobs)
+{
+        struct oid_set* set;
+        uint32_t n = 1;
+
+        while (n < OID_SET_STRIPES_PER_CPU * N_CPU)
+                n <<= 1;
+
+        set = alloc_slob(slobs, sizeof(struct oid_set) +
+                         n * sizeof(struct oid_stripe));
+        set->n = n;
+        set->pages = slob_pages(slobs);
+        for (uint32_t i = 0; i < n; i++)
+                pthread_mutex_init(&set->stripes[i].lock, NULL);
+
+        return set;
+}
+
+int
+oid_set_claim(struct oid_set* set, const uint8_t* id)
+{
+        struct oid_stripe* s = get_stripe(set, id);
+        uint64_t n;
+
+        /* A stripe maps its memory once an ID falls in it */
+        pthread_mutex_lock(&s->lock);
+        if (!s->list) {
+                s->slobs = init_huge_slobs("oid-set", set->pages);
+                s->list = init_data_list(s->slobs);
+        }
+        n = data_list_size(s->list);
+        add_file_to_list(s->list, id);
+        n = data_list_size(s->list) - n;
+        pthread_mutex_unlock(&s->lock);
+
+        return (int)n;
+}
+
+int
+oid_set_has(struct oid_set* set, const uint8_t* id)
+{
+        struct oid_stripe* s = get_stripe(set, id);
+        int ret;
+
+        pthread_mutex_lock(&s->lock);
+        ret = (s->list) ? is_in_data_list(s->list, id) : 0;
+        pthread_mutex_unlock(&s->lock);
+
+        return ret;
+}
+
+uint64_t
+oid_set_size(struct oid_set* set)
+{
+        struct oid_stripe* s;
+        uint64_t n = 0;
+
+        for (uint32_t i = 0; i < set->n; i++) {
+                s = &set->stripes[i];
+                pthread_mutex_lock(&s->lock);
+                if (s->list)
+                        n += data_list_size(s->list);
+                pthread_mutex_unlock(&s->lock);
+        }
+
+        return n;
+}
+
+uint64_t
+oid_set_copy(struct oid_set* set, uint8_t* dst)
+{
+        uint64_t n = 0;
+
+        for (uint32_t i = 0; i < set->n; i++)
+                if (set->stripes[i].list)
+                        n += copy_data_list(set->stripes[i].list,
+                                            dst + n * OID_SZ);
+
+        return n;
+}
+
+void
+clear_oid_set(struct oid_set* set)
+{
+        struct oid_stripe* s;
+
+        for (uint32_t i = 0; i < set->n; i++) {
+                s = &set->stripes[i];
+                if (s->slobs)
+                        clear_slobs(s->slobs);
+                pthread_mutex_destroy(&s->lock);
+                s->slobs = NULL;
+                s->list = NULL;
+        }
+}
+
+/**
+ * Thread of the test, claiming every ID starting from a different one.
+ */
+struct test_claimer {
+        struct oid_set* set; /**< Set being raced for        */
+        uint32_t first;      /**< First ID claimed           */
+        uint32_t n;          /**< Number of IDs              */
+        uint32_t won;        /**< Number of IDs it claimed   */
+        pthread_t tid;       /**< Thread's ID                */
+};
+
+/**
+ * Claim every ID of the test, counting those claimed by this thread.
+ */
+static void*
+test_claim_ids(void* arg)
+{
+        struct test_claimer* c = arg;
+        uint8_t id[OID_SZ] = {0};
+        uint32_t i, k;
+
+        for (i = 0; i < c->n; i++) {
+                k = (c->first + i) % c->n;
+                memcpy(id, &k, sizeof(k));
+                id[OID_SZ - 1] = k * 7;
+                c->won += oid_set_claim(c->set, id);
+        }
+
+        return NULL;
+}
+
+int
+test_oid_set(void)
+{
+        int ret = 1;
+        struct slobs* slobs = init_slobs("test");
+        struct oid_set* set = init_oid_set(slobs);
+        struct test_claimer claimers[4] = {{0}};
+        const uint32_t n = 20000;
+        uint8_t id[OID_SZ] = {0};
+        uint8_t* ids;
+        uint32_t i, won = 0;
+
+        /* Stripes are powers of 2 and only created by a claim */
+        ret &= (set->n >= OID_SET_STRIPES_PER_CPU * N_CPU &&
+                !(set->n & (set->n - 1))) ? 1 : 0;
+        ret &= (!oid_set_has(set, id) && !oid_set_size(set)) ? 1 : 0;
+        for (i = 0; i < set->n; i++)
+                ret &= (!set->stripes[i].list) ? 1 : 0;
+
+        /* Threads race for the same IDs, each is won exactly once */
+        for (i = 0; i < 4; i++) {
+                claimers[i].set = set;
+                claimers[i].first = i * (n / 4);
+                claimers[i].n = n;
+                pthread_create(&claimers[i].tid, NULL, test_claim_ids,
+                               &claimers[i]);
+        }
+        for (i = 0; i < 4; i++) {
+                pthread_join(claimers[i].tid, NULL);
+                won += claimers[i].won;
+        }
+        ret &= (won == n && oid_set_size(set) == n) ? 1 : 0;
+
+        /* Claimed IDs are found and can't be claimed again */
+        memcpy(id, &n, sizeof(n));
+        ret &= !oid_set_has(set, id);
+        ret &= oid_set_claim(set, id);
+        ret &= oid_set_has(set, id);
+        ret &= !oid_set_claim(set, id);
+
+        /* Every ID is copied once */
+        ids = calloc(n + 1, OID_SZ);
+        ret &= (oid_set_copy(set, ids) == n + 1) ? 1 : 0;
+        for (i = 0; i < n + 1; i++)
+                ret &= oid_set_has(set, ids + i * OID_SZ);
+
+        free(ids);
+        clear_oid_set(set);
+        clear_slobs(slobs);
+        return ret;
+}
@@ -0,0 +1,448 @@
+#include "core/pack.h"
+#include "core/wrappers.h"
+#include "crypto/sha2.h"
+#include "const/const.h"
+#include "const/err.h"
+#include "misc/decorations.h"
+#include "dirent.h"
+#include "errno.h"
+#include "stddef.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "fcntl.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+
+/**
+ * @file pack.c
+ * Implementation of the packs of small objects.
+ */
+
+/**
+ * @def PACK_MAGIC
+ * Bytes "DPAK" identifying a pack file, read in host byte order.
+ */
+#define PACK_MAGIC 0x4b415044
+
+/**
+ * @def PACK_IDX_MAGIC
+ * Bytes "DPIX" identifying a pack's index file, read in host byte order.
+ */
+#define PACK_IDX_MAGIC 0x58495044
+
+/**
+ * @def PACK_VERSION
+ * Version of the pack and index formats.
+ */
+#define PACK_VERSION 1
+
+/**
+ * @def PACK_BUF_SZ
+ * Size of the buffer used to copy objects into a pack.
+ */
+#define PACK_BUF_SZ (1024 * 1024)
+
+/**
+ * Header at the start of a pack file, followed by the objects' bytes.
+ */
+struct pack_hdr {
+        uint32_t magic;   /**< Must be PACK_MAGIC         */
+        uint32_t version; /**< Must be PACK_VERSION       */
+        uint64_t count;   /**< Number of objects held     */
+};
+
+/**
+ * Pack being written.
+ */
+struct pack_writer {
+        char* tmp;                  /**< Path to the temporary pack   */
+        size_t tmp_len;             /**< Length of the folder's path  */
+        int fd;                     /**< Descriptor of the pack       */
+        uint64_t off;               /**< Offset of the next object    */
+        struct pack_entry* entries; /**< Objects in the pack          */
+        uint64_t n;                 /**< Number of objects            */
+        uint64_t cap;               /**< Capacity of "entries"        */
+        uint8_t* buf;               /**< Copy buffer of PACK_BUF_SZ   */
+        struct slobs* slobs;        /**< Slob Allocator               */
+};
+
+/**
+ * Compare two pack entries by ID for sorting.
+ */
+static int
+cmp_entry(const void* a, const void* b)
+{
+        return memcmp(a, b, OID_SZ);
+}
+
+/**
+ * Check that a pack index's fanout never decreases and stays within its
+ * count, so lookups only bisect entries of the mapping.
+ *
+ * @param idx Header of the index.
+ * @returns 1 if the fanout is valid otherwise 0.
+ */
+static int
+valid_fanout(const struct pack_idx_hdr* idx)
+{
+        for (int i = 0; i < 256; i++)
+                if (idx->fanout[i] > idx->count ||
+                    (i && idx->fanout[i] < idx->fanout[i - 1]))
+                        return 0;
+
+        return 1;
+}
+
+/**
+ * Map a pack's index and open its pack file, if both are valid.
+ *
+ * @param p Pack to be opened.
+ * @param path Path to the index file, whose extension is replaced.
+ * @param len Length of the path.
+ * @returns 0 if the pack was opened otherwise -1.
+ */
+static int
+map_pack(struct pack* p, char* path, size_t len)
+{
+        struct stat st;
+        struct pack_hdr hdr;
+        const struct pack_idx_hdr* idx;
+        int fd = open(path, O_RDONLY);
+
+        if (fd < 0)
+                return -1;
+
+        if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*idx)) {
+                xclose(fd);
+                return -1;
+        }
+
+        idx = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        xclose(fd);
+        if (idx == MAP_FAILED)
+                return -1;
+
+        if (idx->magic != PACK_IDX_MAGIC || idx->version != PACK_VERSION ||
+            idx->fanout[255] != idx->count || !valid_fanout(idx) ||
+            (size_t)st.st_size != sizeof(*idx) +
+            idx->count * sizeof(struct pack_entry))
+                goto unmap;
+
+        strncpy(path + len - strlen(PACK_IDX_EXT), PACK_EXT, PAGE_SIZE - len);
+        p->fd = open(path, O_RDONLY);
+        if (p->fd < 0)
+                goto unmap;
+
+        if (xpread(p->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+            hdr.magic != PACK_MAGIC || hdr.version != PACK_VERSION ||
+            hdr.count != idx->count) {
+                xclose(p->fd);
+                goto unmap;
+        }
+
+        p->hdr = idx;
+        p->entries = (const struct pack_entry*)(idx + 1);
+        p->map_sz = st.st_size;
+        return 0;
+
+unmap:
+        munmap((void*)idx, st.st_size);
+        return -1;
+}
+
+struct packs*
+open_packs(struct slobs* slobs, const char* data_dir)
+{
+        struct packs* packs = alloc_slob(slobs, sizeof(struct packs));
+        char* path = alloc_slob(slobs, PAGE_SIZE);
+        struct dirent* entry;
+        unsigned int cap = 0;
+        size_t len, n_len;
+        DIR* dir;
+
+        packs->packs = NULL;
+        packs->n = 0;
+        len = snprintf(path, PAGE_SIZE, "%s" PACK_FOLDER, data_dir);
+        dir = opendir(path);
+        if (!dir) {
+                free_slob(slobs, path);
+                return packs;
+        }
+
+        while ((entry = readdir(dir))) {
+                n_len = strnlen(entry->d_name, NAME_MAX);
+                if (n_len <= strlen(PACK_IDX_EXT) || len + n_len >= PAGE_SIZE ||
+                    strcmp(entry->d_name + n_len - strlen(PACK_IDX_EXT),
+                           PACK_IDX_EXT))
+                        continue;
+
+                if (packs->n == cap) {
+                        cap = (cap) ? cap << 1 : 8;
+                        packs->packs = xrealloc(packs->packs,
+                                                cap * sizeof(struct pack));
+                }
+
+                memcpy(path + len, entry->d_name, n_len + 1);
+                if (!map_pack(&packs->packs[packs->n], path, len + n_len))
+                        packs->n++;
+        }
+
+        closedir(dir);
+        free_slob(slobs, path);
+        return packs;
+}
+
+const struct pack_entry*
+find_packed(const struct packs* packs, const uint8_t* id, int* fd)
+{
+        const struct pack* p;
+        uint64_t lo, hi, mid;
+        int cmp;
+
+        for (unsigned int i = 0; i < packs->n; i++) {
+                p = &packs->packs[i];
+                lo = (id[0]) ? p->hdr->fanout[id[0] - 1] : 0;
+                hi = p->hdr->fanout[id[0]];
+
+                while (lo < hi) {
+                        mid = lo + (hi - lo) / 2;
+                        cmp = memcmp(p->entries[mid].id, id, OID_SZ);
+                        if (!cmp) {
+                                *fd = p->fd;
+                                return &p->entries[mid];
+                        } else if (cmp < 0) {
+                                lo = mid + 1;
+                        } else {
+                                hi = mid;
+                        }
+                }
+        }
+
+        return NULL;
+}
+
+void
+close_packs(struct packs* packs)
+{
+        for (unsigned int i = 0; i < packs->n; i++) {
+                munmap((void*)packs->packs[i].hdr, packs->packs[i].map_sz);
+                xclose(packs->packs[i].fd);
+        }
+
+        free(packs->packs);
+        packs->packs = NULL;
+        packs->n = 0;
+}
+
+struct pack_writer*
+begin_pack(struct slobs* slobs, const char* tmp_dir)
+{
+        struct pack_writer* pw = alloc_slob(slobs, sizeof(struct pack_writer));
+
+        pw->slobs = slobs;
+        pw->tmp = alloc_slob(slobs, PAGE_SIZE);
+        pw->buf = alloc_slob(slobs, PACK_BUF_SZ);
+        pw->tmp_len = snprintf(pw->tmp, PAGE_SIZE, "%s/", tmp_dir);
+        snprintf(pw->tmp + pw->tmp_len, PAGE_SIZE - pw->tmp_len, "pack-%d",
+                 (int)getpid());
+        pw->fd = xopen(pw->tmp, O_RDWR | O_CREAT | O_TRUNC, 0444);
+        pw->off = sizeof(struct pack_hdr);
+        pw->entries = NULL;
+        pw->n = pw->cap = 0;
+        return pw;
+}
+
+void
+pack_object(struct pack_writer* pw, const uint8_t* id, int fd, uint64_t len)
+{
+        struct pack_entry* e;
+        uint64_t done;
+        size_t bytes;
+
+        if (pw->n == pw->cap) {
+                pw->cap = (pw->cap) ? pw->cap << 1 : 1024;
+                pw->entries = xrealloc(pw->entries,
+                                       pw->cap * sizeof(struct pack_entry));
+        }
+
+        for (done = 0; done < len; done += bytes) {
+                bytes = xpread(fd, pw->buf, (len - done < PACK_BUF_SZ) ?
+                               len - done : PACK_BUF_SZ, done);
+                if (!bytes) {
+                        printf(DONUT_ERROR "An object was truncated while it\
+ was packed.\n");
+                        exit(DEF_ERR);
+                }
+                xpwrite(pw->fd, pw->buf, bytes, pw->off + done);
+        }
+
+        e = &pw->entries[pw->n++];
+        memcpy(e->id, id, OID_SZ);
+        e->off = pw->off;
+        e->len = len;
+        pw->off += len;
+}
+
+uint64_t
+end_pack(struct pack_writer* pw, const char* data_dir, char* name)
+{
+        struct pack_hdr hdr = {PACK_MAGIC, PACK_VERSION, pw->n};
+        struct pack_idx_hdr idx = {PACK_IDX_MAGIC, PACK_VERSION, pw->n, {0}};
+        char* dst = alloc_slob(pw->slobs, PAGE_SIZE);
+        void* hash = alloc_slob(pw->slobs, SHA_STRUCT_SZ);
+        uint8_t digest[SHA2_DIGEST_SZ];
+        uint64_t i, n = pw->n;
+        size_t len;
+        int fd;
+
+        xpwrite(pw->fd, &hdr, sizeof(hdr), 0);
+        fsync(pw->fd);
+        xclose(pw->fd);
+        if (!n) {
+                remove(pw->tmp);
+                goto cleanup_return;
+        }
+
+        /* Packs are named after the IDs they hold */
+        qsort(pw->entries, n, sizeof(struct pack_entry), cmp_entry);
+        sha2_init(hash);
+        for (i = 0; i < n; i++) {
+                sha2_update(pw->entries[i].id, hash, OID_SZ);
+                idx.fanout[pw->entries[i].id[0]]++;
+        }
+        sha2_final(digest, hash);
+        sha2_to_str(digest, name);
+        for (i = 1; i < 256; i++)
+                idx.fanout[i] += idx.fanout[i - 1];
+
+        /* The index is written next to the pack */
+        snprintf(pw->tmp + pw->tmp_len, PAGE_SIZE - pw->tmp_len,
+                 "pack-%d" PACK_IDX_EXT, (int)getpid());
+        fd = xopen(pw->tmp, O_WRONLY | O_CREAT | O_TRUNC, 0444);
+        xwrite(fd, &idx, sizeof(idx));
+        xwrite(fd, pw->entries, n * sizeof(struct pack_entry));
+        fsync(fd);
+        xclose(fd);
+
+        len = snprintf(dst, PAGE_SIZE, "%s" PACK_FOLDER, data_dir);
+        if (mkdir(dst, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) &&
+            errno != EEXIST) {
+                printf(DONUT_ERROR "Failed to create the packs folder: %s\n",
+                       dst);
+                exit(DEF_ERR);
+        }
+
+        /* Readers only look for packs through their index, moved last */
+        snprintf(pw->tmp + pw->tmp_len, PAGE_SIZE - pw->tmp_len, "pack-%d",
+                 (int)getpid());
+        snprintf(dst + len, PAGE_SIZE - len, "pack-%s" PACK_EXT, name);
+        xrename(pw->tmp, dst);
+        snprintf(pw->tmp + pw->tmp_len, PAGE_SIZE - pw->tmp_len,
+                 "pack-%d" PACK_IDX_EXT, (int)getpid());
+        snprintf(dst + len, PAGE_SIZE - len, "pack-%s" PACK_IDX_EXT, name);
+        xrename(pw->tmp, dst);
+
+cleanup_return:
+        free(pw->entries);
+        free_slob(pw->slobs, hash);
+        free_slob(pw->slobs, dst);
+        free_slob(pw->slobs, pw->buf);
+        free_slob(pw->slobs, pw->tmp);
+        free_slob(pw->slobs, pw);
+        return n;
+}
+
+int
+test_pack(void)
+{
+        int fd, pack_fd, ret = 1;
+        uint32_t bad = 15;
+        uint8_t id[OID_SZ];
+        uint8_t buf[64];
+        char name[2][OID_STR_SZ];
+        const struct pack_entry* e;
+        struct packs* packs;
+        struct pack_writer* pw;
+        struct slobs* slobs = init_slobs("test");
+        char* dir = alloc_slob(slobs, PAGE_SIZE);
+        char* path = alloc_slob(slobs, PAGE_SIZE);
+
+        snprintf(dir, PAGE_SIZE, "%s/donut_test_pack/", getenv("HOME"));
+        snprintf(path, PAGE_SIZE, "%sobj", dir);
+        mkdir(dir, S_IRWXU);
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0640);
+        if (fd < 0) {
+                ret = 0;
+                goto cleanup_return;
+        }
+        xwrite(fd, "0123456789abcdefghijklmnopqrstuvwxyz", 36);
+
+        /* Two packs of 3 objects, whose bytes are prefixes of the file */
+        for (int p = 0; p < 2; p++) {
+                pw = begin_pack(slobs, dir);
+                for (int i = 0; i < 3; i++) {
+                        memset(id, p * 3 + i, OID_SZ);
+                        pack_object(pw, id, fd, p * 3 + i + 1);
+                }
+                ret &= (end_pack(pw, dir, name[p]) == 3) ? 1 : 0;
+        }
+
+        packs = open_packs(slobs, dir);
+        ret &= (packs->n == 2) ? 1 : 0;
+        for (int i = 0; i < 6; i++) {
+                memset(id, i, OID_SZ);
+                e = find_packed(packs, id, &pack_fd);
+                ret &= (e && e->len == (uint64_t)i + 1) ? 1 : 0;
+                if (e) {
+                        ret &= (xpread(pack_fd, buf, e->len, e->off) == e->len);
+                        ret &= !memcmp(buf, "0123456789", e->len);
+                }
+        }
+        memset(id, 6, OID_SZ);
+        ret &= !find_packed(packs, id, &pack_fd);
+        close_packs(packs);
+
+        /* A pack whose fanout leaves its entries isn't opened */
+        snprintf(path, PAGE_SIZE, "%s" PACK_FOLDER "pack-%s" PACK_IDX_EXT,
+                 dir, name[1]);
+        chmod(path, S_IRUSR | S_IWUSR);
+        pack_fd = open(path, O_WRONLY);
+        ret &= (pack_fd >= 0) ? 1 : 0;
+        if (pack_fd >= 0) {
+                ret &= (xpwrite(pack_fd, &bad, sizeof(bad),
+                        offsetof(struct pack_idx_hdr, fanout[10])) ==
+                        sizeof(bad));
+                xclose(pack_fd);
+        }
+        packs = open_packs(slobs, dir);
+        ret &= (packs->n == 1) ? 1 : 0;
+        memset(id, 1, OID_SZ);
+        ret &= find_packed(packs, id, &pack_fd) ? 1 : 0;
+        memset(id, 4, OID_SZ);
+        ret &= !find_packed(packs, id, &pack_fd);
+        close_packs(packs);
+
+        /* An empty pack isn't kept */
+        pw = begin_pack(slobs, dir);
+        ret &= (end_pack(pw, dir, name[0]) == 0) ? 1 : 0;
+        xclose(fd);
+
+        for (int p = 0; p < 2; p++) {
+                snprintf(path, PAGE_SIZE, "%s" PACK_FOLDER "pack-%s" PACK_EXT,
+                         dir, name[p]);
+                remove(path);
+                snprintf(path, PAGE_SIZE, "%s" PACK_FOLDER "pack-%s"
+                         PACK_IDX_EXT, dir, name[p]);
+                remove(path);
+        }
+        snprintf(path, PAGE_SIZE, "%s" PACK_FOLDER, dir);
+        ret &= !rmdir(path);
+        snprintf(path, PAGE_SIZE, "%sobj", dir);
+        remove(path);
+        ret &= !rmdir(dir);
+
+cleanup_return:
+        clear_slobs(slobs);
+        return ret;
+}
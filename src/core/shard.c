@@ -0,0 +1,283 @@
+#include "core/shard.h"
+#include "core/wrappers.h"
+#include "crypto/sha2.h"
+#include "const/const.h"
+#include "const/err.h"
+#include "misc/decorations.h"
+#include "dirent.h"
+#include "errno.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "fcntl.h"
+#include "sys/stat.h"
+
+/**
+ * @file shard.c
+ * Implementation of the sharded data directories.
+ */
+
+/**
+ * @def SHARD_MODE
+ * Flags used to create shards.
+ */
+#define SHARD_MODE S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH
+
+static const char hex[] = "0123456789abcdef";
+
+size_t
+shard_name(unsigned int depth, const uint8_t* id, char* dst)
+{
+        char* p = dst;
+
+        for (unsigned int i = 0; i < depth; i++) {
+                *p++ = hex[id[i] >> 4];
+                *p++ = hex[id[i] & 0xf];
+                *p++ = '/';
+        }
+        sha2_to_str(id, p);
+        return p - dst + OID_STR_SZ - 1;
+}
+
+struct shards*
+open_shards(struct slobs* slobs, const char* data_dir, unsigned int depth)
+{
+        struct shards* s = alloc_slob(slobs, sizeof(struct shards));
+
+        s->depth = depth;
+        s->dir = alloc_slob(slobs, PAGE_SIZE);
+        s->len = snprintf(s->dir, PAGE_SIZE, "%s", data_dir);
+        s->made = NULL;
+        if (depth)
+                s->made = alloc_slob(slobs, ((1ull << (8 * depth)) + 63) / 64 *
+                                            sizeof(uint64_t));
+        return s;
+}
+
+void
+make_shard(struct shards* s, const uint8_t* id)
+{
+        char path[PATH_MAX];
+        uint64_t key = 0, bit;
+        size_t len = s->len;
+
+        if (!s->depth)
+                return;
+
+        for (unsigned int i = 0; i < s->depth; i++)
+                key = (key << 8) | id[i];
+        bit = 1ull << (key & 63);
+        if (__atomic_load_n(&s->made[key >> 6], __ATOMIC_ACQUIRE) & bit)
+                return;
+
+        /* Threads racing for the same shard both find it made */
+        memcpy(path, s->dir, len);
+        for (unsigned int i = 0; i < s->depth; i++) {
+                path[len++] = hex[id[i] >> 4];
+                path[len++] = hex[id[i] & 0xf];
+                path[len] = '\0';
+                if (mkdir(path, SHARD_MODE) && errno != EEXIST) {
+                        printf(DONUT_ERROR "Failed to create shard: %s\n", path);
+                        exit(DEF_ERR);
+                }
+                path[len++] = '/';
+        }
+        __atomic_fetch_or(&s->made[key >> 6], bit, __ATOMIC_RELEASE);
+}
+
+int
+is_shard(const char* name)
+{
+        return name[0] && name[1] && !name[2] && strchr(hex, name[0]) &&
+               strchr(hex, name[1]);
+}
+
+/**
+ * Call a function on every object below a shard.
+ *
+ * @param path Buffer of PAGE_SIZE bytes with the path to the shard.
+ * @param len Length of the path, ending with a slash.
+ * @param level Number of directories between the shard and the objects.
+ * @param fn Function called on every object.
+ * @param arg Argument given to the function.
+ */
+static void
+walk_shard(char* path, size_t len, unsigned int level, shard_obj_fn fn,
+           void* arg)
+{
+        struct dirent* entry;
+        uint8_t id[OID_SZ];
+        size_t n_len;
+        DIR* dir = opendir(path);
+
+        if (!dir)
+                return;
+
+        while ((entry = readdir(dir))) {
+                n_len = strnlen(entry->d_name, NAME_MAX);
+                if (len + n_len + 2 > PAGE_SIZE)
+                        continue;
+
+                if (level && entry->d_type == DT_DIR &&
+                    is_shard(entry->d_name)) {
+                        memcpy(path + len, entry->d_name, n_len);
+                        path[len + n_len] = '/';
+                        path[len + n_len + 1] = '\0';
+                        walk_shard(path, len + n_len + 1, level - 1, fn, arg);
+                } else if (!level && entry->d_type == DT_REG &&
+                           !sha2_from_str(entry->d_name, id)) {
+                        /* Files not named after an object ID aren't objects */
+                        memcpy(path + len, entry->d_name, n_len + 1);
+                        fn(arg, id, path);
+                }
+        }
+
+        path[len] = '\0';
+        closedir(dir);
+}
+
+void
+walk_objects(const char* data_dir, unsigned int depth, shard_obj_fn fn,
+             void* arg)
+{
+        char* path = xmalloc(PAGE_SIZE);
+        size_t len = snprintf(path, PAGE_SIZE, "%s", data_dir);
+
+        walk_shard(path, len, depth, fn, arg);
+        free(path);
+}
+
+/**
+ * Remove the empty shards below a shard.
+ *
+ * @param path Buffer of PAGE_SIZE bytes with the path to the shard.
+ * @param len Length of the path, ending with a slash.
+ * @param level Number of shard levels below.
+ */
+static void
+prune_shard(char* path, size_t len, unsigned int level)
+{
+        struct dirent* entry;
+        DIR* dir = opendir(path);
+
+        if (!dir)
+                return;
+
+        while ((entry = readdir(dir))) {
+                if (entry->d_type != DT_DIR || !is_shard(entry->d_name))
+                        continue;
+
+                memcpy(path + len, entry->d_name, 2);
+                path[len + 2] = '/';
+                path[len + 3] = '\0';
+                if (level > 1)
+                        prune_shard(path, len + 3, level - 1);
+                path[len + 2] = '\0';
+                rmdir(path);
+        }
+
+        path[len] = '\0';
+        closedir(dir);
+}
+
+void
+prune_shards(const char* data_dir, unsigned int depth)
+{
+        char* path = xmalloc(PAGE_SIZE);
+        size_t len = snprintf(path, PAGE_SIZE, "%s", data_dir);
+
+        if (depth)
+                prune_shard(path, len, depth);
+        free(path);
+}
+
+/**
+ * Count the objects found by a walk, checking they're in their shard.
+ */
+static void
+count_object(void* arg, const uint8_t* id, const char* path)
+{
+        uint64_t* n = arg;
+        char name[SHARD_NAME_SZ];
+        size_t len = strlen(path), n_len = shard_name(n[1], id, name);
+
+        if (len >= n_len && !strcmp(path + len - n_len, name))
+                n[0]++;
+}
+
+int
+test_shard(void)
+{
+        int fd, ret = 1;
+        uint8_t ids[4][OID_SZ];
+        uint64_t found[2];
+        size_t len;
+        char name[SHARD_NAME_SZ];
+        struct shards* s;
+        struct slobs* slobs = init_slobs("test");
+        char* dir = alloc_slob(slobs, PAGE_SIZE);
+        char* path = alloc_slob(slobs, PAGE_SIZE);
+
+        /* Names of the flat and sharded layouts */
+        memset(ids[0], 0xab, OID_SZ);
+        ret &= (shard_name(0, ids[0], name) == OID_STR_SZ - 1) ? 1 : 0;
+        ret &= (shard_name(2, ids[0], name) == OID_STR_SZ + 5) ? 1 : 0;
+        ret &= !strncmp(name, "ab/ab/abab", 10);
+
+        /* Objects sharing their first bytes share shards */
+        memset(ids[1], 0xab, OID_SZ);
+        ids[1][2] = 0x01;
+        memset(ids[2], 0x00, OID_SZ);
+        memset(ids[3], 0xff, OID_SZ);
+
+        snprintf(dir, PAGE_SIZE, "%s/donut_test_shard/", getenv("HOME"));
+        mkdir(dir, S_IRWXU);
+        len = snprintf(path, PAGE_SIZE, "%sframe", dir);
+        mkdir(path, S_IRWXU);
+        path[len++] = '/';
+        sha2_to_str(ids[0], path + len);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+        ret &= (fd >= 0) ? 1 : 0;
+        if (fd >= 0)
+                xclose(fd);
+
+        for (unsigned int depth = 0; depth <= SHARD_DEPTH_MAX; depth++) {
+                s = open_shards(slobs, dir, depth);
+                for (int i = 0; i < 4; i++) {
+                        make_shard(s, ids[i]);
+                        make_shard(s, ids[i]);
+                        len = snprintf(path, PAGE_SIZE, "%s", dir);
+                        shard_name(depth, ids[i], path + len);
+                        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+                        ret &= (fd >= 0) ? 1 : 0;
+                        if (fd >= 0)
+                                xclose(fd);
+                }
+
+                /* Objects of dataframes aren't found */
+                found[0] = 0;
+                found[1] = depth;
+                walk_objects(dir, depth, count_object, found);
+                ret &= (found[0] == 4) ? 1 : 0;
+
+                for (int i = 0; i < 4; i++) {
+                        len = snprintf(path, PAGE_SIZE, "%s", dir);
+                        shard_name(depth, ids[i], path + len);
+                        remove(path);
+                }
+                prune_shards(dir, depth);
+                free_slob(slobs, s->made);
+                free_slob(slobs, s->dir);
+                free_slob(slobs, s);
+        }
+
+        len = snprintf(path, PAGE_SIZE, "%sframe/", dir);
+        sha2_to_str(ids[0], path + len);
+        remove(path);
+        path[len] = '\0';
+        ret &= !rmdir(path);
+        ret &= !rmdir(dir);
+
+        clear_slobs(slobs);
+        return ret;
+}
@@ -0,0 +1,411 @@
+#include "core/stat-cache.h"
+#include "core/object.h"
+#include "core/wrappers.h"
+#include "const/const.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "unistd.h"
+#include "sys/mman.h"
+
+/**
+ * @file stat-cache.c
+ * Implementation of the stat cache.
+ */
+
+/**
+ * @def SC_MAGIC
+ * Bytes "DSTC" identifying a stat cache, read in host byte order.
+ */
+#define SC_MAGIC 0x43545344
+
+/**
+ * @def SC_VERSION
+ * Version of the stat cache's format.
+ */
+#define SC_VERSION 1
+
+/**
+ * @def TMP_EXT
+ * Extension appended to the cache's path while a new one is written.
+ */
+#define TMP_EXT ".tmp"
+
+/**
+ * @def WRITE_BUF_ENTS
+ * Number of entries buffered while writing the cache's file.
+ */
+#define WRITE_BUF_ENTS 8192
+
+/**
+ * @def ST_MTIM
+ * Last modification timestamp of a stat structure.
+ */
+/**
+ * @def ST_CTIM
+ * Last status change timestamp of a stat structure.
+ */
+#if defined(__APPLE__)
+#define ST_MTIM(st) (&(st)->st_mtimespec)
+#define ST_CTIM(st) (&(st)->st_ctimespec)
+#else
+#define ST_MTIM(st) (&(st)->st_mtim)
+#define ST_CTIM(st) (&(st)->st_ctim)
+#endif
+
+/**
+ * Header at the start of the cache's file, followed by the sorted entries.
+ */
+struct sc_header {
+        uint32_t magic;     /**< Must be SC_MAGIC                  */
+        uint32_t version;   /**< Must be SC_VERSION                */
+        uint32_t id_scheme; /**< Object ID scheme of the entries   */
+        uint32_t gen;       /**< Number of runs using the cache    */
+        uint64_t count;     /**< Number of entries                 */
+};
+
+/**
+ * Cached object ID of a file.
+ */
+struct sc_entry {
+        uint64_t key;       /**< Hash of the file's absolute path  */
+        uint64_t dev;       /**< Device of the file                */
+        uint64_t ino;       /**< Inode of the file                 */
+        uint64_t size;      /**< Byte size of the file             */
+        uint64_t mtime_ns;  /**< Last modification in nanoseconds  */
+        uint64_t ctime_ns;  /**< Last status change in nanoseconds */
+        uint32_t gen;       /**< Last run which used the entry     */
+        uint32_t pad;       /**< Unused                            */
+        uint8_t id[OID_SZ]; /**< Object ID of the file's content   */
+};
+
+struct stat_cache {
+        char* path;              /**< Path to the cache's file        */
+        struct sc_header* hdr;   /**< Mapped file or NULL             */
+        struct sc_entry* ents;   /**< Sorted entries of the file      */
+        size_t map_sz;           /**< Size of the mapping             */
+        uint32_t id_scheme;      /**< Object ID scheme of the repo    */
+        uint32_t gen;            /**< Generation of the current run   */
+        struct sc_entry* added;  /**< Entries added in this run       */
+        uint64_t n_added;        /**< Number of entries added         */
+        uint64_t cap;            /**< Capacity of "added" in entries  */
+        uint64_t opened_ns;      /**< Time the cache was opened at    */
+        struct slobs* slobs;     /**< Slob Allocator                  */
+};
+
+/**
+ * Hash a path with 64 bit FNV-1a.
+ *
+ * @param path String containing the path.
+ * @returns The path's hash.
+ */
+static uint64_t
+path_key(const char* path)
+{
+        uint64_t h = 0xcbf29ce484222325ull;
+
+        while (*path) {
+                h ^= (uint8_t)*path++;
+                h *= 0x100000001b3ull;
+        }
+
+        return h;
+}
+
+/**
+ * Convert a timestamp into nanoseconds.
+ */
+inline static uint64_t
+ts_ns(const struct timespec* ts)
+{
+        return ts->tv_sec * 1000000000ull + ts->tv_nsec;
+}
+
+/**
+ * Compare two entries by their key for sorting.
+ */
+static int
+cmp_entry(const void* a, const void* b)
+{
+        uint64_t ka = ((const struct sc_entry*)a)->key;
+        uint64_t kb = ((const struct sc_entry*)b)->key;
+
+        return (ka > kb) - (ka < kb);
+}
+
+struct stat_cache*
+open_stat_cache(struct slobs* slobs, const char* path, uint32_t id_scheme)
+{
+        struct stat st;
+        struct timespec now;
+        struct sc_header* hdr;
+        struct stat_cache* sc = alloc_slob(slobs, sizeof(struct stat_cache));
+        int fd;
+
+        sc->slobs = init_huge_slobs("stat-cache", slob_pages(slobs));
+        sc->id_scheme = id_scheme;
+        sc->gen = 1;
+        clock_gettime(CLOCK_REALTIME, &now);
+        sc->opened_ns = ts_ns(&now);
+        sc->path = alloc_slob(sc->slobs, PAGE_SIZE);
+        snprintf(sc->path, PAGE_SIZE, "%s", path);
+
+        fd = open(path, O_RDWR);
+        if (fd < 0)
+                return sc;
+
+        if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*hdr)) {
+                xclose(fd);
+                return sc;
+        }
+
+        hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        xclose(fd);
+        if (hdr == MAP_FAILED)
+                return sc;
+
+        if (hdr->magic != SC_MAGIC || hdr->version != SC_VERSION ||
+            hdr->id_scheme != id_scheme || (size_t)st.st_size !=
+            sizeof(*hdr) + hdr->count * sizeof(struct sc_entry)) {
+                munmap(hdr, st.st_size);
+                return sc;
+        }
+
+        sc->hdr = hdr;
+        sc->ents = (struct sc_entry*)(hdr + 1);
+        sc->map_sz = st.st_size;
+        sc->gen = hdr->gen + 1;
+        return sc;
+}
+
+/**
+ * Binary search the entry of a key in the cache's file.
+ *
+ * @param sc Stat cache to be searched.
+ * @param key Hash of the file's path.
+ * @returns Pointer to the entry or NULL if it's not found.
+ */
+static struct sc_entry*
+find_entry(struct stat_cache* sc, uint64_t key)
+{
+        uint64_t lo = 0, hi = (sc->hdr) ? sc->hdr->count : 0, mid;
+
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (sc->ents[mid].key == key)
+                        return &sc->ents[mid];
+                else if (sc->ents[mid].key < key)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        return NULL;
+}
+
+int
+stat_cache_get(struct stat_cache* sc, const char* path, const struct stat* st,
+               uint8_t* id)
+{
+        struct sc_entry* e = find_entry(sc, path_key(path));
+
+        if (!e || e->dev != (uint64_t)st->st_dev ||
+            e->ino != (uint64_t)st->st_ino ||
+            e->size != (uint64_t)st->st_size ||
+            e->mtime_ns != ts_ns(ST_MTIM(st)) ||
+            e->ctime_ns != ts_ns(ST_CTIM(st)))
+                return 0;
+
+        e->gen = sc->gen;
+        memcpy(id, e->id, OID_SZ);
+        return 1;
+}
+
+void
+stat_cache_put(struct stat_cache* sc, const char* path, const struct stat* st,
+               const uint8_t* id)
+{
+        struct sc_entry* tmp;
+        struct sc_entry* e;
+        uint64_t changed = ts_ns(ST_MTIM(st));
+
+        /* Measured against the opening, the clock isn't read for every file */
+        if (ts_ns(ST_CTIM(st)) > changed)
+                changed = ts_ns(ST_CTIM(st));
+        if (changed + STAT_CACHE_RACY_NS > sc->opened_ns)
+                return;
+
+        if (sc->n_added == sc->cap) {
+                sc->cap = (sc->cap) ? sc->cap << 1 :
+                          PAGE_SIZE / sizeof(struct sc_entry);
+                tmp = alloc_slob(sc->slobs, sc->cap * sizeof(struct sc_entry));
+                if (sc->added) {
+                        memcpy(tmp, sc->added,
+                               sc->n_added * sizeof(struct sc_entry));
+                        free_slob(sc->slobs, sc->added);
+                }
+                sc->added = tmp;
+        }
+
+        e = &sc->added[sc->n_added++];
+        e->key = path_key(path);
+        e->dev = st->st_dev;
+        e->ino = st->st_ino;
+        e->size = st->st_size;
+        e->mtime_ns = ts_ns(ST_MTIM(st));
+        e->ctime_ns = ts_ns(ST_CTIM(st));
+        e->gen = sc->gen;
+        memcpy(e->id, id, OID_SZ);
+}
+
+/**
+ * Write a new cache's file with the entries of the current one and the added
+ * ones, which replace entries with the same key.
+ *
+ * @param sc Stat cache to be written.
+ */
+static void
+write_stat_cache(struct stat_cache* sc)
+{
+        struct sc_header hdr = {SC_MAGIC, SC_VERSION, sc->id_scheme, sc->gen, 0};
+        struct sc_entry* old = sc->ents;
+        struct sc_entry* new = sc->added;
+        struct sc_entry* e;
+        struct sc_entry* buf = alloc_slob(sc->slobs, WRITE_BUF_ENTS *
+                                          sizeof(struct sc_entry));
+        uint64_t n_old = (sc->hdr) ? sc->hdr->count : 0, n_new = sc->n_added;
+        char* tmp = alloc_slob(sc->slobs, PAGE_SIZE);
+        size_t used = 0;
+        int fd;
+
+        qsort(new, n_new, sizeof(struct sc_entry), cmp_entry);
+        snprintf(tmp, PAGE_SIZE, "%s" TMP_EXT, sc->path);
+        fd = xopen(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        lseek(fd, sizeof(hdr), SEEK_SET);
+
+        while (n_old || n_new) {
+                if (!n_new || (n_old && old->key < new->key)) {
+                        e = old++;
+                        n_old--;
+                        if (sc->gen - e->gen > STAT_CACHE_MAX_AGE)
+                                continue;
+                } else {
+                        e = new++;
+                        n_new--;
+
+                        /* Added entries replace the current ones */
+                        while (n_old && old->key == e->key) {
+                                old++;
+                                n_old--;
+                        }
+                        while (n_new && new->key == e->key) {
+                                e = new++;
+                                n_new--;
+                        }
+                }
+
+                if (used == WRITE_BUF_ENTS) {
+                        xwrite(fd, buf, used * sizeof(struct sc_entry));
+                        used = 0;
+                }
+                buf[used++] = *e;
+                hdr.count++;
+        }
+
+        xwrite(fd, buf, used * sizeof(struct sc_entry));
+        xpwrite(fd, &hdr, sizeof(hdr), 0);
+        xclose(fd);
+        xrename(tmp, sc->path);
+        free_slob(sc->slobs, tmp);
+        free_slob(sc->slobs, buf);
+}
+
+void
+close_stat_cache(struct stat_cache* sc)
+{
+        if (sc->n_added)
+                write_stat_cache(sc);
+        else if (sc->hdr)
+                sc->hdr->gen = sc->gen;
+
+        if (sc->hdr)
+                munmap(sc->hdr, sc->map_sz);
+        sc->hdr = NULL;
+        clear_slobs(sc->slobs);
+        sc->slobs = NULL;
+}
+
+int
+test_stat_cache(void)
+{
+        int ret = 1;
+        uint8_t id[OID_SZ], out[OID_SZ];
+        struct stat st;
+        struct stat_cache* sc;
+        struct slobs* slobs = init_slobs("test");
+        char* path = calloc(1, PAGE_SIZE);
+        char* file = calloc(1, PAGE_SIZE);
+        const char* home = getenv("HOME");
+        uint32_t i;
+
+        snprintf(path, PAGE_SIZE, "%s/donut_test_stat_cache", home);
+        snprintf(file, PAGE_SIZE, "%s/donut_test_stat_file", home);
+        remove(path);
+        memset(id, 0xab, OID_SZ);
+        memset(&st, 0x0, sizeof(st));
+        st.st_dev = 1;
+        st.st_ino = 2;
+        st.st_size = 3;
+        ST_MTIM(&st)->tv_sec = 1000;
+        ST_CTIM(&st)->tv_sec = 1000;
+
+        /* Added entries are found once written */
+        sc = open_stat_cache(slobs, path, 0);
+        ret &= !stat_cache_get(sc, file, &st, out);
+        stat_cache_put(sc, file, &st, id);
+        for (i = 0; i < 100; i++) {
+                st.st_ino = 100 + i;
+                snprintf(file, PAGE_SIZE, "%s/donut_test_stat_%u", home, i);
+                stat_cache_put(sc, file, &st, id);
+        }
+        close_stat_cache(sc);
+
+        sc = open_stat_cache(slobs, path, 0);
+        for (i = 0; i < 100; i++) {
+                st.st_ino = 100 + i;
+                snprintf(file, PAGE_SIZE, "%s/donut_test_stat_%u", home, i);
+                ret &= stat_cache_get(sc, file, &st, out);
+                ret &= !memcmp(out, id, OID_SZ);
+        }
+
+        /* Any change to the status is a miss */
+        snprintf(file, PAGE_SIZE, "%s/donut_test_stat_file", home);
+        st.st_ino = 2;
+        ret &= stat_cache_get(sc, file, &st, out);
+        ST_MTIM(&st)->tv_nsec = 1;
+        ret &= !stat_cache_get(sc, file, &st, out);
+        ST_MTIM(&st)->tv_nsec = 0;
+        st.st_size = 4;
+        ret &= !stat_cache_get(sc, file, &st, out);
+        st.st_size = 3;
+        close_stat_cache(sc);
+
+        /* Entries of another ID scheme are ignored */
+        sc = open_stat_cache(slobs, path, 1);
+        ret &= !stat_cache_get(sc, file, &st, out);
+        close_stat_cache(sc);
+
+        /* Recently changed files aren't cached */
+        sc = open_stat_cache(slobs, path, 0);
+        clock_gettime(CLOCK_REALTIME, ST_MTIM(&st));
+        stat_cache_put(sc, file, &st, id);
+        ret &= (sc->n_added == 0) ? 1 : 0;
+        close_stat_cache(sc);
+
+        remove(path);
+        clear_slobs(slobs);
+        free(file);
+        free(path);
+        return ret;
+}
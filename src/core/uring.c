@@ -0,0 +1,415 @@
+#include "core/uring.h"
+#include "core/wrappers.h"
+#include "const/const.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "errno.h"
+
+/**
+ * @file uring.c
+ * Implementation of the io_uring queues.
+ */
+
+/**
+ * @def HAVE_URING
+ * Defined when the kernel's io_uring interface can be used.
+ */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include("linux/io_uring.h")
+#define HAVE_URING 1
+#endif
+#endif
+
+#if defined(HAVE_URING)
+
+#include "linux/io_uring.h"
+#include "sys/mman.h"
+#include "sys/syscall.h"
+
+struct uring {
+        int fd;                     /**< Descriptor of the ring          */
+        uint32_t entries;           /**< Number of submission entries    */
+        uint32_t* sq_head;          /**< Submissions consumed by kernel  */
+        uint32_t* sq_tail;          /**< Submissions published           */
+        uint32_t* sq_mask;          /**< Mask of the submission ring     */
+        uint32_t* cq_head;          /**< Completions reaped              */
+        uint32_t* cq_tail;          /**< Completions posted by kernel    */
+        uint32_t* cq_mask;          /**< Mask of the completion ring     */
+        struct io_uring_sqe* sqes;  /**< Submission entries              */
+        struct io_uring_cqe* cqes;  /**< Completion entries              */
+        void* sq_map;               /**< Mapping of the submission ring  */
+        size_t sq_sz;               /**< Size of the submission mapping  */
+        void* cq_map;               /**< Mapping of the completion ring  */
+        size_t cq_sz;               /**< Size of the completion mapping  */
+        uint32_t tail;              /**< Next submission entry           */
+        uint32_t pending;           /**< Operations not yet reaped       */
+};
+
+/**
+ * Check the kernel supports every operation queued by donut.
+ */
+static int
+probe_ops(struct slobs* slobs, int fd)
+{
+        static const uint8_t ops[] = {IORING_OP_OPENAT, IORING_OP_READ,
+                                      IORING_OP_CLOSE, IORING_OP_RENAMEAT};
+        struct io_uring_probe* probe = alloc_slob(slobs, sizeof(*probe) +
+                                                  256 * sizeof(probe->ops[0]));
+        int ret = 1;
+        size_t i;
+
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+                    256) < 0)
+                ret = 0;
+
+        for (i = 0; ret && i < sizeof(ops); i++)
+                ret = (probe->last_op >= ops[i] &&
+                       (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) ?
+                      1 : 0;
+
+        free_slob(slobs, probe);
+        return ret;
+}
+
+struct uring*
+uring_init(struct slobs* slobs, unsigned int entries)
+{
+        struct io_uring_params p = {0};
+        struct uring* r;
+        uint8_t* sq;
+        uint8_t* cq;
+        uint32_t i;
+        int fd = syscall(__NR_io_uring_setup, entries, &p);
+
+        if (fd < 0)
+                return NULL;
+
+        if (!probe_ops(slobs, fd)) {
+                close(fd);
+                return NULL;
+        }
+
+        r = alloc_slob(slobs, sizeof(struct uring));
+        r->fd = fd;
+        r->entries = p.sq_entries;
+        r->sq_sz = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        r->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+        /* Both rings may share a single mapping */
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+                r->sq_sz = (r->cq_sz > r->sq_sz) ? r->cq_sz : r->sq_sz;
+                r->cq_sz = r->sq_sz;
+        }
+
+        r->sq_map = mmap(NULL, r->sq_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        r->cq_map = (p.features & IORING_FEAT_SINGLE_MMAP) ? r->sq_map :
+                    mmap(NULL, r->cq_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                       IORING_OFF_SQES);
+
+        if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED ||
+            r->sqes == MAP_FAILED) {
+                if (r->sqes != MAP_FAILED)
+                        r->sqes = NULL;
+                if (r->cq_map == MAP_FAILED)
+                        r->cq_map = NULL;
+                if (r->sq_map == MAP_FAILED)
+                        r->sq_map = NULL;
+                uring_exit(r);
+                free_slob(slobs, r);
+                return NULL;
+        }
+
+        sq = r->sq_map;
+        cq = r->cq_map;
+        r->sq_head = (uint32_t*)(sq + p.sq_off.head);
+        r->sq_tail = (uint32_t*)(sq + p.sq_off.tail);
+        r->sq_mask = (uint32_t*)(sq + p.sq_off.ring_mask);
+        r->cq_head = (uint32_t*)(cq + p.cq_off.head);
+        r->cq_tail = (uint32_t*)(cq + p.cq_off.tail);
+        r->cq_mask = (uint32_t*)(cq + p.cq_off.ring_mask);
+        r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+        /* Submission entries are used in order */
+        for (i = 0; i < p.sq_entries; i++)
+                ((uint32_t*)(sq + p.sq_off.array))[i] = i;
+        r->tail = *r->sq_tail;
+
+        return r;
+}
+
+void
+uring_exit(struct uring* r)
+{
+        if (r->sqes)
+                munmap(r->sqes, r->entries * sizeof(struct io_uring_sqe));
+        if (r->cq_map && r->cq_map != r->sq_map)
+                munmap(r->cq_map, r->cq_sz);
+        if (r->sq_map)
+                munmap(r->sq_map, r->sq_sz);
+        close(r->fd);
+}
+
+unsigned int
+uring_space(struct uring* r)
+{
+        return r->entries - r->pending;
+}
+
+unsigned int
+uring_inflight(struct uring* r)
+{
+        return r->pending;
+}
+
+/**
+ * Obtain a cleared submission entry.
+ *
+ * Operations are limited to the submission queue's size, including those
+ * already submitted, so completions never exceed the completion queue.
+ *
+ * @returns Pointer to the entry or NULL if the queue is full.
+ */
+static struct io_uring_sqe*
+get_sqe(struct uring* r, uint8_t op, int fd, uint64_t tag)
+{
+        struct io_uring_sqe* sqe;
+
+        if (r->pending == r->entries)
+                return NULL;
+
+        sqe = &r->sqes[r->tail++ & *r->sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = op;
+        sqe->fd = fd;
+        sqe->user_data = tag;
+        r->pending++;
+        return sqe;
+}
+
+int
+uring_openat(struct uring* r, int dir_fd, const char* path, int flags,
+             uint64_t tag)
+{
+        struct io_uring_sqe* sqe = get_sqe(r, IORING_OP_OPENAT, dir_fd, tag);
+
+        if (!sqe)
+                return -1;
+
+        sqe->addr = (uintptr_t)path;
+        sqe->open_flags = flags;
+        return 0;
+}
+
+int
+uring_read(struct uring* r, int fd, void* buf, uint32_t len, uint64_t off,
+           uint64_t tag)
+{
+        struct io_uring_sqe* sqe = get_sqe(r, IORING_OP_READ, fd, tag);
+
+        if (!sqe)
+                return -1;
+
+        sqe->addr = (uintptr_t)buf;
+        sqe->len = len;
+        sqe->off = off;
+        return 0;
+}
+
+int
+uring_close(struct uring* r, int fd, uint64_t tag)
+{
+        return (get_sqe(r, IORING_OP_CLOSE, fd, tag)) ? 0 : -1;
+}
+
+int
+uring_renameat(struct uring* r, int old_fd, const char* old_path, int new_fd,
+               const char* new_path, uint64_t tag)
+{
+        struct io_uring_sqe* sqe = get_sqe(r, IORING_OP_RENAMEAT, old_fd, tag);
+
+        if (!sqe)
+                return -1;
+
+        sqe->addr = (uintptr_t)old_path;
+        sqe->len = new_fd;
+        sqe->addr2 = (uintptr_t)new_path;
+        return 0;
+}
+
+int
+uring_submit(struct uring* r, unsigned int wait)
+{
+        uint32_t n;
+        long ret;
+
+        __atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+
+        do {
+                n = r->tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+                ret = syscall(__NR_io_uring_enter, r->fd, n, wait,
+                              (wait) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+        return (ret < 0) ? -errno : 0;
+}
+
+int
+uring_reap(struct uring* r, uint64_t* tag, int32_t* res)
+{
+        uint32_t head = *r->cq_head;
+        struct io_uring_cqe* cqe;
+
+        if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+                return 0;
+
+        cqe = &r->cqes[head & *r->cq_mask];
+        *tag = cqe->user_data;
+        *res = cqe->res;
+        __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+        r->pending--;
+        return 1;
+}
+
+#else
+
+struct uring*
+uring_init(struct slobs* slobs, unsigned int entries)
+{
+        return NULL;
+}
+
+void
+uring_exit(struct uring* r)
+{
+}
+
+unsigned int
+uring_space(struct uring* r)
+{
+        return 0;
+}
+
+unsigned int
+uring_inflight(struct uring* r)
+{
+        return 0;
+}
+
+int
+uring_openat(struct uring* r, int dir_fd, const char* path, int flags,
+             uint64_t tag)
+{
+        return -1;
+}
+
+int
+uring_read(struct uring* r, int fd, void* buf, uint32_t len, uint64_t off,
+           uint64_t tag)
+{
+        return -1;
+}
+
+int
+uring_close(struct uring* r, int fd, uint64_t tag)
+{
+        return -1;
+}
+
+int
+uring_renameat(struct uring* r, int old_fd, const char* old_path, int new_fd,
+               const char* new_path, uint64_t tag)
+{
+        return -1;
+}
+
+int
+uring_submit(struct uring* r, unsigned int wait)
+{
+        return -ENOSYS;
+}
+
+int
+uring_reap(struct uring* r, uint64_t* tag, int32_t* res)
+{
+        return 0;
+}
+
+#endif
+
+int
+test_uring(void)
+{
+        int fd, ret = 1;
+        int32_t res, fds[2] = {-1, -1};
+        uint64_t tag, seen = 0;
+        char buf[16] = {0};
+        char* a = calloc(1, PAGE_SIZE);
+        char* b = calloc(1, PAGE_SIZE);
+        struct slobs* slobs = init_slobs("test");
+        struct uring* r = uring_init(slobs, 8);
+
+        /* Blocking calls are used where io_uring isn't available */
+        if (!r)
+                goto cleanup_return;
+
+        snprintf(a, PAGE_SIZE, "%s/donut_test_uring_a", getenv("HOME"));
+        snprintf(b, PAGE_SIZE, "%s/donut_test_uring_b", getenv("HOME"));
+        fd = open(a, O_RDWR | O_CREAT | O_TRUNC, 0640);
+        if (fd < 0) {
+                ret = 0;
+                goto cleanup_return;
+        }
+        xwrite(fd, "donut", 5);
+        xclose(fd);
+
+        /* Two opens in flight at once complete with their own tags */
+        ret &= !uring_openat(r, AT_FDCWD, a, O_RDONLY, 1);
+        ret &= !uring_openat(r, AT_FDCWD, a, O_RDONLY, 2);
+        ret &= (uring_inflight(r) == 2 && uring_space(r) == 6) ? 1 : 0;
+        ret &= !uring_submit(r, 2);
+        while (uring_reap(r, &tag, &res)) {
+                ret &= (tag == 1 || tag == 2) && res >= 0;
+                if (tag == 1 || tag == 2)
+                        fds[tag - 1] = res;
+                seen |= tag;
+        }
+        ret &= (seen == 3 && !uring_inflight(r)) ? 1 : 0;
+
+        /* Reads and renames return their results */
+        if (fds[0] >= 0) {
+                ret &= !uring_read(r, fds[0], buf, sizeof(buf), 1, 3);
+                ret &= !uring_renameat(r, AT_FDCWD, a, AT_FDCWD, b, 4);
+                ret &= !uring_submit(r, 2);
+                for (seen = 0; uring_reap(r, &tag, &res); seen |= tag)
+                        ret &= (tag == 3) ? (res == 4 && !memcmp(buf, "onut",
+                                                                4)) :
+                               (tag == 4 && !res);
+                ret &= (seen == 7 && !access(b, F_OK)) ? 1 : 0;
+        }
+
+        /* Queue never holds more operations than its size */
+        ret &= !uring_close(r, fds[0], 5) && !uring_close(r, fds[1], 5);
+        for (tag = 0; tag < 6; tag++)
+                ret &= !uring_close(r, -1, 6);
+        ret &= (!uring_space(r) && uring_close(r, -1, 6) == -1) ? 1 : 0;
+        ret &= !uring_submit(r, 8);
+        while (uring_reap(r, &tag, &res))
+                ;
+        ret &= (!uring_inflight(r)) ? 1 : 0;
+
+        remove(a);
+        remove(b);
+        uring_exit(r);
+
+cleanup_return:
+        clear_slobs(slobs);
+        free(a);
+        free(b);
+        return ret;
+}
@@ -0,0 +1,697 @@
+#include "core/walk.h"
+#include "core/wrappers.h"
+#include "mem/slob.h"
+#include "const/const.h"
+#include "const/err.h"
+#include "misc/decorations.h"
+#include "tools/stats.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "limits.h"
+#include "pthread.h"
+#include "inttypes.h"
+#include "sys/stat.h"
+
+/**
+ * @file walk.c
+ * Implementation of the parallel directory walker.
+ */
+
+/**
+ * @def CHUNK_SZ
+ * Byte size of the memory holding a task or a directory.
+ */
+#define CHUNK_SZ (2 * PAGE_SIZE)
+
+/**
+ * @def STEP_FILES
+ * Maximum number of files handled by a thread per batch of a directory.
+ */
+#define STEP_FILES 128
+
+/**
+ * @def MIN_DEQUE
+ * Number of tasks a thread's deque holds before it's grown.
+ */
+#define MIN_DEQUE 64
+
+/**
+ * @def TASK_READ
+ * Task reading the next batch of a directory.
+ */
+#define TASK_READ 0
+
+/**
+ * @def TASK_DIRS
+ * Task opening and reading a batch of subdirectories.
+ */
+#define TASK_DIRS 1
+
+/**
+ * Directory being walked.
+ *
+ * Held directories keep their descriptor open until every task using it is
+ * done. Other directories are read whole by a single thread, so their
+ * descriptor is only used by that thread.
+ */
+struct walk_dir {
+        DIR* dir;                /**< Open directory or NULL once closed   */
+        int fd;                  /**< Descriptor shared by tasks or -1     */
+        uint32_t refs;           /**< Number of tasks using the directory  */
+        struct walk_task* dirs;  /**< Subdirectories not yet queued        */
+        size_t len;              /**< Length of the path                   */
+        char path[];             /**< Path ending with a '/'               */
+};
+
+/**
+ * Task queued on a thread's deque, or batch of files being handled.
+ */
+struct walk_task {
+        struct walk_dir* dir; /**< Directory of the task    */
+        uint32_t kind;        /**< TASK_READ or TASK_DIRS   */
+        uint32_t n;           /**< Number of names          */
+        uint32_t used;        /**< Bytes used by the names  */
+        char names[];         /**< NUL terminated names     */
+};
+
+/**
+ * Unused chunk kept by a thread for later tasks and directories.
+ */
+struct walk_chunk {
+        struct walk_chunk* next; /**< Next unused chunk */
+};
+
+/**
+ * State owned by a single thread walking a tree.
+ */
+struct walk_worker {
+        struct walk* walk;         /**< Shared state                      */
+        void* arg;                 /**< Argument of the thread's calls    */
+        unsigned int idx;          /**< Index of the thread               */
+        pthread_mutex_t lock;      /**< Lock of the deque                 */
+        struct walk_task** deque;  /**< Ring of tasks                     */
+        uint64_t top;              /**< Oldest task, taken by thieves     */
+        uint64_t bottom;           /**< Next slot, used by the owner      */
+        uint64_t cap;              /**< Capacity of the ring, a power of 2 */
+        struct walk_chunk* free;   /**< Unused chunks                     */
+        struct slobs* slobs;       /**< Slob Allocator of the thread      */
+        char* path;                /**< Path of the file being handled    */
+        pthread_t tid;             /**< Thread's ID                       */
+        int started;               /**< Set if the thread is running      */
+};
+
+/**
+ * State shared by the threads walking a tree.
+ */
+struct walk {
+        struct walk_worker* workers; /**< Threads walking the tree         */
+        unsigned int jobs;           /**< Number of threads                */
+        int recursive;               /**< Set if subdirectories are walked */
+        walk_file_fn file;           /**< Called on every regular file     */
+        walk_idle_fn idle;           /**< Called when a thread is idle     */
+        uint64_t queued;             /**< Number of tasks in the deques    */
+        uint64_t pending;            /**< Number of tasks not yet done     */
+        uint32_t sleepers;           /**< Number of threads waiting        */
+        int64_t fds;                 /**< Descriptors left to be held      */
+        pthread_mutex_t lock;        /**< Lock of the sleeping threads     */
+        pthread_cond_t cond;         /**< Signalled on new tasks or the end */
+};
+
+/**
+ * Obtain a chunk of CHUNK_SZ bytes for a task or directory.
+ *
+ * Chunks are only allocated by their thread's slob allocator, but may be
+ * released by any thread into its own list, so they're all freed at the end.
+ */
+static void*
+get_chunk(struct walk_worker* w)
+{
+        struct walk_chunk* c = w->free;
+
+        if (!c)
+                return alloc_slob(w->slobs, CHUNK_SZ);
+
+        w->free = c->next;
+        return c;
+}
+
+static void
+put_chunk(struct walk_worker* w, void* chunk)
+{
+        struct walk_chunk* c = chunk;
+
+        c->next = w->free;
+        w->free = c;
+}
+
+/**
+ * Queue a task on a thread's deque and wake a waiting thread.
+ *
+ * @param w Thread owning the deque
+ * @param t Task to be queued
+ */
+static void
+push_task(struct walk_worker* w, struct walk_task* t)
+{
+        struct walk* wk = w->walk;
+        struct walk_task** tmp;
+        uint64_t i;
+
+        __atomic_add_fetch(&wk->pending, 1, __ATOMIC_SEQ_CST);
+
+        pthread_mutex_lock(&w->lock);
+        if (w->bottom - w->top == w->cap) {
+                tmp = alloc_slob(w->slobs, 2 * w->cap * __SIZEOF_POINTER__);
+                for (i = w->top; i < w->bottom; i++)
+                        tmp[i & (2 * w->cap - 1)] = w->deque[i & (w->cap - 1)];
+                free_slob(w->slobs, w->deque);
+                w->deque = tmp;
+                w->cap <<= 1;
+        }
+        w->deque[w->bottom++ & (w->cap - 1)] = t;
+        pthread_mutex_unlock(&w->lock);
+
+        __atomic_add_fetch(&wk->queued, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&wk->sleepers, __ATOMIC_SEQ_CST)) {
+                pthread_mutex_lock(&wk->lock);
+                pthread_cond_signal(&wk->cond);
+                pthread_mutex_unlock(&wk->lock);
+        }
+}
+
+/**
+ * Take a task from a deque, the newest if owned by the thread or the oldest
+ * if stolen from another thread.
+ *
+ * @param v Thread owning the deque
+ * @param own Set if the calling thread owns the deque
+ * @returns Pointer to the task or NULL if the deque is empty
+ */
+static struct walk_task*
+take_task(struct walk_worker* v, int own)
+{
+        struct walk_task* t = NULL;
+
+        pthread_mutex_lock(&v->lock);
+        if (v->bottom != v->top)
+                t = (own) ? v->deque[--v->bottom & (v->cap - 1)] :
+                            v->deque[v->top++ & (v->cap - 1)];
+        pthread_mutex_unlock(&v->lock);
+
+        if (t)
+                __atomic_sub_fetch(&v->walk->queued, 1, __ATOMIC_SEQ_CST);
+        return t;
+}
+
+/**
+ * Drop a task's reference to a directory, closing it if it was the last.
+ *
+ * @param w Thread dropping the reference
+ * @param d Directory to be released
+ */
+static void
+release_dir(struct walk_worker* w, struct walk_dir* d)
+{
+        if (__atomic_sub_fetch(&d->refs, 1, __ATOMIC_ACQ_REL))
+                return;
+
+        if (d->dir) {
+                xclosedir(d->dir);
+                __atomic_add_fetch(&w->walk->fds, 1, __ATOMIC_RELAXED);
+        }
+        put_chunk(w, d);
+}
+
+/**
+ * Open a directory and set up its structure.
+ *
+ * @param w Thread opening the directory
+ * @param parent Directory containing it or NULL for the root
+ * @param name Name within the parent or path of the root
+ * @returns Pointer to the directory, with a reference for its reader
+ */
+static struct walk_dir*
+open_dir(struct walk_worker* w, struct walk_dir* parent, const char* name)
+{
+        struct walk_dir* d = get_chunk(w);
+        size_t len = strlen(name);
+        int fd = -1;
+
+        if ((parent ? parent->len : 0) + len + 2 > PATH_MAX) {
+                printf(DONUT_ERROR "Path is too long: %s%s\n",
+                       (parent) ? parent->path : "", name);
+                exit(DEF_ERR);
+        }
+
+        d->len = 0;
+        if (parent) {
+                memcpy(d->path, parent->path, parent->len);
+                d->len = parent->len;
+        }
+        memcpy(d->path + d->len, name, len);
+        d->len += len;
+        if (d->path[d->len - 1] != '/')
+                d->path[d->len++] = '/';
+        d->path[d->len] = '\0';
+
+        /* Relative to the parent while it's held open */
+        if (parent && parent->fd >= 0)
+                fd = openat(parent->fd, name,
+                            O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        else
+                fd = open(d->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (fd < 0 || !(d->dir = fdopendir(fd))) {
+                printf(DONUT_ERROR "Failed to open the directory: %s\n",
+                       d->path);
+                exit(DEF_ERR);
+        }
+
+        /* Directories are held open while descriptors are left */
+        d->fd = -1;
+        if (__atomic_sub_fetch(&w->walk->fds, 1, __ATOMIC_RELAXED) >= 0)
+                d->fd = fd;
+        else
+                __atomic_add_fetch(&w->walk->fds, 1, __ATOMIC_RELAXED);
+
+        d->refs = 1;
+        d->dirs = NULL;
+        return d;
+}
+
+/**
+ * Append a name to a task.
+ *
+ * @returns Returns 1 if the task has no room for another name otherwise 0.
+ */
+static int
+add_name(struct walk_task* t, const char* name)
+{
+        size_t len = strlen(name) + 1;
+
+        memcpy(t->names + t->used, name, len);
+        t->used += len;
+        t->n++;
+
+        return t->used + NAME_MAX + 1 > CHUNK_SZ - sizeof(struct walk_task);
+}
+
+static struct walk_task*
+new_task(struct walk_worker* w, struct walk_dir* d, uint32_t kind)
+{
+        struct walk_task* t = get_chunk(w);
+
+        t->dir = d;
+        t->kind = kind;
+        t->n = 0;
+        t->used = 0;
+        return t;
+}
+
+/**
+ * Queue a directory's gathered subdirectories.
+ */
+static void
+push_dirs(struct walk_worker* w, struct walk_dir* d)
+{
+        if (!d->dirs)
+                return;
+
+        __atomic_add_fetch(&d->refs, 1, __ATOMIC_RELAXED);
+        push_task(w, d->dirs);
+        d->dirs = NULL;
+}
+
+/**
+ * Obtain the type of a directory entry, from the file's status if the file
+ * system doesn't provide it.
+ */
+static unsigned char
+entry_type(DIR* dir, struct dirent* e)
+{
+        struct stat st;
+
+        if (e->d_type != DT_UNKNOWN)
+                return e->d_type;
+
+        if (fstatat(dirfd(dir), e->d_name, &st, AT_SYMLINK_NOFOLLOW))
+                return DT_UNKNOWN;
+        if (S_ISREG(st.st_mode))
+                return DT_REG;
+        if (S_ISDIR(st.st_mode))
+                return DT_DIR;
+
+        return DT_UNKNOWN;
+}
+
+/**
+ * Read the next batch of a directory and handle its files.
+ *
+ * The rest of a held directory is queued before the batch's files are
+ * handled, so another thread may read it meanwhile. Other directories are
+ * read to the end by the calling thread.
+ *
+ * @param w Thread reading the directory
+ * @param d Directory to be read, whose reference is dropped
+ */
+static void
+read_dir(struct walk_worker* w, struct walk_dir* d)
+{
+        struct walk* wk = w->walk;
+        struct walk_task* files = new_task(w, d, TASK_READ);
+        struct dirent* e;
+        unsigned char type;
+        const char* name;
+        int fd = dirfd(d->dir), eof;
+        uint32_t i;
+        size_t len;
+        uint64_t t;
+
+        do {
+                t = stats_begin();
+                files->n = files->used = 0;
+                while (files->n < STEP_FILES && (e = readdir(d->dir))) {
+                        type = entry_type(d->dir, e);
+                        if (type == DT_REG) {
+                                if (add_name(files, e->d_name))
+                                        break;
+                                continue;
+                        }
+
+                        if (type != DT_DIR || !wk->recursive ||
+                            !strcmp(e->d_name, ".") ||
+                            !strcmp(e->d_name, "..") ||
+                            !strcmp(e->d_name, DONUT_FOLDER_RELATIVE))
+                                continue;
+
+                        if (!d->dirs)
+                                d->dirs = new_task(w, d, TASK_DIRS);
+                        if (add_name(d->dirs, e->d_name))
+                                push_dirs(w, d);
+                }
+
+                stats_end(PHASE_SCAN, t, 0, files->n);
+
+                /* The batch keeps its reference while its files are handled */
+                eof = (files->n < STEP_FILES && !e) ? 1 : 0;
+                if (eof) {
+                        push_dirs(w, d);
+                } else if (d->fd >= 0) {
+                        __atomic_add_fetch(&d->refs, 1, __ATOMIC_RELAXED);
+                        push_task(w, new_task(w, d, TASK_READ));
+                }
+
+                /* Files are named after the directory's path, copied once */
+                memcpy(w->path, d->path, d->len);
+                for (i = 0, name = files->names; i < files->n; i++) {
+                        len = strlen(name);
+                        memcpy(w->path + d->len, name, len + 1);
+                        wk->file(w->arg, fd, w->path, d->len + len, name);
+                        name += len + 1;
+                }
+        } while (!eof && d->fd < 0);
+
+        put_chunk(w, files);
+
+        /* Directories which aren't held are only used by their reader */
+        if (d->fd < 0) {
+                xclosedir(d->dir);
+                d->dir = NULL;
+        }
+        release_dir(w, d);
+}
+
+/**
+ * Open and read every subdirectory of a task.
+ */
+static void
+read_subdirs(struct walk_worker* w, struct walk_task* t)
+{
+        const char* name = t->names;
+        uint32_t i;
+
+        for (i = 0; i < t->n; i++) {
+                read_dir(w, open_dir(w, t->dir, name));
+                name += strlen(name) + 1;
+        }
+
+        release_dir(w, t->dir);
+}
+
+/**
+ * Run tasks, stealing them from other threads when the thread's own deque is
+ * empty, until every task of the walk is done.
+ *
+ * @param arg Pointer to the thread's walk_worker structure
+ * @returns NULL
+ */
+static void*
+walk_work(void* arg)
+{
+        struct walk_worker* w = arg;
+        struct walk* wk = w->walk;
+        struct walk_task* t;
+        unsigned int i;
+        int done;
+
+        for (;;) {
+                t = take_task(w, 1);
+                for (i = 1; !t && i < wk->jobs; i++)
+                        t = take_task(&wk->workers[(w->idx + i) % wk->jobs], 0);
+
+                if (t) {
+                        if (t->kind == TASK_READ)
+                                read_dir(w, t->dir);
+                        else
+                                read_subdirs(w, t);
+                        put_chunk(w, t);
+
+                        if (!__atomic_sub_fetch(&wk->pending, 1,
+                                                __ATOMIC_SEQ_CST)) {
+                                pthread_mutex_lock(&wk->lock);
+                                pthread_cond_broadcast(&wk->cond);
+                                pthread_mutex_unlock(&wk->lock);
+                        }
+                        continue;
+                }
+
+                if (wk->idle)
+                        wk->idle(w->arg);
+
+                pthread_mutex_lock(&wk->lock);
+                __atomic_add_fetch(&wk->sleepers, 1, __ATOMIC_SEQ_CST);
+                while (!__atomic_load_n(&wk->queued, __ATOMIC_SEQ_CST) &&
+                       __atomic_load_n(&wk->pending, __ATOMIC_SEQ_CST))
+                        pthread_cond_wait(&wk->cond, &wk->lock);
+                __atomic_sub_fetch(&wk->sleepers, 1, __ATOMIC_SEQ_CST);
+                done = !__atomic_load_n(&wk->pending, __ATOMIC_SEQ_CST);
+                pthread_mutex_unlock(&wk->lock);
+
+                if (done)
+                        break;
+        }
+
+        return NULL;
+}
+
+void
+walk_tree(const char* root, int recursive, unsigned int jobs, unsigned int fds,
+          void** args, walk_file_fn file, walk_idle_fn idle)
+{
+        struct slobs* slobs = init_slobs("walk");
+        struct walk wk = {0};
+        struct walk_worker* w;
+        unsigned int i;
+
+        wk.jobs = (jobs) ? jobs : 1;
+        wk.recursive = recursive;
+        wk.file = file;
+        wk.idle = idle;
+
+        /* Each thread has a directory and its own files open besides held
+         * ones */
+        wk.fds = OPEN_MAX / 2 - (1 + (int64_t)fds) * wk.jobs;
+        pthread_mutex_init(&wk.lock, NULL);
+        pthread_cond_init(&wk.cond, NULL);
+
+        wk.workers = alloc_slob(slobs, wk.jobs * sizeof(struct walk_worker));
+        for (i = 0; i < wk.jobs; i++) {
+                w = &wk.workers[i];
+                w->walk = &wk;
+                w->arg = args[i];
+                w->idx = i;
+                w->slobs = init_slobs("walk");
+                w->cap = MIN_DEQUE;
+                w->deque = alloc_slob(w->slobs, MIN_DEQUE * __SIZEOF_POINTER__);
+                w->path = alloc_slob(w->slobs, PATH_MAX + NAME_MAX + 1);
+                pthread_mutex_init(&w->lock, NULL);
+        }
+
+        w = &wk.workers[0];
+        push_task(w, new_task(w, open_dir(w, NULL, root), TASK_READ));
+
+        /* The calling thread walks the tree as well */
+        for (i = 1; i < wk.jobs; i++)
+                wk.workers[i].started = !pthread_create(&wk.workers[i].tid,
+                                                        NULL, walk_work,
+                                                        &wk.workers[i]);
+
+        walk_work(w);
+        for (i = 1; i < wk.jobs; i++)
+                if (wk.workers[i].started)
+                        pthread_join(wk.workers[i].tid, NULL);
+
+        for (i = 0; i < wk.jobs; i++) {
+                pthread_mutex_destroy(&wk.workers[i].lock);
+                clear_slobs(wk.workers[i].slobs);
+        }
+        pthread_cond_destroy(&wk.cond);
+        pthread_mutex_destroy(&wk.lock);
+        clear_slobs(slobs);
+}
+
+/**
+ * Files found by a thread of the walker's test.
+ */
+struct test_walk {
+        uint64_t files;   /**< Number of files found         */
+        uint64_t names;   /**< Sum of the files' name values */
+        uint64_t idle;    /**< Number of idle calls          */
+        int ok;           /**< Cleared on an inconsistent call */
+};
+
+static void
+test_walk_file(void* arg, int dir_fd, const char* path, size_t len,
+               const char* name)
+{
+        struct test_walk* t = arg;
+        struct stat a, b;
+        size_t n_len = strlen(name);
+
+        t->files++;
+        t->names += strtoul(name + 1, NULL, 10);
+        t->ok &= (len == strlen(path) && len > n_len &&
+                  !strcmp(path + len - n_len, name)) ? 1 : 0;
+        t->ok &= (!fstatat(dir_fd, name, &a, 0) && !stat(path, &b) &&
+                  a.st_ino == b.st_ino) ? 1 : 0;
+}
+
+static void
+test_walk_idle(void* arg)
+{
+        ((struct test_walk*)arg)->idle++;
+}
+
+/**
+ * Remove a directory of the walker's test along with its content.
+ */
+static void
+test_walk_remove(const char* path)
+{
+        struct dirent* e;
+        char* sub;
+        DIR* dir = opendir(path);
+
+        if (!dir)
+                return;
+
+        sub = calloc(1, PATH_MAX);
+        while ((e = readdir(dir))) {
+                if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+                        continue;
+
+                snprintf(sub, PATH_MAX, "%s/%s", path, e->d_name);
+                if (e->d_type == DT_DIR)
+                        test_walk_remove(sub);
+                else
+                        remove(sub);
+        }
+
+        closedir(dir);
+        remove(path);
+        free(sub);
+}
+
+int
+test_walk_tree(void)
+{
+        int fd, ret = 1;
+        unsigned int i, j, jobs;
+        uint64_t files, names, idle, sum = 0, n = 0, top = 0;
+        struct test_walk t[4];
+        void* args[4] = {&t[0], &t[1], &t[2], &t[3]};
+        char* path = calloc(1, PATH_MAX);
+        char* root = calloc(1, PATH_MAX);
+
+        snprintf(root, PATH_MAX, "%s/donut_test_walk", getenv("HOME"));
+        test_walk_remove(root);
+        mkdir(root, 0750);
+
+        /* Files fill several batches at the top, and in nested directories */
+        for (i = 0; i < 20; i++) {
+                snprintf(path, PATH_MAX, "%s/d%u", root, i);
+                mkdir(path, 0750);
+                snprintf(path, PATH_MAX, "%s/d%u/e%u", root, i, i);
+                mkdir(path, 0750);
+        }
+        snprintf(path, PATH_MAX, "%s/" DONUT_FOLDER_RELATIVE, root);
+        mkdir(path, 0750);
+
+        for (i = 0; i < 6 * STEP_FILES; i++) {
+                j = i % 42;
+                if (j < 20)
+                        snprintf(path, PATH_MAX, "%s/d%u/f%u", root, j, i);
+                else if (j < 40)
+                        snprintf(path, PATH_MAX, "%s/d%u/e%u/f%u", root,
+                                 j - 20, j - 20, i);
+                else if (j == 40)
+                        snprintf(path, PATH_MAX, "%s/f%u", root, i);
+                else
+                        snprintf(path, PATH_MAX, "%s/" DONUT_FOLDER_RELATIVE
+                                 "/f%u", root, i);
+
+                fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+                if (fd < 0) {
+                        ret = 0;
+                        continue;
+                }
+                xclose(fd);
+
+                /* Files in donut's folder aren't walked */
+                if (j == 41)
+                        continue;
+                sum += i;
+                top += (j == 40) ? i : 0;
+                n++;
+        }
+
+        /* Every file is found once, whatever the number of threads */
+        for (jobs = 1; jobs <= 4; jobs++) {
+                memset(t, 0, sizeof(t));
+                for (i = 0; i < 4; i++)
+                        t[i].ok = 1;
+
+                walk_tree(root, 1, jobs, 1, args, test_walk_file, test_walk_idle);
+                files = names = idle = 0;
+                for (i = 0; i < jobs; i++) {
+                        files += t[i].files;
+                        names += t[i].names;
+                        idle += t[i].idle;
+                        ret &= t[i].ok;
+                }
+                ret &= (files == n && names == sum && idle >= jobs) ? 1 : 0;
+        }
+
+        /* Subdirectories are skipped unless recursive */
+        memset(t, 0, sizeof(t));
+        t[0].ok = t[1].ok = 1;
+        walk_tree(root, 0, 2, 1, args, test_walk_file, NULL);
+        ret &= (t[0].names + t[1].names == top && t[0].ok && t[1].ok) ? 1 : 0;
+
+        test_walk_remove(root);
+        free(root);
+        free(path);
+        return ret;
+}
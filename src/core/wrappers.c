@@ -83,6 +83,50 @@ cleanup_return:
         return ret;
 }
 
+int
+xopenat(int dir_fd, const char* path, int oflag)
+{
+        int fd;
+
+        while (1) {
+
+                fd = openat(dir_fd, path, oflag);
+                if (fd >= 0)
+                        return fd;
+                else if (errno == EINTR)
+                        continue;
+
+                printf(DONUT "Failed to open file: %s\n", path);
+                exit(DEF_ERR);
+        }
+}
+
+int
+test_xopenat(void)
+{
+        int dir_fd, fd, ret = 0;
+        char* path = calloc(1, PAGE_SIZE);
+
+        snprintf(path, PAGE_SIZE, "%s/" TEST_FILE, getenv("HOME"));
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0640);
+        dir_fd = open(getenv("HOME"), O_RDONLY | O_DIRECTORY);
+        if (fd < 0 || dir_fd < 0)
+                goto cleanup_return;
+        close(fd);
+
+        /* Should be successful - The file exists in the directory */
+        fd = xopenat(dir_fd, TEST_FILE, O_RDONLY);
+        ret = (fd >= 0) ? 1 : 0;
+        close(fd);
+
+cleanup_return:
+        if (dir_fd >= 0)
+                close(dir_fd);
+        remove(path);
+        free(path);
+        return ret;
+}
+
 int
 xclose(int fd)
 {
@@ -133,18 +177,19 @@ cleanup_return:
 size_t
 xread(int fd, void* buf, size_t nbyte)
 {
-        size_t bytes_read, acc = 0, bytes = nbyte;
+        ssize_t bytes_read;
+        size_t acc = 0, bytes = nbyte;
 
         while (bytes) {
-                bytes_read = read(fd, buf, bytes);
+                bytes_read = read(fd, (char*)buf + acc, bytes);
 
-                if(errno == EINTR) {
+                if (bytes_read < 0 && errno == EINTR) {
                         continue;
                 } else if (!bytes_read) {
                         return acc;
                 } else if (bytes_read < 0) {
-                        printf(DONUT "Failed reading from file with error: %lu.\n",
-                               bytes_read);
+                        printf(DONUT "Failed reading from file with error: %d.\n",
+                               errno);
                         exit(DEF_ERR);
                 }
 
@@ -195,18 +240,19 @@ cleanup_return:
 size_t
 xpread(int fd, void* restrict buf, size_t nbyte, off_t offset)
 {
-        size_t bytes_read, acc = 0, bytes = nbyte;
+        ssize_t bytes_read;
+        size_t acc = 0, bytes = nbyte;
 
         while (bytes) {
-                bytes_read = pread(fd, buf, bytes, offset);
+                bytes_read = pread(fd, (char*)buf + acc, bytes, offset);
 
-                if(errno == EINTR) {
+                if (bytes_read < 0 && errno == EINTR) {
                         continue;
                 } else if (!bytes_read) {
                         return acc;
                 } else if (bytes_read < 0) {
-                        printf(DONUT "Failed reading from file with error: %lu.\n",
-                               bytes_read);
+                        printf(DONUT "Failed reading from file with error: %d.\n",
+                               errno);
                         exit(DEF_ERR);
                 }
 
@@ -258,16 +304,17 @@ cleanup_return:
 size_t
 xwrite(int fd, void* buf, size_t nbyte)
 {
-        size_t written, bytes = nbyte;
+        ssize_t written;
+        size_t bytes = nbyte;
 
         while (bytes) {
-                written = write(fd, buf, bytes);
+                written = write(fd, (char*)buf + (nbyte - bytes), bytes);
 
-                if(errno == EINTR) {
+                if (written < 0 && errno == EINTR) {
                         continue;
-                } else if ((long)written < 0) {
-                        printf(DONUT "Failed writing to file with error: %lu.\n",
-                               written);
+                } else if (written < 0) {
+                        printf(DONUT "Failed writing to file with error: %d.\n",
+                               errno);
                         exit(DEF_ERR);
                 }
 
@@ -318,16 +365,18 @@ cleanup_return:
 size_t
 xpwrite(int fd, void* restrict buf, size_t nbyte, off_t offset)
 {
-        size_t written, bytes = nbyte;
+        ssize_t written;
+        size_t bytes = nbyte;
 
         while (bytes) {
-                written = pwrite(fd, buf, bytes, offset);
+                written = pwrite(fd, (char*)buf + (nbyte - bytes), bytes,
+                                 offset);
 
-                if(errno == EINTR) {
+                if (written < 0 && errno == EINTR) {
                         continue;
-                } else if ((long)written < 0) {
-                        printf(DONUT "Failed writing to file with error: %lu.\n",
-                               written);
+                } else if (written < 0) {
+                        printf(DONUT "Failed writing to file with error: %d.\n",
+                               errno);
                         exit(DEF_ERR);
                 }
 
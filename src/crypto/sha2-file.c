@@ -0,0 +1,125 @@
+#include "crypto/sha2-file.h"
+#include "crypto/sha2.h"
+#include "core/wrappers.h"
+#include "const/const.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "fcntl.h"
+#include "sys/mman.h"
+
+/**
+ * @file sha2-file.c
+ * Implementation of the SHA-2 hashing of whole files.
+ */
+
+/**
+ * Hash a file by reading it into a buffer.
+ *
+ * @param fd File descriptor of the file
+ * @param hash Initialized hash state
+ * @param buf Read buffer of READ_BUF_SZ bytes
+ */
+static void
+sha2_file_read(int fd, void* hash, void* buf)
+{
+        size_t bytes;
+        off_t off = 0;
+
+        while ((bytes = xpread(fd, buf, READ_BUF_SZ, off))) {
+                sha2_update(buf, hash, bytes);
+                off += bytes;
+        }
+}
+
+/**
+ * Hash a file from a mapping of its content.
+ *
+ * The mapping is hashed a window at a time, while the kernel is asked to read
+ * the next window ahead.
+ *
+ * @param fd File descriptor of the file
+ * @param size Byte size of the file
+ * @param hash Initialized hash state
+ * @returns Returns 0 on success or -1 if the file couldn't be mapped.
+ */
+static int
+sha2_file_mmap(int fd, uint64_t size, void* hash)
+{
+        uint8_t* map;
+        uint64_t off, len;
+
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+                return -1;
+
+        madvise(map, size, MADV_SEQUENTIAL);
+        for (off = 0; off < size; off += len) {
+                len = (size - off < READ_BUF_SZ) ? size - off : READ_BUF_SZ;
+                if (off + len < size)
+                        madvise(map + off + len, (size - off - len < READ_BUF_SZ) ?
+                                size - off - len : READ_BUF_SZ, MADV_WILLNEED);
+                sha2_update(map + off, hash, len);
+        }
+
+        munmap(map, size);
+        return 0;
+}
+
+void
+sha2_file(int fd, uint64_t size, int strategy, void* hash, void* buf,
+          uint8_t* out)
+{
+        if (strategy == SHA2_READ_AUTO)
+                strategy = (size >= SHA2_MMAP_MIN) ? SHA2_READ_MMAP :
+                           SHA2_READ_BUF;
+
+        sha2_init(hash);
+        if (strategy != SHA2_READ_MMAP || !size || sha2_file_mmap(fd, size, hash))
+                sha2_file_read(fd, hash, buf);
+        sha2_final(out, hash);
+}
+
+int
+test_sha2_file(void)
+{
+        int fd, ret = 1;
+        uint8_t ref[SHA2_DIGEST_SZ], out[SHA2_DIGEST_SZ];
+        size_t i, j, lens[3] = {0, 2 * 4096 + 100, READ_BUF_SZ + 4096 + 7};
+        size_t len = lens[2];
+        uint8_t* in = malloc(len);
+        void* buf = malloc(READ_BUF_SZ);
+        void* state = malloc(SHA_STRUCT_SZ);
+        char* path = calloc(1, PAGE_SIZE);
+        const char* home = getenv("HOME");
+
+        strncpy(path, home, PAGE_SIZE - 1);
+        strncat(path, "/donut_test_file", 17);
+
+        for (i = 0; i < len; i++)
+                in[i] = (uint8_t)((i * 2654435761u) >> 9);
+
+        for (i = 0; i < 3 && ret; i++) {
+                fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0640);
+                if (fd < 0) {
+                        ret = 0;
+                        break;
+                }
+                xwrite(fd, in, lens[i]);
+                sha2_hash(in, ref, state, lens[i]);
+
+                /* The offset left by the write must not matter */
+                for (j = SHA2_READ_AUTO; j <= SHA2_READ_MMAP; j++) {
+                        sha2_file(fd, lens[i], j, state, buf, out);
+                        ret &= !memcmp(out, ref, SHA2_DIGEST_SZ);
+                }
+                xclose(fd);
+        }
+
+        remove(path);
+        free(path);
+        free(state);
+        free(buf);
+        free(in);
+        return ret;
+}
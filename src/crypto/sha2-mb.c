@@ -0,0 +1,626 @@
+#include "crypto/sha2-mb.h"
+#include "crypto/sha2.h"
+#include "stdlib.h"
+#include "string.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include "immintrin.h"
+#endif
+
+/**
+ * @file sha2-mb.c
+ * Implementation of the multi-buffer SHA-2 hashing engine.
+ */
+
+/**
+ * @def TAIL_SZ
+ * Size of the buffer holding the padded last blocks of a message.
+ */
+#define TAIL_SZ (SHA_BLK_SZ * 2)
+
+/**
+ * Signature shared by all multi-buffer kernels.
+ *
+ * Transforms "blks" blocks of every lane. The hash state is stored word-major,
+ * so the n-th word of all lanes is contiguous in memory. Every lane's pointer
+ * must have "blks" blocks available and is advanced past them.
+ *
+ * @param hx Hash state of all lanes
+ * @param ptrs Pointers to the next block of each lane
+ * @param blks Number of blocks to transform
+ */
+typedef void (*mb_kernel_fn)(uint32_t (*hx)[SHA2_MB_MAX_LANES],
+                             const uint8_t** ptrs, size_t blks);
+
+/**
+ * Description of a multi-buffer backend.
+ */
+struct mb_impl {
+        const char* name;    /**< Name reported to the user                */
+        unsigned int lanes;  /**< Number of lanes transformed at once      */
+        mb_kernel_fn kernel; /**< Kernel transforming all lanes            */
+        int (*probe)(void);  /**< Returns 1 if the CPU supports the kernel */
+        int over_hw;         /**< Faster than a hardware single backend    */
+};
+
+/**
+ * State of a single lane.
+ */
+struct mb_lane {
+        struct sha2_job* job;   /**< Job being hashed, NULL if the lane is free */
+        size_t blks;            /**< Blocks left in the current segment         */
+        size_t tail_blks;       /**< Blocks in the padded tail                  */
+        uint8_t tail[TAIL_SZ];  /**< Padded last blocks of the message          */
+};
+
+/**
+ * Multi-buffer engine state.
+ */
+struct sha2_mb {
+        uint32_t hx[8][SHA2_MB_MAX_LANES];          /**< Word-major hash states  */
+        const uint8_t* ptrs[SHA2_MB_MAX_LANES];     /**< Next block of each lane */
+        struct mb_lane lanes[SHA2_MB_MAX_LANES];    /**< Lanes' bookkeeping      */
+        struct sha2_job* done[SHA2_MB_MAX_LANES];   /**< Completed jobs          */
+        const struct mb_impl* impl;                 /**< Backend in use          */
+        unsigned int active;                        /**< Number of busy lanes    */
+        unsigned int done_head;                     /**< Next completed job      */
+        unsigned int done_cnt;                      /**< Completed jobs pending  */
+};
+
+/**
+ * Kernel transforming a single lane with the single buffer backend.
+ *
+ * Used when no SIMD kernel is available or when the single buffer backend has
+ * hardware support, in which case it is faster than the SIMD kernels.
+ */
+static void
+kernel_scalar(uint32_t (*hx)[SHA2_MB_MAX_LANES], const uint8_t** ptrs,
+              size_t blks)
+{
+        uint32_t state[8];
+        int i;
+
+        for (i = 0; i < 8; i++)
+                state[i] = hx[i][0];
+
+        sha2_xform(state, ptrs[0], blks);
+        ptrs[0] += blks * SHA_BLK_SZ;
+
+        for (i = 0; i < 8; i++)
+                hx[i][0] = state[i];
+}
+
+static int
+probe_scalar(void)
+{
+        return 1;
+}
+
+/**
+ * Load a big-endian 32-bit word.
+ *
+ * @param p Pointer to the word
+ * @returns Word in the machine's byte order
+ */
+inline static uint32_t
+load_be32(const uint8_t* p)
+{
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+               ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/**
+ * @def ROR8
+ * Bitwise right rotate of 8 lanes.
+ */
+#define ROR8(x,n) _mm256_or_si256(_mm256_srli_epi32((x),(n)), \
+                                  _mm256_slli_epi32((x),32-(n)))
+
+/**
+ * Multi-buffer kernel transforming 8 lanes with AVX2.
+ */
+__attribute__((target("avx2")))
+static void
+kernel_avx2(uint32_t (*hx)[SHA2_MB_MAX_LANES], const uint8_t** ptrs,
+            size_t blks)
+{
+        __m256i a, b, c, d, e, f, g, h, t1, t2, w[16], s[8];
+        const uint8_t* p[8];
+        size_t off;
+        int i, j;
+
+        for (i = 0; i < 8; i++)
+                p[i] = ptrs[i];
+
+        a = _mm256_loadu_si256((const __m256i*)hx[0]);
+        b = _mm256_loadu_si256((const __m256i*)hx[1]);
+        c = _mm256_loadu_si256((const __m256i*)hx[2]);
+        d = _mm256_loadu_si256((const __m256i*)hx[3]);
+        e = _mm256_loadu_si256((const __m256i*)hx[4]);
+        f = _mm256_loadu_si256((const __m256i*)hx[5]);
+        g = _mm256_loadu_si256((const __m256i*)hx[6]);
+        h = _mm256_loadu_si256((const __m256i*)hx[7]);
+
+        for (off = 0; blks--; off += SHA_BLK_SZ) {
+                s[0] = a; s[1] = b; s[2] = c; s[3] = d;
+                s[4] = e; s[5] = f; s[6] = g; s[7] = h;
+
+                for (j = 0; j < 64; j++) {
+                        if (j < 16) {
+                                w[j] = _mm256_setr_epi32(
+                                        load_be32(p[0] + off + j * 4),
+                                        load_be32(p[1] + off + j * 4),
+                                        load_be32(p[2] + off + j * 4),
+                                        load_be32(p[3] + off + j * 4),
+                                        load_be32(p[4] + off + j * 4),
+                                        load_be32(p[5] + off + j * 4),
+                                        load_be32(p[6] + off + j * 4),
+                                        load_be32(p[7] + off + j * 4));
+                        } else {
+                                t1 = w[(j - 15) & 15];
+                                t2 = w[(j - 2) & 15];
+                                t1 = _mm256_xor_si256(_mm256_xor_si256(ROR8(t1, 7),
+                                     ROR8(t1, 18)), _mm256_srli_epi32(t1, 3));
+                                t2 = _mm256_xor_si256(_mm256_xor_si256(ROR8(t2, 17),
+                                     ROR8(t2, 19)), _mm256_srli_epi32(t2, 10));
+                                w[j & 15] = _mm256_add_epi32(
+                                        _mm256_add_epi32(w[j & 15], t1),
+                                        _mm256_add_epi32(w[(j - 7) & 15], t2));
+                        }
+
+                        /* t1 = h + S1(e) + CH(e,f,g) + k[j] + w[j] */
+                        t1 = _mm256_xor_si256(_mm256_xor_si256(ROR8(e, 6),
+                             ROR8(e, 11)), ROR8(e, 25));
+                        t2 = _mm256_xor_si256(_mm256_and_si256(e, f),
+                             _mm256_andnot_si256(e, g));
+                        t1 = _mm256_add_epi32(_mm256_add_epi32(h, t1),
+                             _mm256_add_epi32(t2, w[j & 15]));
+                        t1 = _mm256_add_epi32(t1, _mm256_set1_epi32(sha2_k[j]));
+
+                        /* t2 = S0(a) + MA(a,b,c) */
+                        t2 = _mm256_xor_si256(_mm256_xor_si256(ROR8(a, 2),
+                             ROR8(a, 13)), ROR8(a, 22));
+                        t2 = _mm256_add_epi32(t2, _mm256_or_si256(
+                             _mm256_and_si256(a, b),
+                             _mm256_and_si256(c, _mm256_or_si256(a, b))));
+
+                        h = g;
+                        g = f;
+                        f = e;
+                        e = _mm256_add_epi32(d, t1);
+                        d = c;
+                        c = b;
+                        b = a;
+                        a = _mm256_add_epi32(t1, t2);
+                }
+
+                a = _mm256_add_epi32(a, s[0]);
+                b = _mm256_add_epi32(b, s[1]);
+                c = _mm256_add_epi32(c, s[2]);
+                d = _mm256_add_epi32(d, s[3]);
+                e = _mm256_add_epi32(e, s[4]);
+                f = _mm256_add_epi32(f, s[5]);
+                g = _mm256_add_epi32(g, s[6]);
+                h = _mm256_add_epi32(h, s[7]);
+        }
+
+        _mm256_storeu_si256((__m256i*)hx[0], a);
+        _mm256_storeu_si256((__m256i*)hx[1], b);
+        _mm256_storeu_si256((__m256i*)hx[2], c);
+        _mm256_storeu_si256((__m256i*)hx[3], d);
+        _mm256_storeu_si256((__m256i*)hx[4], e);
+        _mm256_storeu_si256((__m256i*)hx[5], f);
+        _mm256_storeu_si256((__m256i*)hx[6], g);
+        _mm256_storeu_si256((__m256i*)hx[7], h);
+
+        for (i = 0; i < 8; i++)
+                ptrs[i] += off;
+}
+
+static int
+probe_avx2(void)
+{
+        return __builtin_cpu_supports("avx2") ? 1 : 0;
+}
+
+/**
+ * @def ROR16
+ * Bitwise right rotate of 16 lanes.
+ */
+#define ROR16(x,n) _mm512_ror_epi32((x),(n))
+
+/**
+ * Multi-buffer kernel transforming 16 lanes with AVX-512.
+ *
+ * Uses the native rotates and the ternary logic instruction to compute the
+ * CH and MA functions with a single instruction each.
+ */
+__attribute__((target("avx512f")))
+static void
+kernel_avx512(uint32_t (*hx)[SHA2_MB_MAX_LANES], const uint8_t** ptrs,
+              size_t blks)
+{
+        __m512i a, b, c, d, e, f, g, h, t1, t2, w[16], s[8];
+        const uint8_t* p[16];
+        uint32_t tmp[16];
+        size_t off;
+        int i, j, l;
+
+        for (i = 0; i < 16; i++)
+                p[i] = ptrs[i];
+
+        a = _mm512_loadu_si512(hx[0]);
+        b = _mm512_loadu_si512(hx[1]);
+        c = _mm512_loadu_si512(hx[2]);
+        d = _mm512_loadu_si512(hx[3]);
+        e = _mm512_loadu_si512(hx[4]);
+        f = _mm512_loadu_si512(hx[5]);
+        g = _mm512_loadu_si512(hx[6]);
+        h = _mm512_loadu_si512(hx[7]);
+
+        for (off = 0; blks--; off += SHA_BLK_SZ) {
+                s[0] = a; s[1] = b; s[2] = c; s[3] = d;
+                s[4] = e; s[5] = f; s[6] = g; s[7] = h;
+
+                for (j = 0; j < 64; j++) {
+                        if (j < 16) {
+                                for (l = 0; l < 16; l++)
+                                        tmp[l] = load_be32(p[l] + off + j * 4);
+                                w[j] = _mm512_loadu_si512(tmp);
+                        } else {
+                                t1 = w[(j - 15) & 15];
+                                t2 = w[(j - 2) & 15];
+                                t1 = _mm512_ternarylogic_epi32(ROR16(t1, 7),
+                                     ROR16(t1, 18), _mm512_srli_epi32(t1, 3), 0x96);
+                                t2 = _mm512_ternarylogic_epi32(ROR16(t2, 17),
+                                     ROR16(t2, 19), _mm512_srli_epi32(t2, 10), 0x96);
+                                w[j & 15] = _mm512_add_epi32(
+                                        _mm512_add_epi32(w[j & 15], t1),
+                                        _mm512_add_epi32(w[(j - 7) & 15], t2));
+                        }
+
+                        /* t1 = h + S1(e) + CH(e,f,g) + k[j] + w[j] */
+                        t1 = _mm512_ternarylogic_epi32(ROR16(e, 6), ROR16(e, 11),
+                             ROR16(e, 25), 0x96);
+                        t2 = _mm512_ternarylogic_epi32(e, f, g, 0xCA);
+                        t1 = _mm512_add_epi32(_mm512_add_epi32(h, t1),
+                             _mm512_add_epi32(t2, w[j & 15]));
+                        t1 = _mm512_add_epi32(t1, _mm512_set1_epi32(sha2_k[j]));
+
+                        /* t2 = S0(a) + MA(a,b,c) */
+                        t2 = _mm512_ternarylogic_epi32(ROR16(a, 2), ROR16(a, 13),
+                             ROR16(a, 22), 0x96);
+                        t2 = _mm512_add_epi32(t2,
+                             _mm512_ternarylogic_epi32(a, b, c, 0xE8));
+
+                        h = g;
+                        g = f;
+                        f = e;
+                        e = _mm512_add_epi32(d, t1);
+                        d = c;
+                        c = b;
+                        b = a;
+                        a = _mm512_add_epi32(t1, t2);
+                }
+
+                a = _mm512_add_epi32(a, s[0]);
+                b = _mm512_add_epi32(b, s[1]);
+                c = _mm512_add_epi32(c, s[2]);
+                d = _mm512_add_epi32(d, s[3]);
+                e = _mm512_add_epi32(e, s[4]);
+                f = _mm512_add_epi32(f, s[5]);
+                g = _mm512_add_epi32(g, s[6]);
+                h = _mm512_add_epi32(h, s[7]);
+        }
+
+        _mm512_storeu_si512(hx[0], a);
+        _mm512_storeu_si512(hx[1], b);
+        _mm512_storeu_si512(hx[2], c);
+        _mm512_storeu_si512(hx[3], d);
+        _mm512_storeu_si512(hx[4], e);
+        _mm512_storeu_si512(hx[5], f);
+        _mm512_storeu_si512(hx[6], g);
+        _mm512_storeu_si512(hx[7], h);
+
+        for (i = 0; i < 16; i++)
+                ptrs[i] += off;
+}
+
+static int
+probe_avx512(void)
+{
+        return __builtin_cpu_supports("avx512f") ? 1 : 0;
+}
+
+#endif
+
+/**
+ * All multi-buffer backends compiled for the current architecture by order of
+ * preference. The scalar backend must always be the last entry.
+ */
+static const struct mb_impl mb_impls[] = {
+#if defined(__x86_64__) || defined(__i386__)
+        {"avx512-16x", 16, kernel_avx512, probe_avx512, 1},
+        {"avx2-8x", 8, kernel_avx2, probe_avx2, 0},
+#endif
+        {"scalar", 1, kernel_scalar, probe_scalar, 1}
+};
+
+/**
+ * @def N_MB_IMPLS
+ * Number of multi-buffer backends compiled.
+ */
+#define N_MB_IMPLS (sizeof(mb_impls) / sizeof(mb_impls[0]))
+
+/**
+ * Select the multi-buffer backend to be used.
+ *
+ * When the single buffer backend has hardware support, 8 lanes of AVX2 don't
+ * keep up with it, while 16 lanes of AVX-512 still do. Kernels slower than the
+ * hardware are skipped in favour of the scalar kernel on top of it.
+ *
+ * @returns Pointer to the selected backend
+ */
+static const struct mb_impl*
+select_impl(void)
+{
+        int hw = strncmp(sha2_backend(), "generic", 8) ? 1 : 0;
+
+        for (size_t i = 0; i < N_MB_IMPLS; i++)
+                if ((!hw || mb_impls[i].over_hw) && mb_impls[i].probe())
+                        return &mb_impls[i];
+
+        return &mb_impls[N_MB_IMPLS - 1];
+}
+
+const char*
+sha2_mb_backend(void)
+{
+        return select_impl()->name;
+}
+
+/**
+ * Initialize an engine with a given backend.
+ *
+ * @param slobs Slob allocator used for the engine's memory
+ * @param impl Backend to be used
+ * @returns Pointer to the engine
+ */
+static struct sha2_mb*
+mb_init_impl(struct slobs* slobs, const struct mb_impl* impl)
+{
+        struct sha2_mb* mb = alloc_slob(slobs, sizeof(struct sha2_mb));
+        mb->impl = impl;
+        return mb;
+}
+
+struct sha2_mb*
+sha2_mb_init(struct slobs* slobs)
+{
+        return mb_init_impl(slobs, select_impl());
+}
+
+unsigned int
+sha2_mb_lanes(struct sha2_mb* mb)
+{
+        return mb->impl->lanes;
+}
+
+/**
+ * Place a job on a free lane.
+ *
+ * Initializes the lane's hash state and builds the padded tail of the message,
+ * so the lane only has whole blocks to transform.
+ *
+ * @param mb Pointer to the engine
+ * @param l Index of the free lane
+ * @param job Job to be placed on the lane
+ */
+static void
+lane_load(struct sha2_mb* mb, unsigned int l, struct sha2_job* job)
+{
+        struct mb_lane* lane = &mb->lanes[l];
+        size_t rem = job->len % SHA_BLK_SZ;
+        uint64_t bits = (uint64_t)job->len * 8;
+        uint8_t* end;
+        int i;
+
+        for (i = 0; i < 8; i++)
+                mb->hx[i][l] = sha2_h0[i];
+
+        lane->job = job;
+        lane->blks = job->len / SHA_BLK_SZ;
+        lane->tail_blks = (rem < 56) ? 1 : 2;
+
+        /* Only the padding between the message and its length is cleared */
+        end = lane->tail + (lane->tail_blks * SHA_BLK_SZ);
+        memcpy(lane->tail, job->in + (job->len - rem), rem);
+        lane->tail[rem] = 0x80;
+        memset(lane->tail + rem + 1, 0x0, end - 8 - (lane->tail + rem + 1));
+        for (i = 1; i <= 8; i++, bits >>= 8)
+                end[-i] = (uint8_t)bits;
+
+        mb->ptrs[l] = job->in;
+        if (!lane->blks) {
+                mb->ptrs[l] = lane->tail;
+                lane->blks = lane->tail_blks;
+                lane->tail_blks = 0;
+        }
+
+        mb->active++;
+}
+
+/**
+ * Store a lane's hash into its job and release the lane.
+ *
+ * @param mb Pointer to the engine
+ * @param l Index of the finished lane
+ */
+static void
+lane_retire(struct sha2_mb* mb, unsigned int l)
+{
+        struct mb_lane* lane = &mb->lanes[l];
+        struct sha2_job* job = lane->job;
+        unsigned int i;
+
+        for (i = 0; i < 8; i++) {
+                job->digest[i * 4]     = (uint8_t)(mb->hx[i][l] >> 24);
+                job->digest[i * 4 + 1] = (uint8_t)(mb->hx[i][l] >> 16);
+                job->digest[i * 4 + 2] = (uint8_t)(mb->hx[i][l] >> 8);
+                job->digest[i * 4 + 3] = (uint8_t)(mb->hx[i][l]);
+        }
+
+        i = (mb->done_head + mb->done_cnt++) % SHA2_MB_MAX_LANES;
+        mb->done[i] = job;
+        lane->job = NULL;
+        mb->active--;
+}
+
+/**
+ * Transform all busy lanes until at least one of them completes its message.
+ *
+ * Free lanes follow the pointer of a busy lane, so the kernel always has valid
+ * memory to read and their result is simply discarded.
+ *
+ * @param mb Pointer to the engine
+ */
+static void
+mb_run(struct sha2_mb* mb)
+{
+        unsigned int l, lanes = mb->impl->lanes, first = 0;
+        size_t blks = SIZE_MAX;
+        struct mb_lane* lane;
+        int retired = 0;
+
+        while (!retired) {
+                for (l = 0; l < lanes; l++) {
+                        if (mb->lanes[l].job && mb->lanes[l].blks < blks) {
+                                blks = mb->lanes[l].blks;
+                                first = l;
+                        }
+                }
+
+                for (l = 0; l < lanes; l++)
+                        if (!mb->lanes[l].job)
+                                mb->ptrs[l] = mb->ptrs[first];
+
+                mb->impl->kernel(mb->hx, mb->ptrs, blks);
+
+                for (l = 0; l < lanes; l++) {
+                        lane = &mb->lanes[l];
+                        if (!lane->job)
+                                continue;
+
+                        lane->blks -= blks;
+                        if (lane->blks)
+                                continue;
+
+                        if (lane->tail_blks) {
+                                mb->ptrs[l] = lane->tail;
+                                lane->blks = lane->tail_blks;
+                                lane->tail_blks = 0;
+                        } else {
+                                lane_retire(mb, l);
+                                retired = 1;
+                        }
+                }
+                blks = SIZE_MAX;
+        }
+}
+
+/**
+ * Pop the oldest completed job.
+ *
+ * @param mb Pointer to the engine
+ * @returns Completed job or NULL if there isn't any
+ */
+static struct sha2_job*
+mb_pop(struct sha2_mb* mb)
+{
+        struct sha2_job* job;
+
+        if (!mb->done_cnt)
+                return NULL;
+
+        job = mb->done[mb->done_head];
+        mb->done_head = (mb->done_head + 1) % SHA2_MB_MAX_LANES;
+        mb->done_cnt--;
+        return job;
+}
+
+struct sha2_job*
+sha2_mb_submit(struct sha2_mb* mb, struct sha2_job* job)
+{
+        unsigned int l, lanes = mb->impl->lanes;
+
+        for (l = 0; l < lanes && mb->lanes[l].job; l++)
+                ;
+
+        lane_load(mb, l, job);
+        if (mb->active == lanes)
+                mb_run(mb);
+
+        return mb_pop(mb);
+}
+
+struct sha2_job*
+sha2_mb_flush(struct sha2_mb* mb)
+{
+        if (!mb->done_cnt && mb->active)
+                mb_run(mb);
+
+        return mb_pop(mb);
+}
+
+int
+test_sha2_mb(void)
+{
+        struct slobs* slobs = init_slobs("test");
+        struct sha2_job* jobs = alloc_slob(slobs, sizeof(struct sha2_job) * 64);
+        struct sha2_job* job;
+        struct sha2_mb* mb;
+        uint8_t* in = alloc_slob(slobs, 8192);
+        uint8_t* ref = alloc_slob(slobs, SHA2_DIGEST_SZ * 64);
+        void* state = alloc_slob(slobs, SHA_STRUCT_SZ);
+        size_t i, j, done;
+        int ret = 1;
+
+        for (i = 0; i < 8192; i++)
+                in[i] = (uint8_t)((i * 2654435761u) >> 11);
+
+        /* Lengths around the padding boundaries and of several blocks */
+        for (i = 0; i < 64; i++) {
+                jobs[i].in = in + i;
+                jobs[i].len = (i * 131) % 700 + (i % 3) * 55;
+                sha2_hash((uint8_t*)jobs[i].in, ref + i * SHA2_DIGEST_SZ, state,
+                          jobs[i].len);
+        }
+
+        for (i = 0; i < N_MB_IMPLS; i++) {
+                if (!mb_impls[i].probe())
+                        continue;
+
+                mb = mb_init_impl(slobs, &mb_impls[i]);
+                done = 0;
+                for (j = 0; j < 64; j++) {
+                        memset(jobs[j].digest, 0x0, SHA2_DIGEST_SZ);
+                        jobs[j].tag = ref + j * SHA2_DIGEST_SZ;
+                        if ((job = sha2_mb_submit(mb, &jobs[j]))) {
+                                ret &= !memcmp(job->digest, job->tag, SHA2_DIGEST_SZ);
+                                done++;
+                        }
+                }
+
+                while ((job = sha2_mb_flush(mb))) {
+                        ret &= !memcmp(job->digest, job->tag, SHA2_DIGEST_SZ);
+                        done++;
+                }
+
+                ret &= (done == 64) ? 1 : 0;
+        }
+
+        clear_slobs(slobs);
+        return ret;
+}
@@ -0,0 +1,291 @@
+#include "crypto/sha2-tree.h"
+#include "crypto/sha2.h"
+#include "core/wrappers.h"
+#include "mem/slob.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "pthread.h"
+
+/**
+ * @file sha2-tree.c
+ * Implementation of the SHA-2 Merkle tree hashing.
+ */
+
+/**
+ * Leaves of a file shared by all threads hashing it.
+ */
+struct tree_file {
+        int fd;            /**< File descriptor of the file */
+        uint64_t size;     /**< Byte size of the file       */
+        uint64_t leaf_sz;  /**< Byte size of the leaves     */
+        uint64_t n_leaves; /**< Number of leaves            */
+        uint64_t next;     /**< Next leaf to be hashed      */
+        uint8_t* hashes;   /**< Hashes of the leaves        */
+};
+
+/**
+ * State owned by a single thread hashing leaves.
+ */
+struct tree_worker {
+        struct tree_file* file; /**< File being hashed              */
+        uint8_t* buf;           /**< Buffer with a leaf's data      */
+        void* state;            /**< Hash state                     */
+        pthread_t tid;          /**< Thread's ID                    */
+        int started;            /**< Set if the thread is running   */
+};
+
+void
+sha2_tree_leaf(const uint8_t* in, size_t len, uint8_t* out, void* buf)
+{
+        const uint8_t prefix = TREE_LEAF_PREFIX;
+
+        sha2_init(buf);
+        sha2_update(&prefix, buf, 1);
+        sha2_update(in, buf, len);
+        sha2_final(out, buf);
+}
+
+void
+sha2_tree_root(uint8_t* hashes, uint64_t n, uint8_t* out, void* buf)
+{
+        const uint8_t prefix = TREE_NODE_PREFIX;
+        uint64_t i;
+
+        while (n > 1) {
+                for (i = 0; i + 1 < n; i += 2) {
+                        sha2_init(buf);
+                        sha2_update(&prefix, buf, 1);
+                        sha2_update(hashes + i * SHA2_DIGEST_SZ, buf,
+                                    SHA2_DIGEST_SZ * 2);
+                        sha2_final(hashes + (i / 2) * SHA2_DIGEST_SZ, buf);
+                }
+
+                /* Promote the unpaired hash */
+                if (n % 2)
+                        memmove(hashes + (n / 2) * SHA2_DIGEST_SZ,
+                                hashes + (n - 1) * SHA2_DIGEST_SZ, SHA2_DIGEST_SZ);
+
+                n = (n + 1) / 2;
+        }
+
+        memcpy(out, hashes, SHA2_DIGEST_SZ);
+}
+
+/**
+ * Hash leaves of a file until there are none left.
+ *
+ * Leaves are claimed one at a time through an atomic counter, so threads that
+ * are faster take more leaves.
+ *
+ * @param arg Pointer to the thread's tree_worker structure
+ * @returns NULL
+ */
+static void*
+hash_leaves(void* arg)
+{
+        struct tree_worker* w = arg;
+        struct tree_file* f = w->file;
+        uint64_t i, off, len;
+        size_t bytes;
+
+        while ((i = __atomic_fetch_add(&f->next, 1, __ATOMIC_RELAXED)) <
+               f->n_leaves) {
+                off = i * f->leaf_sz;
+                len = (f->size - off < f->leaf_sz) ? f->size - off : f->leaf_sz;
+                bytes = (len) ? xpread(f->fd, w->buf, len, off) : 0;
+                sha2_tree_leaf(w->buf, bytes, f->hashes + i * SHA2_DIGEST_SZ,
+                               w->state);
+        }
+
+        return NULL;
+}
+
+void
+sha2_tree_file(int fd, uint64_t size, uint64_t leaf_sz, uint8_t* out,
+               unsigned int threads)
+{
+        struct slobs* slobs = init_slobs("sha2-tree");
+        struct tree_file file = {0};
+        struct tree_worker* workers;
+        unsigned int i;
+
+        file.fd = fd;
+        file.size = size;
+        file.leaf_sz = leaf_sz;
+        file.n_leaves = (size) ? (size + leaf_sz - 1) / leaf_sz : 1;
+        file.hashes = alloc_slob(slobs, file.n_leaves * SHA2_DIGEST_SZ);
+
+        if (!threads)
+                threads = 1;
+        if (threads > file.n_leaves)
+                threads = file.n_leaves;
+
+        workers = alloc_slob(slobs, threads * sizeof(struct tree_worker));
+        for (i = 0; i < threads; i++) {
+                workers[i].file = &file;
+                workers[i].buf = alloc_slob(slobs, leaf_sz);
+                workers[i].state = alloc_slob(slobs, SHA_STRUCT_SZ);
+        }
+
+        /* The calling thread hashes leaves as well */
+        for (i = 1; i < threads; i++)
+                workers[i].started = !pthread_create(&workers[i].tid, NULL,
+                                                     hash_leaves, &workers[i]);
+
+        hash_leaves(&workers[0]);
+        for (i = 1; i < threads; i++)
+                if (workers[i].started)
+                        pthread_join(workers[i].tid, NULL);
+
+        sha2_tree_root(file.hashes, file.n_leaves, out, workers[0].state);
+        clear_slobs(slobs);
+}
+
+/**
+ * Start hashing the next leaf of a stream.
+ *
+ * @param t State of the stream
+ */
+static void
+sha2_tree_leaf_init(struct sha2_tree* t)
+{
+        const uint8_t prefix = TREE_LEAF_PREFIX;
+
+        sha2_init(t->state);
+        sha2_update(&prefix, t->state, 1);
+        t->leaf_len = 0;
+}
+
+/**
+ * Complete the hash of a stream's leaf.
+ *
+ * @param t State of the stream
+ */
+static void
+sha2_tree_leaf_final(struct sha2_tree* t)
+{
+        if (t->n == t->cap) {
+                t->cap = (t->cap) ? t->cap * 2 : 64;
+                t->hashes = xrealloc(t->hashes, t->cap * SHA2_DIGEST_SZ);
+        }
+        sha2_final(t->hashes + t->n++ * SHA2_DIGEST_SZ, t->state);
+}
+
+void
+sha2_tree_init(struct sha2_tree* t, uint64_t leaf_sz)
+{
+        t->leaf_sz = leaf_sz;
+        t->n = 0;
+        t->cap = 0;
+        t->hashes = NULL;
+        sha2_tree_leaf_init(t);
+}
+
+void
+sha2_tree_update(struct sha2_tree* t, const uint8_t* in, size_t len)
+{
+        uint64_t fill;
+
+        while (len) {
+                /* A full leaf is only completed once more data follows, so the
+                 * last leaf is never empty */
+                if (t->leaf_len == t->leaf_sz) {
+                        sha2_tree_leaf_final(t);
+                        sha2_tree_leaf_init(t);
+                }
+
+                fill = t->leaf_sz - t->leaf_len;
+                fill = (len < fill) ? len : fill;
+                sha2_update(in, t->state, fill);
+                t->leaf_len += fill;
+                in += fill;
+                len -= fill;
+        }
+}
+
+void
+sha2_tree_final(struct sha2_tree* t, uint8_t* out)
+{
+        sha2_tree_leaf_final(t);
+        sha2_tree_root(t->hashes, t->n, out, t->state);
+        free(t->hashes);
+        t->hashes = NULL;
+}
+
+int
+test_sha2_tree(void)
+{
+        int fd, ret = 1;
+        uint8_t leaves[3 * SHA2_DIGEST_SZ], node[2 * SHA2_DIGEST_SZ + 1];
+        uint8_t ref[SHA2_DIGEST_SZ];
+        uint8_t out[SHA2_DIGEST_SZ], tmp[SHA2_DIGEST_SZ];
+        size_t i, off, len = 2 * 4096 + 100;
+        size_t chunks[4] = {1, 100, 4096, 5000};
+        struct sha2_tree t;
+        uint8_t* in = malloc(len);
+        void* state = malloc(SHA_STRUCT_SZ);
+        char* path = calloc(1, PAGE_SIZE);
+        const char* home = getenv("HOME");
+
+        strncpy(path, home, PAGE_SIZE - 1);
+        strncat(path, "/donut_test_tree", 17);
+
+        for (i = 0; i < len; i++)
+                in[i] = (uint8_t)((i * 2654435761u) >> 9);
+
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0640);
+        if (fd < 0) {
+                ret = 0;
+                goto cleanup_return;
+        }
+        xwrite(fd, in, len);
+
+        /* Build the tree of 3 leaves by hand: node(node(l0, l1), l2) */
+        for (i = 0; i < 3; i++)
+                sha2_tree_leaf(in + i * 4096, (i < 2) ? 4096 : 100,
+                               leaves + i * SHA2_DIGEST_SZ, state);
+        node[0] = TREE_NODE_PREFIX;
+        memcpy(node + 1, leaves, 2 * SHA2_DIGEST_SZ);
+        sha2_hash(node, tmp, state, 2 * SHA2_DIGEST_SZ + 1);
+        memcpy(node + 1, tmp, SHA2_DIGEST_SZ);
+        memcpy(node + 1 + SHA2_DIGEST_SZ, leaves + 2 * SHA2_DIGEST_SZ,
+               SHA2_DIGEST_SZ);
+        sha2_hash(node, ref, state, 2 * SHA2_DIGEST_SZ + 1);
+
+        /* Root must not depend on the number of threads */
+        for (i = 1; i <= 4; i++) {
+                sha2_tree_file(fd, len, 4096, out, i);
+                ret &= !memcmp(out, ref, SHA2_DIGEST_SZ);
+        }
+
+        /* Streams split at any byte, or at the leaves, get the same root */
+        for (i = 0; i < 4; i++) {
+                sha2_tree_init(&t, 4096);
+                for (off = 0; off < len; off += chunks[i])
+                        sha2_tree_update(&t, in + off, (len - off < chunks[i]) ?
+                                         len - off : chunks[i]);
+                sha2_tree_final(&t, out);
+                ret &= !memcmp(out, ref, SHA2_DIGEST_SZ);
+        }
+
+        /* A single leaf file has the leaf's hash as the root */
+        sha2_tree_leaf(in, 100, ref, state);
+        sha2_tree_file(fd, 100, 4096, out, 2);
+        ret &= !memcmp(out, ref, SHA2_DIGEST_SZ);
+
+        /* An empty stream has the root of an empty file */
+        sha2_tree_file(fd, 0, 4096, ref, 1);
+        sha2_tree_init(&t, 4096);
+        sha2_tree_final(&t, out);
+        ret &= !memcmp(out, ref, SHA2_DIGEST_SZ);
+
+        xclose(fd);
+
+cleanup_return:
+        remove(path);
+        free(path);
+        free(state);
+        free(in);
+        return ret;
+}
@@ -2,6 +2,19 @@
 #include "stdlib.h"
 #include "string.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include "cpuid.h"
+#include "immintrin.h"
+#endif
+
+#if defined(__aarch64__)
+#include "arm_neon.h"
+#if defined(__linux__)
+#include "sys/auxv.h"
+#include "asm/hwcap.h"
+#endif
+#endif
+
 /**
  * @file sha2.c
  * Self-contained implementation of SHA-2.
@@ -65,10 +78,9 @@
  * Buffer structure used to proccess SHA-2.
  */
 struct hash_state {
-        uint64_t len;      /**< Message length in bits */
+        uint64_t len;      /**< Message length in bytes */
         uint32_t hx[8];    /**< Current hash state */
-        uint32_t acc[64];  /**< Current 32-bit words being processed */
-        uint8_t  data[64]; /**< Current 64 bytes being processed */
+        uint8_t  data[64]; /**< Partial block waiting for more data */
 };
 
 /**
@@ -77,7 +89,7 @@ struct hash_state {
  * First 32-bit of the fractional parts of the square roots of the first
  * 8 primes. All of the numbers are represented in big-endian format.
  */
-static const uint32_t k[64] = {
+const uint32_t sha2_k[64] = {
         0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,
         0x923f82a4,0xab1c5ed5,0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,
         0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,0xe49b69c1,0xefbe4786,
@@ -91,19 +103,23 @@ static const uint32_t k[64] = {
         0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
 };
 
+/**
+ * Initial hash values used to compute SHA-2.
+ *
+ * First 32-bit of the fractional parts of the square roots of the first
+ * 8 primes.
+ */
+const uint32_t sha2_h0[8] = {
+        0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,0x510e527f,0x9b05688c,
+        0x1f83d9ab,0x5be0cd19
+};
+
 void
 sha2_init(void* buf)
 {
         struct hash_state* hash = buf;
         hash->len = 0;
-        hash->hx[0] = 0x6a09e667;
-        hash->hx[1] = 0xbb67ae85;
-        hash->hx[2] = 0x3c6ef372;
-        hash->hx[3] = 0xa54ff53a;
-        hash->hx[4] = 0x510e527f;
-        hash->hx[5] = 0x9b05688c;
-        hash->hx[6] = 0x1f83d9ab;
-        hash->hx[7] = 0x5be0cd19;
+        memcpy(hash->hx, sha2_h0, sizeof(sha2_h0));
 }
 
 int
@@ -127,153 +143,464 @@ test_sha2_init(void)
 }
 
 /**
- * SHA-2 data transform process.
+ * Signature shared by all SHA-2 block transform backends.
  *
- * Receives the current hash structure and proccesses the next 64 bytes of data.
- * The data in the structure is converted to big-endian format, and the 64
- * rounds of the SHA-2 transform are performed. Lastly, the current hash state
- * is updated.
+ * @param hx Current hash state, updated in place
+ * @param in Buffer containing the blocks to be processed
+ * @param blks Number of 64 byte blocks available in the buffer
+ */
+typedef void (*xform_fn)(uint32_t* restrict hx, const uint8_t* restrict in,
+                         size_t blks);
+
+/**
+ * Portable SHA-2 data transform process.
+ *
+ * Receives the current hash state and proccesses the given 64 byte blocks.
+ * The data of each block is converted to big-endian format, and the 64 rounds
+ * of the SHA-2 transform are performed. Lastly, the current hash state is
+ * updated.
  *
- * @param hash The current state of the hash
+ * @param hx The current state of the hash
+ * @param in Buffer containing the blocks to be processed
+ * @param blks Number of blocks to process
  */
 static void
-xform(struct hash_state* restrict hash)
+xform_generic(uint32_t* restrict hx, const uint8_t* restrict in, size_t blks)
 {
         uint32_t a, b, c, d, e, f, g, h, t1, t2, i, j;
+        uint32_t acc[64];
+
+        for (; blks--; in += SHA_BLK_SZ) {
+                for (i = 0, j = 0; i < 16; ++i, j += 4)
+                        acc[i] = ((uint32_t)in[j]   << 24) |
+                                 ((uint32_t)in[j+1] << 16) |
+                                 ((uint32_t)in[j+2] << 8)  |
+                                 ((uint32_t)in[j+3]);
+                for (; i < 64; i++)
+                        acc[i] = acc[i-16] + acc[i-7] + S3(acc[i-2]) +
+                                 S2(acc[i-15]);
+
+                a = hx[0];
+                b = hx[1];
+                c = hx[2];
+                d = hx[3];
+                e = hx[4];
+                f = hx[5];
+                g = hx[6];
+                h = hx[7];
+
+                for (j = 0; j < 64; j++) {
+                        t1 = h + S1(e) + CH(e,f,g) + sha2_k[j] + acc[j];
+                        t2 = S0(a) + MA(a,b,c);
+                        h = g;
+                        g = f;
+                        f = e;
+                        e = d + t1;
+                        d = c;
+                        c = b;
+                        b = a;
+                        a = t1 + t2;
+                }
 
-        for (i = 0, j = 0; i < 16; ++i, j += 4)
-                hash->acc[i] = (hash->data[j]   << 24) |
-                               (hash->data[j+1] << 16) |
-                               (hash->data[j+2] << 8)  |
-                               (hash->data[j+3]);
-        for (; i < 64; i++)
-                hash->acc[i] = hash->acc[i-16] + hash->acc[i-7] +
-                               S3(hash->acc[i-2]) + S2(hash->acc[i-15]);
-
-        a = hash->hx[0];
-        b = hash->hx[1];
-        c = hash->hx[2];
-        d = hash->hx[3];
-        e = hash->hx[4];
-        f = hash->hx[5];
-        g = hash->hx[6];
-        h = hash->hx[7];
-
-        for (j = 0; j < 64; j++) {
-                t1 = h + S1(e) + CH(e,f,g) + k[j] + hash->acc[j];
-                t2 = S0(a) + MA(a,b,c);
-                h = g;
-                g = f;
-                f = e;
-                e = d + t1;
-                d = c;
-                c = b;
-                b = a;
-                a = t1 + t2;
+                hx[0] += a;
+                hx[1] += b;
+                hx[2] += c;
+                hx[3] += d;
+                hx[4] += e;
+                hx[5] += f;
+                hx[6] += g;
+                hx[7] += h;
         }
+}
 
-        hash->hx[0] += a;
-        hash->hx[1] += b;
-        hash->hx[2] += c;
-        hash->hx[3] += d;
-        hash->hx[4] += e;
-        hash->hx[5] += f;
-        hash->hx[6] += g;
-        hash->hx[7] += h;
+static int
+probe_generic(void)
+{
+        return 1;
 }
 
+#if defined(__x86_64__) || defined(__i386__)
+
 /**
- * SHA-2 padding procedure.
+ * @def SHANI_RNDS
+ * Performs 4 SHA-2 rounds with the message words in "m" and the constants of
+ * the round group "g".
+ */
+#define SHANI_RNDS(m, g)                                                     \
+        do {                                                                 \
+                msg = _mm_add_epi32((m),                                     \
+                      _mm_loadu_si128((const __m128i*)&sha2_k[(g) * 4]));         \
+                st1 = _mm_sha256rnds2_epu32(st1, st0, msg);                  \
+                msg = _mm_shuffle_epi32(msg, 0x0E);                          \
+                st0 = _mm_sha256rnds2_epu32(st0, st1, msg);                  \
+        } while (0)
+
+/**
+ * @def SHANI_NEXT
+ * Completes the message schedule of "nxt" using the current and previous
+ * message words.
+ */
+#define SHANI_NEXT(nxt, cur, prv)                                            \
+        do {                                                                 \
+                tmp = _mm_alignr_epi8((cur), (prv), 4);                      \
+                nxt = _mm_add_epi32((nxt), tmp);                             \
+                nxt = _mm_sha256msg2_epu32((nxt), (cur));                    \
+        } while (0)
+
+/**
+ * SHA-2 data transform process using the x86 SHA extensions.
  *
- * If there is a remainder of 56 bytes or more, then the data is padded and
- * transformed again. Otherwise, the data is padded with zeros and the message's
- * bit length before the last transformation. Lastly, the hash state is updated.
+ * The hash state is kept in the ABEF/CDGH layout expected by the SHA-NI
+ * instructions for the whole run and only converted back at the end, so
+ * several blocks are processed without touching memory.
  *
- * @param hash The current hash state
- * @param in The input buffer
- * @param bytes The message's remaining byte count
+ * @param hx The current state of the hash
+ * @param in Buffer containing the blocks to be processed
+ * @param blks Number of blocks to process
  */
-inline static void
-sha2_padding(struct hash_state* hash, uint8_t* restrict in, uint64_t bytes)
+__attribute__((target("sha,sse4.1")))
+static void
+xform_shani(uint32_t* restrict hx, const uint8_t* restrict in, size_t blks)
 {
-        memset(hash->data, 0x0, SHA_BLK_SZ);
-        memcpy(hash->data, in, bytes);
-        hash->data[bytes] = 0x80;
+        __m128i st0, st1, msg, tmp, w0, w1, w2, w3, abef, cdgh;
+        const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                            0x0405060700010203ULL);
+        int g;
+
+        tmp = _mm_loadu_si128((const __m128i*)&hx[0]);
+        st1 = _mm_loadu_si128((const __m128i*)&hx[4]);
+        tmp = _mm_shuffle_epi32(tmp, 0xB1);          /* CDAB */
+        st1 = _mm_shuffle_epi32(st1, 0x1B);          /* EFGH */
+        st0 = _mm_alignr_epi8(tmp, st1, 8);          /* ABEF */
+        st1 = _mm_blend_epi16(st1, tmp, 0xF0);       /* CDGH */
+
+        for (; blks--; in += SHA_BLK_SZ) {
+                abef = st0;
+                cdgh = st1;
+
+                /* Rounds 0-15 */
+                w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), mask);
+                SHANI_RNDS(w0, 0);
+                w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 16)), mask);
+                SHANI_RNDS(w1, 1);
+                w0 = _mm_sha256msg1_epu32(w0, w1);
+                w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 32)), mask);
+                SHANI_RNDS(w2, 2);
+                w1 = _mm_sha256msg1_epu32(w1, w2);
+                w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 48)), mask);
+                SHANI_RNDS(w3, 3);
+                SHANI_NEXT(w0, w3, w2);
+                w2 = _mm_sha256msg1_epu32(w2, w3);
+
+                /* Rounds 16-47 */
+                for (g = 4; g < 12; g += 4) {
+                        SHANI_RNDS(w0, g);
+                        SHANI_NEXT(w1, w0, w3);
+                        w3 = _mm_sha256msg1_epu32(w3, w0);
+                        SHANI_RNDS(w1, g + 1);
+                        SHANI_NEXT(w2, w1, w0);
+                        w0 = _mm_sha256msg1_epu32(w0, w1);
+                        SHANI_RNDS(w2, g + 2);
+                        SHANI_NEXT(w3, w2, w1);
+                        w1 = _mm_sha256msg1_epu32(w1, w2);
+                        SHANI_RNDS(w3, g + 3);
+                        SHANI_NEXT(w0, w3, w2);
+                        w2 = _mm_sha256msg1_epu32(w2, w3);
+                }
 
-        if (bytes >= 56) {
-                xform(hash);
-                memset(hash->data, 0x0, SHA_BLK_SZ);
+                /* Rounds 48-63 */
+                SHANI_RNDS(w0, 12);
+                SHANI_NEXT(w1, w0, w3);
+                w3 = _mm_sha256msg1_epu32(w3, w0);
+                SHANI_RNDS(w1, 13);
+                SHANI_NEXT(w2, w1, w0);
+                SHANI_RNDS(w2, 14);
+                SHANI_NEXT(w3, w2, w1);
+                SHANI_RNDS(w3, 15);
+
+                st0 = _mm_add_epi32(st0, abef);
+                st1 = _mm_add_epi32(st1, cdgh);
         }
 
-        hash->len += bytes * 8;
-        hash->data[63] = hash->len;
-        hash->data[62] = hash->len >> 8;
-        hash->data[61] = hash->len >> 16;
-        hash->data[60] = hash->len >> 24;
-        hash->data[59] = hash->len >> 32;
-        hash->data[58] = hash->len >> 40;
-        hash->data[57] = hash->len >> 48;
-        hash->data[56] = hash->len >> 56;
-        xform(hash);
+        tmp = _mm_shuffle_epi32(st0, 0x1B);          /* FEBA */
+        st1 = _mm_shuffle_epi32(st1, 0xB1);          /* DCHG */
+        st0 = _mm_blend_epi16(tmp, st1, 0xF0);       /* DCBA */
+        st1 = _mm_alignr_epi8(st1, tmp, 8);          /* HGFE */
+        _mm_storeu_si128((__m128i*)&hx[0], st0);
+        _mm_storeu_si128((__m128i*)&hx[4], st1);
 }
 
-void
-sha2_update(void* in, void* out, void* buf, size_t bytes)
+/**
+ * Determines if the CPU supports the SHA extensions and SSE4.1.
+ * @returns 1 if the SHA-NI backend can be used otherwise 0
+ */
+static int
+probe_shani(void)
 {
-        struct hash_state* hash = buf;
-        uint8_t* in_cp = in;
-        uint8_t* out_cp = out;
-        uint64_t blks = bytes / SHA_BLK_SZ;
-        uint64_t rem = bytes % SHA_BLK_SZ;
-
-        while (blks--) {
-                memcpy(hash->data, in_cp, SHA_BLK_SZ);
-                xform(hash);
-                in_cp += SHA_BLK_SZ;
+        unsigned int a, b, c, d;
+
+        if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1) ||
+            !(c & bit_SSSE3))
+                return 0;
+
+        if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+                return 0;
+
+        return (b & (1 << 29)) ? 1 : 0;
+}
+
+#endif
+
+#if defined(__aarch64__)
+
+/**
+ * @def ARM_SHA2_TARGET
+ * Function attribute enabling the ARMv8 cryptographic extensions.
+ */
+#if defined(__clang__)
+#define ARM_SHA2_TARGET __attribute__((target("crypto")))
+#else
+#define ARM_SHA2_TARGET __attribute__((target("+crypto")))
+#endif
+
+/**
+ * @def ARMV8_RNDS
+ * Performs 4 SHA-2 rounds with the message words in "m" and the constants of
+ * the round group "g".
+ */
+#define ARMV8_RNDS(m, g)                                                     \
+        do {                                                                 \
+                tmp = vaddq_u32((m), vld1q_u32(&sha2_k[(g) * 4]));                \
+                abcd = st0;                                                  \
+                st0 = vsha256hq_u32(st0, st1, tmp);                          \
+                st1 = vsha256h2q_u32(st1, abcd, tmp);                        \
+        } while (0)
+
+/**
+ * @def ARMV8_NEXT
+ * Computes the message words 16 positions ahead of "w0".
+ */
+#define ARMV8_NEXT(w0, w1, w2, w3)                                           \
+        w0 = vsha256su1q_u32(vsha256su0q_u32((w0), (w1)), (w2), (w3))
+
+/**
+ * SHA-2 data transform process using the ARMv8 cryptographic extensions.
+ *
+ * @param hx The current state of the hash
+ * @param in Buffer containing the blocks to be processed
+ * @param blks Number of blocks to process
+ */
+ARM_SHA2_TARGET
+static void
+xform_armv8(uint32_t* restrict hx, const uint8_t* restrict in, size_t blks)
+{
+        uint32x4_t st0, st1, abcd, tmp, w0, w1, w2, w3, save0, save1;
+        int g;
+
+        st0 = vld1q_u32(&hx[0]);
+        st1 = vld1q_u32(&hx[4]);
+
+        for (; blks--; in += SHA_BLK_SZ) {
+                save0 = st0;
+                save1 = st1;
+
+                w0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(in)));
+                w1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(in + 16)));
+                w2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(in + 32)));
+                w3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(in + 48)));
+
+                /* Rounds 0-47 */
+                for (g = 0; g < 12; g += 4) {
+                        ARMV8_RNDS(w0, g);
+                        ARMV8_NEXT(w0, w1, w2, w3);
+                        ARMV8_RNDS(w1, g + 1);
+                        ARMV8_NEXT(w1, w2, w3, w0);
+                        ARMV8_RNDS(w2, g + 2);
+                        ARMV8_NEXT(w2, w3, w0, w1);
+                        ARMV8_RNDS(w3, g + 3);
+                        ARMV8_NEXT(w3, w0, w1, w2);
+                }
+
+                /* Rounds 48-63 */
+                ARMV8_RNDS(w0, 12);
+                ARMV8_RNDS(w1, 13);
+                ARMV8_RNDS(w2, 14);
+                ARMV8_RNDS(w3, 15);
+
+                st0 = vaddq_u32(st0, save0);
+                st1 = vaddq_u32(st1, save1);
         }
 
-        if (rem) {
-                sha2_padding(hash, (uint8_t*)in_cp, rem);
-
-                for (int i = 0; i < 4; i++) {
-                        out_cp[i]      = (hash->hx[0] >> (24 - i * 8)) & 0x000000ff;
-                        out_cp[i + 4]  = (hash->hx[1] >> (24 - i * 8)) & 0x000000ff;
-                        out_cp[i + 8]  = (hash->hx[2] >> (24 - i * 8)) & 0x000000ff;
-                        out_cp[i + 12] = (hash->hx[3] >> (24 - i * 8)) & 0x000000ff;
-                        out_cp[i + 16] = (hash->hx[4] >> (24 - i * 8)) & 0x000000ff;
-                        out_cp[i + 20] = (hash->hx[5] >> (24 - i * 8)) & 0x000000ff;
-                        out_cp[i + 24] = (hash->hx[6] >> (24 - i * 8)) & 0x000000ff;
-                        out_cp[i + 28] = (hash->hx[7] >> (24 - i * 8)) & 0x000000ff;
+        vst1q_u32(&hx[0], st0);
+        vst1q_u32(&hx[4], st1);
+}
+
+/**
+ * Determines if the CPU supports the ARMv8 SHA-2 instructions.
+ * @returns 1 if the ARMv8 backend can be used otherwise 0
+ */
+static int
+probe_armv8(void)
+{
+#if defined(__linux__)
+        return (getauxval(AT_HWCAP) & HWCAP_SHA2) ? 1 : 0;
+#elif defined(__APPLE__)
+        return 1;
+#elif defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO)
+        return 1;
+#else
+        return 0;
+#endif
+}
+
+#endif
+
+/**
+ * Description of an available SHA-2 block transform backend.
+ */
+struct sha2_impl {
+        const char* name;   /**< Name reported to the user               */
+        xform_fn fn;        /**< Block transform function                */
+        int (*probe)(void); /**< Returns 1 if the CPU supports the backend */
+};
+
+/**
+ * All backends compiled for the current architecture by order of preference.
+ * The generic backend must always be the last entry.
+ */
+static const struct sha2_impl impls[] = {
+#if defined(__x86_64__) || defined(__i386__)
+        {"sha-ni", xform_shani, probe_shani},
+#endif
+#if defined(__aarch64__)
+        {"armv8-ce", xform_armv8, probe_armv8},
+#endif
+        {"generic", xform_generic, probe_generic}
+};
+
+/**
+ * @def N_IMPLS
+ * Number of SHA-2 backends compiled.
+ */
+#define N_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+/**
+ * Backend selected by "sha2_setup". Defaults to the generic backend so the
+ * hashing functions are usable even if the setup was never performed.
+ */
+static const struct sha2_impl* impl = &impls[N_IMPLS - 1];
+
+void
+sha2_setup(void)
+{
+        for (size_t i = 0; i < N_IMPLS; i++) {
+                if (impls[i].probe()) {
+                        impl = &impls[i];
+                        return;
                 }
         }
 }
 
+const char*
+sha2_backend(void)
+{
+        return impl->name;
+}
+
 void
-sha2_hash(uint8_t* restrict in, uint8_t* restrict out, void* restrict buf, size_t len)
+sha2_xform(uint32_t* restrict hx, const uint8_t* restrict in, size_t blks)
+{
+        impl->fn(hx, in, blks);
+}
+
+/**
+ * Transform the given blocks with the selected backend.
+ *
+ * @param hash The current hash state
+ * @param in Buffer containing the blocks to be processed
+ * @param blks Number of blocks to process
+ */
+inline static void
+xform(struct hash_state* restrict hash, const uint8_t* restrict in, size_t blks)
+{
+        impl->fn(hash->hx, in, blks);
+}
+
+/**
+ * SHA-2 padding procedure.
+ *
+ * The buffered remainder of the message is followed by the 0x80 byte. If it
+ * doesn't leave room for the message's bit length, the block is zero padded
+ * and transformed. Then the last block is zero padded, the message's bit
+ * length is appended and the hash state is updated.
+ *
+ * @param hash The current hash state
+ */
+inline static void
+sha2_padding(struct hash_state* hash)
+{
+        uint64_t bits = hash->len * 8;
+        size_t used = hash->len % SHA_BLK_SZ;
+
+        hash->data[used++] = 0x80;
+        if (used > 56) {
+                memset(hash->data + used, 0x0, SHA_BLK_SZ - used);
+                xform(hash, hash->data, 1);
+                used = 0;
+        }
+
+        memset(hash->data + used, 0x0, 56 - used);
+        hash->data[63] = bits;
+        hash->data[62] = bits >> 8;
+        hash->data[61] = bits >> 16;
+        hash->data[60] = bits >> 24;
+        hash->data[59] = bits >> 32;
+        hash->data[58] = bits >> 40;
+        hash->data[57] = bits >> 48;
+        hash->data[56] = bits >> 56;
+        xform(hash, hash->data, 1);
+}
+
+void
+sha2_update(const void* in, void* buf, size_t bytes)
 {
         struct hash_state* hash = buf;
-        uint64_t rm, i, blks = len / SHA_BLK_SZ;
- 
-        hash->len = blks * 512;
-        hash->hx[0] = 0x6a09e667;
-        hash->hx[1] = 0xbb67ae85;
-        hash->hx[2] = 0x3c6ef372;
-        hash->hx[3] = 0xa54ff53a;
-        hash->hx[4] = 0x510e527f;
-        hash->hx[5] = 0x9b05688c;
-        hash->hx[6] = 0x1f83d9ab;
-        hash->hx[7] = 0x5be0cd19;
-
-        for (i = 0; i < blks; i++) {
-                memcpy(hash->data, in, SHA_BLK_SZ);
-                in += SHA_BLK_SZ;
-                xform(hash);
+        const uint8_t* in_cp = in;
+        size_t used = hash->len % SHA_BLK_SZ;
+        size_t fill, blks;
+
+        hash->len += bytes;
+
+        /* Complete the block buffered by the previous update */
+        if (used) {
+                fill = SHA_BLK_SZ - used;
+                if (bytes < fill) {
+                        memcpy(hash->data + used, in_cp, bytes);
+                        return;
+                }
+
+                memcpy(hash->data + used, in_cp, fill);
+                xform(hash, hash->data, 1);
+                in_cp += fill;
+                bytes -= fill;
         }
 
-        rm = len - (SHA_BLK_SZ * blks);
-        sha2_padding(hash, in, rm);
+        /* Whole blocks are transformed straight from the input */
+        blks = bytes / SHA_BLK_SZ;
+        xform(hash, in_cp, blks);
+        in_cp += blks * SHA_BLK_SZ;
+
+        /* Keep the remainder for the next update or the final step */
+        memcpy(hash->data, in_cp, bytes % SHA_BLK_SZ);
+}
+
+void
+sha2_final(uint8_t* out, void* buf)
+{
+        struct hash_state* hash = buf;
 
-        for (i = 0; i < 4; i++) {
+        sha2_padding(hash);
+        for (int i = 0; i < 4; i++) {
                 out[i]      = (hash->hx[0] >> (24 - i * 8)) & 0x000000ff;
                 out[i + 4]  = (hash->hx[1] >> (24 - i * 8)) & 0x000000ff;
                 out[i + 8]  = (hash->hx[2] >> (24 - i * 8)) & 0x000000ff;
@@ -285,6 +612,51 @@ sha2_hash(uint8_t* restrict in, uint8_t* restrict out, void* restrict buf, size_
         }
 }
 
+int
+test_sha2_update(void)
+{
+        size_t chunks[6] = {1, 63, 64, 65, 127, 4097};
+        size_t i, off, len = 3 * PAGE_SIZE + 29;
+        uint8_t* in = malloc(len);
+        uint8_t ref[32], out[32];
+        void* buf = calloc(1, sizeof(struct hash_state));
+        int ret = 1;
+
+        for (i = 0; i < len; i++)
+                in[i] = (uint8_t)((i * 2654435761u) >> 7);
+        sha2_hash(in, ref, buf, len);
+
+        /* Feed the same message in irregular chunk sizes */
+        for (i = 0; i < 6; i++) {
+                sha2_init(buf);
+                for (off = 0; off < len; off += chunks[i])
+                        sha2_update(in + off, buf, (len - off < chunks[i]) ?
+                                    len - off : chunks[i]);
+                sha2_final(out, buf);
+                ret &= !memcmp(ref, out, 32);
+        }
+
+        /* An update of zero bytes must not change the result */
+        sha2_init(buf);
+        sha2_update(in, buf, 0);
+        sha2_update(in, buf, len);
+        sha2_update(in, buf, 0);
+        sha2_final(out, buf);
+        ret &= !memcmp(ref, out, 32);
+
+        free(in);
+        free(buf);
+        return ret;
+}
+
+void
+sha2_hash(uint8_t* restrict in, uint8_t* restrict out, void* restrict buf, size_t len)
+{
+        sha2_init(buf);
+        sha2_update(in, buf, len);
+        sha2_final(out, buf);
+}
+
 int
 test_sha2(void)
 {
@@ -328,15 +700,115 @@ opjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu"};
         return !res;
 }
 
-void
-sha2_to_str(uint8_t* hash, char* buf)
+/**
+ * Hex digits indexed by their value.
+ */
+static const char hex_digits[] = "0123456789abcdef";
+
+/**
+ * Encode bytes into lowercase hex digits, one byte at a time.
+ *
+ * @param in Bytes to be encoded
+ * @param out Buffer where 2 digits per byte are placed
+ * @param n Number of bytes to encode
+ */
+static void
+hex_encode_generic(const uint8_t* restrict in, char* restrict out, size_t n)
+{
+        while (n--) {
+                *out++ = hex_digits[*in >> 4];
+                *out++ = hex_digits[*in++ & 0xf];
+        }
+}
+
+#if defined(__SSE2__)
+
+/**
+ * Encode bytes into lowercase hex digits, 16 bytes at a time.
+ *
+ * Nibbles are split and interleaved, then mapped to ASCII by adding '0' and
+ * the distance between '9' and 'a' for the ones above 9.
+ *
+ * @param in Bytes to be encoded
+ * @param out Buffer where 2 digits per byte are placed
+ * @param n Number of bytes to encode
+ */
+static void
+hex_encode(const uint8_t* restrict in, char* restrict out, size_t n)
+{
+        const __m128i nib = _mm_set1_epi8(0xf);
+        const __m128i nine = _mm_set1_epi8(9);
+        const __m128i zero = _mm_set1_epi8('0');
+        const __m128i gap = _mm_set1_epi8('a' - '9' - 1);
+        __m128i v, hi, lo, a, b;
+
+        for (; n >= 16; n -= 16, in += 16, out += 32) {
+                v = _mm_loadu_si128((const __m128i*)in);
+                hi = _mm_and_si128(_mm_srli_epi16(v, 4), nib);
+                lo = _mm_and_si128(v, nib);
+                a = _mm_unpacklo_epi8(hi, lo);
+                b = _mm_unpackhi_epi8(hi, lo);
+                a = _mm_add_epi8(_mm_add_epi8(a, zero),
+                                 _mm_and_si128(_mm_cmpgt_epi8(a, nine), gap));
+                b = _mm_add_epi8(_mm_add_epi8(b, zero),
+                                 _mm_and_si128(_mm_cmpgt_epi8(b, nine), gap));
+                _mm_storeu_si128((__m128i*)out, a);
+                _mm_storeu_si128((__m128i*)(out + 16), b);
+        }
+
+        hex_encode_generic(in, out, n);
+}
+
+#elif defined(__aarch64__)
+
+/**
+ * Encode bytes into lowercase hex digits, 16 bytes at a time.
+ *
+ * Nibbles are mapped to ASCII with a table lookup and stored interleaved.
+ *
+ * @param in Bytes to be encoded
+ * @param out Buffer where 2 digits per byte are placed
+ * @param n Number of bytes to encode
+ */
+static void
+hex_encode(const uint8_t* restrict in, char* restrict out, size_t n)
 {
-        int ret, off = 0;
-        while (off < SHA_BLK_SZ) {
-                ret = snprintf(buf + off, 3, "%02hhx", *hash++);
-                if (ret != -1)
-                        off += ret;
+        const uint8x16_t tbl = vld1q_u8((const uint8_t*)hex_digits);
+        uint8x16x2_t digits;
+        uint8x16_t v;
+
+        for (; n >= 16; n -= 16, in += 16, out += 32) {
+                v = vld1q_u8(in);
+                digits.val[0] = vqtbl1q_u8(tbl, vshrq_n_u8(v, 4));
+                digits.val[1] = vqtbl1q_u8(tbl, vandq_u8(v, vdupq_n_u8(0xf)));
+                vst2q_u8((uint8_t*)out, digits);
         }
+
+        hex_encode_generic(in, out, n);
+}
+
+#else
+
+/**
+ * Encode bytes into lowercase hex digits.
+ *
+ * @param in Bytes to be encoded
+ * @param out Buffer where 2 digits per byte are placed
+ * @param n Number of bytes to encode
+ */
+static void
+hex_encode(const uint8_t* restrict in, char* restrict out, size_t n)
+{
+        hex_encode_generic(in, out, n);
+}
+
+#endif
+
+void
+sha2_to_str(const uint8_t* hash, char* buf)
+{
+        hex_encode(hash, buf, SHA2_DIGEST_SZ);
+        buf[SHA2_HEX_SZ] = '\0';
 }
 
 int
@@ -347,11 +819,21 @@ test_sha2_to_str()
         char* tmp = calloc(1,65);
         char* out = "03ba204e50d126e4674c005e04d82e84c21366780af1f43bd54a37816b6ab340";
         void* buf = calloc(1, sizeof(struct hash_state));
-	int ret;
+        uint8_t all[256];
+        char ref[512], enc[512];
+	int ret, i;
 
         sha2_hash((uint8_t*)test, (uint8_t*)tmp, buf, strlen(test));
         sha2_to_str((uint8_t*)tmp, str);
-        ret = !strncmp(str, out, 64);
+        ret = !strncmp(str, out, 64) && !str[64];
+
+        /* Every byte value must match the portable encoder */
+        for (i = 0; i < 256; i++)
+                all[i] = i;
+        hex_encode_generic(all, ref, 256);
+        hex_encode(all, enc, 256);
+        ret &= !memcmp(ref, enc, 512);
+        ret &= !strncmp(ref + 2 * 0xa5, "a5", 2);
 
 	free(str);
 	free(tmp);
@@ -361,18 +843,16 @@ test_sha2_to_str()
 }
 
 void
-sha2_to_strn(uint8_t* hash, char* buf, uint8_t bytes)
+sha2_to_strn(const uint8_t* hash, char* buf, uint8_t bytes)
 {
-        int ret, off = 0;
+        char tmp[SHA2_HEX_SZ];
 
-        while (off < bytes) {
-                ret = snprintf(buf + off, 3, "%02x", *hash++);
-                if (ret != -1)
-                        off += ret;
-        }
+        if (bytes > SHA2_HEX_SZ)
+                bytes = SHA2_HEX_SZ;
 
-	if (bytes % 2)
-		*(buf + --off) = '\0';
+        hex_encode(hash, tmp, (bytes + 1) / 2);
+        memcpy(buf, tmp, bytes);
+        buf[bytes] = '\0';
 }
 
 int
@@ -389,7 +869,7 @@ test_sha2_to_strn()
 
         for (uint8_t i = 0; i <= SHA_BLK_SZ; i++) {
                 sha2_to_strn((uint8_t*)tmp, str, i);
-                ret &= !strncmp(str, out, i);
+                ret &= !strncmp(str, out, i) && !str[i];
         }
 
 	free(str);
@@ -398,3 +878,89 @@ test_sha2_to_strn()
 
         return ret;
 }
+
+/**
+ * Obtain the value of a lowercase hex digit.
+ *
+ * @param c Character containing the digit
+ * @returns The digit's value or -1 if it isn't a lowercase hex digit
+ */
+inline static int
+hex_value(char c)
+{
+        if (c >= '0' && c <= '9')
+                return c - '0';
+        if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+        return -1;
+}
+
+int
+sha2_from_str(const char* str, uint8_t* hash)
+{
+        int hi, lo;
+
+        for (size_t i = 0; i < SHA2_DIGEST_SZ; i++) {
+                hi = hex_value(str[2 * i]);
+                lo = (hi < 0) ? -1 : hex_value(str[2 * i + 1]);
+                if (lo < 0)
+                        return -1;
+                hash[i] = (hi << 4) | lo;
+        }
+
+        return (str[SHA2_HEX_SZ]) ? -1 : 0;
+}
+
+int
+test_sha2_from_str(void)
+{
+        char* out = "03ba204e50d126e4674c005e04d82e84c21366780af1f43bd54a37816b6ab340";
+        uint8_t hash[SHA2_DIGEST_SZ];
+        char str[SHA2_HEX_SZ + 1];
+        int ret = 1;
+
+        /* Decoding and encoding must give back the same string */
+        ret &= !sha2_from_str(out, hash);
+        sha2_to_str(hash, str);
+        ret &= !strncmp(str, out, SHA2_HEX_SZ + 1);
+
+        /* Truncated names, longer names and non hex digits aren't IDs */
+        ret &= (sha2_from_str("03ba204e50d126e4674c005e04d82e8", hash) < 0);
+        strncpy(str, out, SHA2_HEX_SZ + 1);
+        str[10] = 'G';
+        ret &= (sha2_from_str(str, hash) < 0);
+        ret &= (sha2_from_str("03ba204e50d126e4674c005e04d82e84c21366780af1f43bd\
+54a37816b6ab3400", hash) < 0);
+
+        return ret;
+}
+
+int
+test_sha2_backends(void)
+{
+        uint32_t ref[8], hx[8];
+        size_t i, j, blks;
+        int ret = 1;
+        uint8_t* in = malloc(SHA_BLK_SZ * 17);
+
+        /* Deterministic pseudo-random input */
+        for (i = 0; i < SHA_BLK_SZ * 17; i++)
+                in[i] = (uint8_t)((i * 2654435761u) >> 13);
+
+        for (i = 0; i < N_IMPLS; i++) {
+                if (!impls[i].probe())
+                        continue;
+
+                for (blks = 1; blks <= 17; blks += 4) {
+                        for (j = 0; j < 8; j++)
+                                ref[j] = hx[j] = sha2_k[j];
+
+                        xform_generic(ref, in, blks);
+                        impls[i].fn(hx, in, blks);
+                        ret &= !memcmp(ref, hx, sizeof(hx));
+                }
+        }
+
+        free(in);
+        return ret;
+}
@@ -7,6 +7,11 @@
 #include "cli/arg-parse.h"
 #include "misc/decorations.h"
 #include "mem/slob.h"
+#include "mem/mem_stats.h"
+#include "crypto/sha2.h"
+#include "const/const.h"
+#include "const/err.h"
+#include "tools/stats.h"
 #include "inttypes.h"
 
 int
@@ -16,7 +21,9 @@ donut_main(int argc, char** argv)
         const char* cmd;
         uint64_t oflags = 0;
         int args_idx, ret = 0;
-        struct slobs* slobs = init_slobs();
+        uint64_t t, budget;
+        char* end;
+        struct slobs* slobs = init_slobs("main");
         void* buf = alloc_slob(slobs, PAGE_SIZE);
 
         if (!argv[1]) {
@@ -25,9 +32,25 @@ donut_main(int argc, char** argv)
                 exit(1);
         }
 
+        sha2_setup();
         cmd = argv[1];
         len = strnlen(cmd, 15);
         args_idx = parse_opts(argc, argv, buf, &oflags);
+        if (oflags & MEM_BUDGET_OPT) {
+                budget = strtoull((char*)buf + MEM_BUDGET_ARG_IDX *
+                                  (MAX_ARG_SZ + 1), &end, 10);
+                if (*end || !budget) {
+                        printf(DONUT_ERROR "The memory budget must be a\
+ positive number of MiB.\n");
+                        clear_slobs(slobs);
+                        return DEF_ERR;
+                }
+                mem_set_budget(budget << 20);
+        }
+        if (oflags & (STATS_OPT | TRACE_OPT))
+                stats_start((oflags & TRACE_OPT) ? (char*)buf + TRACE_ARG_IDX *
+                            (MAX_ARG_SZ + 1) : NULL);
+        t = stats_begin();
 
         if (!strncmp("init", cmd, len))
                 ret = donut_init(argc, argv, args_idx, buf, oflags);
@@ -39,11 +62,27 @@ donut_main(int argc, char** argv)
                 conf(argc, argv, args_idx, buf, oflags);
         else if (!strncmp("ls-data", cmd, len))
                 ls_data(argc, argv, args_idx, buf, oflags);
+        else if (!strncmp("cat-data", cmd, len))
+                ret = cat_data(argc, argv, args_idx, buf, oflags);
+        else if (!strncmp("repack", cmd, len))
+                ret = repack(argc, argv, args_idx, buf, oflags);
+        else if (!strncmp("reshard", cmd, len))
+                ret = reshard(argc, argv, args_idx, buf, oflags);
+        else if (!strncmp("bench", cmd, len))
+                ret = bench(argc, argv, args_idx, buf, oflags);
         else if (!strncmp("help", cmd, len))
                 printf(HELP_CMD);
         else
                 printf(DONUT_ERROR "Unrecognized command\n" HELP_CMD);
 
+        stats_end(PHASE_COMMAND, t, 0, 0);
+        stats_report(oflags & STATS_OPT);
+        /* Commands past the budget save their work before failing */
+        if ((oflags & MEM_STATS_OPT) || mem_exceeded())
+                mem_report();
+        if (mem_exceeded() && !ret)
+                ret = DEF_ERR;
+
         clear_slobs(slobs);
         return ret;
 }
@@ -0,0 +1,289 @@
+#include "mem/mem_stats.h"
+#include "core/wrappers.h"
+#include "misc/decorations.h"
+#include "pthread.h"
+#include "stdlib.h"
+#include "string.h"
+
+/**
+ * @file mem_stats.c
+ * Implementation of the memory accounting.
+ */
+
+/**
+ * Memory of every allocator tagged with the same name.
+ */
+struct mem_owner {
+        const char* name;          /**< Name of the owner                 */
+        uint64_t mapped;           /**< Bytes mapped                      */
+        uint64_t peak;             /**< Most bytes mapped at once         */
+        uint64_t n_arenas;         /**< Allocators created                */
+        uint64_t allocs;           /**< Allocations of released ones      */
+        uint64_t frees;            /**< Frees of released ones            */
+        struct mem_usage* arenas;  /**< Allocators not released           */
+        struct mem_owner* next;    /**< Next owner registered             */
+};
+
+static struct mem_owner* owners;
+static pthread_mutex_t owners_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t total_mapped;
+static uint64_t total_peak;
+static uint64_t budget;
+static uint64_t base;
+static int exceeded;
+
+struct mem_owner*
+mem_owner(const char* name)
+{
+        struct mem_owner* o;
+
+        pthread_mutex_lock(&owners_lock);
+        for (o = owners; o; o = o->next)
+                if (!strcmp(o->name, name))
+                        break;
+
+        if (!o) {
+                o = xcalloc(1, sizeof(struct mem_owner));
+                o->name = name;
+                o->next = owners;
+                owners = o;
+        }
+        pthread_mutex_unlock(&owners_lock);
+
+        return o;
+}
+
+void
+mem_attach(struct mem_owner* o, struct mem_usage* u)
+{
+        pthread_mutex_lock(&owners_lock);
+        u->prev = NULL;
+        u->next = o->arenas;
+        if (o->arenas)
+                o->arenas->prev = u;
+        o->arenas = u;
+        o->n_arenas++;
+        pthread_mutex_unlock(&owners_lock);
+}
+
+void
+mem_detach(struct mem_owner* o, struct mem_usage* u)
+{
+        pthread_mutex_lock(&owners_lock);
+        if (u->prev)
+                u->prev->next = u->next;
+        else
+                o->arenas = u->next;
+        if (u->next)
+                u->next->prev = u->prev;
+        o->allocs += u->allocs;
+        o->frees += u->frees;
+        pthread_mutex_unlock(&owners_lock);
+}
+
+/**
+ * Raise a peak to a new value if it's higher.
+ *
+ * @param peak Peak shared by threads.
+ * @param val Value reached.
+ */
+static void
+raise_peak(uint64_t* peak, uint64_t val)
+{
+        uint64_t cur = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+        while (val > cur && !__atomic_compare_exchange_n(peak, &cur, val, 1,
+                                                         __ATOMIC_RELAXED,
+                                                         __ATOMIC_RELAXED))
+                ;
+}
+
+void
+mem_map(struct mem_owner* o, uint64_t bytes)
+{
+        uint64_t total = __atomic_add_fetch(&total_mapped, bytes,
+                                            __ATOMIC_RELAXED);
+
+        raise_peak(&o->peak, __atomic_add_fetch(&o->mapped, bytes,
+                                                __ATOMIC_RELAXED));
+        raise_peak(&total_peak, total);
+        if (!budget || total <= budget ||
+            __atomic_exchange_n(&exceeded, 1, __ATOMIC_RELAXED))
+                return;
+
+        printf(DONUT_ERROR "Memory budget of %lu MiB exceeded by %s.\n",
+               (unsigned long)(budget >> 20), o->name);
+}
+
+void
+mem_unmap(struct mem_owner* o, uint64_t bytes)
+{
+        __atomic_sub_fetch(&o->mapped, bytes, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&total_mapped, bytes, __ATOMIC_RELAXED);
+}
+
+void
+mem_set_budget(uint64_t bytes)
+{
+        budget = bytes;
+        __atomic_store_n(&exceeded, 0, __ATOMIC_RELAXED);
+}
+
+void
+mem_set_base(void)
+{
+        base = __atomic_load_n(&total_mapped, __ATOMIC_RELAXED);
+}
+
+int
+mem_over_budget(void)
+{
+        uint64_t total = __atomic_load_n(&total_mapped, __ATOMIC_RELAXED);
+
+        if (!budget)
+                return 0;
+        if (base >= budget || mem_exceeded())
+                return 1;
+        return (total >= base + (budget - base) / 4 * 3) ? 1 : 0;
+}
+
+int
+mem_exceeded(void)
+{
+        return __atomic_load_n(&exceeded, __ATOMIC_RELAXED);
+}
+
+uint64_t
+mem_peak(void)
+{
+        return __atomic_load_n(&total_peak, __ATOMIC_RELAXED);
+}
+
+/**
+ * Sum the allocations of an owner's allocators, released or not.
+ *
+ * Must be called with the owners' lock held.
+ *
+ * @param o Owner to be summed.
+ * @param sum Usage to be populated, "prev" and "next" are left alone.
+ */
+static void
+sum_owner(const struct mem_owner* o, struct mem_usage* sum)
+{
+        sum->allocs = o->allocs;
+        sum->frees = o->frees;
+        sum->live = 0;
+        for (struct mem_usage* u = o->arenas; u; u = u->next) {
+                sum->allocs += u->allocs;
+                sum->frees += u->frees;
+                sum->live += u->live;
+        }
+}
+
+void
+mem_report(void)
+{
+        struct mem_usage sum;
+
+        printf(DONUT "Memory by owner, peak of %lu KiB mapped",
+               (unsigned long)(mem_peak() >> 10));
+        if (budget)
+                printf(" out of a budget of %lu KiB",
+                       (unsigned long)(budget >> 10));
+        printf("\n  %-12s %8s %12s %12s %12s %12s %12s\n", "Owner", "Arenas",
+               "Allocs", "Frees", "Live (KiB)", "Mapped (KiB)", "Peak (KiB)");
+
+        pthread_mutex_lock(&owners_lock);
+        for (struct mem_owner* o = owners; o; o = o->next) {
+                sum_owner(o, &sum);
+                printf("  %-12s %8lu %12lu %12lu %12lu %12lu %12lu\n", o->name,
+                       (unsigned long)o->n_arenas, (unsigned long)sum.allocs,
+                       (unsigned long)sum.frees,
+                       (unsigned long)(sum.live >> 10),
+                       (unsigned long)(o->mapped >> 10),
+                       (unsigned long)(o->peak >> 10));
+        }
+        pthread_mutex_unlock(&owners_lock);
+}
+
+void
+mem_write_trace(FILE* f, double ts)
+{
+        struct mem_usage sum;
+
+        pthread_mutex_lock(&owners_lock);
+        for (struct mem_owner* o = owners; o; o = o->next) {
+                sum_owner(o, &sum);
+                fprintf(f, ",\n{\"name\":\"memory %s\",\"ph\":\"C\",\
+\"ts\":%.3f,\"pid\":1,\"tid\":0,\"args\":{\"allocs\":%lu,\"frees\":%lu,\
+\"live\":%lu,\"mapped\":%lu,\"peak\":%lu}}", o->name, ts,
+                        (unsigned long)sum.allocs, (unsigned long)sum.frees,
+                        (unsigned long)sum.live, (unsigned long)o->mapped,
+                        (unsigned long)o->peak);
+        }
+        pthread_mutex_unlock(&owners_lock);
+}
+
+int
+test_mem_stats(void)
+{
+        int ret = 1;
+        struct mem_owner* o = mem_owner("test-mem");
+        struct mem_usage a = {0}, b = {0}, sum;
+        uint64_t cur, n_arenas = o->n_arenas, allocs = o->allocs;
+        uint64_t frees = o->frees;
+
+        /* Owners are found by name */
+        ret &= (mem_owner("test-mem") == o) ? 1 : 0;
+
+        /* Allocators are summed before and after they're released */
+        mem_attach(o, &a);
+        mem_attach(o, &b);
+        a.allocs = 3;
+        a.live = 300;
+        b.allocs = 2;
+        b.frees = 1;
+        b.live = 100;
+        sum_owner(o, &sum);
+        ret &= (sum.allocs == allocs + 5 && sum.frees == frees + 1 &&
+                sum.live == 400) ? 1 : 0;
+        mem_detach(o, &a);
+        sum_owner(o, &sum);
+        ret &= (sum.allocs == allocs + 5 && sum.live == 100 &&
+                o->arenas == &b && o->n_arenas == n_arenas + 2) ? 1 : 0;
+        mem_detach(o, &b);
+
+        /* The peak stays once memory is unmapped */
+        cur = o->mapped;
+        mem_map(o, 4096);
+        mem_map(o, 8192);
+        mem_unmap(o, 8192);
+        ret &= (o->mapped == cur + 4096 && o->peak >= cur + 12288) ? 1 : 0;
+        mem_unmap(o, 4096);
+
+        /* Commands are told to stop at 3/4 of the budget */
+        base = 0;
+        cur = __atomic_load_n(&total_mapped, __ATOMIC_RELAXED) + (4 << 20);
+        mem_set_budget(4 * cur);
+        ret &= !mem_over_budget();
+        mem_map(o, 3 * cur - total_mapped);
+        ret &= mem_over_budget();
+        mem_unmap(o, o->mapped);
+
+        /* The threshold is placed after the fixed bytes */
+        cur = 4 << 20;
+        mem_map(o, cur);
+        mem_set_base();
+        mem_set_budget(base + 4 * cur);
+        ret &= !mem_over_budget();
+        mem_map(o, 2 * cur);
+        ret &= !mem_over_budget();
+        mem_map(o, cur);
+        ret &= mem_over_budget() && !mem_exceeded();
+        mem_unmap(o, o->mapped);
+        mem_set_base();
+        mem_set_budget(0);
+        ret &= !mem_over_budget();
+
+        return ret;
+}
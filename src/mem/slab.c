@@ -1,24 +1,56 @@
 #include "mem/slab.h"
+#include "mem/mem_stats.h"
 #include "core/wrappers.h"
+#include "misc/decorations.h"
+#include "pthread.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "errno.h"
+#include "sys/mman.h"
 
-union donut_objects {
-        struct dataframe dataframe;
-        struct data_file file;
-        struct node node;
-};
+/**
+ * @file slab.c
+ * Implementation of the object cache.
+ */
+
+/**
+ * @def SLAB_OBJ_SZ
+ * Bytes of an object, rounded to the cache line so objects held by different
+ * threads never share one.
+ */
+#define SLAB_OBJ_SZ ((sizeof(union donut_objects) + CACHE_LINE - 1) & \
+                     ~(size_t)(CACHE_LINE - 1))
+
+/**
+ * @def REGIONS_GROWTH
+ * Number of new region slots added at each expansion.
+ */
+#define REGIONS_GROWTH 16
 
 struct slab {
-        uint32_t slab_t; /**< Total amount of slabs                 */
-        uint32_t slab_l; /**< Amount of slabs left in the allocator */
-        uint64_t idx;    /**< Index of the next slab                */
-        void** origs;    /**< List of aligned slabs                 */
-        void** slabs;    /**< List of original unaligned slabs      */
+        pthread_mutex_t lock;   /**< Guards all fields below           */
+        void* free;             /**< Objects given back by magazines   */
+        uint64_t n_free;        /**< Number of objects in "free"       */
+        uint8_t* next;          /**< Next object to be carved          */
+        uint8_t* end;           /**< End of the last region            */
+        uint64_t carved;        /**< Number of objects carved          */
+        void** regions;         /**< Regions mapped                    */
+        uint32_t n_regions;     /**< Number of regions mapped          */
+        uint32_t cap;           /**< Capacity of "regions"             */
+        struct slab_mag* mags;  /**< Magazines of the cache            */
+        struct mem_owner* owner;/**< Owner the memory is accounted to  */
+        struct mem_usage usage; /**< Objects taken by magazines        */
 };
 
 struct slab*
-init_slabs(void)
+init_slabs(const char* owner)
 {
         struct slab* ret = xcalloc(1, sizeof(struct slab));
+
+        pthread_mutex_init(&ret->lock, NULL);
+        ret->owner = mem_owner(owner);
+        mem_attach(ret->owner, &ret->usage);
         return ret;
 }
 
@@ -26,13 +58,269 @@ int
 test_init_slabs(void)
 {
         int ret = 0;
-        struct slab* slab = init_slabs();
+        struct slab* slab = init_slabs("test");
+
+        ret |= (slab->free == 0 && slab->n_free == 0) ? 1 : 0;
+        ret &= (slab->next == 0 && slab->end == 0) ? 1 : 0;
+        ret &= (slab->carved == 0) ? 1 : 0;
+        ret &= (slab->regions == 0 && slab->n_regions == 0) ? 1 : 0;
+        ret &= (slab->mags == 0) ? 1 : 0;
+
+        clear_slabs(slab);
+        return ret;
+}
+
+struct slab_mag*
+get_slab_mag(struct slab* s)
+{
+        struct slab_mag* m = xcalloc(1, sizeof(struct slab_mag));
+
+        m->cache = s;
+        pthread_mutex_lock(&s->lock);
+        m->next = s->mags;
+        s->mags = m;
+        pthread_mutex_unlock(&s->lock);
+        return m;
+}
+
+/**
+ * Map a new region for objects to be carved from.
+ *
+ * Must be called with the cache's lock held.
+ *
+ * @param s Cache needing objects.
+ */
+static void
+map_region(struct slab* s)
+{
+        uint8_t* mem;
+
+        mem_map(s->owner, SLAB_REGION_SZ);
+        mem = mmap(NULL, SLAB_REGION_SZ, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+                printf(DONUT "Failed to allocate memory.\n");
+                exit(ENOMEM);
+        }
+
+        if (s->n_regions == s->cap) {
+                s->cap += REGIONS_GROWTH;
+                s->regions = xrealloc(s->regions, s->cap * __SIZEOF_POINTER__);
+        }
+        s->regions[s->n_regions++] = mem;
+        s->next = mem;
+        s->end = mem + SLAB_REGION_SZ;
+}
+
+/**
+ * Fill half of an empty magazine, with objects given back by other
+ * magazines first and newly carved ones otherwise.
+ *
+ * @param m Empty magazine.
+ */
+static void
+refill_slab_mag(struct slab_mag* m)
+{
+        struct slab* s = m->cache;
+        uint32_t n = m->n;
+        void* obj;
+
+        pthread_mutex_lock(&s->lock);
+        while (m->n < SLAB_MAG_SZ / 2 && (obj = s->free)) {
+                s->free = *(void**)obj;
+                s->n_free--;
+                m->objs[m->n++] = obj;
+        }
+
+        while (m->n < SLAB_MAG_SZ / 2) {
+                if ((size_t)(s->end - s->next) < SLAB_OBJ_SZ)
+                        map_region(s);
+                m->objs[m->n++] = s->next;
+                s->next += SLAB_OBJ_SZ;
+                s->carved++;
+        }
+
+        /* Objects are accounted when magazines take them, not one by one */
+        s->usage.allocs += m->n - n;
+        s->usage.live += (m->n - n) * SLAB_OBJ_SZ;
+        pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * Give the objects of a magazine, from a given one on, back to its cache.
+ *
+ * @param m Magazine to be emptied.
+ * @param keep Number of objects kept in the magazine.
+ */
+static void
+drain_slab_mag(struct slab_mag* m, uint32_t keep)
+{
+        struct slab* s = m->cache;
+
+        pthread_mutex_lock(&s->lock);
+        while (m->n > keep) {
+                void* obj = m->objs[--m->n];
+
+                *(void**)obj = s->free;
+                s->free = obj;
+                s->n_free++;
+                s->usage.frees++;
+                s->usage.live -= SLAB_OBJ_SZ;
+        }
+        pthread_mutex_unlock(&s->lock);
+}
+
+void
+flush_slab_mag(struct slab_mag* m)
+{
+        drain_slab_mag(m, 0);
+}
+
+union donut_objects*
+alloc_slab(struct slab_mag* m)
+{
+        void* obj;
+
+        if (!m->n)
+                refill_slab_mag(m);
+
+        obj = m->objs[--m->n];
+        return memset(obj, 0x0, SLAB_OBJ_SZ);
+}
+
+void
+free_slab(struct slab_mag* m, union donut_objects* obj)
+{
+        if (m->n == SLAB_MAG_SZ)
+                drain_slab_mag(m, SLAB_MAG_SZ / 2);
+
+        m->objs[m->n++] = obj;
+}
+
+uint64_t
+slab_live(struct slab* s)
+{
+        uint64_t n;
+
+        /* Magazine counts are only stable once their threads are joined */
+        pthread_mutex_lock(&s->lock);
+        n = s->carved - s->n_free;
+        for (struct slab_mag* m = s->mags; m; m = m->next)
+                n -= m->n;
+        pthread_mutex_unlock(&s->lock);
+
+        return n;
+}
+
+void
+clear_slabs(struct slab* s)
+{
+        struct slab_mag* next;
+
+        for (uint32_t i = 0; i < s->n_regions; i++)
+                munmap(s->regions[i], SLAB_REGION_SZ);
+        mem_unmap(s->owner, (uint64_t)s->n_regions * SLAB_REGION_SZ);
+        mem_detach(s->owner, &s->usage);
+        for (struct slab_mag* m = s->mags; m; m = next) {
+                next = m->next;
+                free(m);
+        }
+
+        pthread_mutex_destroy(&s->lock);
+        free(s->regions);
+        free(s);
+}
+
+/**
+ * Thread of the test, allocating and freeing objects through its magazine.
+ */
+struct test_slab_worker {
+        struct slab* s;             /**< Cache shared by the threads      */
+        union donut_objects** objs; /**< Objects the thread holds         */
+        uint32_t n;                 /**< Number of objects held           */
+        uint32_t tag;               /**< Thread's number                  */
+        int zeroed;                 /**< Cleared if dirty or unaligned    */
+        pthread_t tid;              /**< Thread's ID                      */
+};
+
+/**
+ * Allocate the test's objects, free every other one and allocate them again,
+ * tagging every object with the thread's number and its index.
+ */
+static void*
+test_slab_thread(void* arg)
+{
+        struct test_slab_worker* w = arg;
+        struct slab_mag* m = get_slab_mag(w->s);
+        uint32_t i;
+
+        w->zeroed = 1;
+        for (int pass = 0; pass < 2; pass++) {
+                for (i = pass; i < w->n; i += pass + 1) {
+                        w->objs[i] = alloc_slab(m);
+                        w->zeroed &= (!w->objs[i]->file.size &&
+                                      !((uintptr_t)w->objs[i] % CACHE_LINE)) ?
+                                     1 : 0;
+                        w->objs[i]->file.size = ((uint64_t)w->tag << 32) | i;
+                }
+
+                if (!pass)
+                        for (i = 1; i < w->n; i += 2)
+                                free_slab(m, w->objs[i]);
+        }
+
+        return NULL;
+}
+
+int
+test_slabs(void)
+{
+        int ret = 1;
+        const uint32_t n = 20000;
+        struct test_slab_worker w[4];
+        struct slab* s = init_slabs("test");
+        uint32_t i, t;
+
+        /* Every object held must still carry its own tag */
+        for (t = 0; t < 4; t++) {
+                w[t].s = s;
+                w[t].objs = calloc(n, __SIZEOF_POINTER__);
+                w[t].n = n;
+                w[t].tag = t;
+                pthread_create(&w[t].tid, NULL, test_slab_thread, &w[t]);
+        }
+        for (t = 0; t < 4; t++)
+                pthread_join(w[t].tid, NULL);
+
+        for (t = 0; t < 4; t++) {
+                ret &= w[t].zeroed;
+                for (i = 0; i < n; i++)
+                        ret &= (w[t].objs[i]->file.size ==
+                                (((uint64_t)t << 32) | i)) ? 1 : 0;
+        }
+        ret &= (slab_live(s) == 4 * n) ? 1 : 0;
+
+        /* Objects of a flushed magazine are reused by others */
+        for (struct slab_mag* m = s->mags; m; m = m->next)
+                flush_slab_mag(m);
+        ret &= (slab_live(s) == 4 * n) ? 1 : 0;
+        i = s->carved;
+        for (t = 0; t < SLAB_MAG_SZ / 2; t++)
+                free_slab(s->mags, w[0].objs[t]);
+        flush_slab_mag(s->mags);
+        alloc_slab(s->mags->next);
+        ret &= (s->carved == i && slab_live(s) == 4 * n - t + 1) ? 1 : 0;
 
-        ret |= (slab->slab_t == 0) ? 1 : 0;
-        ret &= (slab->slab_l == 0) ? 1 : 0;
-        ret &= (slab->idx == 0) ? 1 : 0;
-        ret &= (slab->origs == 0) ? 1 : 0;
-        ret &= (slab->slabs == 0) ? 1 : 0;
+        /* Objects held by magazines are accounted as live */
+        ret &= (s->usage.allocs >= 4 * n && s->usage.live ==
+                (s->usage.allocs - s->usage.frees) * SLAB_OBJ_SZ) ? 1 : 0;
+        i = slab_live(s);
+        for (struct slab_mag* m = s->mags; m; m = m->next)
+                i += m->n;
+        ret &= (s->usage.allocs - s->usage.frees == i) ? 1 : 0;
 
+        for (t = 0; t < 4; t++)
+                free(w[t].objs);
+        clear_slabs(s);
         return ret;
 }
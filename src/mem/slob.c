@@ -1,85 +1,332 @@
 #include "core/wrappers.h"
 #include "mem/slob.h"
+#include "mem/mem_stats.h"
+#include "tools/stats.h"
+#include "misc/decorations.h"
 #include "stdio.h"
 #include "inttypes.h"
 #include "string.h"
+#include "errno.h"
+#include "sys/mman.h"
 
 /**
  * @file slob.c
  * Implementation of slob allocator module.
+ *
+ * Memory is mapped in regions of up to SLOB_REGION_SZ bytes, split in runs of
+ * SLOB_RUN_SZ bytes aligned to their size. A run holds slobs of a single size
+ * class, carved one after the other as they're needed, and starts with a
+ * header found from any of its slobs by masking the slob's address. Freed
+ * slobs are pushed on their class's free list, which hands them out again
+ * before new ones are carved, so allocating and freeing take constant time.
+ * Slobs larger than SLOB_CLASS_MAX are mapped on their own behind the same
+ * header and unmapped as soon as they're freed. An allocator's first region is
+ * a single run and each next one doubles, so the many small allocators of a
+ * striped structure don't map a whole region each.
+ *
+ * Allocators backed by huge pages map their slobs of at least a huge page
+ * aligned to SLOB_HUGE_PAGE_SZ, so every whole huge page of the slob may be
+ * placed on one. Transparent huge pages don't round the mapping, the tail past
+ * the last whole huge page simply stays on base pages, while hugetlbfs only
+ * maps whole huge pages.
+ *
+ * Size classes are multiples of the cache line up to 4 lines, then 4 classes
+ * per power of 2, so no more than a quarter of a slob is wasted to rounding.
+ */
+
+/**
+ * @def SLOB_LARGE
+ * Size class of the slobs mapped on their own.
  */
+#define SLOB_LARGE UINT32_MAX
 
 /**
- * @def SLOB_GROWTH
- * Number of new slobs slots added at each expansion.
+ * @def SLOB_HDR_SZ
+ * Bytes before the first slob of a run, a multiple of the cache line.
  */
-#define SLOB_GROWTH 10
+#define SLOB_HDR_SZ ((sizeof(struct slob_run) + CACHE_LINE - 1) & \
+                     ~(size_t)(CACHE_LINE - 1))
+
+/**
+ * @def REGIONS_GROWTH
+ * Number of new region slots added at each expansion.
+ */
+#define REGIONS_GROWTH 16
+
+/**
+ * Header at the start of every run and large slob.
+ */
+struct slob_run {
+        struct slobs* owner;   /**< Allocator of the run               */
+        uint32_t cls;          /**< Size class or SLOB_LARGE           */
+        uint32_t pages;        /**< Pages backing a large slob         */
+        size_t map_sz;         /**< Bytes mapped for a large slob      */
+        struct slob_run* prev; /**< Previous large slob                */
+        struct slob_run* next; /**< Next large slob                    */
+};
 
 /**
  * Structure that contains the slob allocator bookkeeping variables.
  */
 struct slobs {
-        uint32_t slob_t;  /**< Total amount of slobs                 */
-        uint32_t slob_l;  /**< Amount of slobs left in the allocator */
-        uint64_t idx;     /**< Index of the next slob                */
-        void** slobs;     /**< List of aligned slobs                 */
-        void** origs;     /**< List of original unaligned slobs      */
+        void* free[SLOB_CLASSES];    /**< Freed slobs of each class          */
+        uint8_t* bump[SLOB_CLASSES]; /**< Next slob carved of each class     */
+        uint8_t* end[SLOB_CLASSES];  /**< End of the run carved of each class*/
+        uint8_t* runs;               /**< Next run of the last region        */
+        uint8_t* runs_end;           /**< End of the last region             */
+        void** regions;              /**< Regions mapped                     */
+        uint32_t n_regions;          /**< Number of regions mapped           */
+        uint64_t regions_sz;         /**< Bytes of the regions mapped        */
+        uint32_t cap;                /**< Capacity of "regions"              */
+        struct slob_run* large;      /**< Large slobs in use                 */
+        uint64_t large_sz;           /**< Bytes mapped for large slobs       */
+        uint32_t pages;              /**< Pages backing large slobs          */
+        struct mem_owner* owner;     /**< Owner the memory is accounted to   */
+        struct mem_usage usage;      /**< Allocations of the allocator       */
 };
 
 struct slobs*
-init_slobs(void)
+init_slobs(const char* owner)
+{
+        struct slobs* ret = xcalloc(1, sizeof(struct slobs));
+
+        ret->owner = mem_owner(owner);
+        mem_attach(ret->owner, &ret->usage);
+        return ret;
+}
+
+struct slobs*
+init_huge_slobs(const char* owner, unsigned int pages)
 {
-        return xcalloc(1, sizeof(struct slobs));
+        struct slobs* ret = init_slobs(owner);
+
+        ret->pages = pages;
+        return ret;
+}
+
+unsigned int
+slob_pages(struct slobs* ptr)
+{
+        return ptr->pages;
 }
 
 int
 test_init_slob(void)
 {
-        struct slobs* p = init_slobs();
-        int ret = (!p->slob_t && !p->slob_l && !p->slobs &&
-                   !p->origs && !p->idx) ? 1: 0;
+        struct slobs* p = init_slobs("test");
+        int ret = (!p->runs && !p->regions && !p->n_regions &&
+                   !p->large && !p->large_sz &&
+                   p->pages == SLOB_PAGES_BASE) ? 1: 0;
+
+        ret &= (p->owner == mem_owner("test") && !p->usage.allocs &&
+                !p->usage.live) ? 1 : 0;
+
+        for (int i = 0; i < SLOB_CLASSES; i++)
+                ret &= (!p->free[i] && !p->bump[i] && !p->end[i]) ? 1 : 0;
         clear_slobs(p);
         return ret;
 }
 
+unsigned int
+slob_class(size_t sz)
+{
+        const unsigned int line = __builtin_ctz(CACHE_LINE);
+        unsigned int p;
+
+        if (sz <= 4 * CACHE_LINE)
+                return (sz) ? (sz - 1) >> line : 0;
+
+        /* 2^p < sz <= 2^(p + 1), split in 4 classes */
+        p = 63 - __builtin_clzll(sz - 1);
+        return 4 + 4 * (p - line - 2) + ((sz - 1 - (1ull << p)) >> (p - 2));
+}
+
+size_t
+slob_class_size(unsigned int cls)
+{
+        const unsigned int line = __builtin_ctz(CACHE_LINE);
+        unsigned int p;
+
+        if (cls < 4)
+                return (size_t)(cls + 1) << line;
+
+        p = line + 2 + (cls - 4) / 4;
+        return ((size_t)1 << p) + ((size_t)((cls - 4) % 4 + 1) << (p - 2));
+}
+
+/**
+ * Map zeroed memory aligned to a power of 2.
+ *
+ * @param sz Bytes to be mapped, a multiple of the page size
+ * @param align Alignment of the memory, a multiple of the page size
+ * @returns Pointer to the mapped memory
+ */
+static void*
+map_aligned(size_t sz, size_t align)
+{
+        uint8_t* mem = mmap(NULL, sz + align, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        uint8_t* ret;
+
+        if (mem == MAP_FAILED) {
+                printf(DONUT "Failed to allocate memory.\n");
+                exit(ENOMEM);
+        }
+
+        /* Give back the bytes around the aligned part */
+        ret = (uint8_t*)(((uintptr_t)mem + align - 1) &
+                         ~(uintptr_t)(align - 1));
+        if (ret != mem)
+                munmap(mem, ret - mem);
+        if (mem + align != ret)
+                munmap(ret + sz, mem + align - ret);
+        return ret;
+}
+
 /**
- * Align a memory address to the cache line's size.
+ * Map zeroed memory aligned to SLOB_HUGE_PAGE_SZ and placed on huge pages.
+ *
+ * hugetlbfs is only tried if the allocator asks for it, and a failure, most
+ * often because no huge page is reserved, falls back to transparent huge
+ * pages.
  *
- * @param ptr Pointer to the memory address to be aligned
- * @returns Pointer to an aligned memory address
+ * @param ptr Pointer to a slob allocator structure
+ * @param sz Bytes to be mapped, updated with the bytes actually mapped
+ * @param pages Updated with the pages backing the memory
+ * @returns Pointer to the mapped memory
  */
-inline static void*
-align_addr(void* ptr)
+static void*
+map_huge(struct slobs* restrict ptr, size_t* sz, uint32_t* pages)
 {
-        const int align = CACHE_LINE - 1;
-        uintptr_t bit_mask = ~(uintptr_t)align;
-        return (void*)(((uintptr_t)ptr + align) & bit_mask);
+        size_t huge_sz = (*sz + SLOB_HUGE_PAGE_SZ - 1) &
+                         ~(size_t)(SLOB_HUGE_PAGE_SZ - 1);
+        void* mem;
+
+        if (ptr->pages == SLOB_PAGES_HUGETLB) {
+                mem = mmap(NULL, huge_sz, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (mem != MAP_FAILED) {
+                        *sz = huge_sz;
+                        *pages = SLOB_PAGES_HUGETLB;
+                        return mem;
+                }
+        }
 
+        mem = map_aligned(*sz, SLOB_HUGE_PAGE_SZ);
+        madvise(mem, *sz, MADV_HUGEPAGE);
+        *pages = SLOB_PAGES_THP;
+        return mem;
+}
+
+/**
+ * Obtain the bytes of an allocator's region.
+ *
+ * @param i Index of the region
+ * @returns Bytes of the region, a multiple of SLOB_RUN_SZ
+ */
+static inline size_t
+region_sz(uint32_t i)
+{
+        return (i < (uint32_t)__builtin_ctz(SLOB_REGION_SZ / SLOB_RUN_SZ)) ?
+               (size_t)SLOB_RUN_SZ << i : SLOB_REGION_SZ;
+}
+
+/**
+ * Start carving a class's slobs from a new run, mapping a new region when
+ * the last one is used up.
+ *
+ * @param ptr Pointer to a slob allocator structure
+ * @param cls Size class of the run
+ */
+static void
+new_run(struct slobs* restrict ptr, unsigned int cls)
+{
+        struct slob_run* run;
+        size_t sz;
+
+        if (ptr->runs == ptr->runs_end) {
+                if (ptr->n_regions == ptr->cap) {
+                        ptr->cap += REGIONS_GROWTH;
+                        ptr->regions = xrealloc(ptr->regions, ptr->cap *
+                                                __SIZEOF_POINTER__);
+                }
+                sz = region_sz(ptr->n_regions);
+                mem_map(ptr->owner, sz);
+                ptr->runs = map_aligned(sz, SLOB_RUN_SZ);
+                ptr->runs_end = ptr->runs + sz;
+                ptr->regions[ptr->n_regions++] = ptr->runs;
+                ptr->regions_sz += sz;
+        }
+
+        run = (struct slob_run*)ptr->runs;
+        ptr->runs += SLOB_RUN_SZ;
+        run->owner = ptr;
+        run->cls = cls;
+        ptr->bump[cls] = (uint8_t*)run + SLOB_HDR_SZ;
+        ptr->end[cls] = (uint8_t*)run + SLOB_RUN_SZ;
+}
+
+/**
+ * Map a slob too large for the size classes.
+ *
+ * @param ptr Pointer to a slob allocator structure
+ * @param slob_sz Bytes of the slob
+ * @returns Pointer to the slob
+ */
+static void*
+alloc_large(struct slobs* restrict ptr, size_t slob_sz)
+{
+        size_t sz = (SLOB_HDR_SZ + slob_sz + PAGE_SIZE - 1) &
+                    ~(size_t)(PAGE_SIZE - 1);
+        uint32_t pages = SLOB_PAGES_BASE;
+        struct slob_run* run;
+
+        if (ptr->pages != SLOB_PAGES_BASE && slob_sz >= SLOB_HUGE_PAGE_SZ)
+                run = map_huge(ptr, &sz, &pages);
+        else
+                run = map_aligned(sz, SLOB_RUN_SZ);
+        mem_map(ptr->owner, sz);
+        ptr->usage.live += sz;
+
+        run->owner = ptr;
+        run->cls = SLOB_LARGE;
+        run->pages = pages;
+        run->map_sz = sz;
+        ptr->large_sz += sz;
+        run->next = ptr->large;
+        if (ptr->large)
+                ptr->large->prev = run;
+        ptr->large = run;
+        return (uint8_t*)run + SLOB_HDR_SZ;
 }
 
 void*
 alloc_slob(struct slobs* restrict ptr, size_t slob_sz)
 {
-        size_t sz  = (slob_sz < PAGE_SIZE) ? PAGE_SIZE : slob_sz;
-        void*  mem = xcalloc(1, sz + CACHE_LINE);
-        void*  ret = align_addr(mem);
+        unsigned int cls;
+        size_t sz;
+        void* ret;
 
-        if (!ptr->slob_l) {
-                ptr->slob_t += SLOB_GROWTH;
-                ptr->slob_l += SLOB_GROWTH;
-                ptr->slobs = xrealloc(ptr->slobs, ptr->slob_t * __SIZEOF_POINTER__);
-                ptr->origs = xrealloc(ptr->origs, ptr->slob_t * __SIZEOF_POINTER__);
+        stats_add(STAT_SLOB_ALLOCS, 1);
+        stats_add(STAT_SLOB_BYTES, slob_sz);
+        ptr->usage.allocs++;
+        if (slob_sz > SLOB_CLASS_MAX)
+                return alloc_large(ptr, slob_sz);
 
-                /* Zero new indices */
-                memset(&ptr->slobs[ptr->idx], 0x0, SLOB_GROWTH * __SIZEOF_POINTER__);
-                memset(&ptr->origs[ptr->idx], 0x0, SLOB_GROWTH * __SIZEOF_POINTER__);
+        /* Freed slobs are reused first, carved ones are still zeroed */
+        cls = slob_class(slob_sz);
+        sz = slob_class_size(cls);
+        ptr->usage.live += sz;
+        ret = ptr->free[cls];
+        if (ret) {
+                ptr->free[cls] = *(void**)ret;
+                return memset(ret, 0x0, slob_sz);
         }
 
-        /* Adjust slob bookkeeping state */
-        ptr->origs[ptr->idx] = mem;
-        ptr->slobs[ptr->idx] = ret;
-        ptr->idx++;
-        ptr->slob_l--;
+        if ((size_t)(ptr->end[cls] - ptr->bump[cls]) < sz)
+                new_run(ptr, cls);
+        ret = ptr->bump[cls];
+        ptr->bump[cls] += sz;
         return ret;
 }
 
@@ -87,91 +334,220 @@ int
 test_alloc_slob(void)
 {
         struct slobs* ptr;
-        void* pg;
-        int sum = 0;
+        uint8_t* pg;
+        uint8_t* pg2;
+        uint64_t sz = 0;
+        int ret = 1;
+
+        /* Classes are cache line multiples, then quarters of powers of 2 */
+        ret &= (slob_class_size(slob_class(1)) == CACHE_LINE) ? 1 : 0;
+        ret &= (slob_class_size(slob_class(4 * CACHE_LINE + 1)) ==
+                5 * CACHE_LINE) ? 1 : 0;
+        ret &= (slob_class_size(slob_class(SLOB_CLASS_MAX)) ==
+                SLOB_CLASS_MAX) ? 1 : 0;
+        ret &= (slob_class(SLOB_CLASS_MAX) < SLOB_CLASSES) ? 1 : 0;
+        for (size_t sz = 1; sz <= SLOB_CLASS_MAX; sz += 7)
+                ret &= (slob_class_size(slob_class(sz)) >= sz &&
+                        slob_class_size(slob_class(sz)) % CACHE_LINE == 0 &&
+                        slob_class_size(slob_class(sz)) - sz <
+                        (sz >> 2) + CACHE_LINE) ? 1 : 0;
 
-        /* Test Allocation below page size */
-        ptr = init_slobs();
+        /* Test Allocation below page size, carved one after the other */
+        ptr = init_slobs("test");
         pg = alloc_slob(ptr, PAGE_SIZE >> 1);
-        if (ptr->slob_l == 9 &&
-            ptr->slob_t == 10 &&
-            ptr->slobs &&
-            pg &&
-            !((uintptr_t)pg % CACHE_LINE) &&
-            ptr->slobs[0] == pg &&
-            ptr->origs &&
-            ptr->origs[0])
-                sum += 1;
-
-        /* Test second allocation, but above page size */
-        pg = alloc_slob(ptr, PAGE_SIZE << 1);
-        if (ptr->slob_l == 8 &&
-            ptr->slob_t == 10 &&
-            &ptr->slobs[1] &&
-            pg &&
-            !((uintptr_t)pg % CACHE_LINE) &&
-            ptr->slobs[1] == pg &&
-            &ptr->origs[1] &&
-            ptr->origs[1])
-                sum += 1;
-
-        for (int i = 0; i < 512; i++)
-                     alloc_slob(ptr, PAGE_SIZE);
+        pg2 = alloc_slob(ptr, PAGE_SIZE >> 1);
+        ret &= (pg && !((uintptr_t)pg % CACHE_LINE) && ptr->n_regions == 1 &&
+                ptr->regions_sz == SLOB_RUN_SZ) ?
+               1 : 0;
+        ret &= (pg2 == pg + slob_class_size(slob_class(PAGE_SIZE >> 1))) ?
+               1 : 0;
 
-        clear_slobs(ptr);
+        /* Test allocation above the largest class, mapped on its own */
+        pg = alloc_slob(ptr, SLOB_CLASS_MAX << 1);
+        ret &= (pg && !((uintptr_t)pg % CACHE_LINE) && ptr->large &&
+                (uint8_t*)ptr->large + SLOB_HDR_SZ == pg) ? 1 : 0;
+        ret &= (!pg[0] && !pg[(SLOB_CLASS_MAX << 1) - 1]) ? 1 : 0;
 
-        return (sum == 2) ? 1 : 0;
+        /* Runs are refilled from new regions */
+        for (int i = 0; i < 512; i++) {
+                pg = alloc_slob(ptr, PAGE_SIZE);
+                ret &= (!pg[0] && !pg[PAGE_SIZE - 1]) ? 1 : 0;
+                memset(pg, 0xff, PAGE_SIZE);
+        }
+        for (uint32_t i = 0; i < ptr->n_regions; i++)
+                sz += region_sz(i);
+        ret &= (ptr->n_regions > 1 && ptr->regions_sz == sz) ? 1 : 0;
+
+        clear_slobs(ptr);
+        return ret;
 }
 
 void
 free_slob(struct slobs* restrict ptr, void* slob)
 {
-        void** slobs = ptr->slobs;
-        void** orig = ptr->origs;
+        struct slob_run* run;
 
-        /* Lookup pointer to be freed */
-        while (*slobs && *slobs != slob) {
-                slobs++;
-                orig++;
-        }
-
-        if (!*orig)
+        if (!slob)
                 return;
 
-        free(*orig);
-        ptr->slob_l++;
-        ptr->idx--;
+        /*
+         * Only slobs have a run header to mask to, those of other slob
+         * allocators are ignored
+         */
+        run = (struct slob_run*)((uintptr_t)slob &
+                                 ~(uintptr_t)(SLOB_RUN_SZ - 1));
+        if (run->owner != ptr)
+                return;
 
-        /* Shrink list of pointers [Aligned] */
-        void** nxt = ++slobs;
-        slobs--;
-        while ((*slobs++ = *nxt++));
+        ptr->usage.frees++;
+        if (run->cls != SLOB_LARGE) {
+                ptr->usage.live -= slob_class_size(run->cls);
+                *(void**)slob = ptr->free[run->cls];
+                ptr->free[run->cls] = slob;
+                return;
+        }
 
-        /* Shrink list of pointers [Unaligned] */
-        nxt = ++orig;
-        orig--;
-        while((*orig++ = *nxt++));
+        if (run->prev)
+                run->prev->next = run->next;
+        else
+                ptr->large = run->next;
+        if (run->next)
+                run->next->prev = run->prev;
+        ptr->large_sz -= run->map_sz;
+        ptr->usage.live -= run->map_sz;
+        mem_unmap(ptr->owner, run->map_sz);
+        munmap(run, run->map_sz);
 }
 
 int
 test_free_slob(void)
 {
-        struct slobs* ptr = init_slobs();
-        int ret = 0;
-        void* pg = alloc_slob(ptr, PAGE_SIZE);
-        void* pg2 = alloc_slob(ptr, PAGE_SIZE);
-        void* orig_cp = ptr->origs[1];
+        struct slobs* ptr = init_slobs("test");
+        struct slobs* other = init_slobs("test");
+        uint8_t* pg = alloc_slob(ptr, PAGE_SIZE);
+        uint8_t* pg2 = alloc_slob(ptr, PAGE_SIZE);
+        uint8_t* big = alloc_slob(ptr, SLOB_CLASS_MAX + 1);
+        uint8_t* big2 = alloc_slob(ptr, SLOB_CLASS_MAX + 1);
+        int ret = 1;
 
+        /* A freed slob is handed out again, zeroed */
+        memset(pg, 0xff, PAGE_SIZE);
         free_slob(ptr, pg);
-        if (ptr->slobs[0] == pg2 &&
-            ptr->slobs[1] == 0x0 &&
-            ptr->slob_t == 10 &&
-            ptr->slob_l == 9 &&
-            ptr->origs[0] == orig_cp)
-                ret = 1;
-        else
-                ret = 0;
+        ret &= (alloc_slob(ptr, PAGE_SIZE - 1) == pg) ? 1 : 0;
+        ret &= (!pg[0] && !pg[PAGE_SIZE - 2]) ? 1 : 0;
+        ret &= (alloc_slob(ptr, PAGE_SIZE) != pg2) ? 1 : 0;
+
+        /* Large slobs are unmapped from anywhere in the list */
+        free_slob(ptr, big2);
+        ret &= ((uint8_t*)ptr->large + SLOB_HDR_SZ == big &&
+                !ptr->large->prev && !ptr->large->next) ? 1 : 0;
+        free_slob(ptr, big);
+        ret &= (!ptr->large) ? 1 : 0;
+        ret &= (ptr->usage.allocs == 6 && ptr->usage.frees == 3 &&
+                ptr->usage.live == 3 * slob_class_size(slob_class(PAGE_SIZE))) ?
+               1 : 0;
 
+        /* Slobs of other slob allocators are ignored */
+        free_slob(other, pg2);
+        free_slob(other, NULL);
+        ret &= (!other->free[slob_class(PAGE_SIZE)]) ? 1 : 0;
+
+        clear_slobs(other);
+        clear_slobs(ptr);
+        return ret;
+}
+
+uint64_t
+slob_mem(struct slobs* ptr)
+{
+        return ptr->regions_sz + ptr->large_sz;
+}
+
+/**
+ * Determines if a mapping holds a large slob advised as transparent huge
+ * pages.
+ *
+ * @param ptr Pointer to a slob allocator structure
+ * @param start Start of the mapping
+ * @param end End of the mapping
+ * @returns Returns 1 if it does and 0 otherwise
+ */
+static int
+maps_thp_slob(struct slobs* ptr, uintptr_t start, uintptr_t end)
+{
+        for (struct slob_run* run = ptr->large; run; run = run->next)
+                if (run->pages == SLOB_PAGES_THP && (uintptr_t)run < end &&
+                    (uintptr_t)run + run->map_sz > start)
+                        return 1;
+
+        return 0;
+}
+
+uint64_t
+slob_huge_mem(struct slobs* ptr)
+{
+        char line[PAGE_SIZE];
+        unsigned long start, end, kb;
+        uint64_t ret = 0;
+        int counted = 0;
+        FILE* f;
+
+        for (struct slob_run* run = ptr->large; run; run = run->next)
+                if (run->pages == SLOB_PAGES_HUGETLB)
+                        ret += run->map_sz;
+
+        /* A mapping's header is followed by its fields */
+        f = fopen("/proc/self/smaps", "r");
+        if (!f)
+                return ret;
+        while (fgets(line, sizeof(line), f)) {
+                if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+                        counted = maps_thp_slob(ptr, start, end);
+                else if (counted &&
+                         sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+                        ret += (uint64_t)kb << 10;
+        }
+        fclose(f);
+
+        return ret;
+}
+
+int
+test_huge_slob(void)
+{
+        struct slobs* ptr = init_huge_slobs("test", SLOB_PAGES_THP);
+        struct slobs* tlb = init_huge_slobs("test", SLOB_PAGES_HUGETLB);
+        uint8_t* big = alloc_slob(ptr, SLOB_HUGE_PAGE_SZ);
+        uint8_t* small = alloc_slob(ptr, SLOB_CLASS_MAX + 1);
+        uint8_t* pg = alloc_slob(ptr, PAGE_SIZE);
+        int ret = (slob_pages(ptr) == SLOB_PAGES_THP) ? 1 : 0;
+
+        /* Slobs of a huge page or more are aligned to it */
+        memset(big, 0xff, SLOB_HUGE_PAGE_SZ);
+        ret &= (!((uintptr_t)(big - SLOB_HDR_SZ) % SLOB_HUGE_PAGE_SZ)) ? 1 : 0;
+        ret &= (ptr->large->next &&
+                ptr->large->next->pages == SLOB_PAGES_THP) ? 1 : 0;
+
+        /* Smaller slobs stay on base pages */
+        ret &= (ptr->large->pages == SLOB_PAGES_BASE &&
+                (uint8_t*)ptr->large + SLOB_HDR_SZ == small) ? 1 : 0;
+        ret &= (pg && ptr->n_regions == 1) ? 1 : 0;
+
+        /* Huge pages are part of the memory mapped */
+        ret &= (slob_mem(ptr) == SLOB_RUN_SZ + ptr->large->map_sz +
+                ptr->large->next->map_sz) ? 1 : 0;
+        ret &= (slob_huge_mem(ptr) <= slob_mem(ptr)) ? 1 : 0;
+        free_slob(ptr, big);
+        ret &= (slob_mem(ptr) == SLOB_RUN_SZ + ptr->large->map_sz) ? 1 : 0;
+        ret &= (!slob_huge_mem(ptr)) ? 1 : 0;
+
+        /* hugetlbfs falls back to transparent huge pages */
+        big = alloc_slob(tlb, SLOB_HUGE_PAGE_SZ);
+        ret &= (tlb->large->pages != SLOB_PAGES_BASE && !big[0] &&
+                !((uintptr_t)tlb->large % SLOB_HUGE_PAGE_SZ)) ? 1 : 0;
+        ret &= (slob_huge_mem(tlb) <= slob_mem(tlb)) ? 1 : 0;
+
+        clear_slobs(tlb);
         clear_slobs(ptr);
         return ret;
 }
@@ -179,10 +555,16 @@ test_free_slob(void)
 void
 clear_slobs(struct slobs* restrict ptr)
 {
-        void** slobs = ptr->origs;
-        for (uint64_t i = 0; i != ptr->idx; i++)
-                free(slobs[i]);
-	free(ptr->origs);
-	free(ptr->slobs);
+        struct slob_run* next;
+
+        for (struct slob_run* run = ptr->large; run; run = next) {
+                next = run->next;
+                munmap(run, run->map_sz);
+        }
+        for (uint32_t i = 0; i < ptr->n_regions; i++)
+                munmap(ptr->regions[i], region_sz(i));
+        mem_unmap(ptr->owner, slob_mem(ptr));
+        mem_detach(ptr->owner, &ptr->usage);
+        free(ptr->regions);
         free(ptr);
 }
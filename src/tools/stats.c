@@ -0,0 +1,352 @@
+#include "tools/stats.h"
+#include "core/wrappers.h"
+#include "const/const.h"
+#include "mem/mem_stats.h"
+#include "misc/decorations.h"
+#include "pthread.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+
+/**
+ * @file stats.c
+ * Implementation of the spans and counters.
+ */
+
+/**
+ * @def TRACE_MAX_EVENTS
+ * Number of trace events a thread keeps, later spans are only counted.
+ */
+#define TRACE_MAX_EVENTS (256 * 1024)
+
+/**
+ * Span kept for the trace file.
+ */
+struct trace_event {
+        uint64_t start; /**< Start in nanoseconds          */
+        uint64_t dur;   /**< Duration in nanoseconds       */
+        uint64_t bytes; /**< Bytes handled                 */
+        uint64_t files; /**< Files handled                 */
+        uint32_t phase; /**< Phase of the span             */
+};
+
+/**
+ * Spans and counters of a thread.
+ */
+struct stats_thread {
+        uint64_t time[PHASE_N];       /**< Nanoseconds spent per phase  */
+        uint64_t calls[PHASE_N];      /**< Spans per phase              */
+        uint64_t bytes[PHASE_N];      /**< Bytes handled per phase      */
+        uint64_t files[PHASE_N];      /**< Files handled per phase      */
+        uint64_t counters[STAT_N];    /**< Events counted               */
+        struct trace_event* events;   /**< Spans kept for the trace     */
+        uint64_t n_events;            /**< Number of spans kept         */
+        uint64_t cap;                 /**< Capacity of "events"         */
+        uint64_t dropped;             /**< Spans past TRACE_MAX_EVENTS  */
+        unsigned int tid;             /**< Thread's number              */
+        struct stats_thread* next;    /**< Next thread measured         */
+};
+
+/**
+ * Names of the phases indexed by their ID.
+ */
+static const char* phase_names[] = {"command", "scan", "stat", "hash", "io",
+                                    "lookup", "store", "copy", "compress",
+                                    "chunk", "pack", "index"};
+
+int stats_on;
+
+static __thread struct stats_thread* local;
+static struct stats_thread* threads;
+static unsigned int n_threads;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t t_start;
+static char* trace_path;
+
+uint64_t
+stats_now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void
+stats_start(const char* trace)
+{
+        trace_path = (trace) ? strdup(trace) : NULL;
+        t_start = stats_now();
+        stats_on = 1;
+}
+
+/**
+ * Obtain the calling thread's totals, registering the thread on first use.
+ *
+ * @returns Pointer to the thread's totals.
+ */
+static struct stats_thread*
+get_local(void)
+{
+        if (local)
+                return local;
+
+        local = xcalloc(1, sizeof(struct stats_thread));
+        pthread_mutex_lock(&threads_lock);
+        local->tid = n_threads++;
+        local->next = threads;
+        threads = local;
+        pthread_mutex_unlock(&threads_lock);
+        return local;
+}
+
+void
+stats_span(unsigned int phase, uint64_t start, uint64_t bytes, uint64_t files)
+{
+        struct stats_thread* t = get_local();
+        struct trace_event* e;
+        uint64_t end = stats_now();
+
+        t->time[phase] += end - start;
+        t->calls[phase]++;
+        t->bytes[phase] += bytes;
+        t->files[phase] += files;
+        if (!trace_path)
+                return;
+
+        if (t->n_events == TRACE_MAX_EVENTS) {
+                t->dropped++;
+                return;
+        }
+        if (t->n_events == t->cap) {
+                t->cap = (t->cap) ? t->cap << 1 : 1024;
+                t->events = xrealloc(t->events,
+                                     t->cap * sizeof(struct trace_event));
+        }
+
+        e = &t->events[t->n_events++];
+        e->start = start;
+        e->dur = end - start;
+        e->bytes = bytes;
+        e->files = files;
+        e->phase = phase;
+}
+
+void
+stats_count(unsigned int counter, uint64_t n)
+{
+        get_local()->counters[counter] += n;
+}
+
+/**
+ * Sum the totals of every thread.
+ *
+ * @param sum Totals to be populated.
+ */
+static void
+merge_threads(struct stats_thread* sum)
+{
+        memset(sum, 0x0, sizeof(struct stats_thread));
+        for (struct stats_thread* t = threads; t; t = t->next) {
+                for (int i = 0; i < PHASE_N; i++) {
+                        sum->time[i] += t->time[i];
+                        sum->calls[i] += t->calls[i];
+                        sum->bytes[i] += t->bytes[i];
+                        sum->files[i] += t->files[i];
+                }
+                for (int i = 0; i < STAT_N; i++)
+                        sum->counters[i] += t->counters[i];
+                sum->dropped += t->dropped;
+        }
+}
+
+/**
+ * Print the per-phase breakdown and the counters.
+ *
+ * @param sum Totals of every thread.
+ * @param wall Nanoseconds since the measurements started.
+ */
+static void
+print_stats(const struct stats_thread* sum, uint64_t wall)
+{
+        const uint64_t* c = sum->counters;
+        double sec;
+
+        printf(DONUT "Stats over %.2f ms on %u threads, phase times are summed\
+ over threads\n", wall / 1e6, n_threads);
+        printf("  %-10s %12s %10s %12s %10s %12s\n", "Phase", "Time (ms)",
+               "Calls", "MB", "MB/s", "Files/s");
+        for (int i = 0; i < PHASE_N; i++) {
+                if (!sum->calls[i])
+                        continue;
+
+                sec = sum->time[i] / 1e9;
+                printf("  %-10s %12.2f %10lu %12.2f ", phase_names[i],
+                       sum->time[i] / 1e6, (unsigned long)sum->calls[i],
+                       sum->bytes[i] / 1e6);
+                if (sum->bytes[i] && sec > 0)
+                        printf("%10.1f ", sum->bytes[i] / 1e6 / sec);
+                else
+                        printf("%10s ", "-");
+                if (sum->files[i] && sec > 0)
+                        printf("%12.0f\n", sum->files[i] / sec);
+                else
+                        printf("%12s\n", "-");
+        }
+
+        sec = wall / 1e9;
+        printf("  Bytes hashed: %lu (%.1f MB/s)\n",
+               (unsigned long)c[STAT_BYTES_HASHED],
+               (sec > 0) ? c[STAT_BYTES_HASHED] / 1e6 / sec : 0.0);
+        printf("  Files scanned: %lu (%.0f files/s)\n",
+               (unsigned long)c[STAT_FILES_SCANNED],
+               (sec > 0) ? c[STAT_FILES_SCANNED] / sec : 0.0);
+        printf("  Index lookups: %lu, hits: %lu\n",
+               (unsigned long)c[STAT_LOOKUPS], (unsigned long)c[STAT_HITS]);
+        printf("  Slob allocations: %lu (%lu bytes)\n",
+               (unsigned long)c[STAT_SLOB_ALLOCS],
+               (unsigned long)c[STAT_SLOB_BYTES]);
+        printf("  Memory mapped at peak: %lu KiB\n",
+               (unsigned long)(mem_peak() >> 10));
+        if (sum->dropped)
+                printf("  Trace spans dropped: %lu\n",
+                       (unsigned long)sum->dropped);
+}
+
+/**
+ * Write the spans and counters as Chrome trace events.
+ *
+ * @param sum Totals of every thread.
+ * @param end Time the measurements ended.
+ */
+static void
+write_trace(const struct stats_thread* sum, uint64_t end)
+{
+        const struct trace_event* e;
+        const char* sep = "";
+        FILE* f = fopen(trace_path, "w");
+
+        if (!f) {
+                printf(DONUT_ERROR "Failed to write the trace: %s\n",
+                       trace_path);
+                return;
+        }
+
+        fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        for (struct stats_thread* t = threads; t; t = t->next) {
+                fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\
+\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}", sep, t->tid, t->tid);
+                sep = ",\n";
+                for (uint64_t i = 0; i < t->n_events; i++) {
+                        e = &t->events[i];
+                        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"donut\",\
+\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\
+\"bytes\":%lu,\"files\":%lu}}", phase_names[e->phase],
+                                (e->start - t_start) / 1e3, e->dur / 1e3,
+                                t->tid, (unsigned long)e->bytes,
+                                (unsigned long)e->files);
+                }
+        }
+
+        fprintf(f, "%s{\"name\":\"counters\",\"ph\":\"C\",\"ts\":%.3f,\
+\"pid\":1,\"tid\":0,\"args\":{\"bytes_hashed\":%lu,\"files_scanned\":%lu,\
+\"lookups\":%lu,\"hits\":%lu,\"slob_allocs\":%lu,\"slob_bytes\":%lu}}",
+                sep, (end - t_start) / 1e3,
+                (unsigned long)sum->counters[STAT_BYTES_HASHED],
+                (unsigned long)sum->counters[STAT_FILES_SCANNED],
+                (unsigned long)sum->counters[STAT_LOOKUPS],
+                (unsigned long)sum->counters[STAT_HITS],
+                (unsigned long)sum->counters[STAT_SLOB_ALLOCS],
+                (unsigned long)sum->counters[STAT_SLOB_BYTES]);
+        mem_write_trace(f, (end - t_start) / 1e3);
+        fprintf(f, "\n]}\n");
+        fclose(f);
+}
+
+void
+stats_report(int print)
+{
+        struct stats_thread sum;
+        struct stats_thread* next;
+        uint64_t end = stats_now();
+
+        if (!stats_on)
+                return;
+
+        stats_on = 0;
+        merge_threads(&sum);
+        if (print)
+                print_stats(&sum, end - t_start);
+        if (trace_path)
+                write_trace(&sum, end);
+
+        for (struct stats_thread* t = threads; t; t = next) {
+                next = t->next;
+                free(t->events);
+                free(t);
+        }
+        threads = NULL;
+        local = NULL;
+        n_threads = 0;
+        free(trace_path);
+        trace_path = NULL;
+}
+
+/**
+ * Record a span and counters from a thread of the test.
+ */
+static void*
+test_stats_thread(void* arg)
+{
+        uint64_t t = stats_begin();
+
+        stats_add(STAT_BYTES_HASHED, 100);
+        stats_add(STAT_LOOKUPS, 2);
+        stats_end(PHASE_HASH, t, 100, 1);
+        return NULL;
+}
+
+int
+test_stats(void)
+{
+        int ret = 1;
+        pthread_t tids[3];
+        struct stats_thread sum;
+        char* path = calloc(1, PAGE_SIZE);
+        char* buf = calloc(1, PAGE_SIZE);
+        FILE* f;
+
+        /* Nothing is recorded until started */
+        stats_add(STAT_LOOKUPS, 1);
+        ret &= (!threads && !stats_begin()) ? 1 : 0;
+
+        snprintf(path, PAGE_SIZE, "%s/donut_test_trace.json", getenv("HOME"));
+        stats_start(path);
+        for (int i = 0; i < 3; i++)
+                pthread_create(&tids[i], NULL, test_stats_thread, NULL);
+        for (int i = 0; i < 3; i++)
+                pthread_join(tids[i], NULL);
+
+        merge_threads(&sum);
+        ret &= (n_threads == 3) ? 1 : 0;
+        ret &= (sum.counters[STAT_BYTES_HASHED] == 300) ? 1 : 0;
+        ret &= (sum.counters[STAT_LOOKUPS] == 6) ? 1 : 0;
+        ret &= (sum.calls[PHASE_HASH] == 3 && sum.files[PHASE_HASH] == 3) ? 1 : 0;
+
+        /* The trace holds a span per thread */
+        stats_report(0);
+        ret &= (!stats_on && !threads) ? 1 : 0;
+        f = fopen(path, "r");
+        if (f) {
+                ret &= (fread(buf, 1, PAGE_SIZE - 1, f) > 0) ? 1 : 0;
+                fclose(f);
+        }
+        ret &= !strncmp(buf, "{\"displayTimeUnit\"", 18);
+        ret &= (strstr(buf, "\"name\":\"hash\"") != NULL) ? 1 : 0;
+        ret &= (strstr(buf, "\"lookups\":6") != NULL) ? 1 : 0;
+
+        remove(path);
+        free(buf);
+        free(path);
+        return ret;
+}